@@ -246,19 +246,26 @@ show_usage(const char *name, gboolean terse)
 	if (terse) {
 		text = g_strdup_printf(_("%s. Try `%s -h' for more information.\n"), DISPLAY_VERSION, name);
 	} else {
-		text = g_strdup_printf(_("%s\n"
+		char *usage = g_strdup_printf(_("%s\n"
 		       "Usage: %s [OPTION]...\n\n"
 		       "  -c, --config=DIR    use DIR for config files\n"
 		       "  -d, --debug         print debugging messages to stderr\n"
 		       "  -h, --help          display this help and exit\n"
 		       "  -n, --nologin       don't automatically login\n"
 		       "  -v, --version       display the current version and exit\n"), DISPLAY_VERSION, name);
+
+		/* Kept apart so the existing translations of the usage still apply. */
+		text = g_strdup_printf("%s  --startup-profile   %s\n", usage,
+				_("print how long each stage of startup took on exit"));
+		g_free(usage);
 	}
 
 	purple_print_utf8_to_console(stdout, text);
 	g_free(text);
 }
 
+static gboolean opt_startup_profile = FALSE;
+
 static int
 init_libpurple(int argc, char **argv)
 {
@@ -276,6 +283,7 @@ init_libpurple(int argc, char **argv)
 		{"help",     no_argument,       NULL, 'h'},
 		{"nologin",  no_argument,       NULL, 'n'},
 		{"version",  no_argument,       NULL, 'v'},
+		{"startup-profile", no_argument, NULL, 'P'},
 		{0, 0, 0, 0}
 	};
 
@@ -315,6 +323,9 @@ init_libpurple(int argc, char **argv)
 		case 'v':	/* version */
 			opt_version = TRUE;
 			break;
+		case 'P':	/* --startup-profile */
+			opt_startup_profile = TRUE;
+			break;
 		case '?':	/* show terse help */
 		default:
 			show_usage(argv[0], TRUE);
@@ -396,15 +407,18 @@ init_libpurple(int argc, char **argv)
 	/* TODO: Move blist loading into purple_blist_init() */
 	purple_set_blist(purple_blist_new());
 	purple_blist_load();
+	purple_core_startup_stage("finch: buddy list");
 
 	/* TODO: should this be moved into finch_prefs_init() ? */
 	finch_prefs_update_old();
 
 	/* load plugins we had when we quit */
 	purple_plugins_load_saved("/finch/plugins/loaded");
+	purple_core_startup_stage("finch: plugins");
 
 	/* TODO: Move pounces loading into purple_pounces_init() */
 	purple_pounces_load();
+	purple_core_startup_stage("finch: pounces");
 
 	if (opt_nologin)
 	{
@@ -429,6 +443,7 @@ init_libpurple(int argc, char **argv)
 			purple_savedstatus_activate(purple_savedstatus_get_startup());
 		purple_accounts_restore_current_statuses();
 	}
+	purple_core_startup_stage("finch: statuses");
 
 	return 1;
 }
@@ -440,11 +455,14 @@ static gboolean gnt_start(int *argc, char ***argv)
 		return FALSE;
 
 	purple_blist_show();
+	purple_core_startup_stage("finch: show buddy list");
 	return TRUE;
 }
 
 int main(int argc, char *argv[])
 {
+	char *profile = NULL;
+
 	signal(SIGPIPE, SIG_IGN);
 
 #if !GLIB_CHECK_VERSION(2, 32, 0)
@@ -459,6 +477,10 @@ int main(int argc, char *argv[])
 	g_set_application_name(_("Finch"));
 
 	if (gnt_start(&argc, &argv)) {
+		/* The screen belongs to gnt until it quits. */
+		if (opt_startup_profile)
+			profile = purple_core_get_startup_profile();
+
 		gnt_main();
 
 #ifdef STANDALONE
@@ -466,6 +488,11 @@ int main(int argc, char *argv[])
 #endif
 	}
 
+	if (profile != NULL) {
+		printf("%s", profile);
+		g_free(profile);
+	}
+
 	return 0;
 }
 
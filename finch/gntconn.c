@@ -81,9 +81,9 @@ do_signon(gpointer data)
 	status = purple_account_get_active_status(account);
 	if (purple_status_is_online(status))
 	{
-		purple_debug_info("autorecon", "calling purple_account_connect\n");
-		purple_account_connect(account);
-		purple_debug_info("autorecon", "done calling purple_account_connect\n");
+		purple_debug_info("autorecon", "queueing %s to connect\n",
+				purple_account_get_username(account));
+		purple_accounts_queue_connect(account);
 	}
 
 	return FALSE;
@@ -30,6 +30,7 @@
 #include <cmds.h>
 #include <core.h>
 #include <idle.h>
+#include <metrics.h>
 #include <prefs.h>
 #include <util.h>
 
@@ -1267,6 +1268,23 @@ debug_command_cb(PurpleConversation *conv,
 	return PURPLE_CMD_RET_OK;
 }
 
+static PurpleCmdRet
+metrics_command_cb(PurpleConversation *conv,
+                   const char *cmd, char **args, char **error, void *data)
+{
+	char *snapshot, *tmp, *markup;
+
+	snapshot = purple_metrics_get_snapshot();
+	tmp = g_markup_escape_text(snapshot, -1);
+	markup = purple_strreplace(tmp, "\n", "<br>");
+	purple_conversation_write(conv, NULL, markup, PURPLE_MESSAGE_NO_LOG, time(NULL));
+
+	g_free(snapshot);
+	g_free(tmp);
+	g_free(markup);
+	return PURPLE_CMD_RET_OK;
+}
+
 /* Xerox */
 static PurpleCmdRet
 clear_command_cb(PurpleConversation *conv,
@@ -1419,6 +1437,9 @@ void finch_conversation_init()
 	purple_cmd_register("debug", "w", PURPLE_CMD_P_DEFAULT,
 	                  PURPLE_CMD_FLAG_CHAT | PURPLE_CMD_FLAG_IM, NULL,
 	                  debug_command_cb, _("debug &lt;option&gt;:  Send various debug information to the current conversation."), NULL);
+	purple_cmd_register("metrics", "", PURPLE_CMD_P_DEFAULT,
+	                  PURPLE_CMD_FLAG_CHAT | PURPLE_CMD_FLAG_IM, NULL,
+	                  metrics_command_cb, _("metrics:  Show libpurple's internal metrics in the current conversation."), NULL);
 	purple_cmd_register("clear", "", PURPLE_CMD_P_DEFAULT,
 	                  PURPLE_CMD_FLAG_CHAT | PURPLE_CMD_FLAG_IM, NULL,
 	                  clear_command_cb, _("clear: Clears the conversation scrollback."), NULL);
@@ -714,7 +714,11 @@ void gnt_box_set_toplevel(GntBox *box, gboolean set)
 	}
 }
 
-void gnt_box_sync_children(GntBox *box)
+/* Copies the children of the box into its window. If 'all' is FALSE, only
+ * the children that overlap the area from (x1, y1) to (x2, y2) (in screen
+ * coordinates) are copied. */
+static void
+sync_children(GntBox *box, gboolean all, int x1, int y1, int x2, int y2)
 {
 	GList *iter;
 	GntWidget *widget = GNT_WIDGET(box);
@@ -736,7 +740,7 @@ void gnt_box_sync_children(GntBox *box)
 			continue;
 
 		if (GNT_IS_BOX(w))
-			gnt_box_sync_children(GNT_BOX(w));
+			sync_children(GNT_BOX(w), all, x1, y1, x2, y2);
 
 		gnt_widget_get_size(w, &width, &height);
 
@@ -764,8 +768,11 @@ void gnt_box_sync_children(GntBox *box)
 				y = widget->priv.height - height - pos;
 		}
 
-		copywin(w->window, widget->window, 0, 0,
-				y, x, y + height - 1, x + width - 1, FALSE);
+		if (all || (x + widget->priv.x < x2 && x + widget->priv.x + width > x1 &&
+					y + widget->priv.y < y2 && y + widget->priv.y + height > y1)) {
+			copywin(w->window, widget->window, 0, 0,
+					y, x, y + height - 1, x + width - 1, FALSE);
+		}
 		gnt_widget_set_position(w, x + widget->priv.x, y + widget->priv.y);
 		if (w == box->active) {
 			wmove(widget->window, y + getcury(w->window), x + getcurx(w->window));
@@ -773,6 +780,16 @@ void gnt_box_sync_children(GntBox *box)
 	}
 }
 
+void gnt_box_sync_children(GntBox *box)
+{
+	sync_children(box, TRUE, 0, 0, 0, 0);
+}
+
+void gnt_box_sync_children_area(GntBox *box, int x, int y, int width, int height)
+{
+	sync_children(box, FALSE, x, y, x + width, y + height);
+}
+
 void gnt_box_set_alignment(GntBox *box, GntAlignment alignment)
 {
 	box->alignment = alignment;
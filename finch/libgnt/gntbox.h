@@ -148,6 +148,12 @@ void gnt_box_set_toplevel(GntBox *box, gboolean set);
  */
 void gnt_box_sync_children(GntBox *box);
 
+/**
+ * @internal
+ * Refresh only the widgets in the box that overlap an area of the screen.
+ */
+void gnt_box_sync_children_area(GntBox *box, int x, int y, int width, int height);
+
 /**
  * Set the alignment for the widgets in the box.
  *
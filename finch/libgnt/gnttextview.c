@@ -37,6 +37,12 @@ enum
 	SIGS = 1,
 };
 
+/* The number of lines a textview keeps before the oldest ones are dropped.
+ * This can be changed with 'textview-max-lines' in ~/.gntrc (0 means no
+ * limit). Lines are dropped TRIM_CHUNK at a time. */
+#define DEFAULT_MAX_LINES 10000
+#define TRIM_CHUNK 256
+
 typedef struct
 {
 	GntTextFormatFlags tvflag;
@@ -50,6 +56,7 @@ typedef struct
 	GList *segments;         /* A list of GntTextSegments */
 	int length;              /* The current length of the line so far (ie. onscreen width) */
 	gboolean soft;           /* TRUE if it's an overflow from prev. line */
+	int width;               /* The width of the textview when this line was laid out */
 } GntTextLine;
 
 typedef struct
@@ -59,13 +66,24 @@ typedef struct
 	int end;
 } GntTextTag;
 
+struct _GntTextViewPriv
+{
+	int lines;               /* The number of GntTextLines */
+	GList *tags_tail;        /* The last link in view->tags */
+};
+
+#define GNT_TEXT_VIEW_GET_PRIVATE(o)   (G_TYPE_INSTANCE_GET_PRIVATE ((o), GNT_TYPE_TEXT_VIEW, GntTextViewPriv))
+
 static GntWidgetClass *parent_class = NULL;
 
 static gchar *select_start;
 static gchar *select_end;
 static gboolean double_click;
 
+static int max_lines = -1;
+
 static void reset_text_view(GntTextView *view);
+static void layout_visible_lines(GntTextView *view);
 
 static gboolean
 text_view_contains(GntTextView *view, const char *str)
@@ -87,6 +105,8 @@ gnt_text_view_draw(GntWidget *widget)
 	wbkgd(widget->window, gnt_color_pair(GNT_COLOR_NORMAL));
 	werase(widget->window);
 
+	layout_visible_lines(view);
+
 	n = g_list_length(view->list);
 	if ((view->flags & GNT_TEXT_VIEW_TOP_ALIGN) &&
 			n < widget->priv.height) {
@@ -365,65 +385,277 @@ gnt_text_view_clicked(GntWidget *widget, GntMouseEvent event, int x, int y)
 	return TRUE;
 }
 
-static void
-gnt_text_view_reflow(GntTextView *view)
+static GntTextLine *
+new_text_line(GntTextView *view, gboolean soft)
+{
+	GntTextLine *line = g_new0(GntTextLine, 1);
+	line->soft = soft;
+	line->width = GNT_WIDGET(view)->priv.width;
+	return line;
+}
+
+/* Lays out the text from 'start' up to the terminating NUL after the newest
+ * line in 'lines', adding new lines as necessary. 'start' must point inside
+ * view->string. Returns the newest line. */
+static GList *
+layout_text(GntTextView *view, GList *lines, const char *start,
+		GntTextFormatFlags flags, int *added)
 {
-	/* This is pretty ugly, and inefficient. Someone do something about it. */
+	GntWidget *widget = GNT_WIDGET(view);
+	int fl = gnt_text_format_flag_to_chtype(flags);
+	const char *end = start;
 	GntTextLine *line;
-	GList *back, *iter, *list;
-	GString *string;
-	int pos = 0;    /* no. of 'real' lines */
-
-	list = view->list;
-	while (list->prev) {
-		line = list->data;
-		if (!line->soft)
-			pos++;
-		list = list->prev;
-	}
+	int len;
+	gboolean has_scroll = !(view->flags & GNT_TEXT_VIEW_NO_SCROLL);
+	gboolean wrap_word = !(view->flags & GNT_TEXT_VIEW_WRAP_CHAR);
 
-	back = g_list_last(view->list);
-	view->list = NULL;
+	while (*start) {
+		GntTextLine *oldl;
+		GntTextSegment *seg = NULL;
 
-	string = view->string;
-	view->string = NULL;
-	reset_text_view(view);
+		if (*end == '\n' || *end == '\r') {
+			if (!strncmp(end, "\r\n", 2))
+				end++;
+			end++;
+			start = end;
+			lines = g_list_prepend(lines, new_text_line(view, FALSE));
+			(*added)++;
+			continue;
+		}
+
+		line = lines->data;
+		if (line->length == widget->priv.width - has_scroll) {
+			/* The last added line was exactly the same width as the widget */
+			line = new_text_line(view, TRUE);
+			lines = g_list_prepend(lines, line);
+			(*added)++;
+		}
+
+		if ((end = strchr(start, '\r')) != NULL ||
+			(end = strchr(start, '\n')) != NULL) {
+			len = gnt_util_onscreen_width(start, end - has_scroll);
+			if (widget->priv.width > 0 &&
+					len >= widget->priv.width - line->length - has_scroll) {
+				end = NULL;
+			}
+		}
 
-	view->string = g_string_set_size(view->string, string->len);
-	view->string->len = 0;
-	GNT_WIDGET_SET_FLAGS(GNT_WIDGET(view), GNT_WIDGET_DRAWING);
+		if (end == NULL)
+			end = gnt_util_onscreen_width_to_pointer(start,
+					widget->priv.width - line->length - has_scroll, &len);
 
-	for (; back; back = back->prev) {
-		line = back->data;
-		if (back->next && !line->soft) {
-			gnt_text_view_append_text_with_flags(view, "\n", GNT_TEXT_FLAG_NORMAL);
+		/* Try to append to the previous segment if possible */
+		if (line->segments) {
+			seg = g_list_last(line->segments)->data;
+			if (seg->flags != fl || seg->end != start - view->string->str)
+				seg = NULL;
 		}
 
-		for (iter = line->segments; iter; iter = iter->next) {
-			GntTextSegment *seg = iter->data;
-			char *start = string->str + seg->start;
-			char *end = string->str + seg->end;
+		if (seg == NULL) {
+			seg = g_new0(GntTextSegment, 1);
+			seg->start = start - view->string->str;
+			seg->tvflag = flags;
+			seg->flags = fl;
+			line->segments = g_list_append(line->segments, seg);
+		}
+
+		oldl = line;
+		if (wrap_word && *end && *end != '\n' && *end != '\r') {
+			const char *tmp = end;
+			while (end && *end != '\n' && *end != '\r' && !g_ascii_isspace(*end)) {
+				end = g_utf8_find_prev_char(seg->start + view->string->str, end);
+			}
+			if (!end || !g_ascii_isspace(*end))
+				end = tmp;
+			else
+				end++; /* Remove the space */
+
+			line = new_text_line(view, TRUE);
+			lines = g_list_prepend(lines, line);
+			(*added)++;
+		}
+		seg->end = end - view->string->str;
+		oldl->length += len;
+		start = end;
+	}
+
+	return lines;
+}
+
+static gboolean
+line_needs_layout(GntTextView *view, GList *list)
+{
+	GntTextLine *line = list->data;
+	return (line->width != GNT_WIDGET(view)->priv.width);
+}
+
+/* Lays out the line 'list' is a part of (along with all its overflow lines)
+ * again for the current width of the textview. Returns the newest line of the
+ * new layout. */
+static GList *
+relayout_line(GntTextView *view, GList *list)
+{
+	GntTextViewPriv *priv = GNT_TEXT_VIEW_GET_PRIVATE(view);
+	GList *oldest = list, *newest, *before, *after, *head, *tail, *iter, *next;
+	GntTextLine *line;
+	int added = 1, removed = 0;
+	int offset = -1;
+	gboolean in_view = FALSE;
+
+	while (((GntTextLine *)oldest->data)->soft && oldest->next)
+		oldest = oldest->next;
+	newest = oldest;
+	while (newest->prev && ((GntTextLine *)newest->prev->data)->soft)
+		newest = newest->prev;
+	before = newest->prev;
+	after = oldest->next;
+
+	head = g_list_prepend(NULL, new_text_line(view, ((GntTextLine *)oldest->data)->soft));
+	for (iter = oldest; iter != before; iter = iter->prev) {
+		GList *segs;
+
+		line = iter->data;
+		if (iter == view->list) {
+			in_view = TRUE;
+			if (line->segments)
+				offset = ((GntTextSegment *)line->segments->data)->start;
+		}
+
+		for (segs = line->segments; segs; segs = segs->next) {
+			GntTextSegment *seg = segs->data;
+			char *end = view->string->str + seg->end;
 			char back = *end;
 			*end = '\0';
-			gnt_text_view_append_text_with_flags(view, start, seg->tvflag);
+			head = layout_text(view, head, view->string->str + seg->start, seg->tvflag, &added);
 			*end = back;
 		}
-		free_text_line(line, NULL);
+		removed++;
 	}
-	g_list_free(list);
-
-	list = view->list = g_list_first(view->list);
-	/* Go back to the line that was in view before resizing started */
-	while (pos--) {
-		while (((GntTextLine*)list->data)->soft)
-			list = list->next;
-		list = list->next;
+
+	for (iter = newest; iter != after; iter = next) {
+		next = iter->next;
+		free_text_line(iter->data, NULL);
+		g_list_free_1(iter);
 	}
-	view->list = list;
-	GNT_WIDGET_UNSET_FLAGS(GNT_WIDGET(view), GNT_WIDGET_DRAWING);
+
+	tail = g_list_last(head);
+	tail->next = after;
+	if (after)
+		after->prev = tail;
+	head->prev = before;
+	if (before)
+		before->next = head;
+	priv->lines += added - removed;
+
+	if (in_view) {
+		/* Keep the same text at the bottom of the view */
+		view->list = tail;
+		for (iter = tail; offset >= 0 && iter != before; iter = iter->prev) {
+			line = iter->data;
+			if (line->segments && ((GntTextSegment *)line->segments->data)->start <= offset)
+				view->list = iter;
+		}
+	}
+
+	return head;
+}
+
+/* Makes sure the lines that are going to be drawn are laid out for the
+ * current width of the textview. */
+static void
+layout_visible_lines(GntTextView *view)
+{
+	GntWidget *widget = GNT_WIDGET(view);
+	GList *iter;
+	int i, count = widget->priv.height;
+
+	if (line_needs_layout(view, view->list))
+		relayout_line(view, view->list);
+
+	iter = view->list;
+	if (view->flags & GNT_TEXT_VIEW_TOP_ALIGN) {
+		/* The lines below view->list can be pulled into view */
+		iter = g_list_first(view->list);
+		count *= 2;
+	}
+
+	for (i = 0; iter && i < count; i++, iter = iter->next) {
+		if (line_needs_layout(view, iter))
+			iter = relayout_line(view, iter);
+	}
+}
+
+/* Drops the oldest lines once there are too many of them. */
+static void
+trim_text_view(GntTextView *view)
+{
+	GntTextViewPriv *priv = GNT_TEXT_VIEW_GET_PRIVATE(view);
+	GList *tail, *iter, *next;
+	int remove, cut;
+
+	if (max_lines <= 0 || priv->lines <= max_lines + TRIM_CHUNK)
+		return;
+
+	remove = priv->lines - max_lines;
+	tail = g_list_last(view->list);
+	/* Don't leave the overflow of a dropped line behind */
+	while (tail->prev && (remove > 0 || ((GntTextLine *)tail->data)->soft)) {
+		GList *prev = tail->prev;
+		if (view->list == tail)
+			view->list = prev;
+		free_text_line(tail->data, NULL);
+		prev->next = NULL;
+		g_list_free_1(tail);
+		tail = prev;
+		remove--;
+		priv->lines--;
+	}
+
+	cut = view->string->len;
+	for (iter = tail; iter; iter = iter->prev) {
+		GntTextLine *line = iter->data;
+		if (line->segments) {
+			cut = ((GntTextSegment *)line->segments->data)->start;
+			break;
+		}
+	}
+
+	if (text_view_contains(view, select_start) || text_view_contains(view, select_end))
+		select_start = select_end = NULL;
+	g_string_erase(view->string, 0, cut);
+
+	for (iter = tail; iter; iter = iter->prev) {
+		GntTextLine *line = iter->data;
+		GList *segs;
+		for (segs = line->segments; segs; segs = segs->next) {
+			GntTextSegment *seg = segs->data;
+			seg->start -= cut;
+			seg->end -= cut;
+		}
+	}
+
+	for (iter = view->tags; iter; iter = next) {
+		GntTextTag *tag = iter->data;
+		next = iter->next;
+		if (tag->end <= cut) {
+			free_tag(tag, NULL);
+			view->tags = g_list_delete_link(view->tags, iter);
+		} else {
+			tag->start = MAX(0, tag->start - cut);
+			tag->end -= cut;
+		}
+	}
+	priv->tags_tail = g_list_last(view->tags);
+}
+
+static void
+gnt_text_view_reflow(GntTextView *view)
+{
+	/* Only the lines in view are laid out again right away. The rest are
+	 * laid out as they are scrolled into view. */
+	layout_visible_lines(view);
 	if (GNT_WIDGET(view)->window)
 		gnt_widget_draw(GNT_WIDGET(view));
-	g_string_free(string, TRUE);
 }
 
 static void
@@ -438,6 +670,9 @@ static void
 gnt_text_view_class_init(GntTextViewClass *klass)
 {
 	parent_class = GNT_WIDGET_CLASS(klass);
+
+	g_type_class_add_private(G_OBJECT_CLASS(klass), sizeof(GntTextViewPriv));
+
 	parent_class->destroy = gnt_text_view_destroy;
 	parent_class->draw = gnt_text_view_draw;
 	parent_class->map = gnt_text_view_map;
@@ -454,14 +689,22 @@ gnt_text_view_init(GTypeInstance *instance, gpointer class)
 {
 	GntWidget *widget = GNT_WIDGET(instance);
 	GntTextView *view = GNT_TEXT_VIEW(widget);
+	GntTextViewPriv *priv = GNT_TEXT_VIEW_GET_PRIVATE(view);
 	GntTextLine *line = g_new0(GntTextLine, 1);
 
+	if (max_lines < 0) {
+		char *value = gnt_style_get_from_name(NULL, "textview-max-lines");
+		max_lines = value ? MAX(0, atoi(value)) : DEFAULT_MAX_LINES;
+		g_free(value);
+	}
+
 	GNT_WIDGET_SET_FLAGS(widget, GNT_WIDGET_NO_BORDER | GNT_WIDGET_NO_SHADOW |
             GNT_WIDGET_GROW_Y | GNT_WIDGET_GROW_X);
 	widget->priv.minw = 5;
 	widget->priv.minh = 2;
 	view->string = g_string_new(NULL);
 	view->list = g_list_append(view->list, line);
+	priv->lines = 1;
 
 	GNTDEBUG;
 }
@@ -512,19 +755,16 @@ void gnt_text_view_append_text_with_flags(GntTextView *view, const char *text, G
 void gnt_text_view_append_text_with_tag(GntTextView *view, const char *text,
 			GntTextFormatFlags flags, const char *tagname)
 {
-	GntWidget *widget = GNT_WIDGET(view);
-	int fl = 0;
-	const char *start, *end;
-	GList *list = view->list;
-	GntTextLine *line;
-	int len;
-	gboolean has_scroll = !(view->flags & GNT_TEXT_VIEW_NO_SCROLL);
-	gboolean wrap_word = !(view->flags & GNT_TEXT_VIEW_WRAP_CHAR);
+	GntTextViewPriv *priv = GNT_TEXT_VIEW_GET_PRIVATE(view);
+	GList *first;
+	int len, added = 0;
 
 	if (text == NULL || *text == '\0')
 		return;
 
-	fl = gnt_text_format_flag_to_chtype(flags);
+	first = g_list_first(view->list);
+	if (line_needs_layout(view, first))
+		first = relayout_line(view, first);
 
 	len = view->string->len;
 	view->string = g_string_append(view->string, text);
@@ -534,86 +774,18 @@ void gnt_text_view_append_text_with_tag(GntTextView *view, const char *text,
 		tag->name = g_strdup(tagname);
 		tag->start = len;
 		tag->end = view->string->len;
-		view->tags = g_list_append(view->tags, tag);
-	}
-
-	view->list = g_list_first(view->list);
-
-	start = end = view->string->str + len;
-
-	while (*start) {
-		GntTextLine *oldl;
-		GntTextSegment *seg = NULL;
-
-		if (*end == '\n' || *end == '\r') {
-			if (!strncmp(end, "\r\n", 2))
-				end++;
-			end++;
-			start = end;
-			gnt_text_view_next_line(view);
-			view->list = g_list_first(view->list);
-			continue;
-		}
-
-		line = view->list->data;
-		if (line->length == widget->priv.width - has_scroll) {
-			/* The last added line was exactly the same width as the widget */
-			line = g_new0(GntTextLine, 1);
-			line->soft = TRUE;
-			view->list = g_list_prepend(view->list, line);
-		}
-
-		if ((end = strchr(start, '\r')) != NULL ||
-			(end = strchr(start, '\n')) != NULL) {
-			len = gnt_util_onscreen_width(start, end - has_scroll);
-			if (widget->priv.width > 0 &&
-					len >= widget->priv.width - line->length - has_scroll) {
-				end = NULL;
-			}
-		}
-
-		if (end == NULL)
-			end = gnt_util_onscreen_width_to_pointer(start,
-					widget->priv.width - line->length - has_scroll, &len);
-
-		/* Try to append to the previous segment if possible */
-		if (line->segments) {
-			seg = g_list_last(line->segments)->data;
-			if (seg->flags != fl)
-				seg = NULL;
-		}
-
-		if (seg == NULL) {
-			seg = g_new0(GntTextSegment, 1);
-			seg->start = start - view->string->str;
-			seg->tvflag = flags;
-			seg->flags = fl;
-			line->segments = g_list_append(line->segments, seg);
-		}
-
-		oldl = line;
-		if (wrap_word && *end && *end != '\n' && *end != '\r') {
-			const char *tmp = end;
-			while (end && *end != '\n' && *end != '\r' && !g_ascii_isspace(*end)) {
-				end = g_utf8_find_prev_char(seg->start + view->string->str, end);
-			}
-			if (!end || !g_ascii_isspace(*end))
-				end = tmp;
-			else
-				end++; /* Remove the space */
-
-			line = g_new0(GntTextLine, 1);
-			line->soft = TRUE;
-			view->list = g_list_prepend(view->list, line);
+		if (priv->tags_tail) {
+			priv->tags_tail = g_list_append(priv->tags_tail, tag)->next;
+		} else {
+			view->tags = priv->tags_tail = g_list_append(NULL, tag);
 		}
-		seg->end = end - view->string->str;
-		oldl->length += len;
-		start = end;
 	}
 
-	view->list = list;
+	layout_text(view, first, view->string->str + len, flags, &added);
+	priv->lines += added;
+	trim_text_view(view);
 
-	gnt_widget_draw(widget);
+	gnt_widget_draw(GNT_WIDGET(view));
 }
 
 void gnt_text_view_scroll(GntTextView *view, int scroll)
@@ -642,11 +814,14 @@ void gnt_text_view_scroll(GntTextView *view, int scroll)
 
 void gnt_text_view_next_line(GntTextView *view)
 {
-	GntTextLine *line = g_new0(GntTextLine, 1);
+	GntTextViewPriv *priv = GNT_TEXT_VIEW_GET_PRIVATE(view);
+	GntTextLine *line = new_text_line(view, FALSE);
 	GList *list = view->list;
 
 	view->list = g_list_prepend(g_list_first(view->list), line);
 	view->list = list;
+	priv->lines++;
+	trim_text_view(view);
 	gnt_widget_draw(GNT_WIDGET(view));
 }
 
@@ -677,12 +852,14 @@ static void reset_text_view(GntTextView *view)
 {
 	GntTextLine *line;
 
+	view->list = g_list_first(view->list);
 	g_list_foreach(view->list, free_text_line, NULL);
 	g_list_free(view->list);
 	view->list = NULL;
 
-	line = g_new0(GntTextLine, 1);
+	line = new_text_line(view, FALSE);
 	view->list = g_list_append(view->list, line);
+	GNT_TEXT_VIEW_GET_PRIVATE(view)->lines = 1;
 	if (view->string)
 		g_string_free(view->string, TRUE);
 	view->string = g_string_new(NULL);
@@ -693,7 +870,9 @@ void gnt_text_view_clear(GntTextView *view)
 	reset_text_view(view);
 
 	g_list_foreach(view->tags, free_tag, NULL);
+	g_list_free(view->tags);
 	view->tags = NULL;
+	GNT_TEXT_VIEW_GET_PRIVATE(view)->tags_tail = NULL;
 
 	if (GNT_WIDGET(view)->window)
 		gnt_widget_draw(GNT_WIDGET(view));
@@ -725,6 +904,7 @@ int gnt_text_view_get_lines_above(GntTextView *view)
  */
 int gnt_text_view_tag_change(GntTextView *view, const char *name, const char *text, gboolean all)
 {
+	GntTextViewPriv *priv = GNT_TEXT_VIEW_GET_PRIVATE(view);
 	GList *alllines = g_list_first(view->list);
 	GList *list, *next, *iter, *inext;
 	const int text_length = text ? strlen(text) : 0;
@@ -734,17 +914,14 @@ int gnt_text_view_tag_change(GntTextView *view, const char *name, const char *te
 		next = list->next;
 		if (strcmp(tag->name, name) == 0) {
 			int change;
-			char *before, *after;
 
 			count++;
 
-			before = g_strndup(view->string->str, tag->start);
-			after = g_strdup(view->string->str + tag->end);
 			change = (tag->end - tag->start) - text_length;
 
-			g_string_printf(view->string, "%s%s%s", before, text ? text : "", after);
-			g_free(before);
-			g_free(after);
+			g_string_erase(view->string, tag->start, tag->end - tag->start);
+			if (text)
+				g_string_insert(view->string, tag->start, text);
 
 			/* Update the offsets of the next tags */
 			for (iter = next; iter; iter = iter->next) {
@@ -785,6 +962,7 @@ int gnt_text_view_tag_change(GntTextView *view, const char *name, const char *te
 							if (line->segments == NULL) {
 								free_text_line(line, NULL);
 								line = NULL;
+								priv->lines--;
 								if (view->list == iter) {
 									if (inext)
 										view->list = inext;
@@ -818,6 +996,7 @@ int gnt_text_view_tag_change(GntTextView *view, const char *name, const char *te
 				break;
 		}
 	}
+	priv->tags_tail = g_list_last(view->tags);
 	gnt_widget_draw(GNT_WIDGET(view));
 	return count;
 }
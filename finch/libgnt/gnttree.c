@@ -62,6 +62,9 @@ struct _GntTreePriv
 	GCompareFunc compare;
 	int lastvisible;
 	int expander_level;
+
+	GntTreeRow *index;     /* Root of the index of the displayed rows */
+	guint generation;      /* Bumped when the cached row texts become stale */
 };
 
 #define	TAB_SIZE 3
@@ -87,6 +90,19 @@ struct _GntTreeRow
 
 	GList *columns;
 	GntTree *tree;
+
+	/* Position in the order-statistic index. See index_insert. */
+	GntTreeRow *ileft;
+	GntTreeRow *iright;
+	GntTreeRow *iparent;
+	GntTreeRow *hidden;         /* Index of the rows below, while collapsed */
+	int isize;
+	guint ipriority;
+
+	GList *link;                /* The key's link in tree->list */
+
+	char *text;                 /* Cached result of update_row_text */
+	guint text_generation;
 };
 
 struct _GntTreeCol
@@ -135,16 +151,27 @@ readjust_columns(GntTree *tree)
 	}
 }
 
-/* Move the item at position old to position new */
-static GList *
-g_list_reposition_child(GList *list, int old, int new)
+/* Insert the key of row in tree->list right after the key of 'after', or at
+ * the beginning if 'after' is NULL. */
+static void
+list_insert_after(GntTree *tree, GntTreeRow *row, GntTreeRow *after)
 {
-	gpointer item = g_list_nth_data(list, old);
-	list = g_list_remove(list, item);
-	if (old < new)
-		new--;   /* because the positions would have shifted after removing the item */
-	list = g_list_insert(list, item, new);
-	return list;
+	GList *link;
+
+	if (after == NULL) {
+		tree->list = g_list_prepend(tree->list, row->key);
+		row->link = tree->list;
+		return;
+	}
+
+	link = g_list_alloc();
+	link->data = row->key;
+	link->prev = after->link;
+	link->next = after->link->next;
+	if (link->next)
+		link->next->prev = link;
+	after->link->next = link;
+	row->link = link;
 }
 
 static GntTreeRow *
@@ -265,14 +292,221 @@ get_prev_n(GntTreeRow *row, int n)
 	return row;
 }
 
+/* The displayed rows (ie. the rows whose ancestors are all expanded) are kept
+ * in an order-statistic index, so that the position of a row can be found
+ * without walking all the rows above it. The index is a treap with implicit
+ * keys: the in-order of the nodes is the order in which the rows are displayed.
+ * The rows below a collapsed row are kept in a separate index in that row
+ * ('hidden'), and are merged back when the row is expanded. The index ignores
+ * the search-text. */
+#define ISIZE(row)  ((row) ? (row)->isize : 0)
+
+static void
+index_update(GntTreeRow *row)
+{
+	row->isize = 1 + ISIZE(row->ileft) + ISIZE(row->iright);
+	if (row->ileft)
+		row->ileft->iparent = row;
+	if (row->iright)
+		row->iright->iparent = row;
+}
+
+static GntTreeRow *
+index_merge(GntTreeRow *a, GntTreeRow *b)
+{
+	if (a == NULL)
+		return b;
+	if (b == NULL)
+		return a;
+	if (a->ipriority > b->ipriority) {
+		a->iright = index_merge(a->iright, b);
+		index_update(a);
+		a->iparent = NULL;
+		return a;
+	} else {
+		b->ileft = index_merge(a, b->ileft);
+		index_update(b);
+		b->iparent = NULL;
+		return b;
+	}
+}
+
+/* Split the index into the first n rows (in *left) and the rest (in *right) */
+static void
+index_split(GntTreeRow *index, int n, GntTreeRow **left, GntTreeRow **right)
+{
+	if (index == NULL) {
+		*left = *right = NULL;
+		return;
+	}
+	if (ISIZE(index->ileft) < n) {
+		index_split(index->iright, n - ISIZE(index->ileft) - 1, &index->iright, right);
+		*left = index;
+	} else {
+		index_split(index->ileft, n, left, &index->ileft);
+		*right = index;
+	}
+	index_update(index);
+	index->iparent = NULL;
+}
+
+/* Position of row in the index that contains it. The root of that index is
+ * returned in root. */
+static int
+index_position(GntTreeRow *row, GntTreeRow **root)
+{
+	int pos = ISIZE(row->ileft);
+
+	while (row->iparent) {
+		if (row == row->iparent->iright)
+			pos += ISIZE(row->iparent->ileft) + 1;
+		row = row->iparent;
+	}
+	if (root)
+		*root = row;
+	return pos;
+}
+
+/* The collapsed row whose 'hidden' index contains row, if any */
+static GntTreeRow *
+index_owner(GntTreeRow *row)
+{
+	for (row = row->parent; row; row = row->parent)
+		if (row->collapsed)
+			return row;
+	return NULL;
+}
+
+static GntTreeRow **
+index_slot(GntTree *tree, GntTreeRow *row)
+{
+	GntTreeRow *owner = index_owner(row);
+	return owner ? &owner->hidden : &tree->priv->index;
+}
+
+/* The row displayed right before row, with all its siblings expanded */
+static GntTreeRow *
+index_predecessor(GntTreeRow *row)
+{
+	if (row->prev)
+		return get_last_child(row->prev);
+	if (row->parent && !row->parent->collapsed)
+		return row->parent;
+	return NULL;
+}
+
+/* Insert a range of rows (as an index) right after pred, or at the start */
+static void
+index_insert_range(GntTreeRow **slot, GntTreeRow *range, GntTreeRow *pred)
+{
+	GntTreeRow *left, *right;
+	int pos = pred ? index_position(pred, NULL) + 1 : 0;
+
+	index_split(*slot, pos, &left, &right);
+	*slot = index_merge(index_merge(left, range), right);
+}
+
+/* Take the rows at positions [pos, pos + count) out of the index */
+static GntTreeRow *
+index_remove_range(GntTreeRow **slot, int pos, int count)
+{
+	GntTreeRow *left, *range, *right;
+
+	index_split(*slot, pos, &left, &range);
+	index_split(range, count, &range, &right);
+	*slot = index_merge(left, right);
+	return range;
+}
+
+/* Add a new row in the index. The row must already be linked in the tree. */
+static void
+index_insert(GntTree *tree, GntTreeRow *row)
+{
+	row->ileft = row->iright = row->iparent = NULL;
+	row->isize = 1;
+	row->ipriority = g_random_int();
+	index_insert_range(index_slot(tree, row), row, index_predecessor(row));
+}
+
+/* Remove a row, which must not have any children, from the index */
+static void
+index_remove(GntTree *tree, GntTreeRow *row)
+{
+	index_remove_range(index_slot(tree, row), index_position(row, NULL), 1);
+}
+
+/* Take the row, and the rows displayed below it, out of the index. They are
+ * returned as an index, to be put back with index_insert_range. */
+static GntTreeRow *
+index_cut_subtree(GntTree *tree, GntTreeRow *row)
+{
+	int pos = index_position(row, NULL);
+	int count = index_position(get_last_child(row), NULL) - pos + 1;
+	return index_remove_range(index_slot(tree, row), pos, count);
+}
+
+/* Update the index before the row is collapsed or expanded */
+static void
+index_set_collapsed(GntTree *tree, GntTreeRow *row, gboolean collapsed)
+{
+	GntTreeRow **slot;
+	int pos, count;
+
+	if (row->collapsed == collapsed)
+		return;
+
+	slot = index_slot(tree, row);
+	pos = index_position(row, NULL);
+	if (collapsed) {
+		count = index_position(get_last_child(row), NULL) - pos;
+		row->hidden = index_remove_range(slot, pos + 1, count);
+	} else {
+		index_insert_range(slot, row->hidden, row);
+		row->hidden = NULL;
+	}
+}
+
 /* Distance of row from the root */
-/* XXX: This is uber-inefficient */
 static int
 get_root_distance(GntTreeRow *row)
 {
+	GntTreeRow *index, *owner;
+	int dist;
+
 	if (row == NULL)
 		return -1;
-	return get_root_distance(get_prev(row)) + 1;
+
+	if (SEARCHING(row->tree)) {
+		/* The index doesn't know about the search-text */
+		for (dist = -1; row; row = get_prev(row))
+			dist++;
+		return dist;
+	}
+
+	dist = index_position(row, &index);
+	if (index == row->tree->priv->index)
+		return dist;
+
+	/* A row below a collapsed row. get_prev would have reached the collapsed
+	 * row after walking the rows above this one in the same hidden index. */
+	owner = index_owner(row);
+	return dist + 1 + get_root_distance(owner);
+}
+
+/* Number of rows that can be displayed */
+static int
+get_row_count(GntTree *tree)
+{
+	int count = 0;
+
+	if (!SEARCHING(tree))
+		return ISIZE(tree->priv->index);
+
+	if (tree->root) {
+		get_next_n_opt(tree->root, g_list_length(tree->list), &count);
+		count++;
+	}
+	return count;
 }
 
 /* Returns the distance between a and b.
@@ -282,14 +516,19 @@ get_distance(GntTreeRow *a, GntTreeRow *b)
 {
 	/* First get the distance from a to the root.
 	 * Then the distance from b to the root.
-	 * Subtract.
-	 * It's not that good, but it works. */
+	 * Subtract. */
 	int ha = get_root_distance(a);
 	int hb = get_root_distance(b);
 
 	return (hb - ha);
 }
 
+static gboolean
+row_is_in_view(GntTree *tree, GntTreeRow *row)
+{
+	return (get_distance(tree->top, row) >= 0 && get_distance(row, tree->bottom) >= 0);
+}
+
 static int
 find_depth(GntTreeRow *row)
 {
@@ -392,6 +631,33 @@ update_row_text(GntTree *tree, GntTreeRow *row)
 	return g_string_free(string, FALSE);
 }
 
+static const char *
+get_row_text(GntTree *tree, GntTreeRow *row)
+{
+	if (row->text == NULL || row->text_generation != tree->priv->generation) {
+		g_free(row->text);
+		row->text = update_row_text(tree, row);
+		row->text_generation = tree->priv->generation;
+	}
+	return row->text;
+}
+
+static void
+row_text_changed(GntTreeRow *row)
+{
+	if (row) {
+		g_free(row->text);
+		row->text = NULL;
+	}
+}
+
+/* Call when something that affects the text of all the rows changes */
+static void
+rows_text_changed(GntTree *tree)
+{
+	tree->priv->generation++;
+}
+
 #define NEXT_X x += tree->columns[i].width + (i > 0 ? 1 : 0)
 
 static void
@@ -502,7 +768,8 @@ redraw_tree(GntTree *tree)
 	for (i = start + pos; row && i < widget->priv.height - pos;
 				i++, row = get_next(row))
 	{
-		char *str;
+		const char *str;
+		char *cut = NULL;
 		int wr;
 
 		GntTextFormatFlags flags = row->flags;
@@ -510,12 +777,12 @@ redraw_tree(GntTree *tree)
 
 		if (!row_matches_search(row))
 			continue;
-		str = update_row_text(tree, row);
+		str = get_row_text(tree, row);
 
 		if ((wr = gnt_util_onscreen_width(str, NULL)) > scrcol)
 		{
-			char *s = (char*)gnt_util_onscreen_width_to_pointer(str, scrcol, &wr);
-			*s = '\0';
+			const char *s = gnt_util_onscreen_width_to_pointer(str, scrcol, &wr);
+			str = cut = g_strndup(str, s - str);
 		}
 
 		if (flags & GNT_TEXT_FLAG_BOLD)
@@ -553,7 +820,7 @@ redraw_tree(GntTree *tree)
 		mvwaddstr(widget->window, i, pos, C_(str));
 		whline(widget->window, ' ', scrcol - wr);
 		tree->bottom = row;
-		g_free(str);
+		g_free(cut);
 		tree_mark_columns(tree, pos, i,
 			(tree->show_separator ? ACS_VLINE : ' ') | attr);
 	}
@@ -575,7 +842,7 @@ redraw_tree(GntTree *tree)
 		int total = 0;
 		int showing, position;
 
-		get_next_n_opt(tree->root, g_list_length(tree->list), &total);
+		total = MAX(0, get_row_count(tree) - 1);
 		showing = rows * rows / MAX(total, 1) + 1;
 		showing = MIN(rows, showing);
 
@@ -836,13 +1103,16 @@ gnt_tree_key_pressed(GntWidget *widget, const char *text)
 		GntTreeRow *row = tree->current;
 		if (row && row->child)
 		{
+			index_set_collapsed(tree, row, !row->collapsed);
 			row->collapsed = !row->collapsed;
+			row_text_changed(row);
 			redraw_tree(tree);
 			g_signal_emit(tree, signals[SIG_COLLAPSED], 0, row->key, row->collapsed);
 		}
 		else if (row && row->choice)
 		{
 			row->isselected = !row->isselected;
+			row_text_changed(row);
 			g_signal_emit(tree, signals[SIG_TOGGLED], 0, row->key);
 			redraw_tree(tree);
 		}
@@ -908,6 +1178,7 @@ gnt_tree_clicked(GntWidget *widget, GntMouseEvent event, int x, int y)
 		} else if (row && row == tree->current) {
 			if (row->choice) {
 				row->isselected = !row->isselected;
+				row_text_changed(row);
 				g_signal_emit(tree, signals[SIG_TOGGLED], 0, row->key);
 				redraw_tree(tree);
 			} else {
@@ -1009,6 +1280,7 @@ gnt_tree_set_property(GObject *obj, guint prop_id, const GValue *value,
 			if (tree->priv->expander_level == g_value_get_int(value))
 				break;
 			tree->priv->expander_level = g_value_get_int(value);
+			rows_text_changed(tree);
 			g_object_notify(obj, "expander-level");
 		default:
 			break;
@@ -1189,6 +1461,7 @@ free_tree_row(gpointer data)
 
 	g_list_foreach(row->columns, (GFunc)free_tree_col, NULL);
 	g_list_free(row->columns);
+	g_free(row->text);
 	g_free(row);
 }
 
@@ -1275,8 +1548,7 @@ find_position(GntTree *tree, gpointer key, gpointer parent)
 
 void gnt_tree_sort_row(GntTree *tree, gpointer key)
 {
-	GntTreeRow *row, *q, *s;
-	int current, newp;
+	GntTreeRow *row, *q, *s, *range;
 
 	if (!tree->priv->compare)
 		return;
@@ -1284,8 +1556,6 @@ void gnt_tree_sort_row(GntTree *tree, gpointer key)
 	row = g_hash_table_lookup(tree->hash, key);
 	g_return_if_fail(row != NULL);
 
-	current = g_list_index(tree->list, key);
-
 	if (row->parent)
 		s = row->parent->child;
 	else
@@ -1303,6 +1573,9 @@ void gnt_tree_sort_row(GntTree *tree, gpointer key)
 	if (row == q || row == s)
 		return;
 
+	range = index_cut_subtree(tree, row);
+	tree->list = g_list_delete_link(tree->list, row->link);
+
 	if (q == NULL) {
 		/* row becomes the first child of its parent */
 		row->prev->next = row->next;  /* row->prev cannot be NULL at this point */
@@ -1315,7 +1588,8 @@ void gnt_tree_sort_row(GntTree *tree, gpointer key)
 		row->next = s;
 		s->prev = row;  /* s cannot be NULL */
 		row->prev = NULL;
-		newp = g_list_index(tree->list, s) - 1;
+		tree->list = g_list_insert_before(tree->list, s->link, key);
+		row->link = s->link->prev;
 	} else {
 		if (row->prev) {
 			row->prev->next = row->next;
@@ -1324,7 +1598,7 @@ void gnt_tree_sort_row(GntTree *tree, gpointer key)
 			if (row->parent)
 				row->parent->child = row->next;
 			else
-				tree->top = row->next;
+				tree->root = row->next;
 		}
 
 		if (row->next)
@@ -1335,9 +1609,9 @@ void gnt_tree_sort_row(GntTree *tree, gpointer key)
 		if (s)
 			s->prev = row;
 		row->next = s;
-		newp = g_list_index(tree->list, q) + 1;
+		list_insert_after(tree, row, q);
 	}
-	tree->list = g_list_reposition_child(tree->list, current, newp);
+	index_insert_range(index_slot(tree, row), range, index_predecessor(row));
 
 	redraw_tree(tree);
 }
@@ -1363,12 +1637,10 @@ GntTreeRow *gnt_tree_add_row_after(GntTree *tree, void *key, GntTreeRow *row, vo
 	if (tree->root == NULL)
 	{
 		tree->root = row;
-		tree->list = g_list_prepend(tree->list, key);
+		list_insert_after(tree, row, NULL);
 	}
 	else
 	{
-		int position = 0;
-
 		if (bigbro)
 		{
 			pr = g_hash_table_lookup(tree->hash, bigbro);
@@ -1379,8 +1651,6 @@ GntTreeRow *gnt_tree_add_row_after(GntTree *tree, void *key, GntTreeRow *row, vo
 				row->prev = pr;
 				pr->next = row;
 				row->parent = pr->parent;
-
-				position = g_list_index(tree->list, bigbro);
 			}
 		}
 
@@ -1393,8 +1663,6 @@ GntTreeRow *gnt_tree_add_row_after(GntTree *tree, void *key, GntTreeRow *row, vo
 				row->next = pr->child;
 				pr->child = row;
 				row->parent = pr;
-
-				position = g_list_index(tree->list, parent);
 			}
 		}
 
@@ -1406,13 +1674,11 @@ GntTreeRow *gnt_tree_add_row_after(GntTree *tree, void *key, GntTreeRow *row, vo
 			if (tree->current == tree->root)
 				tree->current = row;
 			tree->root = row;
-			tree->list = g_list_prepend(tree->list, key);
-		}
-		else
-		{
-			tree->list = g_list_insert(tree->list, key, position + 1);
 		}
+		list_insert_after(tree, row, pr);
 	}
+	index_insert(tree, row);
+	row_text_changed(row->parent);
 	redraw_tree(tree);
 
 	return row;
@@ -1493,7 +1759,7 @@ void gnt_tree_remove(GntTree *tree, gpointer key)
 			depth--;
 		}
 
-		if (get_distance(tree->top, row) >= 0 && get_distance(row, tree->bottom) >= 0)
+		if (row_is_in_view(tree, row))
 			redraw = TRUE;
 
 		/* Update root/top/current/bottom if necessary */
@@ -1519,6 +1785,9 @@ void gnt_tree_remove(GntTree *tree, gpointer key)
 			tree->bottom = get_prev(row);
 		}
 
+		index_remove(tree, row);
+		row_text_changed(row->parent);
+
 		/* Fix the links */
 		if (row->next)
 			row->next->prev = row->prev;
@@ -1527,8 +1796,8 @@ void gnt_tree_remove(GntTree *tree, gpointer key)
 		if (row->prev)
 			row->prev->next = row->next;
 
+		tree->list = g_list_delete_link(tree->list, row->link);
 		g_hash_table_remove(tree->hash, key);
-		tree->list = g_list_remove(tree->list, key);
 
 		if (redraw && depth == 0)
 		{
@@ -1546,6 +1815,7 @@ return_true(gpointer key, gpointer data, gpointer null)
 void gnt_tree_remove_all(GntTree *tree)
 {
 	tree->root = NULL;
+	tree->priv->index = NULL;
 	g_hash_table_foreach_remove(tree->hash, (GHRFunc)return_true, tree);
 	g_list_free(tree->list);
 	tree->list = NULL;
@@ -1575,9 +1845,10 @@ void gnt_tree_change_text(GntTree *tree, gpointer key, int colno, const char *te
 			g_free(col->text);
 			col->text = g_strdup(text ? text : "");
 		}
+		row_text_changed(row);
 
 		if (GNT_WIDGET_IS_FLAG_SET(GNT_WIDGET(tree), GNT_WIDGET_MAPPED) &&
-			get_distance(tree->top, row) >= 0 && get_distance(row, tree->bottom) >= 0)
+			row_is_in_view(tree, row))
 			redraw_tree(tree);
 	}
 }
@@ -1606,6 +1877,7 @@ GntTreeRow *gnt_tree_add_choice(GntTree *tree, void *key, GntTreeRow *row, void
 	}
 	row = gnt_tree_add_row_after(tree, key, row, parent, bigbro);
 	row->choice = TRUE;
+	row_text_changed(row);
 
 	return row;
 }
@@ -1619,6 +1891,7 @@ void gnt_tree_set_choice(GntTree *tree, void *key, gboolean set)
 	g_return_if_fail(row->choice);
 
 	row->isselected = set;
+	row_text_changed(row);
 	redraw_tree(tree);
 }
 
@@ -1688,6 +1961,7 @@ static void _gnt_tree_init_internals(GntTree *tree, int col)
 		tree->columns[col].width = 15;
 	}
 	tree->list = NULL;
+	tree->priv->index = NULL;
 	tree->show_title = FALSE;
 	g_object_notify(G_OBJECT(tree), "columns");
 }
@@ -1750,6 +2024,8 @@ void gnt_tree_set_col_width(GntTree *tree, int col, int width)
 {
 	g_return_if_fail(col < tree->ncol);
 
+	if (tree->columns[col].width != width)
+		rows_text_changed(tree);
 	tree->columns[col].width = width;
 	if (tree->columns[col].width_ratio == 0)
 		tree->columns[col].width_ratio = width;
@@ -1790,7 +2066,9 @@ void gnt_tree_set_expanded(GntTree *tree, void *key, gboolean expanded)
 {
 	GntTreeRow *row = g_hash_table_lookup(tree->hash, key);
 	if (row) {
+		index_set_collapsed(tree, row, !expanded);
 		row->collapsed = !expanded;
+		row_text_changed(row);
 		if (GNT_WIDGET(tree)->window)
 			gnt_widget_draw(GNT_WIDGET(tree));
 		g_signal_emit(tree, signals[SIG_COLLAPSED], 0, key, row->collapsed);
@@ -1800,6 +2078,7 @@ void gnt_tree_set_expanded(GntTree *tree, void *key, gboolean expanded)
 void gnt_tree_set_show_separator(GntTree *tree, gboolean set)
 {
 	tree->show_separator = set;
+	rows_text_changed(tree);
 }
 
 void gnt_tree_adjust_columns(GntTree *tree)
@@ -1844,6 +2123,7 @@ void gnt_tree_set_hash_fns(GntTree *tree, gpointer hash, gpointer eq, gpointer k
 {
 	g_hash_table_foreach_remove(tree->hash, return_true, NULL);
 	g_hash_table_destroy(tree->hash);
+	tree->priv->index = NULL;
 	tree->hash = g_hash_table_new_full(hash, eq, kd, free_tree_row);
 }
 
@@ -1854,6 +2134,7 @@ set_column_flag(GntTree *tree, int col, GntTreeColumnFlag flag, gboolean set)
 		tree->columns[col].flags |= flag;
 	else
 		tree->columns[col].flags &= ~flag;
+	rows_text_changed(tree);
 }
 
 void gnt_tree_set_column_visible(GntTree *tree, int col, gboolean vis)
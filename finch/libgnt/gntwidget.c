@@ -603,6 +603,66 @@ void gnt_widget_activate(GntWidget *widget)
 	g_signal_emit(widget, signals[SIG_ACTIVATE], 0);
 }
 
+/* The part of a toplevel widget that has been drawn, but not yet copied to
+ * the screen by the window manager. */
+typedef struct
+{
+	int x1, y1;
+	int x2, y2;
+} GntDamage;
+
+static void
+widget_add_damage(GntWidget *widget)
+{
+	GntWidget *top = widget;
+	GntDamage *damage;
+	int x1, y1, x2, y2;
+
+	while (top->parent)
+		top = top->parent;
+
+	/* Include the shadow, if any */
+	x1 = widget->priv.x;
+	y1 = widget->priv.y;
+	x2 = x1 + widget->priv.width + 1;
+	y2 = y1 + widget->priv.height + 1;
+
+	damage = g_object_get_data(G_OBJECT(top), "gnt:damage");
+	if (damage == NULL) {
+		damage = g_new0(GntDamage, 1);
+		damage->x1 = x1;
+		damage->y1 = y1;
+		damage->x2 = x2;
+		damage->y2 = y2;
+		g_object_set_data_full(G_OBJECT(top), "gnt:damage", damage, g_free);
+	} else {
+		damage->x1 = MIN(damage->x1, x1);
+		damage->y1 = MIN(damage->y1, y1);
+		damage->x2 = MAX(damage->x2, x2);
+		damage->y2 = MAX(damage->y2, y2);
+	}
+}
+
+gboolean gnt_widget_take_damage(GntWidget *widget, int *x, int *y, int *width, int *height)
+{
+	GntDamage *damage = g_object_get_data(G_OBJECT(widget), "gnt:damage");
+
+	if (damage == NULL)
+		return FALSE;
+
+	if (x)
+		*x = damage->x1;
+	if (y)
+		*y = damage->y1;
+	if (width)
+		*width = damage->x2 - damage->x1;
+	if (height)
+		*height = damage->y2 - damage->y1;
+
+	g_object_set_data(G_OBJECT(widget), "gnt:damage", NULL);
+	return TRUE;
+}
+
 static gboolean
 update_queue_callback(gpointer data)
 {
@@ -610,8 +670,13 @@ update_queue_callback(gpointer data)
 
 	if (!g_object_get_data(G_OBJECT(widget), "gnt:queue_update"))
 		return FALSE;
-	if (GNT_WIDGET_IS_FLAG_SET(widget, GNT_WIDGET_MAPPED))
+	if (GNT_WIDGET_IS_FLAG_SET(widget, GNT_WIDGET_MAPPED)) {
+		/* Tell the window manager that the recorded damage is what this
+		 * update needs to copy. */
+		g_object_set_data(G_OBJECT(widget), "gnt:queued_update", GINT_TO_POINTER(TRUE));
 		gnt_screen_update(widget);
+		g_object_set_data(G_OBJECT(widget), "gnt:queued_update", NULL);
+	}
 	g_object_set_data(G_OBJECT(widget), "gnt:queue_update", NULL);
 	return FALSE;
 }
@@ -620,6 +685,7 @@ void gnt_widget_queue_update(GntWidget *widget)
 {
 	if (widget->window == NULL)
 		return;
+	widget_add_damage(widget);
 	while (widget->parent)
 		widget = widget->parent;
 
@@ -287,6 +287,15 @@ const char *gnt_widget_get_name(GntWidget *widget);
  */
 void gnt_widget_queue_update(GntWidget *widget);
 
+/**
+ * @internal
+ * Get the area of a toplevel widget that has been drawn since the last call,
+ * in screen coordinates, and forget about it.
+ *
+ * @return  @c FALSE if nothing has been drawn.
+ */
+gboolean gnt_widget_take_damage(GntWidget *widget, int *x, int *y, int *width, int *height);
+
 /**
  * Set whether a widget can take focus or not.
  *
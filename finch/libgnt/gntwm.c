@@ -131,15 +131,19 @@ free_node(gpointer data)
 	g_free(node);
 }
 
-void
-gnt_wm_copy_win(GntWidget *widget, GntNode *node)
+/* Copies the rows from 'first' to 'last' of the window of a toplevel widget
+ * to the window of its node. The rows are counted from the top of the node. */
+static void
+copy_win_rows(GntWidget *widget, GntNode *node, int first, int last)
 {
 	WINDOW *src, *dst;
-	if (!node)
-		return;
+
 	src = widget->window;
 	dst = node->window;
-	copywin(src, dst, node->scroll, 0, 0, 0, getmaxy(dst) - 1, getmaxx(dst) - 1, 0);
+	first = MAX(first, 0);
+	last = MIN(last, getmaxy(dst) - 1);
+	if (first <= last)
+		copywin(src, dst, node->scroll + first, 0, first, 0, last, getmaxx(dst) - 1, 0);
 
 	/* Update the hardware cursor */
 	if (GNT_IS_WINDOW(widget) || GNT_IS_BOX(widget)) {
@@ -153,6 +157,14 @@ gnt_wm_copy_win(GntWidget *widget, GntNode *node)
 	}
 }
 
+void
+gnt_wm_copy_win(GntWidget *widget, GntNode *node)
+{
+	if (!node)
+		return;
+	copy_win_rows(widget, node, 0, getmaxy(node->window) - 1);
+}
+
 /**
  * The following is a workaround for a bug in most versions of ncursesw.
  * Read about it in: http://article.gmane.org/gmane.comp.lib.ncurses.bugs/2751
@@ -239,11 +251,24 @@ update_act_msg(void)
 	g_string_free(text, TRUE);
 }
 
+/* Updates to the screen are coalesced, and written out once the redraws
+ * queued during this iteration of the main loop have been processed. */
+static guint update_screen_source = 0;
+static gboolean update_taskbar = FALSE;
+
 static gboolean
-update_screen(GntWM *wm)
+update_screen_cb(gpointer data)
 {
+	GntWM *wm = data;
+
+	update_screen_source = 0;
 	if (wm->mode == GNT_KP_MODE_WAIT_ON_CHILD)
-		return TRUE;
+		return FALSE;
+
+	if (update_taskbar) {
+		update_taskbar = FALSE;
+		gnt_ws_draw_taskbar(wm->cws, FALSE);
+	}
 
 	if (wm->menu) {
 		GntMenu *top = wm->menu;
@@ -257,6 +282,15 @@ update_screen(GntWM *wm)
 	work_around_for_ncurses_bug();
 	update_panels();
 	doupdate();
+	return FALSE;
+}
+
+static gboolean
+update_screen(GntWM *wm)
+{
+	if (update_screen_source == 0)
+		update_screen_source = g_idle_add_full(G_PRIORITY_HIGH_IDLE,
+				update_screen_cb, wm, NULL);
 	return TRUE;
 }
 
@@ -1391,6 +1425,11 @@ gnt_wm_destroy(GObject *obj)
 	g_hash_table_destroy(wm->nodes);
 	wm->nodes = NULL;
 
+	if (update_screen_source) {
+		g_source_remove(update_screen_source);
+		update_screen_source = 0;
+	}
+
 	while (wm->workspaces) {
 		g_object_unref(wm->workspaces->data);
 		wm->workspaces = g_list_delete_link(wm->workspaces, wm->workspaces);
@@ -2248,13 +2287,25 @@ void gnt_wm_update_window(GntWM *wm, GntWidget *widget)
 {
 	GntNode *node = NULL;
 	GntWS *ws;
+	gboolean damaged;
+	int x, y, w, h;
 
 	while (widget->parent)
 		widget = widget->parent;
+
+	/* Only copy the parts of the window that have been drawn since the last
+	 * update. The damage is only recorded for queued updates; a direct update
+	 * (e.g. after the window was marked urgent, renamed or uncovered) may need
+	 * more than that, so copy everything. */
+	damaged = gnt_widget_take_damage(widget, &x, &y, &w, &h) &&
+		g_object_get_data(G_OBJECT(widget), "gnt:queued_update");
 	if (!GNT_IS_MENU(widget)) {
 		if (!GNT_IS_BOX(widget))
 			return;
-		gnt_box_sync_children(GNT_BOX(widget));
+		if (damaged)
+			gnt_box_sync_children_area(GNT_BOX(widget), x, y, w, h);
+		else
+			gnt_box_sync_children(GNT_BOX(widget));
 	}
 
 	ws = gnt_wm_widget_find_workspace(wm, widget);
@@ -2265,8 +2316,12 @@ void gnt_wm_update_window(GntWM *wm, GntWidget *widget)
 		g_signal_emit(wm, signals[SIG_UPDATE_WIN], 0, node);
 
 	if (ws == wm->cws || GNT_WIDGET_IS_FLAG_SET(widget, GNT_WIDGET_TRANSIENT)) {
-		gnt_wm_copy_win(widget, node);
-		gnt_ws_draw_taskbar(wm->cws, FALSE);
+		if (node && damaged)
+			copy_win_rows(widget, node, y - widget->priv.y - node->scroll,
+					y + h - 1 - widget->priv.y - node->scroll);
+		else
+			gnt_wm_copy_win(widget, node);
+		update_taskbar = TRUE;
 		update_screen(wm);
 	} else if (ws && ws != wm->cws && GNT_WIDGET_IS_FLAG_SET(widget, GNT_WIDGET_URGENT)) {
 		if (!act || (act && !g_list_find(act, ws)))
@@ -0,0 +1,72 @@
+#include "gnt.h"
+#include "gntbox.h"
+#include "gnttree.h"
+
+/* Scrolls through a tree with a lot of rows, and reports the time it took
+ * in .error */
+
+#define GROUPS   500
+#define CHILDREN 100
+
+static gboolean
+scroll_tree(GntTree *tree)
+{
+	GTimer *timer = g_timer_new();
+	int i;
+
+	for (i = 0; i < GROUPS * (CHILDREN + 1); i++)
+		gnt_tree_scroll(tree, 1);
+	for (i = 0; i < GROUPS * (CHILDREN + 1); i++)
+		gnt_tree_scroll(tree, -1);
+
+	g_printerr("scrolled %d rows down and up in %.3f seconds\n",
+			GROUPS * (CHILDREN + 1), g_timer_elapsed(timer, NULL));
+	g_timer_destroy(timer);
+	return FALSE;
+}
+
+int main()
+{
+	GntWidget *box, *tree;
+	GTimer *timer;
+	int i, j;
+
+#ifdef STANDALONE
+	freopen(".error", "w", stderr);
+	gnt_init();
+#endif
+
+	box = gnt_box_new(FALSE, TRUE);
+	gnt_box_set_toplevel(GNT_BOX(box), TRUE);
+	gnt_box_set_title(GNT_BOX(box), "Big tree");
+
+	tree = gnt_tree_new_with_columns(2);
+	gnt_tree_set_visible_rows(GNT_TREE(tree), 20);
+	gnt_box_add_widget(GNT_BOX(box), tree);
+	gnt_widget_show(box);
+
+	timer = g_timer_new();
+	for (i = 0; i < GROUPS; i++) {
+		char *group = g_strdup_printf("group %d", i);   /* XXX: leaking the keys */
+		gnt_tree_add_row_last(GNT_TREE(tree), group,
+				gnt_tree_create_row(GNT_TREE(tree), group, ""), NULL);
+		for (j = 0; j < CHILDREN; j++) {
+			char *s = g_strdup_printf("%s, row %d", group, j);
+			gnt_tree_add_row_last(GNT_TREE(tree), s,
+					gnt_tree_create_row(GNT_TREE(tree), s, "text"), group);
+		}
+	}
+	g_printerr("added %d rows in %.3f seconds\n",
+			GROUPS * (CHILDREN + 1), g_timer_elapsed(timer, NULL));
+	g_timer_destroy(timer);
+
+	g_idle_add((GSourceFunc)scroll_tree, tree);
+
+#ifdef STANDALONE
+	gnt_main();
+
+	gnt_quit();
+#endif
+
+	return 0;
+}
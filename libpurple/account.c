@@ -91,8 +91,38 @@ static gboolean accounts_loaded = FALSE;
 
 static GList *handles = NULL;
 
+/* Accounts waiting for their turn to connect, highest priority first. */
+static GList      *login_queue = NULL;
+static GHashTable *login_hosts = NULL;   /* host key -> PurpleLoginHost */
+static guint       login_queue_timer = 0;
+
+typedef struct
+{
+	int delay;       /* The current backoff, in milliseconds. */
+	time_t retry;    /* When accounts on this host may connect again. */
+	guint timeout;
+} PurpleLoginHost;
+
+#define LOGIN_HOST_DELAY_MIN   5000
+#define LOGIN_HOST_DELAY_MAX 600000
+
+/*
+ * An index of the accounts for purple_accounts_find().  It's built when
+ * it's first needed and thrown away when accounts are removed, reordered
+ * or renamed.
+ */
+static GHashTable *accounts_index = NULL;   /* protocol id -> AccountsByProtocol */
+
+typedef struct
+{
+	GList *accounts;      /* In the same order as the accounts list */
+	GHashTable *names;    /* normalized username -> the first such account */
+} AccountsByProtocol;
+
 static void set_current_error(PurpleAccount *account,
 	PurpleConnectionErrorInfo *new_err);
+static void login_queue_remove(PurpleAccount *account);
+static void accounts_index_invalidate(void);
 
 static void
 _purple_account_set_encrypted_password(PurpleAccount *account, const char *keyring,
@@ -1126,6 +1156,8 @@ purple_account_destroy(PurpleAccount *account)
 	purple_debug_info("account", "Destroying account %p\n", account);
 	purple_signal_emit(purple_accounts_get_handle(), "account-destroying", account);
 
+	login_queue_remove(account);
+
 	for (l = purple_get_conversations(); l != NULL; l = l->next)
 	{
 		PurpleConversation *conv = (PurpleConversation *)l->data;
@@ -1691,6 +1723,7 @@ purple_account_set_username(PurpleAccount *account, const char *username)
 	g_free(account->username);
 	account->username = g_strdup(username);
 
+	accounts_index_invalidate();
 	schedule_accounts_save();
 
 	/* if the name changes, we should re-write the buddy list
@@ -1767,6 +1800,7 @@ purple_account_set_protocol_id(PurpleAccount *account, const char *protocol_id)
 	g_free(account->protocol_id);
 	account->protocol_id = g_strdup(protocol_id);
 
+	accounts_index_invalidate();
 	schedule_accounts_save();
 }
 
@@ -1816,6 +1850,9 @@ purple_account_set_enabled(PurpleAccount *account, const char *ui,
 	else if(!was_enabled && value)
 		purple_signal_emit(purple_accounts_get_handle(), "account-enabled", account);
 
+	if (!value)
+		login_queue_remove(account);
+
 	if ((gc != NULL) && (gc->wants_to_die == TRUE))
 		return;
 
@@ -2839,6 +2876,300 @@ gboolean purple_account_supports_offline_message(PurpleAccount *account, PurpleB
 	return prpl_info->offline_message(buddy);
 }
 
+/*********************************************************************
+ * Login queue                                                       *
+ *********************************************************************/
+
+/*
+ * Connecting lots of accounts at once (at startup, or when the network
+ * comes back) means lots of simultaneous DNS lookups, TLS handshakes and
+ * roster downloads, and servers tend to rate limit that.  Queued accounts
+ * are only connected while fewer than /purple/login/max_connecting
+ * connections are in progress, and a non-fatal connection error holds
+ * back every queued account on the same server for a while.
+ */
+
+/* Returns a key for the server an account connects to, for backoff. */
+static char *
+login_host_key(const PurpleAccount *account)
+{
+	const char *host, *username;
+	char *key, *tmp;
+	size_t len;
+
+	host = purple_account_get_string(account, "connect_server", NULL);
+	if (host == NULL || *host == '\0')
+		host = purple_account_get_string(account, "server", NULL);
+
+	if (host == NULL || *host == '\0') {
+		username = purple_account_get_username(account);
+		host = username ? strchr(username, '@') : NULL;
+		if (host != NULL)
+			host++;
+	}
+
+	if (host == NULL || *host == '\0')
+		return g_strdup(purple_account_get_protocol_id(account));
+
+	/* Leave out any XMPP resource. */
+	len = strcspn(host, "/");
+	tmp = g_strdup_printf("%s:%.*s", purple_account_get_protocol_id(account),
+	                      (int)len, host);
+	key = g_ascii_strdown(tmp, -1);
+	g_free(tmp);
+
+	return key;
+}
+
+static PurpleLoginHost *
+login_host_find(const PurpleAccount *account)
+{
+	PurpleLoginHost *host;
+	char *key;
+
+	if (login_hosts == NULL)
+		return NULL;
+
+	key = login_host_key(account);
+	host = g_hash_table_lookup(login_hosts, key);
+	g_free(key);
+
+	return host;
+}
+
+static void
+login_host_free(PurpleLoginHost *host)
+{
+	if (host->timeout != 0)
+		purple_timeout_remove(host->timeout);
+	g_free(host);
+}
+
+static gboolean login_queue_run(gpointer unused);
+
+static void
+login_queue_schedule(void)
+{
+	if (login_queue_timer == 0 && login_queue != NULL)
+		login_queue_timer = purple_timeout_add(0, login_queue_run, NULL);
+}
+
+static void
+login_queue_changed(void)
+{
+	purple_signal_emit(purple_accounts_get_handle(),
+	                   "account-login-queue-changed");
+}
+
+static gboolean
+login_host_retry_cb(gpointer data)
+{
+	PurpleLoginHost *host = data;
+
+	host->timeout = 0;
+	login_queue_schedule();
+
+	return FALSE;
+}
+
+/* Backs off every account on a server after a non-fatal error. */
+static void
+login_host_failed(PurpleAccount *account)
+{
+	PurpleLoginHost *host;
+	char *key;
+	int wait;
+
+	if (login_hosts == NULL)
+		return;
+
+	key = login_host_key(account);
+	host = g_hash_table_lookup(login_hosts, key);
+	if (host == NULL) {
+		host = g_new0(PurpleLoginHost, 1);
+		g_hash_table_insert(login_hosts, key, host);
+	} else {
+		g_free(key);
+
+		/* Everyone on a server that went away fails at once; that's
+		 * still only one failure. */
+		if (host->timeout != 0)
+			return;
+	}
+
+	if (host->delay == 0)
+		host->delay = LOGIN_HOST_DELAY_MIN;
+	else
+		host->delay = MIN(2 * host->delay, LOGIN_HOST_DELAY_MAX);
+
+	/* Spread the retries out, so everyone doesn't come back at once. */
+	wait = host->delay / 2 + g_random_int_range(0, host->delay / 2 + 1);
+
+	if (host->timeout != 0)
+		purple_timeout_remove(host->timeout);
+	host->timeout = purple_timeout_add(wait, login_host_retry_cb, host);
+	host->retry = time(NULL) + (wait + 999) / 1000;
+
+	purple_debug_info("account", "Holding back connections to %s's server for %d ms\n",
+	                  purple_account_get_username(account), wait);
+}
+
+static void
+login_host_succeeded(PurpleAccount *account)
+{
+	char *key;
+
+	if (login_hosts == NULL)
+		return;
+
+	key = login_host_key(account);
+	if (g_hash_table_remove(login_hosts, key))
+		login_queue_schedule();
+	g_free(key);
+}
+
+static gboolean
+login_queue_run(gpointer unused)
+{
+	GList *l, *next;
+	guint max, connecting;
+	gboolean changed = FALSE;
+
+	login_queue_timer = 0;
+
+	max = MAX(purple_prefs_get_int("/purple/login/max_connecting"), 0);
+	connecting = g_list_length(purple_connections_get_connecting());
+
+	for (l = login_queue; l != NULL && (max == 0 || connecting < max); l = next) {
+		PurpleAccount *account = l->data;
+		PurpleLoginHost *host;
+
+		next = l->next;
+
+		host = login_host_find(account);
+		if (host != NULL && host->timeout != 0)
+			continue;
+
+		login_queue = g_list_delete_link(login_queue, l);
+		changed = TRUE;
+
+		if (!purple_account_is_disconnected(account) ||
+				!purple_account_get_enabled(account, purple_core_get_ui()) ||
+				!purple_presence_is_online(account->presence))
+			continue;
+
+		purple_account_connect(account);
+		if (purple_account_is_connecting(account))
+			connecting++;
+
+		/* Connecting can run all kinds of callbacks, so start over. */
+		next = login_queue;
+	}
+
+	if (changed)
+		login_queue_changed();
+
+	return FALSE;
+}
+
+static void
+login_queue_remove(PurpleAccount *account)
+{
+	GList *l = g_list_find(login_queue, account);
+
+	if (l == NULL)
+		return;
+
+	login_queue = g_list_delete_link(login_queue, l);
+	login_queue_changed();
+}
+
+void
+purple_accounts_queue_connect(PurpleAccount *account)
+{
+	int priority;
+	GList *l;
+
+	g_return_if_fail(account != NULL);
+
+	if (g_list_find(login_queue, account) != NULL ||
+			!purple_account_is_disconnected(account))
+		return;
+
+	/* Behind everything with the same or a higher priority. */
+	priority = purple_account_get_login_priority(account);
+	for (l = login_queue; l != NULL; l = l->next)
+		if (purple_account_get_login_priority(l->data) < priority)
+			break;
+
+	if (l == NULL)
+		login_queue = g_list_append(login_queue, account);
+	else
+		login_queue = g_list_insert_before(login_queue, l, account);
+
+	login_queue_schedule();
+	login_queue_changed();
+}
+
+void
+purple_accounts_unqueue_connect(PurpleAccount *account)
+{
+	g_return_if_fail(account != NULL);
+
+	login_queue_remove(account);
+}
+
+GList *
+purple_accounts_get_login_queue(void)
+{
+	return login_queue;
+}
+
+int
+purple_account_get_login_delay(const PurpleAccount *account)
+{
+	PurpleLoginHost *host;
+
+	g_return_val_if_fail(account != NULL, 0);
+
+	host = login_host_find(account);
+	if (host == NULL || host->timeout == 0)
+		return 0;
+
+	return (int)MAX(host->retry - time(NULL), 1);
+}
+
+void
+purple_account_set_login_priority(PurpleAccount *account, int priority)
+{
+	GList *l;
+
+	g_return_if_fail(account != NULL);
+
+	purple_account_set_int(account, "login_priority", priority);
+
+	/* Move it to its new place in the queue. */
+	if ((l = g_list_find(login_queue, account)) != NULL) {
+		login_queue = g_list_delete_link(login_queue, l);
+		purple_accounts_queue_connect(account);
+	}
+}
+
+int
+purple_account_get_login_priority(const PurpleAccount *account)
+{
+	g_return_val_if_fail(account != NULL, 0);
+
+	return purple_account_get_int(account, "login_priority", 0);
+}
+
+static void
+login_max_connecting_changed_cb(const char *name, PurplePrefType type,
+                                gconstpointer value, gpointer data)
+{
+	login_queue_schedule();
+}
+
 static void
 signed_on_cb(PurpleConnection *gc,
              gpointer unused)
@@ -2846,6 +3177,9 @@ signed_on_cb(PurpleConnection *gc,
 	PurpleAccount *account = purple_connection_get_account(gc);
 	purple_account_clear_current_error(account);
 
+	login_host_succeeded(account);
+	login_queue_schedule();
+
 	purple_signal_emit(purple_accounts_get_handle(), "account-signed-on",
 	                   account);
 }
@@ -2856,6 +3190,8 @@ signed_off_cb(PurpleConnection *gc,
 {
 	PurpleAccount *account = purple_connection_get_account(gc);
 
+	login_queue_schedule();
+
 	purple_signal_emit(purple_accounts_get_handle(), "account-signed-off",
 	                   account);
 }
@@ -2909,6 +3245,9 @@ connection_error_cb(PurpleConnection *gc,
 
 	set_current_error(account, err);
 
+	if (!purple_connection_error_is_fatal(type))
+		login_host_failed(account);
+
 	purple_signal_emit(purple_accounts_get_handle(), "account-connection-error",
 	                   account, type, description);
 }
@@ -2926,6 +3265,53 @@ purple_account_clear_current_error(PurpleAccount *account)
 	set_current_error(account, NULL);
 }
 
+static void
+accounts_by_protocol_free(AccountsByProtocol *index)
+{
+	g_list_free(index->accounts);
+	g_hash_table_destroy(index->names);
+	g_free(index);
+}
+
+static void
+accounts_index_add(PurpleAccount *account)
+{
+	AccountsByProtocol *index;
+	const char *username = purple_account_get_username(account);
+	const char *protocol_id = purple_account_get_protocol_id(account);
+	char *name;
+
+	if (protocol_id == NULL)
+		return;
+
+	index = g_hash_table_lookup(accounts_index, protocol_id);
+	if (index == NULL) {
+		index = g_new0(AccountsByProtocol, 1);
+		index->names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+		g_hash_table_insert(accounts_index, g_strdup(protocol_id), index);
+	}
+
+	index->accounts = g_list_append(index->accounts, account);
+
+	if (username == NULL)
+		return;
+
+	name = g_strdup(purple_normalize(account, username));
+	if (g_hash_table_lookup(index->names, name) == NULL)
+		g_hash_table_insert(index->names, name, account);
+	else
+		g_free(name);
+}
+
+static void
+accounts_index_invalidate(void)
+{
+	if (accounts_index != NULL) {
+		g_hash_table_destroy(accounts_index);
+		accounts_index = NULL;
+	}
+}
+
 void
 purple_accounts_add(PurpleAccount *account)
 {
@@ -2935,6 +3321,8 @@ purple_accounts_add(PurpleAccount *account)
 		return;
 
 	accounts = g_list_append(accounts, account);
+	if (accounts_index != NULL)
+		accounts_index_add(account);
 
 	schedule_accounts_save();
 
@@ -2947,6 +3335,7 @@ purple_accounts_remove(PurpleAccount *account)
 	g_return_if_fail(account != NULL);
 
 	accounts = g_list_remove(accounts, account);
+	accounts_index_invalidate();
 
 	schedule_accounts_save();
 
@@ -3059,6 +3448,7 @@ purple_accounts_reorder(PurpleAccount *account, gint new_index)
 
 	/* Insert it where it should go. */
 	accounts = g_list_insert(accounts, account, new_index);
+	accounts_index_invalidate();
 
 	schedule_accounts_save();
 }
@@ -3087,27 +3477,57 @@ purple_accounts_get_all_active(void)
 	return list;
 }
 
+static gboolean
+account_has_name(PurpleAccount *account, const char *name)
+{
+	char *who;
+	gboolean ret;
+
+	if (purple_account_get_username(account) == NULL)
+		return FALSE;
+
+	who = g_strdup(purple_normalize(account, name));
+	ret = purple_strequal(purple_normalize(account, purple_account_get_username(account)), who);
+	g_free(who);
+
+	return ret;
+}
+
 PurpleAccount *
 purple_accounts_find(const char *name, const char *protocol_id)
 {
-	PurpleAccount *account = NULL;
+	AccountsByProtocol *index;
+	PurpleAccount *account;
 	GList *l;
-	char *who;
 
 	g_return_val_if_fail(name != NULL, NULL);
 	g_return_val_if_fail(protocol_id != NULL, NULL);
 
-	for (l = purple_accounts_get_all(); l != NULL; l = l->next) {
-		account = (PurpleAccount *)l->data;
-		if (!purple_strequal(account->protocol_id, protocol_id))
-			continue;
+	if (accounts_index == NULL) {
+		accounts_index = g_hash_table_new_full(g_str_hash, g_str_equal,
+				g_free, (GDestroyNotify)accounts_by_protocol_free);
+		for (l = accounts; l != NULL; l = l->next)
+			accounts_index_add(l->data);
+	}
 
-		who = g_strdup(purple_normalize(account, name));
-		if (purple_strequal(purple_normalize(account, purple_account_get_username(account)), who)) {
-			g_free(who);
-			return account;
-		}
-		g_free(who);
+	index = g_hash_table_lookup(accounts_index, protocol_id);
+	if (index == NULL)
+		return NULL;
+
+	account = g_hash_table_lookup(index->names,
+			purple_normalize(index->accounts->data, name));
+	if (account != NULL && account_has_name(account, name))
+		return account;
+
+	/*
+	 * How a prpl normalizes a name can depend on the account and on
+	 * whether it's connected, so the index can be out of date.  If it
+	 * doesn't have the answer, check this protocol's accounts the slow
+	 * way.
+	 */
+	for (l = index->accounts; l != NULL; l = l->next) {
+		if (account_has_name(l->data, name))
+			return l->data;
 	}
 
 	return NULL;
@@ -3132,7 +3552,7 @@ purple_accounts_restore_current_statuses()
 		if (purple_account_get_enabled(account, purple_core_get_ui()) &&
 			(purple_presence_is_online(account->presence)))
 		{
-			purple_account_connect(account);
+			purple_accounts_queue_connect(account);
 		}
 	}
 }
@@ -3276,6 +3696,17 @@ purple_accounts_init(void)
 	                       purple_value_new(PURPLE_TYPE_ENUM),
 	                       purple_value_new(PURPLE_TYPE_STRING));
 
+	purple_signal_register(handle, "account-login-queue-changed",
+	                       purple_marshal_VOID, NULL, 0);
+
+	purple_prefs_add_none("/purple/login");
+	purple_prefs_add_int("/purple/login/max_connecting", 4);
+	purple_prefs_connect_callback(handle, "/purple/login/max_connecting",
+	                              login_max_connecting_changed_cb, NULL);
+
+	login_hosts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+	                                    (GDestroyNotify)login_host_free);
+
 	purple_signal_connect(conn_handle, "signed-on", handle,
 	                      PURPLE_CALLBACK(signed_on_cb), NULL);
 	purple_signal_connect(conn_handle, "signed-off", handle,
@@ -3298,9 +3729,21 @@ purple_accounts_uninit(void)
 		sync_accounts();
 	}
 
+	if (login_queue_timer != 0) {
+		purple_timeout_remove(login_queue_timer);
+		login_queue_timer = 0;
+	}
+
 	for (; accounts; accounts = g_list_delete_link(accounts, accounts))
 		purple_account_destroy(accounts->data);
+	accounts_index_invalidate();
+
+	g_list_free(login_queue);
+	login_queue = NULL;
+	g_hash_table_destroy(login_hosts);
+	login_hosts = NULL;
 
+	purple_prefs_disconnect_by_handle(handle);
 	purple_signals_disconnect_by_handle(handle);
 	purple_signals_unregister_by_instance(handle);
 }
@@ -1062,6 +1062,40 @@ const PurpleConnectionErrorInfo *purple_account_get_current_error(PurpleAccount
  */
 void purple_account_clear_current_error(PurpleAccount *account);
 
+/**
+ * Sets the priority of an account in the login queue.  Accounts with a
+ * higher priority are connected first.  The default is 0.
+ *
+ * @param account  The account.
+ * @param priority The login priority.
+ *
+ * @see purple_accounts_queue_connect()
+ * @since 2.10.11
+ */
+void purple_account_set_login_priority(PurpleAccount *account, int priority);
+
+/**
+ * Returns the priority of an account in the login queue.
+ *
+ * @param account The account.
+ *
+ * @return The login priority.
+ * @since 2.10.11
+ */
+int purple_account_get_login_priority(const PurpleAccount *account);
+
+/**
+ * Returns how long a queued account will be held back because connecting
+ * to its server recently failed.
+ *
+ * @param account The account.
+ *
+ * @return The number of seconds until the account's server will be tried
+ *         again, or 0 if it isn't being held back.
+ * @since 2.10.11
+ */
+int purple_account_get_login_delay(const PurpleAccount *account);
+
 /*@}*/
 
 /**************************************************************************/
@@ -1139,6 +1173,43 @@ PurpleAccount *purple_accounts_find(const char *name, const char *protocol);
  */
 void purple_accounts_restore_current_statuses(void);
 
+/**
+ * Adds an account to the login queue, to be connected once it's its turn.
+ *
+ * No more than /purple/login/max_connecting accounts (0 means no limit)
+ * are connecting at any time.  Queued accounts are connected in order of
+ * their login priority.  When connecting to a server fails with a
+ * non-fatal error, all queued accounts on that server are held back for a
+ * randomized, increasing delay until a connection to it succeeds.
+ *
+ * The account is only connected if it's still enabled, online and
+ * disconnected when its turn comes.
+ *
+ * @param account The account to connect.
+ *
+ * @see purple_account_set_login_priority()
+ * @since 2.10.11
+ */
+void purple_accounts_queue_connect(PurpleAccount *account);
+
+/**
+ * Removes an account from the login queue.
+ *
+ * @param account The account.
+ *
+ * @since 2.10.11
+ */
+void purple_accounts_unqueue_connect(PurpleAccount *account);
+
+/**
+ * Returns the accounts waiting in the login queue, in the order they will
+ * be connected.
+ *
+ * @constreturn The queued accounts.
+ * @since 2.10.11
+ */
+GList *purple_accounts_get_login_queue(void);
+
 /*@}*/
 
 
@@ -30,6 +30,7 @@
 #include "conversation.h"
 #include "dbus-maybe.h"
 #include "debug.h"
+#include "eventloop.h"
 #include "imgstore.h"
 #include "util.h"
 
@@ -109,6 +110,10 @@ static gboolean    icon_caching  = TRUE;
 static char *old_icons_dir = NULL;
 
 static void delete_buddy_icon_settings(PurpleBlistNode *node, const char *setting_name);
+static PurpleStoredImage *purple_buddy_icons_set_account_img(PurpleAccount *account,
+                                                             PurpleStoredImage *img);
+static PurpleStoredImage *purple_buddy_icons_node_set_custom_img(PurpleBlistNode *node,
+                                                                 PurpleStoredImage *img);
 
 /*
  * Begin functions for dealing with the on-disk icon cache
@@ -148,67 +153,535 @@ unref_filename(const char *filename)
 	}
 }
 
-static void
-purple_buddy_icon_data_cache(PurpleStoredImage *img)
+/*
+ * Icon cache files are read, written and deleted by a background thread,
+ * so that a roster full of new icons doesn't stall the main thread.
+ * Operations are queued here and the thread picks them up a batch at a
+ * time, writing every file in a batch before flushing them to disk.  Only
+ * the last operation queued for a file is kept.  Finished operations are
+ * collected on the main thread by a timer, which is where errors are
+ * logged.
+ *
+ * A queued write holds a reference to its image.  That keeps the image
+ * in icon_data_cache until the file is on disk, so nothing goes looking
+ * for the file before it's there.
+ */
+typedef enum
 {
-	const char *dirname;
+	ICON_CACHE_CHECK,   /* Note whether the file is missing, ahead of use */
+	ICON_CACHE_WRITE,
+	ICON_CACHE_DELETE
+} IconCacheOpType;
+
+typedef struct
+{
+	IconCacheOpType type;
+	char *filename;
 	char *path;
+	PurpleStoredImage *img;   /* The image being written */
+	gconstpointer data;
+	size_t size;
+	FILE *file;               /* The temporary file, while writing */
+	gboolean missing;         /* The file turned out not to exist */
+	GError *error;
+} IconCacheOp;
 
-	g_return_if_fail(img != NULL);
+/* The most operations handed to the thread at once */
+#define ICON_CACHE_BATCH_SIZE 64
 
-	if (!purple_buddy_icons_is_caching())
-		return;
+/* How often finished operations are collected, in milliseconds */
+#define ICON_CACHE_POLL_INTERVAL 500
 
-	dirname  = purple_buddy_icons_get_cache_dir();
-	path = g_build_filename(dirname, purple_imgstore_get_filename(img), NULL);
+static struct
+{
+	GThreadPool *pool;
+	GMutex *mutex;
+	GCond *idle;          /* Signalled when the thread runs out of work */
+	GQueue *pending;
+	GHashTable *by_path;  /* Path -> pending IconCacheOp */
+	GList *done;          /* Finished operations, oldest first */
+	gboolean busy;
+	guint timer;
+} icon_cache_io;
 
-	if (!g_file_test(dirname, G_FILE_TEST_IS_DIR))
-	{
-		purple_debug_info("buddyicon", "Creating icon cache directory.\n");
+/**
+ * The icon cache files known not to exist, so that looking for them again
+ * doesn't touch the disk.  Writing a file removes it from here.
+ */
+static GHashTable *missing_icon_files = NULL;
 
-		if (g_mkdir(dirname, S_IRUSR | S_IWUSR | S_IXUSR) < 0)
-		{
-			purple_debug_error("buddyicon",
-			                   "Unable to create directory %s: %s\n",
-			                   dirname, g_strerror(errno));
+static IconCacheOp *
+icon_cache_op_new(IconCacheOpType type, const char *filename,
+                  PurpleStoredImage *img)
+{
+	IconCacheOp *op = g_new0(IconCacheOp, 1);
+
+	op->type = type;
+	op->filename = g_strdup(filename);
+	op->path = g_build_filename(purple_buddy_icons_get_cache_dir(), filename, NULL);
+	if (img != NULL) {
+		op->img = purple_imgstore_ref(img);
+		op->data = purple_imgstore_get_data(img);
+		op->size = purple_imgstore_get_size(img);
+	}
+
+	return op;
+}
+
+static void
+icon_cache_op_free(IconCacheOp *op)
+{
+	purple_imgstore_unref(op->img);
+	if (op->error != NULL)
+		g_error_free(op->error);
+	g_free(op->filename);
+	g_free(op->path);
+	g_free(op);
+}
+
+static void
+icon_cache_op_set_error(IconCacheOp *op, const char *format)
+{
+	int err = errno;
+
+	g_set_error(&op->error, G_FILE_ERROR, g_file_error_from_errno(err),
+			format, op->path, g_strerror(err));
+}
+
+/*
+ * The functions below run on the I/O thread, and so must not use
+ * anything that isn't thread-safe (including purple_debug_*).
+ */
+
+static void
+icon_cache_op_check(IconCacheOp *op)
+{
+	struct stat st;
+
+	if (g_stat(op->path, &st) != 0)
+		op->missing = (errno == ENOENT);
+}
+
+static void
+icon_cache_op_write(IconCacheOp *op)
+{
+	char *temp = g_strdup_printf("%s.save", op->path);
+
+	op->file = g_fopen(temp, "wb");
+	if (op->file == NULL && errno == ENOENT) {
+		/* The cache directory doesn't exist yet. */
+		char *dirname = g_path_get_dirname(op->path);
+
+		if (purple_build_dir(dirname, S_IRUSR | S_IWUSR | S_IXUSR) == 0)
+			op->file = g_fopen(temp, "wb");
+		g_free(dirname);
+	}
+
+	if (op->file == NULL) {
+		icon_cache_op_set_error(op, "Error opening %s for writing: %s");
+	} else if (fwrite(op->data, 1, op->size, op->file) != op->size ||
+	           fflush(op->file) != 0) {
+		icon_cache_op_set_error(op, "Error writing %s: %s");
+		fclose(op->file);
+		op->file = NULL;
+		g_unlink(temp);
+	}
+
+	g_free(temp);
+}
+
+/* Syncs and closes the temporary file, and renames it into place. */
+static void
+icon_cache_op_commit(IconCacheOp *op)
+{
+	char *temp = g_strdup_printf("%s.save", op->path);
+
+#ifdef HAVE_FILENO
+#ifndef _WIN32
+	fchmod(fileno(op->file), S_IRUSR | S_IWUSR);
+#endif
+#ifdef HAVE_FDATASYNC
+	if (fdatasync(fileno(op->file)) < 0)
+#else
+	if (fsync(fileno(op->file)) < 0)
+#endif
+		icon_cache_op_set_error(op, "Error syncing %s: %s");
+#endif
+
+	if (fclose(op->file) != 0 && op->error == NULL)
+		icon_cache_op_set_error(op, "Error closing %s: %s");
+	op->file = NULL;
+
+	if (op->error == NULL && g_rename(temp, op->path) == -1)
+		icon_cache_op_set_error(op, "Error renaming to %s: %s");
+	if (op->error != NULL)
+		g_unlink(temp);
+
+	g_free(temp);
+}
+
+static void
+icon_cache_op_delete(IconCacheOp *op)
+{
+	if (g_unlink(op->path) != 0) {
+		if (errno == ENOENT)
+			op->missing = TRUE;
+		else
+			icon_cache_op_set_error(op, "Failed to delete %s: %s");
+	}
+}
+
+#ifndef _WIN32
+/* Syncs the directories that files were renamed into, once each. */
+static void
+icon_cache_io_sync_dirs(GList *batch)
+{
+	char *synced = NULL;
+	GList *l;
+
+	for (l = batch; l != NULL; l = l->next) {
+		IconCacheOp *op = l->data;
+		char *dirname;
+		int fd;
+
+		if (op->type != ICON_CACHE_WRITE || op->error != NULL)
+			continue;
+
+		dirname = g_path_get_dirname(op->path);
+		if (purple_strequal(dirname, synced)) {
+			g_free(dirname);
+			continue;
+		}
+
+		if ((fd = open(dirname, O_RDONLY)) >= 0) {
+			fsync(fd);
+			close(fd);
 		}
+		g_free(synced);
+		synced = dirname;
 	}
 
-	purple_util_write_data_to_file_absolute(path, purple_imgstore_get_data(img),
-											purple_imgstore_get_size(img));
-	g_free(path);
+	g_free(synced);
 }
+#endif
 
 static void
-purple_buddy_icon_data_uncache_file(const char *filename)
+icon_cache_io_run(GList *batch)
 {
-	const char *dirname;
-	char *path;
+	GList *l;
 
-	g_return_if_fail(filename != NULL);
+	for (l = batch; l != NULL; l = l->next) {
+		IconCacheOp *op = l->data;
 
-	/* It's possible that there are other references to this icon
-	 * cache file that are not currently loaded into memory. */
-	if (GPOINTER_TO_INT(g_hash_table_lookup(icon_file_cache, filename)))
-		return;
+		if (op->type == ICON_CACHE_WRITE)
+			icon_cache_op_write(op);
+		else if (op->type == ICON_CACHE_CHECK)
+			icon_cache_op_check(op);
+		else
+			icon_cache_op_delete(op);
+	}
 
-	dirname  = purple_buddy_icons_get_cache_dir();
-	path = g_build_filename(dirname, filename, NULL);
+	/* The files are only renamed into place once they're on disk, so a
+	 * crash can't leave an empty or partial icon behind.  Everything was
+	 * written first, so the kernel can already be writing the later files
+	 * while the earlier ones are synced. */
+	for (l = batch; l != NULL; l = l->next) {
+		IconCacheOp *op = l->data;
 
-	if (g_file_test(path, G_FILE_TEST_EXISTS))
+		if (op->file != NULL)
+			icon_cache_op_commit(op);
+	}
+
+#ifndef _WIN32
+	icon_cache_io_sync_dirs(batch);
+#endif
+}
+
+/* Called with the lock held. */
+static GList *
+icon_cache_io_take_batch(void)
+{
+	GList *batch = NULL;
+	IconCacheOp *op;
+	int i;
+
+	for (i = 0; i < ICON_CACHE_BATCH_SIZE; i++) {
+		if ((op = g_queue_pop_head(icon_cache_io.pending)) == NULL)
+			break;
+		g_hash_table_remove(icon_cache_io.by_path, op->path);
+		batch = g_list_prepend(batch, op);
+	}
+
+	return g_list_reverse(batch);
+}
+
+static void
+icon_cache_io_thread(gpointer data, gpointer user_data)
+{
+	GList *batch;
+
+	g_mutex_lock(icon_cache_io.mutex);
+	while ((batch = icon_cache_io_take_batch()) != NULL) {
+		g_mutex_unlock(icon_cache_io.mutex);
+
+		icon_cache_io_run(batch);
+
+		g_mutex_lock(icon_cache_io.mutex);
+		icon_cache_io.done = g_list_concat(icon_cache_io.done, batch);
+	}
+	icon_cache_io.busy = FALSE;
+	g_cond_broadcast(icon_cache_io.idle);
+	g_mutex_unlock(icon_cache_io.mutex);
+}
+
+/*
+ * Back on the main thread.
+ */
+
+static gboolean
+icon_is_missing(const char *filename)
+{
+	return (g_hash_table_lookup(missing_icon_files, filename) != NULL);
+}
+
+/* Forgets the icons on blist nodes whose cache files have gone missing. */
+static void
+remove_missing_icon_settings(void)
+{
+	PurpleBlistNode *node;
+
+	for (node = purple_blist_get_root(); node != NULL;
+	     node = purple_blist_node_next(node, TRUE))
 	{
-		if (g_unlink(path))
-		{
-			purple_debug_error("buddyicon", "Failed to delete %s: %s\n",
-			                   path, g_strerror(errno));
-		}
+		const char *setting;
+		const char *filename;
+
+		if (PURPLE_BLIST_NODE_IS_BUDDY(node))
+			setting = "buddy_icon";
+		else if (PURPLE_BLIST_NODE_IS_CONTACT(node) ||
+		         PURPLE_BLIST_NODE_IS_CHAT(node) ||
+		         PURPLE_BLIST_NODE_IS_GROUP(node))
+			setting = "custom_buddy_icon";
 		else
-		{
-			purple_debug_info("buddyicon", "Deleted cache file: %s\n", path);
+			continue;
+
+		filename = purple_blist_node_get_string(node, setting);
+		if (filename == NULL || !icon_is_missing(filename))
+			continue;
+
+		unref_filename(filename);
+		purple_blist_node_remove_setting(node, setting);
+		if (PURPLE_BLIST_NODE_IS_BUDDY(node))
+			purple_blist_node_remove_setting(node, "icon_checksum");
+	}
+}
+
+static void
+icon_cache_io_finish(GList *ops)
+{
+	gboolean found_missing = FALSE;
+	GList *l;
+
+	for (l = ops; l != NULL; l = l->next) {
+		IconCacheOp *op = l->data;
+
+		if (op->error != NULL) {
+			purple_debug_error("buddyicon", "%s\n", op->error->message);
+		} else if (op->type == ICON_CACHE_DELETE) {
+			if (!op->missing)
+				purple_debug_info("buddyicon", "Deleted cache file: %s\n", op->path);
+		} else if (op->type == ICON_CACHE_CHECK && op->missing &&
+		           g_hash_table_lookup(icon_data_cache, op->filename) == NULL) {
+			/* The image isn't in memory, so it isn't being written. */
+			g_hash_table_insert(missing_icon_files, g_strdup(op->filename),
+			                    GINT_TO_POINTER(TRUE));
+			found_missing = TRUE;
 		}
 	}
 
-	g_free(path);
+	if (found_missing)
+		remove_missing_icon_settings();
+
+	/* Releasing the images may queue more operations, so do it last. */
+	g_list_foreach(ops, (GFunc)icon_cache_op_free, NULL);
+	g_list_free(ops);
+}
+
+static gboolean
+icon_cache_io_timeout_cb(gpointer data)
+{
+	GList *done;
+	gboolean more;
+
+	g_mutex_lock(icon_cache_io.mutex);
+	if (!icon_cache_io.busy && !g_queue_is_empty(icon_cache_io.pending)) {
+		icon_cache_io.busy = TRUE;
+		g_thread_pool_push(icon_cache_io.pool, &icon_cache_io, NULL);
+	}
+	done = icon_cache_io.done;
+	icon_cache_io.done = NULL;
+	g_mutex_unlock(icon_cache_io.mutex);
+
+	icon_cache_io_finish(done);
+
+	g_mutex_lock(icon_cache_io.mutex);
+	more = icon_cache_io.busy || icon_cache_io.done != NULL ||
+	       !g_queue_is_empty(icon_cache_io.pending);
+	if (!more)
+		icon_cache_io.timer = 0;
+	g_mutex_unlock(icon_cache_io.mutex);
+
+	return more;
+}
+
+static gboolean
+icon_cache_io_start(void)
+{
+	GError *error = NULL;
+
+	if (icon_cache_io.pool != NULL)
+		return TRUE;
+
+	if (!g_thread_supported())
+		return FALSE;
+
+	icon_cache_io.pool = g_thread_pool_new(icon_cache_io_thread, NULL, 1,
+			FALSE, &error);
+	if (icon_cache_io.pool == NULL) {
+		purple_debug_error("buddyicon", "Unable to start the icon cache "
+				"thread: %s\n", error->message);
+		g_error_free(error);
+		return FALSE;
+	}
+
+	icon_cache_io.mutex = g_mutex_new();
+	icon_cache_io.idle = g_cond_new();
+	icon_cache_io.pending = g_queue_new();
+	icon_cache_io.by_path = g_hash_table_new(g_str_hash, g_str_equal);
+
+	return TRUE;
+}
+
+static void
+icon_cache_io_queue(IconCacheOpType type, const char *filename,
+                    PurpleStoredImage *img)
+{
+	IconCacheOp *op = icon_cache_op_new(type, filename, img);
+	IconCacheOp *old;
+
+	if (type == ICON_CACHE_WRITE)
+		g_hash_table_remove(missing_icon_files, filename);
+
+	if (!icon_cache_io_start()) {
+		GList *batch;
+
+		/* Without a thread, a missing file is found when it's loaded. */
+		if (type == ICON_CACHE_CHECK) {
+			icon_cache_op_free(op);
+			return;
+		}
+
+		/* Without threads, do it right away. */
+		batch = g_list_prepend(NULL, op);
+
+		icon_cache_io_run(batch);
+		icon_cache_io_finish(batch);
+		return;
+	}
+
+	g_mutex_lock(icon_cache_io.mutex);
+	old = g_hash_table_lookup(icon_cache_io.by_path, op->path);
+	if (old == NULL) {
+		g_queue_push_tail(icon_cache_io.pending, op);
+		g_hash_table_insert(icon_cache_io.by_path, op->path, op);
+		op = NULL;
+	} else if (type != ICON_CACHE_CHECK) {
+		/* Only the last write or delete of a file matters, so this
+		 * one takes the place of the old one in the queue. */
+		PurpleStoredImage *old_img = old->img;
+
+		old->type = op->type;
+		old->img = op->img;
+		old->data = op->data;
+		old->size = op->size;
+		op->img = old_img;
+	}
+	g_mutex_unlock(icon_cache_io.mutex);
+
+	/* Release the unneeded operation outside the lock, since releasing
+	 * its image can queue more. */
+	if (op != NULL)
+		icon_cache_op_free(op);
+
+	if (icon_cache_io.timer == 0) {
+		icon_cache_io.timer = purple_timeout_add(ICON_CACHE_POLL_INTERVAL,
+				icon_cache_io_timeout_cb, NULL);
+	}
+}
+
+/* Waits for everything queued to be done, then stops the thread. */
+static void
+icon_cache_io_stop(void)
+{
+	GList *done;
+	gboolean more;
+
+	if (icon_cache_io.pool == NULL)
+		return;
+
+	for (;;) {
+		g_mutex_lock(icon_cache_io.mutex);
+		while (icon_cache_io.busy)
+			g_cond_wait(icon_cache_io.idle, icon_cache_io.mutex);
+		done = icon_cache_io.done;
+		icon_cache_io.done = NULL;
+		more = !g_queue_is_empty(icon_cache_io.pending);
+		if (more) {
+			icon_cache_io.busy = TRUE;
+			g_thread_pool_push(icon_cache_io.pool, &icon_cache_io, NULL);
+		}
+		g_mutex_unlock(icon_cache_io.mutex);
+
+		if (done == NULL && !more)
+			break;
+
+		/* This can queue more, such as deleting an icon nobody uses. */
+		icon_cache_io_finish(done);
+	}
+
+	if (icon_cache_io.timer != 0)
+		purple_timeout_remove(icon_cache_io.timer);
+
+	g_thread_pool_free(icon_cache_io.pool, FALSE, TRUE);
+	g_mutex_free(icon_cache_io.mutex);
+	g_cond_free(icon_cache_io.idle);
+	g_queue_free(icon_cache_io.pending);
+	g_hash_table_destroy(icon_cache_io.by_path);
+	memset(&icon_cache_io, 0, sizeof(icon_cache_io));
+}
+
+static void
+purple_buddy_icon_data_cache(PurpleStoredImage *img)
+{
+	g_return_if_fail(img != NULL);
+
+	if (!purple_buddy_icons_is_caching())
+		return;
+
+	icon_cache_io_queue(ICON_CACHE_WRITE, purple_imgstore_get_filename(img), img);
+}
+
+static void
+purple_buddy_icon_data_uncache_file(const char *filename)
+{
+	g_return_if_fail(filename != NULL);
+
+	/* It's possible that there are other references to this icon
+	 * cache file that are not currently loaded into memory. */
+	if (GPOINTER_TO_INT(g_hash_table_lookup(icon_file_cache, filename)))
+		return;
+
+	icon_cache_io_queue(ICON_CACHE_DELETE, filename, NULL);
 }
 
 /*
@@ -283,6 +756,37 @@ purple_buddy_icon_data_new(guchar *icon_data, size_t icon_len, const char *filen
 	return img;
 }
 
+/*
+ * Loads an icon from the on-disk cache.  The cache file is mapped rather
+ * than read, and nothing is read at all if the icon is already in memory.
+ */
+static PurpleStoredImage *
+purple_buddy_icon_data_new_from_file(const char *filename)
+{
+	PurpleStoredImage *img;
+	char *path;
+
+	g_return_val_if_fail(filename != NULL, NULL);
+
+	if ((img = g_hash_table_lookup(icon_data_cache, filename)))
+		return purple_imgstore_ref(img);
+
+	if (icon_is_missing(filename))
+		return NULL;
+
+	path = g_build_filename(purple_buddy_icons_get_cache_dir(), filename, NULL);
+	img = purple_imgstore_new_from_mapped_file(path, filename);
+	g_free(path);
+
+	if (img != NULL)
+		g_hash_table_insert(icon_data_cache, g_strdup(filename), img);
+	else
+		g_hash_table_insert(missing_icon_files, g_strdup(filename),
+		                    GINT_TO_POINTER(TRUE));
+
+	return img;
+}
+
 /*
  * End functions for dealing with the in-memory icon cache
  */
@@ -458,31 +962,41 @@ purple_buddy_icon_update(PurpleBuddyIcon *icon)
 	purple_buddy_icon_unref(icon);
 }
 
+/* Takes ownership of the reference to img. */
+static void
+purple_buddy_icon_set_img(PurpleBuddyIcon *icon, PurpleStoredImage *img,
+                          const char *checksum)
+{
+	PurpleStoredImage *old_img;
+
+	old_img = icon->img;
+	icon->img = img;
+
+	g_free(icon->checksum);
+	icon->checksum = g_strdup(checksum);
+
+	purple_buddy_icon_update(icon);
+
+	purple_imgstore_unref(old_img);
+}
+
 void
 purple_buddy_icon_set_data(PurpleBuddyIcon *icon, guchar *data,
                            size_t len, const char *checksum)
 {
-	PurpleStoredImage *old_img;
+	PurpleStoredImage *img = NULL;
 
 	g_return_if_fail(icon != NULL);
 
-	old_img = icon->img;
-	icon->img = NULL;
-
 	if (data != NULL)
 	{
 		if (len > 0)
-			icon->img = purple_buddy_icon_data_new(data, len, NULL);
+			img = purple_buddy_icon_data_new(data, len, NULL);
 		else
 			g_free(data);
 	}
 
-	g_free(icon->checksum);
-	icon->checksum = g_strdup(checksum);
-
-	purple_buddy_icon_update(icon);
-
-	purple_imgstore_unref(old_img);
+	purple_buddy_icon_set_img(icon, img, checksum);
 }
 
 PurpleAccount *
@@ -534,6 +1048,17 @@ purple_buddy_icon_get_extension(const PurpleBuddyIcon *icon)
 	return NULL;
 }
 
+const char *
+purple_buddy_icon_get_filename(const PurpleBuddyIcon *icon)
+{
+	g_return_val_if_fail(icon != NULL, NULL);
+
+	if (icon->img != NULL)
+		return purple_imgstore_get_filename(icon->img);
+
+	return NULL;
+}
+
 void
 purple_buddy_icons_set_for_user(PurpleAccount *account, const char *username,
                                 void *icon_data, size_t icon_len,
@@ -643,10 +1168,8 @@ purple_buddy_icons_find(PurpleAccount *account, const char *username)
 	{
 		PurpleBuddy *b = purple_find_buddy(account, username);
 		const char *protocol_icon_file;
-		const char *dirname;
+		PurpleStoredImage *img;
 		gboolean caching;
-		guchar *data;
-		size_t len;
 
 		if (!b)
 			return NULL;
@@ -656,31 +1179,23 @@ purple_buddy_icons_find(PurpleAccount *account, const char *username)
 		if (protocol_icon_file == NULL)
 			return NULL;
 
-		dirname = purple_buddy_icons_get_cache_dir();
-
 		caching = purple_buddy_icons_is_caching();
 		/* By disabling caching temporarily, we avoid a loop
 		 * and don't have to add special code through several
 		 * functions. */
 		purple_buddy_icons_set_caching(FALSE);
 
-		if (protocol_icon_file != NULL)
+		if ((img = purple_buddy_icon_data_new_from_file(protocol_icon_file)))
 		{
-			char *path = g_build_filename(dirname, protocol_icon_file, NULL);
-			if (read_icon_file(path, &data, &len))
-			{
-				const char *checksum;
+			const char *checksum;
 
-				icon = purple_buddy_icon_create(account, username);
-				icon->img = NULL;
-				checksum = purple_blist_node_get_string((PurpleBlistNode*)b, "icon_checksum");
-				purple_buddy_icon_set_data(icon, data, len, checksum);
-			}
-			else
-				delete_buddy_icon_settings((PurpleBlistNode*)b, "buddy_icon");
-
-			g_free(path);
+			icon = purple_buddy_icon_create(account, username);
+			icon->img = NULL;
+			checksum = purple_blist_node_get_string((PurpleBlistNode*)b, "icon_checksum");
+			purple_buddy_icon_set_img(icon, img, checksum);
 		}
+		else
+			delete_buddy_icon_settings((PurpleBlistNode*)b, "buddy_icon");
 
 		purple_buddy_icons_set_caching(caching);
 	}
@@ -693,10 +1208,6 @@ purple_buddy_icons_find_account_icon(PurpleAccount *account)
 {
 	PurpleStoredImage *img;
 	const char *account_icon_file;
-	const char *dirname;
-	char *path;
-	guchar *data;
-	size_t len;
 
 	g_return_val_if_fail(account != NULL, NULL);
 
@@ -710,16 +1221,11 @@ purple_buddy_icons_find_account_icon(PurpleAccount *account)
 	if (account_icon_file == NULL)
 		return NULL;
 
-	dirname = purple_buddy_icons_get_cache_dir();
-	path = g_build_filename(dirname, account_icon_file, NULL);
-
-	if (read_icon_file(path, &data, &len))
+	if ((img = purple_buddy_icon_data_new_from_file(account_icon_file)))
 	{
-		g_free(path);
-		img = purple_buddy_icons_set_account_icon(account, data, len);
+		img = purple_buddy_icons_set_account_img(account, img);
 		return purple_imgstore_ref(img);
 	}
-	g_free(path);
 
 	return NULL;
 }
@@ -728,15 +1234,24 @@ PurpleStoredImage *
 purple_buddy_icons_set_account_icon(PurpleAccount *account,
                                     guchar *icon_data, size_t icon_len)
 {
-	PurpleStoredImage *old_img;
 	PurpleStoredImage *img = NULL;
-	char *old_icon;
 
 	if (icon_data != NULL && icon_len > 0)
 	{
 		img = purple_buddy_icon_data_new(icon_data, icon_len, NULL);
 	}
 
+	return purple_buddy_icons_set_account_img(account, img);
+}
+
+/* Takes ownership of the reference to img. */
+static PurpleStoredImage *
+purple_buddy_icons_set_account_img(PurpleAccount *account,
+                                   PurpleStoredImage *img)
+{
+	PurpleStoredImage *old_img;
+	char *old_icon;
+
 	old_icon = g_strdup(purple_account_get_string(account, "buddy_icon", NULL));
 	if (img && purple_buddy_icons_is_caching())
 	{
@@ -815,11 +1330,8 @@ purple_buddy_icons_node_has_custom_icon(PurpleBlistNode *node)
 PurpleStoredImage *
 purple_buddy_icons_node_find_custom_icon(PurpleBlistNode *node)
 {
-	char *path;
-	size_t len;
-	guchar *data;
 	PurpleStoredImage *img;
-	const char *custom_icon_file, *dirname;
+	const char *custom_icon_file;
 
 	g_return_val_if_fail(node != NULL, NULL);
 
@@ -834,16 +1346,11 @@ purple_buddy_icons_node_find_custom_icon(PurpleBlistNode *node)
 	if (custom_icon_file == NULL)
 		return NULL;
 
-	dirname = purple_buddy_icons_get_cache_dir();
-	path = g_build_filename(dirname, custom_icon_file, NULL);
-
-	if (read_icon_file(path, &data, &len))
+	if ((img = purple_buddy_icon_data_new_from_file(custom_icon_file)))
 	{
-		g_free(path);
-		img = purple_buddy_icons_node_set_custom_icon(node, data, len);
+		img = purple_buddy_icons_node_set_custom_img(node, img);
 		return purple_imgstore_ref(img);
 	}
-	g_free(path);
 
 	return NULL;
 }
@@ -852,8 +1359,6 @@ PurpleStoredImage *
 purple_buddy_icons_node_set_custom_icon(PurpleBlistNode *node,
                                         guchar *icon_data, size_t icon_len)
 {
-	char *old_icon;
-	PurpleStoredImage *old_img;
 	PurpleStoredImage *img = NULL;
 
 	g_return_val_if_fail(node != NULL, NULL);
@@ -864,12 +1369,23 @@ purple_buddy_icons_node_set_custom_icon(PurpleBlistNode *node,
 		return NULL;
 	}
 
-	old_img = g_hash_table_lookup(pointer_icon_cache, node);
-
 	if (icon_data != NULL && icon_len > 0) {
 		img = purple_buddy_icon_data_new(icon_data, icon_len, NULL);
 	}
 
+	return purple_buddy_icons_node_set_custom_img(node, img);
+}
+
+/* Takes ownership of the reference to img. */
+static PurpleStoredImage *
+purple_buddy_icons_node_set_custom_img(PurpleBlistNode *node,
+                                       PurpleStoredImage *img)
+{
+	char *old_icon;
+	PurpleStoredImage *old_img;
+
+	old_img = g_hash_table_lookup(pointer_icon_cache, node);
+
 	old_icon = g_strdup(purple_blist_node_get_string(node,
 	                                                 "custom_buddy_icon"));
 	if (img && purple_buddy_icons_is_caching()) {
@@ -977,6 +1493,13 @@ purple_buddy_icons_set_custom_icon(PurpleContact *contact, guchar *icon_data,
 	return purple_buddy_icons_node_set_custom_icon((PurpleBlistNode*)contact, icon_data, icon_len);
 }
 
+void
+_purple_buddy_icons_sync_cache(void)
+{
+	/* The thread is started again by the next operation queued. */
+	icon_cache_io_stop();
+}
+
 void
 _purple_buddy_icon_set_old_icons_dir(const char *dirname)
 {
@@ -1186,17 +1709,10 @@ _purple_buddy_icons_blist_loaded_cb()
 				}
 				else
 				{
-					char *path = g_build_filename(dirname, filename, NULL);
-					if (!g_file_test(path, G_FILE_TEST_EXISTS))
-					{
-						purple_blist_node_remove_setting(node,
-						                                 "buddy_icon");
-						purple_blist_node_remove_setting(node,
-						                                 "icon_checksum");
-					}
-					else
-						ref_filename(filename);
-					g_free(path);
+					/* Missing files are noticed and forgotten later,
+					 * by the icon cache thread. */
+					ref_filename(filename);
+					icon_cache_io_queue(ICON_CACHE_CHECK, filename, NULL);
 				}
 			}
 		}
@@ -1217,15 +1733,8 @@ _purple_buddy_icons_blist_loaded_cb()
 				}
 				else
 				{
-					char *path = g_build_filename(dirname, filename, NULL);
-					if (!g_file_test(path, G_FILE_TEST_EXISTS))
-					{
-						purple_blist_node_remove_setting(node,
-						                                 "custom_buddy_icon");
-					}
-					else
-						ref_filename(filename);
-					g_free(path);
+					ref_filename(filename);
+					icon_cache_io_queue(ICON_CACHE_CHECK, filename, NULL);
 				}
 			}
 		}
@@ -1252,6 +1761,9 @@ purple_buddy_icons_set_cache_dir(const char *dir)
 
 	g_free(cache_dir);
 	cache_dir = g_strdup(dir);
+
+	if (missing_icon_files != NULL)
+		g_hash_table_remove_all(missing_icon_files);
 }
 
 const char *
@@ -1280,6 +1792,8 @@ purple_buddy_icons_init()
 	icon_file_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
 	                                        g_free, NULL);
 	pointer_icon_cache = g_hash_table_new(g_direct_hash, g_direct_equal);
+	missing_icon_files = g_hash_table_new_full(g_str_hash, g_str_equal,
+	                                           g_free, NULL);
 
     if (!cache_dir)
     	cache_dir = g_build_filename(purple_user_dir(), "icons", NULL);
@@ -1292,12 +1806,16 @@ purple_buddy_icons_init()
 void
 purple_buddy_icons_uninit()
 {
+	icon_cache_io_stop();
+
 	purple_signals_disconnect_by_handle(purple_buddy_icons_get_handle());
 
 	g_hash_table_destroy(account_cache);
 	g_hash_table_destroy(icon_data_cache);
 	g_hash_table_destroy(icon_file_cache);
 	g_hash_table_destroy(pointer_icon_cache);
+	g_hash_table_destroy(missing_icon_files);
+	missing_icon_files = NULL;
 	g_free(old_icons_dir);
 	g_free(cache_dir);
 
@@ -157,6 +157,20 @@ gconstpointer purple_buddy_icon_get_data(const PurpleBuddyIcon *icon, size_t *le
  */
 const char *purple_buddy_icon_get_extension(const PurpleBuddyIcon *icon);
 
+/**
+ * Returns the name of the buddy icon's file in the icon cache.  The name
+ * is made from a hash of the image data, so it identifies the image
+ * without having to hash it again.
+ *
+ * @param icon The buddy icon.
+ *
+ * @return The icon's file name, or @c NULL if the image data has
+ *         disappeared.
+ *
+ * @since 2.10.11
+ */
+const char *purple_buddy_icon_get_filename(const PurpleBuddyIcon *icon);
+
 /**
  * Returns a full path to an icon.
  *
@@ -41,6 +41,14 @@ static GList *cert_verifiers = NULL;
 /** List of registered Pools */
 static GList *cert_pools = NULL;
 
+/** Chain verification results, keyed by the chain's joined SHA1
+    fingerprints. Values are verify_cache_entry. */
+static GHashTable *verify_cache = NULL;
+/** Counters reported by purple_certificate_cache_get_stats() */
+static PurpleCertificateCacheStats cache_stats;
+
+static PurpleCertificatePool x509_tls_peers;
+
 
 static const gchar *
 invalidity_reason_to_string(PurpleCertificateInvalidityFlags flag)
@@ -551,6 +559,10 @@ purple_certificate_pool_store(PurpleCertificatePool *pool, const gchar *id, Purp
 
 	/* Signal that the certificate was stored if success*/
 	if (ret) {
+		/* The peers cache only ever holds leaf certificates, which
+		   never act as trust anchors, so it can't change a result. */
+		if (pool != &x509_tls_peers)
+			purple_certificate_cache_invalidate();
 		purple_signal_emit(pool, "certificate-stored",
 				   pool, id);
 	}
@@ -571,6 +583,8 @@ purple_certificate_pool_delete(PurpleCertificatePool *pool, const gchar *id)
 
 	/* Signal that the certificate was deleted if success */
 	if (ret) {
+		if (pool != &x509_tls_peers)
+			purple_certificate_cache_invalidate();
 		purple_signal_emit(pool, "certificate-deleted",
 				   pool, id);
 	}
@@ -601,6 +615,146 @@ purple_certificate_pool_destroy_idlist(GList *idlist)
 }
 
 
+/****************************************************************************/
+/* Verification cache                                                       */
+/****************************************************************************/
+
+typedef struct {
+	PurpleCertificateInvalidityFlags flags;
+	time_t not_before;
+	time_t not_after;
+} verify_cache_entry;
+
+/* Builds the lookup key for a chain: the hex SHA1 fingerprint of every
+   certificate in it, in order. Two chains only share a key if they consist
+   of exactly the same certificates. */
+static gchar *
+verify_cache_make_key(GList *chain)
+{
+	GString *key;
+	GList *l;
+
+	key = g_string_new(NULL);
+	for (l = chain; l; l = l->next) {
+		GByteArray *fpr;
+		gchar *hex;
+
+		fpr = purple_certificate_get_fingerprint_sha1(l->data);
+		if (fpr == NULL) {
+			g_string_free(key, TRUE);
+			return NULL;
+		}
+
+		hex = purple_base16_encode(fpr->data, fpr->len);
+		if (key->len)
+			g_string_append_c(key, ':');
+		g_string_append(key, hex);
+
+		g_free(hex);
+		g_byte_array_free(fpr, TRUE);
+	}
+
+	return g_string_free(key, FALSE);
+}
+
+gboolean
+purple_certificate_cache_lookup(GList *chain,
+                                PurpleCertificateInvalidityFlags *flags)
+{
+	verify_cache_entry *entry = NULL;
+	gchar *key = NULL;
+	time_t now;
+
+	g_return_val_if_fail(chain, FALSE);
+	g_return_val_if_fail(flags, FALSE);
+
+	if (verify_cache != NULL && (key = verify_cache_make_key(chain)) != NULL)
+		entry = g_hash_table_lookup(verify_cache, key);
+
+	/* The chain check looks at the issuers' validity periods, so a result
+	   is only good while every certificate in the chain still is. */
+	now = time(NULL);
+	if (entry && (now < entry->not_before || now > entry->not_after)) {
+		g_hash_table_remove(verify_cache, key);
+		cache_stats.entries = g_hash_table_size(verify_cache);
+		entry = NULL;
+	}
+
+	g_free(key);
+
+	if (entry == NULL) {
+		cache_stats.verify_misses++;
+		return FALSE;
+	}
+
+	cache_stats.verify_hits++;
+	*flags = entry->flags;
+	return TRUE;
+}
+
+void
+purple_certificate_cache_store(GList *chain,
+                               PurpleCertificateInvalidityFlags flags)
+{
+	verify_cache_entry *entry;
+	time_t activation, expiration;
+	gchar *key;
+	GList *l;
+
+	g_return_if_fail(chain);
+
+	entry = g_new(verify_cache_entry, 1);
+	entry->flags = flags;
+	entry->not_before = 0;
+	entry->not_after = G_MAXLONG;
+
+	for (l = chain; l; l = l->next) {
+		if (!purple_certificate_get_times(l->data, &activation, &expiration)) {
+			g_free(entry);
+			return;
+		}
+		entry->not_before = MAX(entry->not_before, activation);
+		entry->not_after = MIN(entry->not_after, expiration);
+	}
+
+	key = verify_cache_make_key(chain);
+	if (key == NULL) {
+		g_free(entry);
+		return;
+	}
+
+	if (verify_cache == NULL)
+		verify_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+		                                     g_free, g_free);
+
+	g_hash_table_replace(verify_cache, key, entry);
+	cache_stats.entries = g_hash_table_size(verify_cache);
+}
+
+void
+purple_certificate_cache_invalidate(void)
+{
+	if (verify_cache == NULL || g_hash_table_size(verify_cache) == 0)
+		return;
+
+	purple_debug_info("certificate",
+	                  "Dropping %u cached chain verification results\n",
+	                  g_hash_table_size(verify_cache));
+
+	g_hash_table_remove_all(verify_cache);
+	cache_stats.entries = 0;
+	cache_stats.invalidations++;
+}
+
+void
+purple_certificate_cache_get_stats(PurpleCertificateCacheStats *stats)
+{
+	g_return_if_fail(stats);
+
+	*stats = cache_stats;
+}
+
+
 /****************************************************************************/
 /* Builtin Verifiers, Pools, etc.                                           */
 /****************************************************************************/
@@ -1072,6 +1226,11 @@ static PurpleCertificatePool x509_ca = {
 /***** Cache of certificates given by TLS/SSL peers *****/
 static PurpleCertificatePool x509_tls_peers;
 
+/** Parsed copies of the certificates on disk, keyed by id, so a reconnect
+    doesn't have to re-import the PEM file. Entries are kept in step with
+    put_cert and delete_cert. */
+static GHashTable *x509_tls_peers_crts = NULL;
+
 static gboolean
 x509_tls_peers_init(void)
 {
@@ -1089,9 +1248,21 @@ x509_tls_peers_init(void)
 
 	g_free(poolpath);
 
+	x509_tls_peers_crts = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, (GDestroyNotify)purple_certificate_destroy);
+
 	return TRUE;
 }
 
+static void
+x509_tls_peers_uninit(void)
+{
+	if (x509_tls_peers_crts) {
+		g_hash_table_destroy(x509_tls_peers_crts);
+		x509_tls_peers_crts = NULL;
+	}
+}
+
 static gboolean
 x509_tls_peers_cert_in_pool(const gchar *id)
 {
@@ -1100,6 +1271,9 @@ x509_tls_peers_cert_in_pool(const gchar *id)
 
 	g_return_val_if_fail(id, FALSE);
 
+	if (x509_tls_peers_crts && g_hash_table_lookup(x509_tls_peers_crts, id))
+		return TRUE;
+
 	keypath = purple_certificate_pool_mkpath(&x509_tls_peers, id);
 
 	ret = g_file_test(keypath, G_FILE_TEST_IS_REGULAR);
@@ -1117,6 +1291,13 @@ x509_tls_peers_get_cert(const gchar *id)
 
 	g_return_val_if_fail(id, NULL);
 
+	/* Already parsed? */
+	if (x509_tls_peers_crts &&
+	    (crt = g_hash_table_lookup(x509_tls_peers_crts, id)) != NULL) {
+		cache_stats.parse_hits++;
+		return purple_certificate_copy(crt);
+	}
+
 	/* Is it in the pool? */
 	if ( !x509_tls_peers_cert_in_pool(id) ) {
 		return NULL;
@@ -1129,9 +1310,14 @@ x509_tls_peers_get_cert(const gchar *id)
 	/* Okay, now find and load that key */
 	keypath = purple_certificate_pool_mkpath(&x509_tls_peers, id);
 	crt = purple_certificate_import(x509, keypath);
+	cache_stats.parse_misses++;
 
 	g_free(keypath);
 
+	if (crt && x509_tls_peers_crts)
+		g_hash_table_replace(x509_tls_peers_crts, g_strdup(id),
+		                     purple_certificate_copy(crt));
+
 	return crt;
 }
 
@@ -1155,6 +1341,14 @@ x509_tls_peers_put_cert(const gchar *id, PurpleCertificate *crt)
 		ret = (crt->scheme->register_trusted_tls_cert)(crt, FALSE);
 	}
 
+	if (x509_tls_peers_crts) {
+		if (ret)
+			g_hash_table_replace(x509_tls_peers_crts, g_strdup(id),
+			                     purple_certificate_copy(crt));
+		else
+			g_hash_table_remove(x509_tls_peers_crts, id);
+	}
+
 	g_free(keypath);
 	return ret;
 }
@@ -1175,6 +1369,9 @@ x509_tls_peers_delete_cert(const gchar *id)
 		return FALSE;
 	}
 
+	if (x509_tls_peers_crts)
+		g_hash_table_remove(x509_tls_peers_crts, id);
+
 	/* OK, so work out the keypath and delete the thing */
 	keypath = purple_certificate_pool_mkpath(&x509_tls_peers, id);
 	if ( unlink(keypath) != 0 ) {
@@ -1229,7 +1426,7 @@ static PurpleCertificatePool x509_tls_peers = {
 	N_("SSL Peers Cache"),        /* User-friendly name */
 	NULL,                         /* Internal data */
 	x509_tls_peers_init,          /* init */
-	NULL,                         /* uninit not required */
+	x509_tls_peers_uninit,        /* uninit */
 	x509_tls_peers_cert_in_pool,  /* Certificate exists? */
 	x509_tls_peers_get_cert,      /* Cert retriever */
 	x509_tls_peers_put_cert,      /* Cert writer */
@@ -1556,18 +1753,22 @@ x509_tls_cached_check_subject_name(PurpleCertificateVerificationRequest *vrq,
 	x509_tls_cached_complete(vrq, flags);
 }
 
-/* For when we've never communicated with this party before */
 /* TODO: Need ways to specify possibly multiple problems with a cert, or at
    least  reprioritize them.
  */
-static void
-x509_tls_cached_unknown_peer(PurpleCertificateVerificationRequest *vrq,
-                             PurpleCertificateInvalidityFlags flags)
+/*
+ * Checks the signature chain of vrq against the CA pool. Only the flags
+ * that depend on the chain itself are returned, so the result can be
+ * cached independently of the current time and the requested subject name.
+ */
+static PurpleCertificateInvalidityFlags
+x509_tls_cached_check_chain(PurpleCertificateVerificationRequest *vrq)
 {
 	PurpleCertificatePool *ca;
 	PurpleCertificate *peer_crt;
 	PurpleCertificate *ca_crt, *end_crt;
 	PurpleCertificate *failing_crt;
+	PurpleCertificateInvalidityFlags flags = PURPLE_CERTIFICATE_NO_PROBLEMS;
 	GList *chain = vrq->cert_chain;
 	GSList *ca_crts, *cur;
 	GByteArray *last_fpr, *ca_fpr;
@@ -1576,14 +1777,6 @@ x509_tls_cached_unknown_peer(PurpleCertificateVerificationRequest *vrq,
 
 	peer_crt = (PurpleCertificate *) chain->data;
 
-	if (peer_crt->scheme->verify_cert) {
-		/** Make sure we've loaded the CA certs (which causes NSS to trust them) */
-		g_return_if_fail(x509_ca_lazy_init());
-		peer_crt->scheme->verify_cert(vrq, &flags);
-		x509_tls_cached_complete(vrq, flags);
-		return;
-	}
-
 	/* TODO: Figure out a way to check for a bad signature, as opposed to
 	   "not self-signed" */
 	if ( purple_certificate_signed_by(peer_crt, peer_crt) ) {
@@ -1593,8 +1786,7 @@ x509_tls_cached_unknown_peer(PurpleCertificateVerificationRequest *vrq,
 				  "Certificate for %s is self-signed.\n",
 				  vrq->subject_name);
 
-		x509_tls_cached_check_subject_name(vrq, flags);
-		return;
+		return flags;
 	} /* if (self signed) */
 
 	ca = purple_certificate_find_pool(x509_tls_cached.scheme_name, "ca");
@@ -1642,8 +1834,7 @@ x509_tls_cached_unknown_peer(PurpleCertificateVerificationRequest *vrq,
 			/* TODO: Tell the user where the chain broke? */
 			flags |= PURPLE_CERTIFICATE_INVALID_CHAIN;
 
-		x509_tls_cached_check_subject_name(vrq, flags);
-		return;
+		return flags;
 	} /* if (signature chain not good) */
 
 	/* Next, attempt to verify the last certificate is signed by a trusted
@@ -1658,8 +1849,7 @@ x509_tls_cached_unknown_peer(PurpleCertificateVerificationRequest *vrq,
 
 		flags |= PURPLE_CERTIFICATE_NO_CA_POOL;
 
-		x509_tls_cached_check_subject_name(vrq, flags);
-		return;
+		return flags;
 	}
 
 	end_crt = g_list_last(chain)->data;
@@ -1685,8 +1875,7 @@ x509_tls_cached_unknown_peer(PurpleCertificateVerificationRequest *vrq,
 				  "No Certificate Authorities with either DN found "
 				  "found. I'll prompt the user, I guess.\n");
 
-		x509_tls_cached_check_subject_name(vrq, flags);
-		return;
+		return flags;
 	}
 
 	/*
@@ -1727,7 +1916,38 @@ x509_tls_cached_unknown_peer(PurpleCertificateVerificationRequest *vrq,
 	g_slist_free(ca_crts);
 	g_byte_array_free(last_fpr, TRUE);
 
-	x509_tls_cached_check_subject_name(vrq, flags);
+	return flags;
+}
+
+/* For when we've never communicated with this party before */
+static void
+x509_tls_cached_unknown_peer(PurpleCertificateVerificationRequest *vrq,
+                             PurpleCertificateInvalidityFlags flags)
+{
+	PurpleCertificate *peer_crt;
+	PurpleCertificateInvalidityFlags chain_flags;
+	GList *chain = vrq->cert_chain;
+
+	peer_crt = (PurpleCertificate *) chain->data;
+
+	if (peer_crt->scheme->verify_cert) {
+		/** Make sure we've loaded the CA certs (which causes NSS to trust them) */
+		g_return_if_fail(x509_ca_lazy_init());
+		peer_crt->scheme->verify_cert(vrq, &flags);
+		x509_tls_cached_complete(vrq, flags);
+		return;
+	}
+
+	if (purple_certificate_cache_lookup(chain, &chain_flags)) {
+		purple_debug_info("certificate/x509/tls_cached",
+				  "Using cached chain verification for %s\n",
+				  vrq->subject_name);
+	} else {
+		chain_flags = x509_tls_cached_check_chain(vrq);
+		purple_certificate_cache_store(chain, chain_flags);
+	}
+
+	x509_tls_cached_check_subject_name(vrq, flags | chain_flags);
 }
 
 static void
@@ -1837,6 +2057,11 @@ purple_certificate_uninit(void)
 
 	/* Unregister all Pools */
 	g_list_foreach(cert_pools, (GFunc)purple_certificate_unregister_pool, NULL);
+
+	if (verify_cache) {
+		g_hash_table_destroy(verify_cache);
+		verify_cache = NULL;
+	}
 }
 
 gpointer
@@ -1917,6 +2142,11 @@ purple_certificate_unregister_scheme(PurpleCertificateScheme *scheme)
 	/* Neither of the above should be necessary, though */
 	cert_schemes = g_list_remove(cert_schemes, scheme);
 
+	/* Cached certificates belong to the scheme that parsed them */
+	if (x509_tls_peers_crts)
+		g_hash_table_remove_all(x509_tls_peers_crts);
+	purple_certificate_cache_invalidate();
+
 	purple_debug_info("certificate",
 			  "CertificateScheme %s unregistered\n",
 			  scheme->name);
@@ -2063,6 +2293,7 @@ purple_certificate_register_pool(PurpleCertificatePool *pool)
 
 	/* Register the Pool */
 	cert_pools = g_list_prepend(cert_pools, pool);
+	purple_certificate_cache_invalidate();
 
 	/* TODO: Emit a signal that the pool got registered */
 
@@ -2116,6 +2347,7 @@ purple_certificate_unregister_pool(PurpleCertificatePool *pool)
 	}
 
 	cert_pools = g_list_remove(cert_pools, pool);
+	purple_certificate_cache_invalidate();
 
 	/* TODO: Signalling? */
 	purple_signal_unregister(pool, "certificate-stored");
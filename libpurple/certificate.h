@@ -743,6 +743,78 @@ purple_certificate_pool_destroy_idlist(GList *idlist);
 
 /*@}*/
 
+/*****************************************************************************/
+/** @name Verification Cache                                                 */
+/*****************************************************************************/
+/*@{*/
+
+/**
+ * Counters describing the process-wide certificate cache.
+ *
+ * @since 2.10.11
+ */
+typedef struct
+{
+	guint parse_hits;     /**< Peer certificates served already parsed */
+	guint parse_misses;   /**< Peer certificates imported from disk */
+	guint verify_hits;    /**< Chain checks answered from the cache */
+	guint verify_misses;  /**< Chain checks that had to be computed */
+	guint invalidations;  /**< Times the chain results were discarded */
+	guint entries;        /**< Chain results currently cached */
+} PurpleCertificateCacheStats;
+
+/**
+ * Looks up a previously computed verification result for a chain.
+ *
+ * Results are keyed by the SHA1 fingerprints of every certificate in the
+ * chain, and are only returned while all of them are within their validity
+ * period. They are discarded whenever a trust pool changes.
+ *
+ * @param chain  Certificate chain, peer certificate first
+ * @param flags  Location to store the cached flags in
+ * @return TRUE if a result was found, otherwise FALSE
+ *
+ * @since 2.10.11
+ */
+gboolean
+purple_certificate_cache_lookup(GList *chain,
+                                PurpleCertificateInvalidityFlags *flags);
+
+/**
+ * Remembers the result of verifying a chain, for any Verifier to reuse.
+ *
+ * Only store flags that depend on the chain itself, not on the subject
+ * name being checked.
+ *
+ * @param chain  Certificate chain, peer certificate first
+ * @param flags  Flags computed for the chain
+ *
+ * @since 2.10.11
+ */
+void
+purple_certificate_cache_store(GList *chain,
+                               PurpleCertificateInvalidityFlags flags);
+
+/**
+ * Discards all cached verification results.
+ *
+ * @since 2.10.11
+ */
+void
+purple_certificate_cache_invalidate(void);
+
+/**
+ * Gets the certificate cache counters.
+ *
+ * @param stats  Structure to fill in
+ *
+ * @since 2.10.11
+ */
+void
+purple_certificate_cache_get_stats(PurpleCertificateCacheStats *stats);
+
+/*@}*/
+
 /*****************************************************************************/
 /** @name Certificate Subsystem API                                          */
 /*****************************************************************************/
@@ -35,6 +35,7 @@
 #include "ft.h"
 #include "idle.h"
 #include "imgstore.h"
+#include "metrics.h"
 #include "network.h"
 #include "notify.h"
 #include "plugin.h"
@@ -73,6 +74,17 @@ struct PurpleCore
 static PurpleCoreUiOps *_ops  = NULL;
 static PurpleCore      *_core = NULL;
 
+typedef struct
+{
+	char *name;
+	double seconds;
+
+} PurpleStartupStage;
+
+static GTimer *startup_timer = NULL;
+static double startup_last = 0;
+static GList *startup_stages = NULL;
+
 STATIC_PROTO_INIT
 
 gboolean
@@ -96,6 +108,9 @@ purple_core_init(const char *ui)
 	g_type_init();
 #endif
 
+	if (startup_timer == NULL)
+		startup_timer = g_timer_new();
+
 	_core = core = g_new0(PurpleCore, 1);
 	core->ui = g_strdup(ui);
 	core->reserved = NULL;
@@ -115,12 +130,15 @@ purple_core_init(const char *ui)
 		purple_value_new(PURPLE_TYPE_BOXED, "GHashTable *")); /* Parameters */
 
 	purple_signal_register(core, "quitting", purple_marshal_VOID, NULL, 0);
+	purple_core_startup_stage("signals");
 
 	/* The prefs subsystem needs to be initialized before static protocols
 	 * for protocol prefs to work. */
 	purple_prefs_init();
+	purple_core_startup_stage("prefs");
 
 	purple_debug_init();
+	purple_metrics_init();
 
 	if (ops != NULL)
 	{
@@ -130,9 +148,11 @@ purple_core_init(const char *ui)
 		if (ops->debug_ui_init != NULL)
 			ops->debug_ui_init();
 	}
+	purple_core_startup_stage("debug");
 
 #ifdef HAVE_DBUS
 	purple_dbus_init();
+	purple_core_startup_stage("dbus");
 #endif
 
 	purple_ciphers_init();
@@ -145,10 +165,13 @@ purple_core_init(const char *ui)
 
 	/* Initialize all static protocols. */
 	static_proto_init();
+	purple_core_startup_stage("static protocols");
 
 	purple_plugins_probe(G_MODULE_SUFFIX);
+	purple_core_startup_stage("plugin probe");
 
 	purple_theme_manager_init();
+	purple_core_startup_stage("themes");
 
 	/* The buddy icon code uses the imgstore, so init it early. */
 	purple_imgstore_init();
@@ -161,9 +184,12 @@ purple_core_init(const char *ui)
 	purple_connections_init();
 
 	purple_accounts_init();
+	purple_core_startup_stage("accounts");
 	purple_savedstatuses_init();
+	purple_core_startup_stage("saved statuses");
 	purple_notify_init();
 	purple_certificate_init();
+	purple_core_startup_stage("certificates");
 	purple_conversations_init();
 	purple_blist_init();
 	purple_log_init();
@@ -177,7 +203,9 @@ purple_core_init(const char *ui)
 	purple_stun_init();
 	purple_xfers_init();
 	purple_idle_init();
+	purple_core_startup_stage("other subsystems");
 	purple_smileys_init();
+	purple_core_startup_stage("smileys");
 	/*
 	 * Call this early on to try to auto-detect our IP address and
 	 * hopefully save some time later.
@@ -186,9 +214,11 @@ purple_core_init(const char *ui)
 
 	if (ops != NULL && ops->ui_init != NULL)
 		ops->ui_init();
+	purple_core_startup_stage("ui");
 
 	/* The UI may have registered some theme types, so refresh them */
 	purple_theme_manager_refresh();
+	purple_core_startup_stage("theme refresh");
 
 	return TRUE;
 }
@@ -206,6 +236,7 @@ purple_core_quit(void)
 
 	/* Transmission ends */
 	purple_connections_disconnect_all();
+	_purple_util_fetch_url_close_idle();
 
 	/*
 	 * Certificates must be destroyed before the SSL plugins, because
@@ -253,6 +284,8 @@ purple_core_quit(void)
 	if (ops != NULL && ops->quit != NULL)
 		ops->quit();
 
+	purple_metrics_uninit();
+
 	/* Everything after prefs_uninit must not try to read any prefs */
 	purple_prefs_uninit();
 	purple_plugins_uninit();
@@ -270,6 +303,18 @@ purple_core_quit(void)
 	g_free(core->ui);
 	g_free(core);
 
+	while (startup_stages != NULL) {
+		PurpleStartupStage *stage = startup_stages->data;
+		g_free(stage->name);
+		g_free(stage);
+		startup_stages = g_list_delete_link(startup_stages, startup_stages);
+	}
+	if (startup_timer != NULL) {
+		g_timer_destroy(startup_timer);
+		startup_timer = NULL;
+		startup_last = 0;
+	}
+
 #ifdef _WIN32
 	wpurple_cleanup();
 #endif
@@ -301,6 +346,46 @@ purple_core_get_ui(void)
 	return core->ui;
 }
 
+void
+purple_core_startup_stage(const char *name)
+{
+	PurpleStartupStage *stage;
+	double now;
+
+	g_return_if_fail(name != NULL);
+
+	if (startup_timer == NULL)
+		startup_timer = g_timer_new();
+
+	now = g_timer_elapsed(startup_timer, NULL);
+
+	stage = g_new0(PurpleStartupStage, 1);
+	stage->name = g_strdup(name);
+	stage->seconds = now - startup_last;
+	startup_stages = g_list_append(startup_stages, stage);
+
+	startup_last = now;
+}
+
+char *
+purple_core_get_startup_profile(void)
+{
+	GString *str = g_string_new(NULL);
+	double total = 0;
+	GList *l;
+
+	for (l = startup_stages; l != NULL; l = l->next) {
+		PurpleStartupStage *stage = l->data;
+
+		g_string_append_printf(str, "%10.1f ms  %s\n",
+				stage->seconds * 1000, stage->name);
+		total += stage->seconds;
+	}
+	g_string_append_printf(str, "%10.1f ms  total\n", total * 1000);
+
+	return g_string_free(str, FALSE);
+}
+
 PurpleCore *
 purple_get_core(void)
 {
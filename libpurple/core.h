@@ -134,6 +134,29 @@ const char *purple_core_get_version(void);
  */
 const char *purple_core_get_ui(void);
 
+/**
+ * Records the end of a stage of startup, for
+ * purple_core_get_startup_profile().  A stage's time is the time since
+ * the previous stage ended, or since purple_core_init() started for the
+ * first stage.  purple_core_init() records its own stages, and UIs can add
+ * theirs after it returns.
+ *
+ * @param name The name of the stage.
+ *
+ * @since 2.10.11
+ */
+void purple_core_startup_stage(const char *name);
+
+/**
+ * Returns a report of how long each stage of startup took, as recorded by
+ * purple_core_startup_stage(), with one stage per line.
+ *
+ * @return The report, which must be freed with g_free().
+ *
+ * @since 2.10.11
+ */
+char *purple_core_get_startup_profile(void);
+
 /**
  * Returns a handle to the purple core.
  *
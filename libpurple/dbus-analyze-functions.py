@@ -41,6 +41,18 @@ excluded = [\
     "purple_buddy_get_protocol_data",
     "purple_buddy_set_protocol_data",
 
+    # These take or return PurpleMetric pointers, which aren't registered
+    # with DBus, or a gint64.  purple_metrics_get_snapshot() is exported.
+    "purple_metrics_get_counter",
+    "purple_metrics_get_gauge",
+    "purple_metrics_get_histogram",
+    "purple_metric_add",
+    "purple_metric_set",
+    "purple_metric_observe",
+    "purple_metric_get_value",
+    "purple_metric_get_type",
+    "purple_metrics_get_time",
+
     # This is excluded because this script treats PurpleLogReadFlags*
     # as pointer to a struct, instead of a pointer to an enum.  This
     # causes a compilation error. Someone should fix this script.
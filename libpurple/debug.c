@@ -50,44 +50,228 @@ static gboolean debug_enabled = FALSE;
 static gboolean debug_verbose = FALSE;
 static gboolean debug_unsafe = FALSE;
 
-static void
-purple_debug_vargs(PurpleDebugLevel level, const char *category,
-				 const char *format, va_list args)
+/*
+ * Per-category settings, keyed by category name ("" for no category).
+ * This is only created once something needs it, so that filtering a
+ * message normally costs no more than a couple of comparisons.
+ */
+typedef struct
 {
-	PurpleDebugUiOps *ops;
-	char *arg_s = NULL;
+	PurpleDebugLevel level;   /* Messages below this are dropped. */
+	time_t second;            /* The second being rate limited. */
+	guint count;              /* Messages printed during that second. */
+	guint suppressed;         /* Messages dropped by the rate limit. */
 
-	g_return_if_fail(level != PURPLE_DEBUG_ALL);
-	g_return_if_fail(format != NULL);
+} PurpleDebugCategory;
 
-	ops = purple_debug_get_ui_ops();
+static GHashTable *debug_categories = NULL;
+static guint debug_rate_limit = 0;
 
-	if (!debug_enabled && ((ops == NULL) || (ops->print == NULL) ||
-			(ops->is_enabled && !ops->is_enabled(level, category))))
-		return;
+/*
+ * The most recent messages, so they can be dumped when something goes
+ * wrong even though nothing was printing them at the time.  Records are
+ * fixed size so writing them never allocates, and a record's seq is only
+ * set once it's complete, so readers can skip ones being overwritten.
+ */
+#define DEBUG_RECENT_SIZE     512
+#define DEBUG_RECENT_TEXT_LEN 240
 
-	arg_s = g_strdup_vprintf(format, args);
+typedef struct
+{
+	volatile gint seq;
+	PurpleDebugLevel level;
+	char time[12];
+	char category[20];
+	char text[DEBUG_RECENT_TEXT_LEN];
+
+} PurpleDebugRecord;
+
+static PurpleDebugRecord debug_recent[DEBUG_RECENT_SIZE];
+static volatile gint debug_recent_next = 0;
+static PurpleDebugLevel debug_recent_level = PURPLE_DEBUG_WARNING;
+
+/* Where a message will go. */
+#define DEBUG_SINK_CONSOLE (1 << 0)
+#define DEBUG_SINK_UI      (1 << 1)
+#define DEBUG_SINK_RECENT  (1 << 2)
 
-	if (debug_enabled) {
-		gchar *ts_s;
-		const char *mdate;
-		time_t mtime = time(NULL);
+static const char *
+debug_timestamp(void)
+{
+	static time_t last = 0;
+	static char buf[12];
+	time_t now = time(NULL);
+
+	if (now != last) {
+		g_strlcpy(buf, purple_utf8_strftime("%H:%M:%S", localtime(&now)),
+				sizeof(buf));
+		last = now;
+	}
+
+	return buf;
+}
+
+static PurpleDebugCategory *
+debug_category_get(const char *category, gboolean create)
+{
+	PurpleDebugCategory *cat;
+
+	if (category == NULL)
+		category = "";
+
+	if (debug_categories == NULL) {
+		if (!create)
+			return NULL;
+		debug_categories = g_hash_table_new_full(g_str_hash, g_str_equal,
+				g_free, g_free);
+	}
+
+	cat = g_hash_table_lookup(debug_categories, category);
+	if (cat == NULL && create) {
+		cat = g_new0(PurpleDebugCategory, 1);
+		cat->level = PURPLE_DEBUG_ALL;
+		g_hash_table_insert(debug_categories, g_strdup(category), cat);
+	}
+
+	return cat;
+}
+
+static guint
+debug_get_sinks(PurpleDebugLevel level, const char *category)
+{
+	PurpleDebugUiOps *ops = debug_ui_ops;
+	guint sinks = 0;
 
+	if (level >= debug_recent_level)
+		sinks |= DEBUG_SINK_RECENT;
 
-		mdate = purple_utf8_strftime("%H:%M:%S", localtime(&mtime));
-		ts_s = g_strdup_printf("(%s) ", mdate);
+	if (debug_enabled)
+		sinks |= DEBUG_SINK_CONSOLE;
 
+	if (ops != NULL && ops->print != NULL &&
+			(ops->is_enabled == NULL || ops->is_enabled(level, category)))
+		sinks |= DEBUG_SINK_UI;
+
+	if (sinks != 0 && debug_categories != NULL) {
+		PurpleDebugCategory *cat = debug_category_get(category, FALSE);
+
+		if (cat != NULL && level < cat->level)
+			return 0;
+	}
+
+	return sinks;
+}
+
+static void
+debug_recent_add(PurpleDebugLevel level, const char *category,
+		const char *timestamp, const char *text)
+{
+	PurpleDebugRecord *record;
+	guint slot;
+	size_t len;
+
+#if GLIB_CHECK_VERSION(2, 30, 0)
+	slot = (guint)g_atomic_int_add(&debug_recent_next, 1);
+#else
+	slot = (guint)g_atomic_int_exchange_and_add(&debug_recent_next, 1);
+#endif
+	record = &debug_recent[slot % DEBUG_RECENT_SIZE];
+
+	g_atomic_int_set(&record->seq, 0);
+
+	record->level = level;
+	g_strlcpy(record->time, timestamp, sizeof(record->time));
+	g_strlcpy(record->category, category ? category : "",
+			sizeof(record->category));
+	len = g_strlcpy(record->text, text, sizeof(record->text));
+
+	/* Keep the newline on truncated messages. */
+	if (len >= sizeof(record->text))
+		record->text[sizeof(record->text) - 2] = '\n';
+
+	g_atomic_int_set(&record->seq, (gint)(slot + 1));
+}
+
+static void
+debug_output(guint sinks, PurpleDebugLevel level, const char *category,
+		const char *arg_s)
+{
+	const char *timestamp = debug_timestamp();
+
+	if (sinks & DEBUG_SINK_RECENT)
+		debug_recent_add(level, category, timestamp, arg_s);
+
+	if (sinks & DEBUG_SINK_CONSOLE) {
 		if (category == NULL)
-			g_print("%s%s", ts_s, arg_s);
+			g_print("(%s) %s", timestamp, arg_s);
 		else
-			g_print("%s%s: %s", ts_s, category, arg_s);
+			g_print("(%s) %s: %s", timestamp, category, arg_s);
+	}
 
-		g_free(ts_s);
+	if (sinks & DEBUG_SINK_UI)
+		debug_ui_ops->print(level, category, arg_s);
+}
+
+/*
+ * Returns the sinks a message still goes to once the category's rate limit
+ * is applied.  Only printing is limited; the recent messages are kept
+ * regardless, since they're what shows what led up to a problem.  The
+ * first message printed after a quiet spell says how many were dropped.
+ */
+static guint
+debug_rate_limit_sinks(guint sinks, PurpleDebugLevel level, const char *category)
+{
+	PurpleDebugCategory *cat;
+	time_t now;
+
+	if (debug_rate_limit == 0 || level == PURPLE_DEBUG_FATAL ||
+			!(sinks & (DEBUG_SINK_CONSOLE | DEBUG_SINK_UI)))
+		return sinks;
+
+	cat = debug_category_get(category, TRUE);
+	now = time(NULL);
+
+	if (cat->second != now) {
+		cat->second = now;
+		cat->count = 0;
 	}
 
-	if (ops != NULL && ops->print != NULL)
-		ops->print(level, category, arg_s);
+	if (cat->count >= debug_rate_limit) {
+		cat->suppressed++;
+		return sinks & DEBUG_SINK_RECENT;
+	}
+	cat->count++;
+
+	if (cat->suppressed > 0) {
+		char *msg = g_strdup_printf("%u messages suppressed by the rate limit\n",
+				cat->suppressed);
+		cat->suppressed = 0;
+		debug_output(sinks & ~DEBUG_SINK_RECENT, PURPLE_DEBUG_WARNING, category, msg);
+		g_free(msg);
+	}
+
+	return sinks;
+}
+
+static void
+purple_debug_vargs(PurpleDebugLevel level, const char *category,
+				 const char *format, va_list args)
+{
+	char *arg_s = NULL;
+	guint sinks;
+
+	g_return_if_fail(level != PURPLE_DEBUG_ALL);
+	g_return_if_fail(format != NULL);
+
+	/* Decide everything before paying for the formatting. */
+	sinks = debug_get_sinks(level, category);
+	if (sinks != 0)
+		sinks = debug_rate_limit_sinks(sinks, level, category);
+	if (sinks == 0)
+		return;
 
+	arg_s = g_strdup_vprintf(format, args);
+	debug_output(sinks, level, category, arg_s);
 	g_free(arg_s);
 }
 
@@ -165,6 +349,113 @@ purple_debug_fatal(const char *category, const char *format, ...)
 	va_end(args);
 }
 
+gboolean
+purple_debug_is_active(PurpleDebugLevel level, const char *category)
+{
+	return debug_get_sinks(level, category) != 0;
+}
+
+void
+purple_debug_set_category_level(const char *category, PurpleDebugLevel level)
+{
+	debug_category_get(category, TRUE)->level = level;
+}
+
+void
+purple_debug_set_rate_limit(guint per_second)
+{
+	debug_rate_limit = per_second;
+}
+
+void
+purple_debug_set_recent_level(PurpleDebugLevel level)
+{
+	debug_recent_level = level;
+}
+
+/*
+ * Calls func on each complete recent record, oldest first.  This must not
+ * allocate, since purple_debug_write_recent() is used by crash handlers.
+ */
+static void
+debug_recent_foreach(void (*func)(const PurpleDebugRecord *record, gpointer data),
+		gpointer data)
+{
+	PurpleDebugRecord copy;
+	guint next, i;
+
+	next = (guint)g_atomic_int_get(&debug_recent_next);
+	i = (next > DEBUG_RECENT_SIZE) ? next - DEBUG_RECENT_SIZE : 0;
+
+	for (; i != next; i++) {
+		PurpleDebugRecord *record = &debug_recent[i % DEBUG_RECENT_SIZE];
+
+		if (g_atomic_int_get(&record->seq) != (gint)(i + 1))
+			continue;
+		copy = *record;
+		if (g_atomic_int_get(&record->seq) != (gint)(i + 1))
+			continue;
+
+		func(&copy, data);
+	}
+}
+
+static void
+debug_recent_append(const PurpleDebugRecord *record, gpointer data)
+{
+	GString *str = data;
+
+	g_string_append_printf(str, "(%s) ", record->time);
+	if (*record->category != '\0')
+		g_string_append_printf(str, "%s: ", record->category);
+	g_string_append(str, record->text);
+}
+
+char *
+purple_debug_get_recent(void)
+{
+	GString *str = g_string_new(NULL);
+
+	debug_recent_foreach(debug_recent_append, str);
+
+	return g_string_free(str, FALSE);
+}
+
+static void
+debug_write_all(int fd, const char *buf)
+{
+	size_t len = strlen(buf);
+
+	while (len > 0) {
+		ssize_t written = write(fd, buf, len);
+		if (written <= 0)
+			return;
+		buf += written;
+		len -= written;
+	}
+}
+
+static void
+debug_recent_write(const PurpleDebugRecord *record, gpointer data)
+{
+	int fd = GPOINTER_TO_INT(data);
+
+	debug_write_all(fd, "(");
+	debug_write_all(fd, record->time);
+	debug_write_all(fd, ") ");
+	if (*record->category != '\0') {
+		debug_write_all(fd, record->category);
+		debug_write_all(fd, ": ");
+	}
+	debug_write_all(fd, record->text);
+}
+
+void
+purple_debug_write_recent(int fd)
+{
+	debug_recent_foreach(debug_recent_write, GINT_TO_POINTER(fd));
+}
+
 void
 purple_debug_set_enabled(gboolean enabled)
 {
@@ -223,6 +514,9 @@ purple_debug_init(void)
 	if(g_getenv("PURPLE_VERBOSE_DEBUG"))
 		purple_debug_set_verbose(TRUE);
 
+	if(g_getenv("PURPLE_DEBUG_RATE_LIMIT"))
+		purple_debug_set_rate_limit(atoi(g_getenv("PURPLE_DEBUG_RATE_LIMIT")));
+
 	purple_prefs_add_none("/purple/debug");
 
 	/*
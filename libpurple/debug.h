@@ -199,6 +199,81 @@ void purple_debug_set_unsafe(gboolean unsafe);
  */
 gboolean purple_debug_is_unsafe(void);
 
+/**
+ * Checks whether a debug message would be printed or recorded anywhere.
+ * Use this to skip expensive work done only to build a debug message.
+ * The purple_debug functions already do this check before formatting
+ * their message.
+ *
+ * @param level    The debug level.
+ * @param category The category (or @c NULL).
+ *
+ * @return TRUE if the message would go somewhere, or FALSE if it would
+ *         be dropped.
+ *
+ * @since 2.10.11
+ */
+gboolean purple_debug_is_active(PurpleDebugLevel level, const char *category);
+
+/**
+ * Drops messages in a category below a debug level, wherever they would
+ * have gone.  Every level is allowed by default.
+ *
+ * @param category The category (or @c NULL for messages without one).
+ * @param level    The lowest level to keep, or #PURPLE_DEBUG_ALL to keep
+ *                 everything.
+ *
+ * @since 2.10.11
+ */
+void purple_debug_set_category_level(const char *category, PurpleDebugLevel level);
+
+/**
+ * Limits how many messages each category can print per second.  Extra
+ * messages are dropped, and a count of them is printed once the category
+ * is allowed to print again.  Fatal messages are never dropped, and the
+ * messages kept for purple_debug_get_recent() aren't limited.  The limit
+ * can also be set with the PURPLE_DEBUG_RATE_LIMIT environment variable.
+ *
+ * @param per_second The number of messages allowed per second, or 0 for
+ *                   no limit (the default).
+ *
+ * @since 2.10.11
+ */
+void purple_debug_set_rate_limit(guint per_second);
+
+/**
+ * Sets the lowest level of debug messages which are kept in memory for
+ * purple_debug_get_recent(), even when debugging is not enabled.  The
+ * default is #PURPLE_DEBUG_WARNING.
+ *
+ * @param level The lowest level to keep.
+ *
+ * @since 2.10.11
+ */
+void purple_debug_set_recent_level(PurpleDebugLevel level);
+
+/**
+ * Returns the most recent debug messages kept in memory, oldest first.
+ * Long messages are truncated.
+ *
+ * @return The recent messages, one per line.  This must be g_free'd.
+ *
+ * @see purple_debug_set_recent_level()
+ * @since 2.10.11
+ */
+char *purple_debug_get_recent(void);
+
+/**
+ * Writes the most recent debug messages kept in memory to a file
+ * descriptor.  This doesn't allocate memory, so it can be used from a
+ * crash handler.
+ *
+ * @param fd The file descriptor to write to.
+ *
+ * @since 2.10.11
+ */
+void purple_debug_write_recent(int fd);
+
 /*@}*/
 
 /**************************************************************************/
@@ -29,6 +29,7 @@
 #include "internal.h"
 #include "debug.h"
 #include "dnsquery.h"
+#include "metrics.h"
 #include "network.h"
 #include "notify.h"
 #include "prefs.h"
@@ -49,6 +50,9 @@
 
 static PurpleDnsQueryUiOps *dns_query_ui_ops = NULL;
 
+static PurpleMetric *dns_lookup_time = NULL;
+static PurpleMetric *dns_lookup_failures = NULL;
+
 typedef struct _PurpleDnsQueryResolverProcess PurpleDnsQueryResolverProcess;
 
 struct _PurpleDnsQueryData {
@@ -58,9 +62,11 @@ struct _PurpleDnsQueryData {
 	gpointer data;
 	guint timeout;
 	PurpleAccount *account;
+	gint64 started;
 
 #if defined(PURPLE_DNSQUERY_USE_FORK)
 	PurpleDnsQueryResolverProcess *resolver;
+	gint64 queued;
 #elif defined _WIN32 /* end PURPLE_DNSQUERY_USE_FORK  */
 	GThread *resolver;
 	GSList *hosts;
@@ -85,6 +91,8 @@ static GSList *free_dns_children = NULL;
 /* TODO: Make me a GQueue when we require >= glib 2.4 */
 static GSList *queued_requests = NULL;
 
+static PurpleMetric *dns_queue_wait = NULL;
+
 static int number_of_dns_children = 0;
 
 /*
@@ -101,6 +109,8 @@ static void
 purple_dnsquery_resolved(PurpleDnsQueryData *query_data, GSList *hosts)
 {
 	purple_debug_info("dnsquery", "IP resolved for %s\n", query_data->hostname);
+	purple_metric_observe(dns_lookup_time,
+			(purple_metrics_get_time() - query_data->started) / 1000);
 	if (query_data->callback != NULL)
 		query_data->callback(hosts, query_data->data, NULL);
 	else
@@ -137,6 +147,7 @@ static void
 purple_dnsquery_failed(PurpleDnsQueryData *query_data, const gchar *error_message)
 {
 	purple_debug_error("dnsquery", "%s\n", error_message);
+	purple_metric_add(dns_lookup_failures, 1);
 	if (query_data->callback != NULL)
 		query_data->callback(NULL, query_data->data, error_message);
 	purple_dnsquery_destroy(query_data);
@@ -625,6 +636,9 @@ handle_next_queued_request(void)
 		}
 	}
 
+	purple_metric_observe(dns_queue_wait,
+			(purple_metrics_get_time() - query_data->queued) / 1000);
+
 	query_data->resolver->inpa = purple_input_add(query_data->resolver->fd_out,
 			PURPLE_INPUT_READ, host_resolved, query_data);
 }
@@ -694,6 +708,7 @@ host_resolved(gpointer data, gint source, PurpleInputCondition cond)
 static void
 resolve_host(PurpleDnsQueryData *query_data)
 {
+	query_data->queued = purple_metrics_get_time();
 	queued_requests = g_slist_append(queued_requests, query_data);
 
 	handle_next_queued_request();
@@ -930,6 +945,7 @@ purple_dnsquery_a_account(PurpleAccount *account, const char *hostname, int port
 	query_data->callback = callback;
 	query_data->data = data;
 	query_data->account = account;
+	query_data->started = purple_metrics_get_time();
 
 	if (*query_data->hostname == '\0')
 	{
@@ -1035,6 +1051,14 @@ purple_dnsquery_get_ui_ops(void)
 void
 purple_dnsquery_init(void)
 {
+	dns_lookup_time = purple_metrics_get_histogram("dns_lookup_ms",
+			"Time taken to resolve a hostname, in milliseconds");
+	dns_lookup_failures = purple_metrics_get_counter("dns_lookup_failures_total",
+			"Hostname lookups that failed");
+#if defined(PURPLE_DNSQUERY_USE_FORK)
+	dns_queue_wait = purple_metrics_get_histogram("dns_queue_wait_ms",
+			"Time lookups spent waiting for a resolver process, in milliseconds");
+#endif
 }
 
 void
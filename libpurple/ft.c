@@ -26,6 +26,7 @@
 #include "internal.h"
 #include "dbus-maybe.h"
 #include "ft.h"
+#include "metrics.h"
 #include "network.h"
 #include "notify.h"
 #include "prefs.h"
@@ -46,6 +47,10 @@ static GList *xfers;
  */
 static GHashTable *xfers_data = NULL;
 
+static PurpleMetric *xfer_sent_bytes = NULL;
+static PurpleMetric *xfer_received_bytes = NULL;
+static PurpleMetric *xfer_throughput = NULL;
+
 typedef struct _PurpleXferPrivData {
 	/*
 	 * Used to moderate the file transfer when either the read/write ui_ops are
@@ -1444,6 +1449,22 @@ purple_xfer_start(PurpleXfer *xfer, int fd, const char *ip,
 	begin_transfer(xfer, cond);
 }
 
+static void
+xfer_record_metrics(PurpleXfer *xfer)
+{
+	time_t elapsed = MAX(xfer->end_time - xfer->start_time, 1);
+
+	if (xfer->start_time == 0)
+		return;
+
+	if (purple_xfer_get_type(xfer) == PURPLE_XFER_SEND)
+		purple_metric_add(xfer_sent_bytes, xfer->bytes_sent);
+	else
+		purple_metric_add(xfer_received_bytes, xfer->bytes_sent);
+
+	purple_metric_observe(xfer_throughput, xfer->bytes_sent / 1024 / elapsed);
+}
+
 void
 purple_xfer_end(PurpleXfer *xfer)
 {
@@ -1456,6 +1477,7 @@ purple_xfer_end(PurpleXfer *xfer)
 	}
 
 	xfer->end_time = time(NULL);
+	xfer_record_metrics(xfer);
 	if (xfer->ops.end != NULL)
 		xfer->ops.end(xfer);
 
@@ -1725,6 +1747,13 @@ purple_xfers_init(void) {
 	xfers_data = g_hash_table_new_full(g_direct_hash, g_direct_equal,
 	                                   NULL, purple_xfer_priv_data_destroy);
 
+	xfer_sent_bytes = purple_metrics_get_counter("xfer_sent_bytes_total",
+			"Bytes sent by completed file transfers");
+	xfer_received_bytes = purple_metrics_get_counter("xfer_received_bytes_total",
+			"Bytes received by completed file transfers");
+	xfer_throughput = purple_metrics_get_histogram("xfer_throughput_kbps",
+			"Average speed of completed file transfers, in KiB per second");
+
 	/* register signals */
 	purple_signal_register(handle, "file-recv-accept",
 	                     purple_marshal_VOID__POINTER, NULL, 1,
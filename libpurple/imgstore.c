@@ -30,11 +30,33 @@
 #include "dbus-maybe.h"
 #include "debug.h"
 #include "imgstore.h"
+#include "metrics.h"
 #include "util.h"
 
 static GHashTable *imgstore;
 static unsigned int nextid = 0;
 
+/*
+ * The bytes behind stored images, shared by every image with the same
+ * contents.  Keyed by content, so a second copy of a buddy icon, smiley or
+ * inline image is freed as soon as it is added.
+ */
+typedef struct
+{
+	guint hash;           /**< Checksum of the data. */
+	size_t size;
+	gpointer data;
+	guint refcount;       /**< The number of images using this data. */
+	GMappedFile *mapped;  /**< The mapping backing @c data, if any. */
+} StoredImageData;
+
+static GHashTable *image_data = NULL;
+static size_t total_bytes = 0;
+static size_t unique_bytes = 0;
+
+static PurpleMetric *total_bytes_metric = NULL;
+static PurpleMetric *unique_bytes_metric = NULL;
+
 /*
  * NOTE: purple_imgstore_add() creates these without zeroing the memory, so
  * NOTE: make sure to update that function when adding members.
@@ -42,31 +64,151 @@ static unsigned int nextid = 0;
 struct _PurpleStoredImage
 {
 	int id;
-	guint8 refcount;
-	size_t size;     /**< The image data's size. */
-	char *filename;  /**< The filename (for the UI) */
-	gpointer data;   /**< The image data. */
+	guint refcount;
+	char *filename;          /**< The filename (for the UI) */
+	StoredImageData *data;   /**< The image data, possibly shared. */
 };
 
-PurpleStoredImage *
-purple_imgstore_add(gpointer data, size_t size, const char *filename)
+static void
+unmap_file(GMappedFile *mapped)
 {
-	PurpleStoredImage *img;
+#if GLIB_CHECK_VERSION(2,22,0)
+	g_mapped_file_unref(mapped);
+#else
+	g_mapped_file_free(mapped);
+#endif
+}
 
-	g_return_val_if_fail(data != NULL, NULL);
-	g_return_val_if_fail(size > 0, NULL);
+/* FNV-1a, mixed with the size.  Equal hashes are confirmed with memcmp(). */
+static guint
+image_data_checksum(gconstpointer data, size_t size)
+{
+	const guchar *p = data;
+	const guchar *end = p + size;
+	guint32 hash = 2166136261U ^ (guint32)size;
+
+	while (p < end) {
+		hash ^= *p++;
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+static guint
+image_data_hash(gconstpointer key)
+{
+	return ((const StoredImageData *)key)->hash;
+}
+
+static gboolean
+image_data_equal(gconstpointer a, gconstpointer b)
+{
+	const StoredImageData *x = a;
+	const StoredImageData *y = b;
+
+	return x->hash == y->hash && x->size == y->size &&
+	       memcmp(x->data, y->data, x->size) == 0;
+}
+
+static void
+update_byte_metrics(void)
+{
+	if (total_bytes_metric == NULL)
+		return;
+
+	purple_metric_set(total_bytes_metric, total_bytes);
+	purple_metric_set(unique_bytes_metric, unique_bytes);
+}
+
+/*
+ * Returns a reference to the shared data with the same contents as
+ * data, taking ownership of data (and of mapped, which backs it, if it
+ * is not NULL).  When the contents are already stored, data is released
+ * right away.
+ */
+static StoredImageData *
+image_data_get(gpointer data, size_t size, GMappedFile *mapped)
+{
+	StoredImageData key, *stored;
+
+	key.hash = image_data_checksum(data, size);
+	key.size = size;
+	key.data = data;
+
+	if (image_data == NULL)
+		image_data = g_hash_table_new(image_data_hash, image_data_equal);
+
+	stored = g_hash_table_lookup(image_data, &key);
+	if (stored != NULL) {
+		if (mapped != NULL)
+			unmap_file(mapped);
+		else
+			g_free(data);
+
+		stored->refcount++;
+		return stored;
+	}
+
+	stored = g_new(StoredImageData, 1);
+	stored->hash = key.hash;
+	stored->size = size;
+	stored->data = data;
+	stored->refcount = 1;
+	stored->mapped = mapped;
+	g_hash_table_insert(image_data, stored, stored);
+
+	unique_bytes += size;
+
+	return stored;
+}
+
+static void
+image_data_unref(StoredImageData *stored)
+{
+	if (--stored->refcount > 0)
+		return;
+
+	/* The table may have been replaced if this outlived the subsystem. */
+	if (image_data != NULL && g_hash_table_lookup(image_data, stored) == stored)
+		g_hash_table_remove(image_data, stored);
+
+	unique_bytes -= stored->size;
+
+	if (stored->mapped != NULL)
+		unmap_file(stored->mapped);
+	else
+		g_free(stored->data);
+	g_free(stored);
+}
+
+static PurpleStoredImage *
+imgstore_new(StoredImageData *stored, const char *filename)
+{
+	PurpleStoredImage *img;
 
 	img = g_new(PurpleStoredImage, 1);
 	PURPLE_DBUS_REGISTER_POINTER(img, PurpleStoredImage);
-	img->data = data;
-	img->size = size;
+	img->data = stored;
 	img->filename = g_strdup(filename);
 	img->refcount = 1;
 	img->id = 0;
 
+	total_bytes += stored->size;
+	update_byte_metrics();
+
 	return img;
 }
 
+PurpleStoredImage *
+purple_imgstore_add(gpointer data, size_t size, const char *filename)
+{
+	g_return_val_if_fail(data != NULL, NULL);
+	g_return_val_if_fail(size > 0, NULL);
+
+	return imgstore_new(image_data_get(data, size, NULL), filename);
+}
+
 PurpleStoredImage *
 purple_imgstore_new_from_file(const char *path)
 {
@@ -85,6 +227,47 @@ purple_imgstore_new_from_file(const char *path)
 	return purple_imgstore_add(data, len, path);
 }
 
+PurpleStoredImage *
+purple_imgstore_new_from_mapped_file(const char *path, const char *filename)
+{
+#ifdef _WIN32
+	/* Windows can't delete a file while it is mapped, and the buddy
+	 * icon cache deletes files that may still be in use here. */
+	PurpleStoredImage *img = purple_imgstore_new_from_file(path);
+
+	if (img != NULL) {
+		g_free(img->filename);
+		img->filename = g_strdup(filename);
+	}
+
+	return img;
+#else
+	GMappedFile *mapped;
+	GError *err = NULL;
+	size_t len;
+
+	g_return_val_if_fail(path != NULL && *path != '\0', NULL);
+
+	mapped = g_mapped_file_new(path, FALSE, &err);
+	if (mapped == NULL) {
+		purple_debug_error("imgstore", "Error mapping %s: %s\n",
+				path, err->message);
+		g_error_free(err);
+		return NULL;
+	}
+
+	len = g_mapped_file_get_length(mapped);
+	if (len == 0) {
+		purple_debug_error("imgstore", "Empty image file: %s\n", path);
+		unmap_file(mapped);
+		return NULL;
+	}
+
+	return imgstore_new(image_data_get(g_mapped_file_get_contents(mapped),
+	                                   len, mapped), filename);
+#endif
+}
+
 int
 purple_imgstore_add_with_id(gpointer data, size_t size, const char *filename)
 {
@@ -121,14 +304,14 @@ gconstpointer purple_imgstore_get_data(PurpleStoredImage *img)
 {
 	g_return_val_if_fail(img != NULL, NULL);
 
-	return img->data;
+	return img->data->data;
 }
 
 size_t purple_imgstore_get_size(PurpleStoredImage *img)
 {
 	g_return_val_if_fail(img != NULL, 0);
 
-	return img->size;
+	return img->data->size;
 }
 
 const char *purple_imgstore_get_filename(const PurpleStoredImage *img)
@@ -142,7 +325,7 @@ const char *purple_imgstore_get_extension(PurpleStoredImage *img)
 {
 	g_return_val_if_fail(img != NULL, NULL);
 
-	return purple_util_get_image_extension(img->data, img->size);
+	return purple_util_get_image_extension(img->data->data, img->data->size);
 }
 
 void purple_imgstore_ref_by_id(int id)
@@ -190,7 +373,10 @@ purple_imgstore_unref(PurpleStoredImage *img)
 		if (img->id)
 			g_hash_table_remove(imgstore, &img->id);
 
-		g_free(img->data);
+		total_bytes -= img->data->size;
+		image_data_unref(img->data);
+		update_byte_metrics();
+
 		g_free(img->filename);
 		PURPLE_DBUS_UNREGISTER_POINTER(img);
 		g_free(img);
@@ -200,6 +386,18 @@ purple_imgstore_unref(PurpleStoredImage *img)
 	return img;
 }
 
+size_t
+purple_imgstore_get_total_bytes(void)
+{
+	return total_bytes;
+}
+
+size_t
+purple_imgstore_get_unique_bytes(void)
+{
+	return unique_bytes;
+}
+
 void *
 purple_imgstore_get_handle()
 {
@@ -220,12 +418,24 @@ purple_imgstore_init()
 	                                        PURPLE_SUBTYPE_STORED_IMAGE));
 
 	imgstore = g_hash_table_new(g_int_hash, g_int_equal);
+	if (image_data == NULL)
+		image_data = g_hash_table_new(image_data_hash, image_data_equal);
+
+	total_bytes_metric = purple_metrics_get_gauge("imgstore_bytes",
+			"Size of all stored images, counting shared data once per image");
+	unique_bytes_metric = purple_metrics_get_gauge("imgstore_unique_bytes",
+			"Size of the image data actually held by the image store");
+	update_byte_metrics();
 }
 
 void
 purple_imgstore_uninit()
 {
 	g_hash_table_destroy(imgstore);
+	g_hash_table_destroy(image_data);
+	image_data = NULL;
+	total_bytes_metric = NULL;
+	unique_bytes_metric = NULL;
 
 	purple_signals_unregister_by_instance(purple_imgstore_get_handle());
 }
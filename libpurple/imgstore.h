@@ -50,6 +50,9 @@ extern "C" {
  * The caller owns a reference to this image and must dereference it with
  * purple_imgstore_unref() for it to be freed.
  *
+ * Images with identical contents share a single copy of the data.  If the
+ * data is already stored, @a data is freed before this function returns.
+ *
  * @param data      Pointer to the image data, which the imgstore will take
  *                  ownership of and free as appropriate.  If you want a
  *                  copy of the data, make it before calling this function.
@@ -87,6 +90,28 @@ purple_imgstore_add(gpointer data, size_t size, const char *filename);
 PurpleStoredImage *
 purple_imgstore_new_from_file(const char *path);
 
+/**
+ * Create a PurpleStoredImage backed by a read-only memory mapping of the
+ * given file, rather than a copy of its contents.  The file must not be
+ * modified in place while the image exists; replacing it with rename()
+ * or deleting it is safe.
+ *
+ * As with purple_imgstore_new_from_file(), the image is not added to the
+ * image store and the caller owns a reference to it.  On Windows, the
+ * file is read into memory instead.
+ *
+ * @param path      The path to the image.
+ * @param filename  Filename associated with the image, as for
+ *                  purple_imgstore_add().
+ *
+ * @return The stored image, or NULL if the file could not be mapped or
+ *         is empty.
+ *
+ * @since 2.10.11
+ */
+PurpleStoredImage *
+purple_imgstore_new_from_mapped_file(const char *path, const char *filename);
+
 /**
  * Create a PurpleStoredImage using purple_imgstore_add() and add the
  * image to the image store.  A unique ID will be assigned to the image.
@@ -206,6 +231,26 @@ void purple_imgstore_ref_by_id(int id);
  */
 void purple_imgstore_unref_by_id(int id);
 
+/**
+ * Returns the combined size of all existing images, counting data shared
+ * by several images once per image.
+ *
+ * @return The total size in bytes.
+ *
+ * @since 2.10.11
+ */
+size_t purple_imgstore_get_total_bytes(void);
+
+/**
+ * Returns the size of the image data actually held, counting data shared
+ * by several images only once.
+ *
+ * @return The deduplicated size in bytes.
+ *
+ * @since 2.10.11
+ */
+size_t purple_imgstore_get_unique_bytes(void);
+
 /**
  * Returns the image store subsystem handle.
  *
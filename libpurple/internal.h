@@ -221,6 +221,17 @@ _purple_buddy_icons_blist_loaded_cb(void);
 void
 _purple_buddy_icon_set_old_icons_dir(const char *dirname);
 
+/* This waits until the icon cache thread has written and deleted
+ * everything queued, including anything queued along the way, so the
+ * unit tests can look at the cache directory. */
+void
+_purple_buddy_icons_sync_cache(void);
+
+/* Serializes all the prefs, exactly as they're written to prefs.xml, so
+ * the unit tests can check it. */
+char *
+_purple_prefs_to_string(void);
+
 /**
  * Creates a connection to the specified account and either connects
  * or attempts to register a new account.  If you are logging in,
@@ -265,6 +276,24 @@ void _purple_connection_new_unregister(PurpleAccount *account, const char *passw
  */
 void _purple_connection_destroy(PurpleConnection *gc);
 
+/**
+ * Closes the HTTP connections util.c keeps open for reuse by later URL
+ * fetches.  This needs to happen before the SSL plugins go away.
+ */
+void
+_purple_util_fetch_url_close_idle(void);
+
+/**
+ * Does the work of purple_util_write_data_to_file_absolute(): writes to a
+ * temporary file, syncs it and renames it over @a filename_full.  This doesn't log anything, so
+ * it can be used from other threads.
+ *
+ * @return TRUE on success, or FALSE with @a error set.
+ */
+gboolean
+_purple_util_write_file(const char *filename_full, const char *data,
+                        gssize size, GError **error);
+
 /**
  * Sets most commonly used socket flags: O_NONBLOCK and FD_CLOEXEC.
  *
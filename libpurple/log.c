@@ -30,6 +30,7 @@
 #include "debug.h"
 #include "internal.h"
 #include "log.h"
+#include "metrics.h"
 #include "prefs.h"
 #include "util.h"
 #include "stringref.h"
@@ -41,6 +42,7 @@ static GSList *loggers = NULL;
 static PurpleLogLogger *html_logger;
 static PurpleLogLogger *txt_logger;
 static PurpleLogLogger *old_logger;
+static PurpleLogLogger *compact_logger;
 
 struct _purple_logsize_user {
 	char *name;
@@ -75,6 +77,19 @@ static GList *txt_logger_list_syslog(PurpleAccount *account);
 static char *txt_logger_read(PurpleLog *log, PurpleLogReadFlags *flags);
 static int txt_logger_total_size(PurpleLogType type, const char *name, PurpleAccount *account);
 
+static gsize compact_logger_write(PurpleLog *log,
+							 PurpleMessageFlags type,
+							 const char *from, time_t time, const char *message);
+static void compact_logger_finalize(PurpleLog *log);
+static GList *compact_logger_list(PurpleLogType type, const char *sn, PurpleAccount *account);
+static GList *compact_logger_list_syslog(PurpleAccount *account);
+static char *compact_logger_read(PurpleLog *log, PurpleLogReadFlags *flags);
+static int compact_logger_size(PurpleLog *log);
+
+static void log_writer_stop(void);
+static void log_writer_pref_cb(const char *name, PurplePrefType type,
+                               gconstpointer value, gpointer data);
+
 /**************************************************************************
  * PUBLIC LOGGING FUNCTIONS ***********************************************
  **************************************************************************/
@@ -651,6 +666,9 @@ void purple_log_init(void)
 	purple_prefs_add_bool("/purple/logging/log_system", FALSE);
 
 	purple_prefs_add_string("/purple/logging/format", "html");
+	purple_prefs_add_bool("/purple/logging/async_writes", FALSE);
+	purple_prefs_add_int("/purple/logging/flush_interval", 1000);
+	purple_prefs_add_int("/purple/logging/flush_size", 65536);
 
 	html_logger = purple_log_logger_new("html", _("HTML"), 11,
 									  NULL,
@@ -680,6 +698,20 @@ void purple_log_init(void)
 									 purple_log_common_is_deletable);
 	purple_log_logger_add(txt_logger);
 
+	compact_logger = purple_log_logger_new("compact", _("Compact"), 11,
+									 NULL,
+									 compact_logger_write,
+									 compact_logger_finalize,
+									 compact_logger_list,
+									 compact_logger_read,
+									 compact_logger_size,
+									 NULL,
+									 compact_logger_list_syslog,
+									 NULL,
+									 purple_log_common_deleter,
+									 purple_log_common_is_deletable);
+	purple_log_logger_add(compact_logger);
+
 	old_logger = purple_log_logger_new("old", _("Old flat format"), 9,
 									 NULL,
 									 NULL,
@@ -716,6 +748,14 @@ void purple_log_init(void)
 							    logger_pref_cb, NULL);
 	purple_prefs_trigger_callback("/purple/logging/format");
 
+	purple_prefs_connect_callback(handle, "/purple/logging/async_writes",
+	                              log_writer_pref_cb, NULL);
+	purple_prefs_connect_callback(handle, "/purple/logging/flush_interval",
+	                              log_writer_pref_cb, NULL);
+	purple_prefs_connect_callback(handle, "/purple/logging/flush_size",
+	                              log_writer_pref_cb, NULL);
+	log_writer_pref_cb(NULL, PURPLE_PREF_NONE, NULL, NULL);
+
 	logsize_users = g_hash_table_new_full((GHashFunc)_purple_logsize_user_hash,
 			(GEqualFunc)_purple_logsize_user_equal,
 			(GDestroyNotify)_purple_logsize_user_free_key, NULL);
@@ -728,6 +768,17 @@ void
 purple_log_uninit(void)
 {
 	purple_signals_unregister_by_instance(purple_log_get_handle());
+	purple_prefs_disconnect_by_handle(purple_log_get_handle());
+
+	/* Everything queued, including closing the files, is done by now. */
+	log_writer_stop();
+	if (log_writer.mutex != NULL) {
+		g_queue_free(log_writer.jobs);
+		g_cond_free(log_writer.done);
+		g_cond_free(log_writer.work);
+		g_mutex_free(log_writer.mutex);
+		log_writer.mutex = NULL;
+	}
 
 	purple_log_logger_remove(html_logger);
 	purple_log_logger_free(html_logger);
@@ -737,6 +788,10 @@ purple_log_uninit(void)
 	purple_log_logger_free(txt_logger);
 	txt_logger = NULL;
 
+	purple_log_logger_remove(compact_logger);
+	purple_log_logger_free(compact_logger);
+	compact_logger = NULL;
+
 	purple_log_logger_remove(old_logger);
 	purple_log_logger_free(old_logger);
 	old_logger = NULL;
@@ -745,6 +800,453 @@ purple_log_uninit(void)
 	g_hash_table_destroy(logsize_users_decayed);
 }
 
+/****************************************************************************
+ * BACKGROUND WRITER ********************************************************
+ ****************************************************************************/
+
+/* When "/purple/logging/async_writes" is set, the built-in loggers
+ * still format messages here, since that runs signal handlers and touches
+ * the image store, but leave the file I/O to a worker thread.  The worker
+ * flushes a batch of writes together flush_interval milliseconds after it
+ * wrote the first of them, or once they're flush_size bytes long, and
+ * whenever it is asked to close a file, sync or quit. */
+
+typedef enum
+{
+	LOG_JOB_APPEND,
+	LOG_JOB_IMAGE,
+	LOG_JOB_CLOSE,
+	LOG_JOB_SYNC,
+	LOG_JOB_QUIT
+} LogJobType;
+
+typedef struct
+{
+	LogJobType type;
+	FILE *file;
+	char *path;
+	char *data;
+	gsize len;
+	GTimeVal queued;
+} LogJob;
+
+/* The writes the worker has made since its last flush. */
+typedef struct
+{
+	GList *files;
+	gsize bytes;
+	guint messages;
+	guint64 queued_msecs;  /* The sum of the messages' queue times */
+	guint64 oldest_msecs;
+	/* When the worker started the batch.  The flush deadline counts from
+	 * here rather than from oldest_msecs, or a backlog would be flushed
+	 * a message at a time. */
+	guint64 started_msecs;
+
+	/* Copies of the settings, taken under the lock */
+	guint flush_interval;
+	guint flush_size;
+} LogBatch;
+
+#define LOG_WRITER_MAX_JOBS 4096
+
+static struct
+{
+	GThread *thread;
+	GMutex *mutex;
+	GCond *work;  /* Signalled when a job is queued */
+	GCond *done;  /* Signalled when a job is finished */
+	GQueue *jobs;
+	guint flush_interval;
+	guint flush_size;
+	guint syncs_queued;
+	guint syncs_done;
+	PurpleLogWriterStats stats;
+} log_writer;
+
+static PurpleMetric *log_write_latency = NULL;
+static PurpleMetric *log_bytes_written = NULL;
+
+static guint64
+timeval_msecs(const GTimeVal *tv)
+{
+	return (guint64)tv->tv_sec * 1000 + tv->tv_usec / 1000;
+}
+
+static gboolean
+log_write_image_file(const char *path, gconstpointer data, gsize size)
+{
+	FILE *image_file;
+
+	if ((image_file = g_fopen(path, "wb")) == NULL)
+		return FALSE;
+
+	if (!fwrite(data, size, 1, image_file))
+	{
+		fclose(image_file);
+
+		/* Attempt to not leave half-written files around. */
+		unlink(path);
+		return FALSE;
+	}
+
+	fclose(image_file);
+	return TRUE;
+}
+
+static void
+log_batch_commit(LogBatch *batch)
+{
+	GList *l;
+	GTimeVal now;
+	guint64 now_msecs;
+
+	for (l = batch->files; l != NULL; l = l->next)
+		fflush(l->data);
+	g_list_free(batch->files);
+
+	if (batch->messages > 0) {
+		g_get_current_time(&now);
+		now_msecs = timeval_msecs(&now);
+
+		g_mutex_lock(log_writer.mutex);
+		log_writer.stats.flushes++;
+		log_writer.stats.messages += batch->messages;
+		log_writer.stats.bytes += batch->bytes;
+		/* Don't let the clock going backwards wreck the averages. */
+		if (now_msecs >= batch->oldest_msecs) {
+			log_writer.stats.total_msecs += now_msecs * batch->messages - batch->queued_msecs;
+			if (now_msecs - batch->oldest_msecs > log_writer.stats.max_msecs)
+				log_writer.stats.max_msecs = now_msecs - batch->oldest_msecs;
+		}
+		g_mutex_unlock(log_writer.mutex);
+
+		if (now_msecs >= batch->oldest_msecs)
+			purple_metric_observe(log_write_latency, now_msecs - batch->oldest_msecs);
+		purple_metric_add(log_bytes_written, batch->bytes);
+	}
+
+	batch->files = NULL;
+	batch->bytes = 0;
+	batch->messages = 0;
+	batch->queued_msecs = 0;
+	batch->oldest_msecs = 0;
+	batch->started_msecs = 0;
+}
+
+/* Runs a job, without holding the lock.  Returns FALSE when it's time to quit. */
+static gboolean
+log_writer_run_job(LogJob *job, LogBatch *batch)
+{
+	switch (job->type) {
+	case LOG_JOB_APPEND:
+		if (fwrite(job->data, job->len, 1, job->file) != 1) {
+			g_mutex_lock(log_writer.mutex);
+			log_writer.stats.errors++;
+			g_mutex_unlock(log_writer.mutex);
+		}
+		if (g_list_find(batch->files, job->file) == NULL)
+			batch->files = g_list_prepend(batch->files, job->file);
+		if (batch->messages == 0) {
+			GTimeVal now;
+			g_get_current_time(&now);
+			batch->started_msecs = timeval_msecs(&now);
+			batch->oldest_msecs = timeval_msecs(&job->queued);
+		}
+		batch->messages++;
+		batch->bytes += job->len;
+		batch->queued_msecs += timeval_msecs(&job->queued);
+		if (batch->bytes >= batch->flush_size)
+			log_batch_commit(batch);
+		break;
+
+	case LOG_JOB_IMAGE:
+		/* Only save unique files. */
+		if (!g_file_test(job->path, G_FILE_TEST_EXISTS) &&
+				!log_write_image_file(job->path, job->data, job->len)) {
+			g_mutex_lock(log_writer.mutex);
+			log_writer.stats.errors++;
+			g_mutex_unlock(log_writer.mutex);
+		}
+		break;
+
+	case LOG_JOB_CLOSE:
+		if (job->data != NULL)
+			fwrite(job->data, job->len, 1, job->file);
+		batch->files = g_list_remove(batch->files, job->file);
+		fclose(job->file);
+		log_batch_commit(batch);
+		break;
+
+	case LOG_JOB_SYNC:
+		log_batch_commit(batch);
+		break;
+
+	case LOG_JOB_QUIT:
+		log_batch_commit(batch);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gpointer
+log_writer_thread(gpointer unused)
+{
+	LogBatch batch;
+	gboolean running = TRUE;
+
+	memset(&batch, 0, sizeof(LogBatch));
+
+	g_mutex_lock(log_writer.mutex);
+	while (running) {
+		LogJob *job = g_queue_pop_head(log_writer.jobs);
+
+		batch.flush_interval = log_writer.flush_interval;
+		batch.flush_size = log_writer.flush_size;
+
+		if (job == NULL) {
+			if (batch.messages == 0) {
+				g_cond_wait(log_writer.work, log_writer.mutex);
+			} else {
+				GTimeVal deadline;
+
+				deadline.tv_sec = (batch.started_msecs + batch.flush_interval) / 1000;
+				deadline.tv_usec = ((batch.started_msecs + batch.flush_interval) % 1000) * 1000;
+				if (!g_cond_timed_wait(log_writer.work, log_writer.mutex, &deadline)) {
+					g_mutex_unlock(log_writer.mutex);
+					log_batch_commit(&batch);
+					g_mutex_lock(log_writer.mutex);
+				}
+			}
+			continue;
+		}
+
+		g_mutex_unlock(log_writer.mutex);
+
+		running = log_writer_run_job(job, &batch);
+
+		/* Under a steady stream of jobs the queue never runs dry, so
+		 * check the deadline here as well. */
+		if (batch.messages > 0) {
+			GTimeVal now;
+			g_get_current_time(&now);
+			if (timeval_msecs(&now) >= batch.started_msecs + batch.flush_interval)
+				log_batch_commit(&batch);
+		}
+
+		g_mutex_lock(log_writer.mutex);
+		if (job->type == LOG_JOB_SYNC)
+			log_writer.syncs_done++;
+		g_cond_broadcast(log_writer.done);
+
+		g_free(job->path);
+		g_free(job->data);
+		g_free(job);
+	}
+	g_mutex_unlock(log_writer.mutex);
+
+	return NULL;
+}
+
+static void
+log_writer_push(LogJob *job)
+{
+	guint length;
+
+	g_get_current_time(&job->queued);
+
+	g_mutex_lock(log_writer.mutex);
+	if (g_queue_get_length(log_writer.jobs) >= LOG_WRITER_MAX_JOBS) {
+		/* The disk can't keep up; wait for it rather than use more memory. */
+		log_writer.stats.stalls++;
+		while (g_queue_get_length(log_writer.jobs) >= LOG_WRITER_MAX_JOBS)
+			g_cond_wait(log_writer.done, log_writer.mutex);
+	}
+	g_queue_push_tail(log_writer.jobs, job);
+	length = g_queue_get_length(log_writer.jobs);
+	if (length > log_writer.stats.peak_queued)
+		log_writer.stats.peak_queued = length;
+	g_cond_signal(log_writer.work);
+	g_mutex_unlock(log_writer.mutex);
+}
+
+/* Waits until everything queued so far is on disk. */
+static void
+log_writer_sync(void)
+{
+	LogJob *job;
+	guint target;
+
+	if (log_writer.thread == NULL)
+		return;
+
+	job = g_new0(LogJob, 1);
+	job->type = LOG_JOB_SYNC;
+	target = ++log_writer.syncs_queued;
+	log_writer_push(job);
+
+	g_mutex_lock(log_writer.mutex);
+	while (log_writer.syncs_done < target)
+		g_cond_wait(log_writer.done, log_writer.mutex);
+	g_mutex_unlock(log_writer.mutex);
+}
+
+static void
+log_writer_start(void)
+{
+	GError *error = NULL;
+
+	if (log_writer.thread != NULL)
+		return;
+
+	if (!g_thread_supported()) {
+		purple_debug_warning("log", "Threads are not initialized; "
+				"writing logs on the main thread.\n");
+		return;
+	}
+
+	if (log_write_latency == NULL) {
+		log_write_latency = purple_metrics_get_histogram("log_write_latency_ms",
+				"Time from queueing a log message until it is flushed, in milliseconds");
+		log_bytes_written = purple_metrics_get_counter("log_bytes_written_total",
+				"Bytes written to conversation logs");
+	}
+
+	if (log_writer.mutex == NULL) {
+		log_writer.mutex = g_mutex_new();
+		log_writer.work = g_cond_new();
+		log_writer.done = g_cond_new();
+		log_writer.jobs = g_queue_new();
+	}
+
+	log_writer.thread = g_thread_create(log_writer_thread, NULL, TRUE, &error);
+	if (log_writer.thread == NULL) {
+		purple_debug_error("log", "Unable to start the log writer: %s\n",
+				error->message);
+		g_error_free(error);
+	}
+}
+
+static void
+log_writer_stop(void)
+{
+	LogJob *job;
+
+	if (log_writer.thread == NULL)
+		return;
+
+	job = g_new0(LogJob, 1);
+	job->type = LOG_JOB_QUIT;
+	log_writer_push(job);
+
+	g_thread_join(log_writer.thread);
+	log_writer.thread = NULL;
+}
+
+/* Appends to a file opened with purple_log_common_writer(). */
+static void
+log_append(PurpleLogCommonLoggerData *data, const char *str, gsize len)
+{
+	if (len == 0)
+		return;
+
+	if (log_writer.thread != NULL) {
+		LogJob *job = g_new0(LogJob, 1);
+
+		job->type = LOG_JOB_APPEND;
+		job->file = data->file;
+		job->data = g_memdup(str, len);
+		job->len = len;
+		log_writer_push(job);
+	} else {
+		fwrite(str, len, 1, data->file);
+		fflush(data->file);
+	}
+}
+
+/* Writes trailer, if any, and closes a file opened with
+ * purple_log_common_writer(). */
+static void
+log_close(PurpleLogCommonLoggerData *data, const char *trailer)
+{
+	if (log_writer.thread != NULL) {
+		LogJob *job = g_new0(LogJob, 1);
+
+		job->type = LOG_JOB_CLOSE;
+		job->file = data->file;
+		if (trailer != NULL) {
+			job->data = g_strdup(trailer);
+			job->len = strlen(trailer);
+		}
+		log_writer_push(job);
+	} else {
+		if (trailer != NULL)
+			fputs(trailer, data->file);
+		fclose(data->file);
+	}
+	data->file = NULL;
+}
+
+static void
+log_write_image(const char *path, gconstpointer image_data, gsize size)
+{
+	if (log_writer.thread != NULL) {
+		LogJob *job = g_new0(LogJob, 1);
+
+		job->type = LOG_JOB_IMAGE;
+		job->path = g_strdup(path);
+		job->data = g_memdup(image_data, size);
+		job->len = size;
+		log_writer_push(job);
+		return;
+	}
+
+	/* Only save unique files. */
+	if (g_file_test(path, G_FILE_TEST_EXISTS))
+		return;
+
+	if (log_write_image_file(path, image_data, size))
+		purple_debug_info("log", "Wrote image file: %s\n", path);
+	else
+		purple_debug_error("log", "Error writing %s: %s\n",
+		                   path, g_strerror(errno));
+}
+
+static void
+log_writer_pref_cb(const char *name, PurplePrefType type,
+                   gconstpointer value, gpointer data)
+{
+	if (log_writer.mutex != NULL)
+		g_mutex_lock(log_writer.mutex);
+	log_writer.flush_interval = MAX(purple_prefs_get_int("/purple/logging/flush_interval"), 0);
+	log_writer.flush_size = MAX(purple_prefs_get_int("/purple/logging/flush_size"), 0);
+	if (log_writer.mutex != NULL)
+		g_mutex_unlock(log_writer.mutex);
+
+	if (purple_prefs_get_bool("/purple/logging/async_writes"))
+		log_writer_start();
+	else
+		log_writer_stop();
+}
+
+void
+purple_log_writer_get_stats(PurpleLogWriterStats *stats)
+{
+	g_return_if_fail(stats != NULL);
+
+	if (log_writer.mutex == NULL) {
+		memset(stats, 0, sizeof(PurpleLogWriterStats));
+		return;
+	}
+
+	g_mutex_lock(log_writer.mutex);
+	*stats = log_writer.stats;
+	stats->active = (log_writer.thread != NULL);
+	stats->queued = g_queue_get_length(log_writer.jobs);
+	g_mutex_unlock(log_writer.mutex);
+}
+
 /****************************************************************************
  * LOGGERS ******************************************************************
  ****************************************************************************/
@@ -770,6 +1272,24 @@ static char *log_get_timestamp(PurpleLog *log, time_t when)
 		return g_strdup(purple_time_format(tm));
 }
 
+/* Runs a message through one stage of the markup filters, as the html
+ * and txt loggers do instead of purple_markup_html_to_xhtml() and
+ * purple_markup_strip_html(). */
+static char *
+log_filter_markup(const char *message,
+                  PurpleMarkupFilter *(*stage_new)(PurpleMarkupFilter *next))
+{
+	GString *out = g_string_new(NULL);
+	PurpleMarkupFilter *filter;
+
+	filter = stage_new(purple_markup_filter_string_new(out));
+	purple_markup_filter_feed(filter, message);
+	purple_markup_filter_finish(filter);
+	purple_markup_filter_free(filter);
+
+	return g_string_free(out, FALSE);
+}
+
 /* NOTE: This can return msg (which you may or may not want to g_free())
  * NOTE: or a newly allocated string which you MUST g_free(). */
 static char *
@@ -799,7 +1319,6 @@ convert_image_tags(const PurpleLog *log, const char *msg)
 
 		if (imgid != 0)
 		{
-			FILE *image_file;
 			char *dir;
 			PurpleStoredImage *image;
 			gconstpointer image_data;
@@ -823,32 +1342,7 @@ convert_image_tags(const PurpleLog *log, const char *msg)
 
 			path = g_build_filename(dir, new_filename, NULL);
 
-			/* Only save unique files. */
-			if (!g_file_test(path, G_FILE_TEST_EXISTS))
-			{
-				if ((image_file = g_fopen(path, "wb")) != NULL)
-				{
-					if (!fwrite(image_data, image_byte_count, 1, image_file))
-					{
-						purple_debug_error("log", "Error writing %s: %s\n",
-						                   path, g_strerror(errno));
-						fclose(image_file);
-
-						/* Attempt to not leave half-written files around. */
-						unlink(path);
-					}
-					else
-					{
-						purple_debug_info("log", "Wrote image file: %s\n", path);
-						fclose(image_file);
-					}
-				}
-				else
-				{
-					purple_debug_error("log", "Unable to create file %s: %s\n",
-					                   path, g_strerror(errno));
-				}
-			}
+			log_write_image(path, image_data, image_byte_count);
 
 			/* Write the new image tag */
 			g_string_append_printf(newmsg, "<IMG SRC=\"%s\">", new_filename);
@@ -872,7 +1366,11 @@ convert_image_tags(const PurpleLog *log, const char *msg)
 	return g_string_free(newmsg, FALSE);
 }
 
-void purple_log_common_writer(PurpleLog *log, const char *ext)
+/* Opens the log file with fopen() mode @a mode.  The text loggers use "a",
+ * as they always have; the compact logger needs "ab" so Windows doesn't
+ * translate its newlines. */
+static void
+log_common_writer_open(PurpleLog *log, const char *ext, const char *mode)
 {
 	PurpleLogCommonLoggerData *data = log->logger_data;
 
@@ -904,7 +1402,7 @@ void purple_log_common_writer(PurpleLog *log, const char *ext)
 
 		log->logger_data = data = g_slice_new0(PurpleLogCommonLoggerData);
 
-		data->file = g_fopen(path, "a");
+		data->file = g_fopen(path, mode);
 		if (data->file == NULL)
 		{
 			purple_debug(PURPLE_DEBUG_ERROR, "log",
@@ -917,10 +1415,15 @@ void purple_log_common_writer(PurpleLog *log, const char *ext)
 			g_free(path);
 			return;
 		}
-		g_free(path);
+		data->path = path;
 	}
 }
 
+void purple_log_common_writer(PurpleLog *log, const char *ext)
+{
+	log_common_writer_open(log, ext, "a");
+}
+
 GList *purple_log_common_lister(PurpleLogType type, const char *name, PurpleAccount *account, const char *ext, PurpleLogLogger *logger)
 {
 	GDir *dir;
@@ -1178,6 +1681,9 @@ gboolean purple_log_common_deleter(PurpleLog *log)
 	if (data->path == NULL)
 		return FALSE;
 
+	/* Don't let queued writes recreate the file. */
+	log_writer_sync();
+
 	ret = g_unlink(data->path);
 	if (ret == 0)
 		return TRUE;
@@ -1369,17 +1875,74 @@ static PurpleLogLogger xml_logger =  {
  ** HTML LOGGER *************
  ****************************/
 
+/* Appends one message, in the form the html logger writes it.  The compact
+ * logger uses this to display its logs too. */
+static void
+html_logger_format(GString *out, PurpleLog *log, PurpleMessageFlags type,
+                   const char *from, time_t time, const char *message)
+{
+	char *msg_fixed;
+	char *date;
+	char *escaped_from;
+
+	escaped_from = from ? g_markup_escape_text(from, -1) : g_strdup("");
+	msg_fixed = log_filter_markup(message, purple_markup_filter_xhtml_new);
+
+	date = log_get_timestamp(log, time);
+
+	if(log->type == PURPLE_LOG_SYSTEM){
+		g_string_append_printf(out, "---- %s @ %s ----<br/>\n", msg_fixed, date);
+	} else {
+		if (type & PURPLE_MESSAGE_SYSTEM)
+			g_string_append_printf(out, "<font size=\"2\">(%s)</font><b> %s</b><br/>\n", date, msg_fixed);
+		else if (type & PURPLE_MESSAGE_RAW)
+			g_string_append_printf(out, "<font size=\"2\">(%s)</font> %s<br/>\n", date, msg_fixed);
+		else if (type & PURPLE_MESSAGE_ERROR)
+			g_string_append_printf(out, "<font color=\"#FF0000\"><font size=\"2\">(%s)</font><b> %s</b></font><br/>\n", date, msg_fixed);
+		else if (type & PURPLE_MESSAGE_WHISPER)
+			g_string_append_printf(out, "<font color=\"#6C2585\"><font size=\"2\">(%s)</font><b> %s:</b></font> %s<br/>\n",
+					date, escaped_from, msg_fixed);
+		else if (type & PURPLE_MESSAGE_AUTO_RESP) {
+			if (type & PURPLE_MESSAGE_SEND)
+				g_string_append_printf(out, _("<font color=\"#16569E\"><font size=\"2\">(%s)</font> <b>%s &lt;AUTO-REPLY&gt;:</b></font> %s<br/>\n"), date, escaped_from, msg_fixed);
+			else if (type & PURPLE_MESSAGE_RECV)
+				g_string_append_printf(out, _("<font color=\"#A82F2F\"><font size=\"2\">(%s)</font> <b>%s &lt;AUTO-REPLY&gt;:</b></font> %s<br/>\n"), date, escaped_from, msg_fixed);
+		} else if (type & PURPLE_MESSAGE_RECV) {
+			if(purple_message_meify(msg_fixed, -1))
+				g_string_append_printf(out, "<font color=\"#062585\"><font size=\"2\">(%s)</font> <b>***%s</b></font> %s<br/>\n",
+						date, escaped_from, msg_fixed);
+			else
+				g_string_append_printf(out, "<font color=\"#A82F2F\"><font size=\"2\">(%s)</font> <b>%s:</b></font> %s<br/>\n",
+						date, escaped_from, msg_fixed);
+		} else if (type & PURPLE_MESSAGE_SEND) {
+			if(purple_message_meify(msg_fixed, -1))
+				g_string_append_printf(out, "<font color=\"#062585\"><font size=\"2\">(%s)</font> <b>***%s</b></font> %s<br/>\n",
+						date, escaped_from, msg_fixed);
+			else
+				g_string_append_printf(out, "<font color=\"#16569E\"><font size=\"2\">(%s)</font> <b>%s:</b></font> %s<br/>\n",
+						date, escaped_from, msg_fixed);
+		} else {
+			purple_debug_error("log", "Unhandled message type.\n");
+			g_string_append_printf(out, "<font size=\"2\">(%s)</font><b> %s:</b></font> %s<br/>\n",
+						date, escaped_from, msg_fixed);
+		}
+	}
+	g_free(date);
+	g_free(msg_fixed);
+	g_free(escaped_from);
+}
+
 static gsize html_logger_write(PurpleLog *log, PurpleMessageFlags type,
 							  const char *from, time_t time, const char *message)
 {
-	char *msg_fixed;
 	char *image_corrected_msg;
-	char *date;
 	char *header;
-	char *escaped_from;
 	PurplePlugin *plugin = purple_find_prpl(purple_account_get_protocol_id(log->account));
 	PurpleLogCommonLoggerData *data = log->logger_data;
-	gsize written = 0;
+	GString *out;
+	gsize written;
+
+	out = g_string_new(NULL);
 
 	if(!data) {
 		const char *prpl =
@@ -1390,14 +1953,16 @@ static gsize html_logger_write(PurpleLog *log, PurpleMessageFlags type,
 		data = log->logger_data;
 
 		/* if we can't write to the file, give up before we hurt ourselves */
-		if(!data->file)
+		if(!data->file) {
+			g_string_free(out, TRUE);
 			return 0;
+		}
 
 		date = purple_date_format_full(localtime(&log->time));
 
-		written += fprintf(data->file, "<html><head>");
-		written += fprintf(data->file, "<meta http-equiv=\"content-type\" content=\"text/html; charset=UTF-8\">");
-		written += fprintf(data->file, "<title>");
+		g_string_append_printf(out, "<html><head>");
+		g_string_append_printf(out, "<meta http-equiv=\"content-type\" content=\"text/html; charset=UTF-8\">");
+		g_string_append_printf(out, "<title>");
 		if (log->type == PURPLE_LOG_SYSTEM)
 			header = g_strdup_printf("System log for account %s (%s) connected at %s",
 					purple_account_get_username(log->account), prpl, date);
@@ -1405,69 +1970,29 @@ static gsize html_logger_write(PurpleLog *log, PurpleMessageFlags type,
 			header = g_strdup_printf("Conversation with %s at %s on %s (%s)",
 					log->name, date, purple_account_get_username(log->account), prpl);
 
-		written += fprintf(data->file, "%s", header);
-		written += fprintf(data->file, "</title></head><body>");
-		written += fprintf(data->file, "<h3>%s</h3>\n", header);
+		g_string_append(out, header);
+		g_string_append_printf(out, "</title></head><body>");
+		g_string_append_printf(out, "<h3>%s</h3>\n", header);
 		g_free(header);
 	}
 
 	/* if we can't write to the file, give up before we hurt ourselves */
-	if(!data->file)
+	if(!data->file) {
+		g_string_free(out, TRUE);
 		return 0;
-
-	escaped_from = g_markup_escape_text(from, -1);
+	}
 
 	image_corrected_msg = convert_image_tags(log, message);
-	purple_markup_html_to_xhtml(image_corrected_msg, &msg_fixed, NULL);
+	html_logger_format(out, log, type, from, time, image_corrected_msg);
 
 	/* Yes, this breaks encapsulation.  But it's a static function and
 	 * this saves a needless strdup(). */
 	if (image_corrected_msg != message)
 		g_free(image_corrected_msg);
 
-	date = log_get_timestamp(log, time);
-
-	if(log->type == PURPLE_LOG_SYSTEM){
-		written += fprintf(data->file, "---- %s @ %s ----<br/>\n", msg_fixed, date);
-	} else {
-		if (type & PURPLE_MESSAGE_SYSTEM)
-			written += fprintf(data->file, "<font size=\"2\">(%s)</font><b> %s</b><br/>\n", date, msg_fixed);
-		else if (type & PURPLE_MESSAGE_RAW)
-			written += fprintf(data->file, "<font size=\"2\">(%s)</font> %s<br/>\n", date, msg_fixed);
-		else if (type & PURPLE_MESSAGE_ERROR)
-			written += fprintf(data->file, "<font color=\"#FF0000\"><font size=\"2\">(%s)</font><b> %s</b></font><br/>\n", date, msg_fixed);
-		else if (type & PURPLE_MESSAGE_WHISPER)
-			written += fprintf(data->file, "<font color=\"#6C2585\"><font size=\"2\">(%s)</font><b> %s:</b></font> %s<br/>\n",
-					date, escaped_from, msg_fixed);
-		else if (type & PURPLE_MESSAGE_AUTO_RESP) {
-			if (type & PURPLE_MESSAGE_SEND)
-				written += fprintf(data->file, _("<font color=\"#16569E\"><font size=\"2\">(%s)</font> <b>%s &lt;AUTO-REPLY&gt;:</b></font> %s<br/>\n"), date, escaped_from, msg_fixed);
-			else if (type & PURPLE_MESSAGE_RECV)
-				written += fprintf(data->file, _("<font color=\"#A82F2F\"><font size=\"2\">(%s)</font> <b>%s &lt;AUTO-REPLY&gt;:</b></font> %s<br/>\n"), date, escaped_from, msg_fixed);
-		} else if (type & PURPLE_MESSAGE_RECV) {
-			if(purple_message_meify(msg_fixed, -1))
-				written += fprintf(data->file, "<font color=\"#062585\"><font size=\"2\">(%s)</font> <b>***%s</b></font> %s<br/>\n",
-						date, escaped_from, msg_fixed);
-			else
-				written += fprintf(data->file, "<font color=\"#A82F2F\"><font size=\"2\">(%s)</font> <b>%s:</b></font> %s<br/>\n",
-						date, escaped_from, msg_fixed);
-		} else if (type & PURPLE_MESSAGE_SEND) {
-			if(purple_message_meify(msg_fixed, -1))
-				written += fprintf(data->file, "<font color=\"#062585\"><font size=\"2\">(%s)</font> <b>***%s</b></font> %s<br/>\n",
-						date, escaped_from, msg_fixed);
-			else
-				written += fprintf(data->file, "<font color=\"#16569E\"><font size=\"2\">(%s)</font> <b>%s:</b></font> %s<br/>\n",
-						date, escaped_from, msg_fixed);
-		} else {
-			purple_debug_error("log", "Unhandled message type.\n");
-			written += fprintf(data->file, "<font size=\"2\">(%s)</font><b> %s:</b></font> %s<br/>\n",
-						date, escaped_from, msg_fixed);
-		}
-	}
-	g_free(date);
-	g_free(msg_fixed);
-	g_free(escaped_from);
-	fflush(data->file);
+	log_append(data, out->str, out->len);
+	written = out->len;
+	g_string_free(out, TRUE);
 
 	return written;
 }
@@ -1476,10 +2001,8 @@ static void html_logger_finalize(PurpleLog *log)
 {
 	PurpleLogCommonLoggerData *data = log->logger_data;
 	if (data) {
-		if(data->file) {
-			fprintf(data->file, "</body></html>\n");
-			fclose(data->file);
-		}
+		if(data->file)
+			log_close(data, "</body></html>\n");
 		g_free(data->path);
 
 		g_slice_free(PurpleLogCommonLoggerData, data);
@@ -1503,6 +2026,7 @@ static char *html_logger_read(PurpleLog *log, PurpleLogReadFlags *flags)
 	*flags = PURPLE_LOG_READ_NO_NEWLINE;
 	if (!data || !data->path)
 		return g_strdup(_("<font color=\"red\"><b>Unable to find log path!</b></font>"));
+	log_writer_sync();
 	if (g_file_get_contents(data->path, &read, NULL, NULL)) {
 		char *minus_header = strchr(read, '\n');
 
@@ -1535,8 +2059,10 @@ static gsize txt_logger_write(PurpleLog *log,
 	PurplePlugin *plugin = purple_find_prpl(purple_account_get_protocol_id(log->account));
 	PurpleLogCommonLoggerData *data = log->logger_data;
 	char *stripped = NULL;
+	GString *out;
+	gsize written;
 
-	gsize written = 0;
+	out = g_string_new(NULL);
 
 	if (data == NULL) {
 		/* This log is new.  We could use the loggers 'new' function, but
@@ -1550,59 +2076,70 @@ static gsize txt_logger_write(PurpleLog *log,
 		data = log->logger_data;
 
 		/* if we can't write to the file, give up before we hurt ourselves */
-		if(!data->file)
+		if(!data->file) {
+			g_string_free(out, TRUE);
 			return 0;
+		}
 
 		if (log->type == PURPLE_LOG_SYSTEM)
-			written += fprintf(data->file, "System log for account %s (%s) connected at %s\n",
+			g_string_append_printf(out, "System log for account %s (%s) connected at %s\n",
 				purple_account_get_username(log->account), prpl,
 				purple_date_format_full(localtime(&log->time)));
 		else
-			written += fprintf(data->file, "Conversation with %s at %s on %s (%s)\n",
+			g_string_append_printf(out, "Conversation with %s at %s on %s (%s)\n",
 				log->name, purple_date_format_full(localtime(&log->time)),
 				purple_account_get_username(log->account), prpl);
 	}
 
 	/* if we can't write to the file, give up before we hurt ourselves */
-	if(!data->file)
+	if(!data->file) {
+		g_string_free(out, TRUE);
 		return 0;
+	}
 
-	stripped = purple_markup_strip_html(message);
+	stripped = log_filter_markup(message, purple_markup_filter_strip_new);
 	date = log_get_timestamp(log, time);
 
 	if(log->type == PURPLE_LOG_SYSTEM){
-		written += fprintf(data->file, "---- %s @ %s ----\n", stripped, date);
+		g_string_append_printf(out, "---- %s @ %s ----\n", stripped, date);
 	} else {
 		if (type & PURPLE_MESSAGE_SEND ||
 			type & PURPLE_MESSAGE_RECV) {
 			if (type & PURPLE_MESSAGE_AUTO_RESP) {
-				written += fprintf(data->file, _("(%s) %s <AUTO-REPLY>: %s\n"), date,
+				g_string_append_printf(out, _("(%s) %s <AUTO-REPLY>: %s\n"), date,
 						from, stripped);
 			} else {
 				if(purple_message_meify(stripped, -1))
-					written += fprintf(data->file, "(%s) ***%s %s\n", date, from,
+					g_string_append_printf(out, "(%s) ***%s %s\n", date, from,
 							stripped);
 				else
-					written += fprintf(data->file, "(%s) %s: %s\n", date, from,
+					g_string_append_printf(out, "(%s) %s: %s\n", date, from,
 							stripped);
 			}
 		} else if (type & PURPLE_MESSAGE_SYSTEM ||
 			type & PURPLE_MESSAGE_ERROR ||
 			type & PURPLE_MESSAGE_RAW)
-			written += fprintf(data->file, "(%s) %s\n", date, stripped);
+			g_string_append_printf(out, "(%s) %s\n", date, stripped);
 		else if (type & PURPLE_MESSAGE_NO_LOG) {
 			/* This shouldn't happen */
+			g_free(date);
 			g_free(stripped);
+			log_append(data, out->str, out->len);
+			written = out->len;
+			g_string_free(out, TRUE);
 			return written;
 		} else if (type & PURPLE_MESSAGE_WHISPER)
-			written += fprintf(data->file, "(%s) *%s* %s", date, from, stripped);
+			g_string_append_printf(out, "(%s) *%s* %s", date, from, stripped);
 		else
-			written += fprintf(data->file, "(%s) %s%s %s\n", date, from ? from : "",
+			g_string_append_printf(out, "(%s) %s%s %s\n", date, from ? from : "",
 					from ? ":" : "", stripped);
 	}
 	g_free(date);
 	g_free(stripped);
-	fflush(data->file);
+
+	log_append(data, out->str, out->len);
+	written = out->len;
+	g_string_free(out, TRUE);
 
 	return written;
 }
@@ -1612,7 +2149,7 @@ static void txt_logger_finalize(PurpleLog *log)
 	PurpleLogCommonLoggerData *data = log->logger_data;
 	if (data) {
 		if(data->file)
-			fclose(data->file);
+			log_close(data, NULL);
 		g_free(data->path);
 
 		g_slice_free(PurpleLogCommonLoggerData, data);
@@ -1636,6 +2173,7 @@ static char *txt_logger_read(PurpleLog *log, PurpleLogReadFlags *flags)
 	*flags = 0;
 	if (!data || !data->path)
 		return g_strdup(_("<font color=\"red\"><b>Unable to find log path!</b></font>"));
+	log_writer_sync();
 	if (g_file_get_contents(data->path, &read, NULL, NULL)) {
 		minus_header = strchr(read, '\n');
 
@@ -1653,6 +2191,1172 @@ static int txt_logger_total_size(PurpleLogType type, const char *name, PurpleAcc
 }
 
 
+/****************************
+ ** COMPACT LOGGER **********
+ ****************************/
+
+/* A compact log is a header followed by records.  Each record starts with
+ * its length, not counting the length itself, and a type byte.  Lengths
+ * and the fields marked (v) are varints, seven bits to a byte, low bits
+ * first; (z) marks zigzag-encoded signed varints, and other integers are
+ * little endian.
+ *
+ *   header   "PLOG" version(8) 0 0 0
+ *   sender   name                      names the next sender id
+ *   message  flags(v) time(z) sender(v) text
+ *   index    senders(v) { len(v) name } blocks(v) { offset prev(64) latest(64) }
+ *   trailer  index_offset count bytes(64) last(64) "PLGI"
+ *
+ * A message's time is relative to the message before it, and its sender
+ * is an id plus one, or zero for none.  The index has an entry for every
+ * block of COMPACT_BLOCK_SIZE messages: where it starts, the time of the
+ * message before it, and the latest time of any message up to its end,
+ * which is what seeking searches.
+ *
+ * The index and the trailer are written when the log is closed.  A log
+ * without them, because it is still open or because we crashed, is read
+ * by scanning its records instead.  Records of unknown types are skipped.
+ */
+
+#define COMPACT_MAGIC         "PLOG"
+#define COMPACT_TRAILER_MAGIC "PLGI"
+#define COMPACT_VERSION       1
+#define COMPACT_HEADER_LEN    8
+#define COMPACT_TRAILER_LEN   30
+#define COMPACT_BLOCK_SIZE    64
+
+enum
+{
+	COMPACT_RECORD_SENDER = 1,
+	COMPACT_RECORD_MESSAGE,
+	COMPACT_RECORD_INDEX,
+	COMPACT_RECORD_TRAILER
+};
+
+typedef struct
+{
+	guint32 offset;
+	gint64 prev;
+	gint64 latest;
+} CompactBlock;
+
+typedef struct
+{
+	GArray *blocks;          /* CompactBlock */
+	GPtrArray *senders;      /* Names, by id */
+	guint count;
+	guint64 bytes;           /* Of message text */
+	gint64 last;             /* The time of the last message */
+	guint32 end;             /* The size of the file */
+	GHashTable *sender_ids;  /* Name to id + 1, only while writing */
+} CompactIndex;
+
+struct _PurpleLogCompactReader
+{
+	FILE *file;
+	CompactIndex *index;
+	guint32 offset;  /* Of the next record */
+	guint next;      /* The number of the next message */
+	gint64 time;     /* The time of the message before it */
+};
+
+static void
+compact_put_u32(GString *str, guint32 value)
+{
+	value = GUINT32_TO_LE(value);
+	g_string_append_len(str, (const char *)&value, 4);
+}
+
+static void
+compact_put_u64(GString *str, guint64 value)
+{
+	value = GUINT64_TO_LE(value);
+	g_string_append_len(str, (const char *)&value, 8);
+}
+
+static void
+compact_put_varint(GString *str, guint64 value)
+{
+	while (value >= 0x80) {
+		g_string_append_c(str, (value & 0x7f) | 0x80);
+		value >>= 7;
+	}
+	g_string_append_c(str, value);
+}
+
+static guint64
+compact_zigzag(gint64 value)
+{
+	return ((guint64)value << 1) ^ (guint64)(value >> 63);
+}
+
+static gint64
+compact_unzigzag(guint64 value)
+{
+	return (gint64)(value >> 1) ^ -(gint64)(value & 1);
+}
+
+static guint32
+compact_get_u32(const guchar *data)
+{
+	guint32 value;
+	memcpy(&value, data, 4);
+	return GUINT32_FROM_LE(value);
+}
+
+static guint64
+compact_get_u64(const guchar *data)
+{
+	guint64 value;
+	memcpy(&value, data, 8);
+	return GUINT64_FROM_LE(value);
+}
+
+/* Reads a varint from a buffer, advancing *data past it. */
+static gboolean
+compact_get_varint(const guchar **data, const guchar *end, guint64 *value)
+{
+	guint64 result = 0;
+	int shift;
+
+	for (shift = 0; *data < end && shift < 64; shift += 7) {
+		guchar c = *(*data)++;
+
+		result |= (guint64)(c & 0x7f) << shift;
+		if (!(c & 0x80)) {
+			*value = result;
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/* Reads a varint from a file, adding the bytes read to *used. */
+static gboolean
+compact_read_varint(FILE *file, guint64 *value, guint32 *used)
+{
+	guint64 result = 0;
+	int shift, c;
+
+	for (shift = 0; shift < 64 && (c = getc(file)) != EOF; shift += 7) {
+		(*used)++;
+		result |= (guint64)(c & 0x7f) << shift;
+		if (!(c & 0x80)) {
+			*value = result;
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+static gboolean
+compact_read_at(FILE *file, long offset, gpointer buf, gsize len)
+{
+	if (fseek(file, offset, SEEK_SET) != 0)
+		return FALSE;
+	return len == 0 || fread(buf, len, 1, file) == 1;
+}
+
+/* Reads the record at the file's position.  For a message, reads the
+ * fields before its text, and leaves the file at the text; other records
+ * are skipped, except that sender names are added to index->senders if
+ * senders is TRUE.  Returns FALSE at the end of the log, or at a partial
+ * record. */
+static gboolean
+compact_read_record(FILE *file, CompactIndex *index, gboolean senders,
+                    guint32 *offset, int *type, PurpleMessageFlags *flags,
+                    gint64 *time, guint32 *sender, guint32 *text_len)
+{
+	guint32 used = 0, len;
+	guint64 value, delta, id;
+	int c;
+
+	if (*offset >= index->end || !compact_read_varint(file, &value, &used) ||
+			used > index->end - *offset ||
+			value < 1 || value > index->end - *offset - used ||
+			(c = getc(file)) == EOF)
+		return FALSE;
+
+	len = value;
+	*offset += used + len;
+	*type = c;
+	used = 1;
+
+	if (c == COMPACT_RECORD_MESSAGE) {
+		if (!compact_read_varint(file, &value, &used) ||
+				!compact_read_varint(file, &delta, &used) ||
+				!compact_read_varint(file, &id, &used) || used > len)
+			return FALSE;
+
+		*flags = value;
+		*time += compact_unzigzag(delta);
+		*sender = id;
+		*text_len = len - used;
+		return TRUE;
+	}
+
+	if (c == COMPACT_RECORD_SENDER && senders) {
+		char *name = g_malloc(len);
+
+		if (len > 1 && fread(name, len - 1, 1, file) != 1) {
+			g_free(name);
+			return FALSE;
+		}
+		name[len - 1] = '\0';
+		g_ptr_array_add(index->senders, name);
+		return TRUE;
+	}
+
+	return fseek(file, *offset, SEEK_SET) == 0;
+}
+
+static CompactIndex *
+compact_index_new(void)
+{
+	CompactIndex *index = g_new0(CompactIndex, 1);
+
+	index->blocks = g_array_new(FALSE, FALSE, sizeof(CompactBlock));
+	index->senders = g_ptr_array_new();
+	return index;
+}
+
+static void
+compact_index_free(CompactIndex *index)
+{
+	g_ptr_array_foreach(index->senders, (GFunc)g_free, NULL);
+	g_ptr_array_free(index->senders, TRUE);
+	g_array_free(index->blocks, TRUE);
+	if (index->sender_ids != NULL)
+		g_hash_table_destroy(index->sender_ids);
+	g_free(index);
+}
+
+/* Notes a message about to be written at offset. */
+static void
+compact_index_add(CompactIndex *index, guint32 offset, gint64 time)
+{
+	CompactBlock *block;
+
+	if (index->count % COMPACT_BLOCK_SIZE == 0) {
+		CompactBlock next;
+
+		next.offset = offset;
+		next.prev = index->last;
+		next.latest = time;
+		if (index->blocks->len > 0)
+			next.latest = MAX(next.latest,
+					g_array_index(index->blocks, CompactBlock, index->blocks->len - 1).latest);
+		g_array_append_val(index->blocks, next);
+	}
+
+	block = &g_array_index(index->blocks, CompactBlock, index->blocks->len - 1);
+	block->latest = MAX(block->latest, time);
+	index->last = time;
+	index->count++;
+}
+
+/* Reads the index from the footer, or returns NULL if there isn't a
+ * complete one.  Without blocks, only the trailer is read. */
+static CompactIndex *
+compact_index_read_footer(FILE *file, guint32 size, gboolean blocks)
+{
+	guchar trailer[COMPACT_TRAILER_LEN];
+	guchar *buf;
+	const guchar *p, *end;
+	guint32 index_offset, len;
+	guint64 n, i;
+	CompactIndex *index;
+
+	if (size < COMPACT_HEADER_LEN + COMPACT_TRAILER_LEN ||
+			!compact_read_at(file, size - COMPACT_TRAILER_LEN, trailer, COMPACT_TRAILER_LEN) ||
+			trailer[0] != COMPACT_TRAILER_LEN - 1 ||
+			trailer[1] != COMPACT_RECORD_TRAILER ||
+			memcmp(trailer + COMPACT_TRAILER_LEN - 4, COMPACT_TRAILER_MAGIC, 4) != 0)
+		return NULL;
+
+	index_offset = compact_get_u32(trailer + 2);
+	if (index_offset < COMPACT_HEADER_LEN ||
+			index_offset >= size - COMPACT_TRAILER_LEN)
+		return NULL;
+
+	index = compact_index_new();
+	index->count = compact_get_u32(trailer + 6);
+	index->bytes = compact_get_u64(trailer + 10);
+	index->last = (gint64)compact_get_u64(trailer + 18);
+	if (!blocks)
+		return index;
+
+	/* The index runs from index_offset up to the trailer. */
+	len = size - COMPACT_TRAILER_LEN - index_offset;
+	buf = g_malloc(len);
+	p = buf;
+	end = buf + len;
+	if (!compact_read_at(file, index_offset, buf, len) ||
+			!compact_get_varint(&p, end, &n) || n != (guint64)(end - p) ||
+			p == end || *p++ != COMPACT_RECORD_INDEX ||
+			!compact_get_varint(&p, end, &n))
+		goto fail;
+
+	for (i = 0; i < n; i++) {
+		guint64 name_len;
+
+		if (!compact_get_varint(&p, end, &name_len) ||
+				name_len > (guint64)(end - p))
+			goto fail;
+		g_ptr_array_add(index->senders, g_strndup((const char *)p, name_len));
+		p += name_len;
+	}
+
+	if (!compact_get_varint(&p, end, &n) || n * 20 != (guint64)(end - p) ||
+			n != (index->count + COMPACT_BLOCK_SIZE - 1) / COMPACT_BLOCK_SIZE)
+		goto fail;
+
+	g_array_set_size(index->blocks, n);
+	for (i = 0; i < n; i++, p += 20) {
+		CompactBlock *block = &g_array_index(index->blocks, CompactBlock, i);
+
+		block->offset = compact_get_u32(p);
+		block->prev = (gint64)compact_get_u64(p + 4);
+		block->latest = (gint64)compact_get_u64(p + 12);
+	}
+
+	g_free(buf);
+	return index;
+
+fail:
+	g_free(buf);
+	compact_index_free(index);
+	return NULL;
+}
+
+/* Builds the index by reading every record.  A partial record at the end
+ * is ignored, and left out of the index's end. */
+static CompactIndex *
+compact_index_scan(FILE *file, guint32 size)
+{
+	CompactIndex *index = compact_index_new();
+	guint32 offset = COMPACT_HEADER_LEN, start, text_len, sender;
+	PurpleMessageFlags flags;
+	gint64 time = 0;
+	int type;
+
+	index->end = size;
+	start = offset;
+	while (fseek(file, offset, SEEK_SET) == 0 &&
+			compact_read_record(file, index, TRUE, &offset, &type,
+			                    &flags, &time, &sender, &text_len)) {
+		if (type == COMPACT_RECORD_MESSAGE) {
+			compact_index_add(index, start, time);
+			index->bytes += text_len;
+		}
+		start = offset;
+	}
+	index->end = start;
+
+	return index;
+}
+
+/* Reads the index of a compact log, or returns NULL if file isn't one. */
+static CompactIndex *
+compact_index_load(FILE *file, gboolean blocks)
+{
+	char header[COMPACT_HEADER_LEN];
+	CompactIndex *index;
+	long size;
+
+	if (!compact_read_at(file, 0, header, COMPACT_HEADER_LEN) ||
+			memcmp(header, COMPACT_MAGIC, 4) != 0 ||
+			header[4] != COMPACT_VERSION)
+		return NULL;
+
+	if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0 ||
+			(unsigned long)size > G_MAXUINT32)
+		return NULL;
+
+	index = compact_index_read_footer(file, size, blocks);
+	if (index != NULL)
+		index->end = size;
+	else
+		index = compact_index_scan(file, size);
+
+	return index;
+}
+
+static void
+compact_put_footer(GString *out, CompactIndex *index)
+{
+	GString *record = g_string_new(NULL);
+	guint i;
+
+	g_string_append_c(record, COMPACT_RECORD_INDEX);
+	compact_put_varint(record, index->senders->len);
+	for (i = 0; i < index->senders->len; i++) {
+		const char *name = g_ptr_array_index(index->senders, i);
+
+		compact_put_varint(record, strlen(name));
+		g_string_append(record, name);
+	}
+	compact_put_varint(record, index->blocks->len);
+	for (i = 0; i < index->blocks->len; i++) {
+		CompactBlock *block = &g_array_index(index->blocks, CompactBlock, i);
+
+		compact_put_u32(record, block->offset);
+		compact_put_u64(record, block->prev);
+		compact_put_u64(record, block->latest);
+	}
+	compact_put_varint(out, record->len);
+	g_string_append_len(out, record->str, record->len);
+	g_string_free(record, TRUE);
+
+	g_string_append_c(out, COMPACT_TRAILER_LEN - 1);
+	g_string_append_c(out, COMPACT_RECORD_TRAILER);
+	compact_put_u32(out, index->end);
+	compact_put_u32(out, index->count);
+	compact_put_u64(out, index->bytes);
+	compact_put_u64(out, index->last);
+	g_string_append_len(out, COMPACT_TRAILER_MAGIC, 4);
+}
+
+/* Sets up a log file for appending, picking up the index of anything
+ * already in it.  Returns FALSE, and closes the file, if it can't be
+ * appended to. */
+static gboolean
+compact_logger_open(PurpleLogCommonLoggerData *data)
+{
+	CompactIndex *index = NULL;
+	gboolean partial = FALSE;
+	FILE *file;
+	guint i;
+
+	/* Anything written to the file before it was last closed may still be
+	 * queued. */
+	log_writer_sync();
+
+	if (data->path != NULL && (file = g_fopen(data->path, "rb")) != NULL) {
+		index = compact_index_load(file, TRUE);
+		partial = index != NULL && fseek(file, 0, SEEK_END) == 0 &&
+			ftell(file) > (long)index->end;
+		fclose(file);
+	}
+
+	/* Drop a partly written record left by a crash, so that new records
+	 * follow the last complete one instead of the garbage. */
+	if (partial) {
+#ifdef HAVE_FILENO
+		if (ftruncate(fileno(data->file), index->end) != 0)
+#endif
+		{
+			purple_debug_error("log", "Unable to truncate %s to append to it\n",
+					data->path);
+			compact_index_free(index);
+			log_close(data, NULL);
+			return FALSE;
+		}
+	}
+
+	if (index == NULL) {
+		index = compact_index_new();
+		index->end = COMPACT_HEADER_LEN;
+		log_append(data, COMPACT_MAGIC "\001\0\0\0", COMPACT_HEADER_LEN);
+	}
+
+	index->sender_ids = g_hash_table_new(g_str_hash, g_str_equal);
+	for (i = 0; i < index->senders->len; i++)
+		g_hash_table_insert(index->sender_ids,
+				g_ptr_array_index(index->senders, i), GUINT_TO_POINTER(i + 1));
+
+	data->extra_data = index;
+	return TRUE;
+}
+
+static gsize compact_logger_write(PurpleLog *log,
+							 PurpleMessageFlags type,
+							 const char *from, time_t time, const char *message)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	CompactIndex *index;
+	char *image_corrected_msg;
+	guint sender = 0;
+	gsize len, written;
+	GString *out, *fields;
+
+	if (data == NULL) {
+		log_common_writer_open(log, ".plog", "ab");
+		data = log->logger_data;
+	}
+
+	/* if we can't write to the file, give up before we hurt ourselves */
+	if (data == NULL || data->file == NULL)
+		return 0;
+
+	if (data->extra_data == NULL && !compact_logger_open(data))
+		return 0;
+	index = data->extra_data;
+
+	out = g_string_new(NULL);
+
+	if (from != NULL) {
+		sender = GPOINTER_TO_UINT(g_hash_table_lookup(index->sender_ids, from));
+		if (sender == 0) {
+			char *name = g_strdup(from);
+
+			compact_put_varint(out, 1 + strlen(name));
+			g_string_append_c(out, COMPACT_RECORD_SENDER);
+			g_string_append(out, name);
+
+			g_ptr_array_add(index->senders, name);
+			sender = index->senders->len;
+			g_hash_table_insert(index->sender_ids, name, GUINT_TO_POINTER(sender));
+		}
+	}
+
+	image_corrected_msg = convert_image_tags(log, message);
+	len = strlen(image_corrected_msg);
+
+	fields = g_string_new(NULL);
+	g_string_append_c(fields, COMPACT_RECORD_MESSAGE);
+	compact_put_varint(fields, type);
+	compact_put_varint(fields, compact_zigzag((gint64)time - index->last));
+	compact_put_varint(fields, sender);
+
+	compact_index_add(index, index->end + out->len, time);
+	compact_put_varint(out, fields->len + len);
+	g_string_append_len(out, fields->str, fields->len);
+	g_string_append_len(out, image_corrected_msg, len);
+	g_string_free(fields, TRUE);
+
+	if (image_corrected_msg != message)
+		g_free(image_corrected_msg);
+
+	index->bytes += len;
+	index->end += out->len;
+
+	log_append(data, out->str, out->len);
+	written = out->len;
+	g_string_free(out, TRUE);
+
+	return written;
+}
+
+static void compact_logger_finalize(PurpleLog *log)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	if (data) {
+		CompactIndex *index = data->extra_data;
+
+		if (data->file) {
+			if (index != NULL) {
+				GString *footer = g_string_new(NULL);
+
+				compact_put_footer(footer, index);
+				log_append(data, footer->str, footer->len);
+				g_string_free(footer, TRUE);
+			}
+			log_close(data, NULL);
+		}
+		if (index != NULL)
+			compact_index_free(index);
+		g_free(data->path);
+
+		g_slice_free(PurpleLogCommonLoggerData, data);
+	}
+}
+
+static GList *compact_logger_list(PurpleLogType type, const char *sn, PurpleAccount *account)
+{
+	return purple_log_common_lister(type, sn, account, ".plog", compact_logger);
+}
+
+static GList *compact_logger_list_syslog(PurpleAccount *account)
+{
+	return purple_log_common_lister(PURPLE_LOG_SYSTEM, ".system", account, ".plog", compact_logger);
+}
+
+static char *compact_logger_read(PurpleLog *log, PurpleLogReadFlags *flags)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	PurpleLogCompactReader *reader;
+	PurpleMessageFlags type;
+	const char *from;
+	time_t when;
+	char *message;
+	GString *out;
+
+	*flags = PURPLE_LOG_READ_NO_NEWLINE;
+	if (!data || !data->path)
+		return g_strdup(_("<font color=\"red\"><b>Unable to find log path!</b></font>"));
+
+	reader = purple_log_compact_reader_new(log);
+	if (reader == NULL)
+		return g_strdup_printf(_("<font color=\"red\"><b>Could not read file: %s</b></font>"), data->path);
+
+	out = g_string_new(NULL);
+	while (purple_log_compact_reader_next(reader, &type, &from, &when, &message)) {
+		html_logger_format(out, log, type, from, when, message);
+		g_free(message);
+	}
+	purple_log_compact_reader_free(reader);
+
+	return g_string_free(out, FALSE);
+}
+
+/* The size of a compact log is the size of its messages' text, which the
+ * trailer records. */
+static int compact_logger_size(PurpleLog *log)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	CompactIndex *index;
+	FILE *file;
+	int size = 0;
+
+	g_return_val_if_fail(data != NULL, 0);
+
+	if (data->extra_data != NULL)
+		return ((CompactIndex *)data->extra_data)->bytes;
+
+	if (data->path == NULL)
+		return 0;
+
+	log_writer_sync();
+	if ((file = g_fopen(data->path, "rb")) == NULL)
+		return 0;
+
+	if ((index = compact_index_load(file, FALSE)) != NULL) {
+		size = index->bytes;
+		compact_index_free(index);
+	}
+	fclose(file);
+
+	return size;
+}
+
+PurpleLogCompactReader *
+purple_log_compact_reader_new(PurpleLog *log)
+{
+	PurpleLogCommonLoggerData *data;
+	PurpleLogCompactReader *reader;
+	CompactIndex *index;
+	FILE *file;
+
+	g_return_val_if_fail(log != NULL, NULL);
+
+	data = log->logger_data;
+	if (log->logger != compact_logger || data == NULL || data->path == NULL)
+		return NULL;
+
+	log_writer_sync();
+	if ((file = g_fopen(data->path, "rb")) == NULL)
+		return NULL;
+
+	if ((index = compact_index_load(file, TRUE)) == NULL) {
+		fclose(file);
+		return NULL;
+	}
+
+	reader = g_new0(PurpleLogCompactReader, 1);
+	reader->file = file;
+	reader->index = index;
+	reader->offset = COMPACT_HEADER_LEN;
+	fseek(file, reader->offset, SEEK_SET);
+
+	return reader;
+}
+
+guint
+purple_log_compact_reader_get_count(PurpleLogCompactReader *reader)
+{
+	g_return_val_if_fail(reader != NULL, 0);
+
+	return reader->index->count;
+}
+
+void
+purple_log_compact_reader_seek(PurpleLogCompactReader *reader, time_t when)
+{
+	GArray *blocks;
+	CompactBlock *block;
+	guint low = 0, high;
+
+	g_return_if_fail(reader != NULL);
+
+	/* The latest times never decrease, even when the messages' times do. */
+	blocks = reader->index->blocks;
+	high = blocks->len;
+	while (low < high) {
+		guint mid = low + (high - low) / 2;
+
+		if (g_array_index(blocks, CompactBlock, mid).latest < when)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	if (low == blocks->len) {
+		reader->next = reader->index->count;
+		return;
+	}
+
+	/* The message is in this block. */
+	block = &g_array_index(blocks, CompactBlock, low);
+	reader->next = low * COMPACT_BLOCK_SIZE;
+	reader->time = block->prev;
+	reader->offset = block->offset;
+	fseek(reader->file, reader->offset, SEEK_SET);
+
+	while (reader->next < reader->index->count) {
+		guint32 offset = reader->offset, sender, text_len;
+		PurpleMessageFlags flags;
+		gint64 time = reader->time;
+		int type;
+
+		if (!compact_read_record(reader->file, reader->index, FALSE, &offset,
+		                         &type, &flags, &time, &sender, &text_len))
+			break;
+
+		if (type == COMPACT_RECORD_MESSAGE) {
+			if (time >= when)
+				break;
+			reader->time = time;
+			reader->next++;
+		}
+		reader->offset = offset;
+		fseek(reader->file, reader->offset, SEEK_SET);
+	}
+
+	fseek(reader->file, reader->offset, SEEK_SET);
+}
+
+gboolean
+purple_log_compact_reader_next(PurpleLogCompactReader *reader,
+                               PurpleMessageFlags *type, const char **from,
+                               time_t *when, char **message)
+{
+	guint32 sender, text_len;
+	PurpleMessageFlags flags;
+	int record_type;
+	char *text;
+
+	g_return_val_if_fail(reader != NULL, FALSE);
+
+	do {
+		if (reader->next >= reader->index->count ||
+				!compact_read_record(reader->file, reader->index, FALSE,
+				                     &reader->offset, &record_type, &flags,
+				                     &reader->time, &sender, &text_len))
+			return FALSE;
+	} while (record_type != COMPACT_RECORD_MESSAGE);
+
+	text = g_malloc(text_len + 1);
+	if (text_len > 0 && fread(text, text_len, 1, reader->file) != 1) {
+		g_free(text);
+		return FALSE;
+	}
+	text[text_len] = '\0';
+	reader->next++;
+
+	if (type != NULL)
+		*type = flags;
+	if (from != NULL)
+		*from = (sender > 0 && sender <= reader->index->senders->len) ?
+				g_ptr_array_index(reader->index->senders, sender - 1) : NULL;
+	if (when != NULL)
+		*when = (time_t)reader->time;
+	if (message != NULL)
+		*message = text;
+	else
+		g_free(text);
+
+	return TRUE;
+}
+
+void
+purple_log_compact_reader_free(PurpleLogCompactReader *reader)
+{
+	if (reader == NULL)
+		return;
+
+	fclose(reader->file);
+	compact_index_free(reader->index);
+	g_free(reader);
+}
+
+/* Makes a log like the given one, but for another logger and file. */
+static PurpleLog *
+log_new_for_path(PurpleLog *log, PurpleLogLogger *logger, char *path)
+{
+	PurpleLog *copy;
+	PurpleLogCommonLoggerData *data;
+
+	copy = purple_log_new(log->type, log->name, log->account, NULL, log->time, log->tm);
+	copy->logger = logger;
+	copy->logger_data = data = g_slice_new0(PurpleLogCommonLoggerData);
+	data->path = path;
+
+	return copy;
+}
+
+/* Swaps the extension of a log file's path, or returns NULL if it
+ * doesn't have the given one. */
+static char *
+log_path_with_ext(PurpleLog *log, const char *from_ext, const char *to_ext)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+
+	if (data == NULL || data->path == NULL ||
+			!purple_str_has_suffix(data->path, from_ext))
+		return NULL;
+
+	return g_strdup_printf("%.*s%s",
+			(int)(strlen(data->path) - strlen(from_ext)), data->path, to_ext);
+}
+
+/* Finds the clock time in a timestamp the html or txt logger wrote, in the
+ * locale's format.  The date is taken from the previous message, moving on
+ * a day when the clock goes backwards, since dates can't be parsed
+ * reliably. */
+static gboolean
+log_import_time(const char *stamp, gsize len, time_t *last)
+{
+	char *buf = g_strndup(stamp, len);
+	const char *p;
+	int hour = 0, min = 0, sec = 0;
+	struct tm tm;
+	time_t when;
+
+	for (p = buf; *p != '\0'; p++) {
+		if (g_ascii_isdigit(*p) && sscanf(p, "%d:%d:%d", &hour, &min, &sec) == 3)
+			break;
+	}
+	if (*p == '\0' || hour > 23 || min > 59 || sec > 60) {
+		g_free(buf);
+		return FALSE;
+	}
+
+	if (hour < 12 && (strstr(p, "PM") || strstr(p, "pm")))
+		hour += 12;
+	else if (hour == 12 && (strstr(p, "AM") || strstr(p, "am")))
+		hour = 0;
+	g_free(buf);
+
+	tm = *localtime(last);
+	tm.tm_hour = hour;
+	tm.tm_min = min;
+	tm.tm_sec = sec;
+	tm.tm_isdst = -1;
+	when = mktime(&tm);
+
+	/* Allow a little for messages logged out of order. */
+	while (when < *last - 60 * 60)
+		when += 24 * 60 * 60;
+
+	*last = when;
+	return TRUE;
+}
+
+static PurpleMessageFlags
+log_import_direction(PurpleLog *log, const char *from)
+{
+	if (log->account != NULL &&
+			(purple_strequal(from, purple_account_get_username(log->account)) ||
+			 purple_strequal(from, purple_account_get_alias(log->account))))
+		return PURPLE_MESSAGE_SEND;
+
+	return PURPLE_MESSAGE_RECV;
+}
+
+/* Parses a line an html or txt log starts a message with, and fills in
+ * the message, which is markup.  Returns FALSE for any other line. */
+static gboolean
+log_import_line(PurpleLog *log, gboolean html, const char *line, time_t *last,
+                PurpleMessageFlags *type, char **from, GString *message)
+{
+	const char *stamp, *stamp_end, *rest;
+	char *name = NULL;
+	gsize len;
+
+	*from = NULL;
+	g_string_truncate(message, 0);
+
+	if (log->type == PURPLE_LOG_SYSTEM) {
+		/* ---- message @ time ---- */
+		const char *tail = html ? " ----<br/>" : " ----";
+
+		if (!purple_str_has_prefix(line, "---- ") ||
+				!purple_str_has_suffix(line, tail) ||
+				(stamp = g_strrstr(line, " @ ")) == NULL)
+			return FALSE;
+		stamp_end = line + strlen(line) - strlen(tail);
+		if (stamp < line + 5 || !log_import_time(stamp + 3, stamp_end - stamp - 3, last))
+			return FALSE;
+
+		*type = PURPLE_MESSAGE_SYSTEM;
+		if (html)
+			g_string_append_len(message, line + 5, stamp - line - 5);
+		else {
+			char *text = g_markup_escape_text(line + 5, stamp - line - 5);
+			g_string_append(message, text);
+			g_free(text);
+		}
+		return TRUE;
+	}
+
+	stamp = html ? strstr(line, "<font size=\"2\">(") : line;
+	if (stamp == NULL || *stamp != (html ? '<' : '('))
+		return FALSE;
+	stamp += html ? 16 : 1;
+	if ((stamp_end = strstr(stamp, html ? ")</font>" : ") ")) == NULL ||
+			!log_import_time(stamp, stamp_end - stamp, last))
+		return FALSE;
+	rest = stamp_end + (html ? 8 : 2);
+
+	if (html) {
+		const char *bold_end;
+
+		if (purple_str_has_suffix(rest, "<br/>"))
+			len = strlen(rest) - 5;
+		else
+			len = strlen(rest);
+
+		if (*rest == ' ')
+			rest++, len--;
+
+		if (!purple_str_has_prefix(rest, "<b>") ||
+				(bold_end = strstr(rest, "</b>")) == NULL || bold_end > rest + len) {
+			*type = PURPLE_MESSAGE_RAW;
+			g_string_append_len(message, rest, len);
+			return TRUE;
+		}
+
+		if (!purple_str_has_prefix(bold_end, "</b></font> ")) {
+			/* "<b> message</b>", maybe in red */
+			*type = strstr(line, "#FF0000") ? PURPLE_MESSAGE_ERROR : PURPLE_MESSAGE_SYSTEM;
+			bold_end = g_strrstr_len(rest, len, "</b>");
+			rest += 3;
+			if (*rest == ' ')
+				rest++;
+			g_string_append_len(message, rest, bold_end - rest);
+			return TRUE;
+		}
+
+		name = g_strndup(rest + 3, bold_end - rest - 3);
+		len -= bold_end + 12 - rest;
+		rest = bold_end + 12;
+	} else {
+		const char *colon = strstr(rest, ": ");
+		const char *space = strchr(rest, ' ');
+
+		if (purple_str_has_prefix(rest, "***") && space != NULL) {
+			name = g_strndup(rest, space - rest);
+			rest = space + 1;
+		} else if (colon != NULL) {
+			name = g_strndup(rest, colon - rest + 1);
+			rest = colon + 2;
+		} else {
+			*type = PURPLE_MESSAGE_SYSTEM;
+		}
+		len = strlen(rest);
+	}
+
+	if (name != NULL) {
+		char *tmp;
+
+		g_strstrip(name);
+		if (purple_str_has_prefix(name, "***")) {
+			*from = g_strdup(name + 3);
+			g_string_append(message, "/me ");
+		} else if (purple_str_has_suffix(name, ":")) {
+			*from = g_strndup(name, strlen(name) - 1);
+		} else {
+			*from = g_strdup(name);
+		}
+		g_free(name);
+
+		if (html) {
+			tmp = purple_unescape_html(*from);
+			g_free(*from);
+			*from = tmp;
+		}
+
+		*type = 0;
+		if (purple_str_has_suffix(*from, " <AUTO-REPLY>")) {
+			(*from)[strlen(*from) - 13] = '\0';
+			*type = PURPLE_MESSAGE_AUTO_RESP;
+		}
+		if (html && strstr(line, "#6C2585"))
+			*type |= PURPLE_MESSAGE_WHISPER;
+		else if (html && strstr(line, "#16569E"))
+			*type |= PURPLE_MESSAGE_SEND;
+		else if (html && strstr(line, "#A82F2F"))
+			*type |= PURPLE_MESSAGE_RECV;
+		else
+			*type |= log_import_direction(log, *from);
+	}
+
+	if (html)
+		g_string_append_len(message, rest, len);
+	else {
+		char *text = g_markup_escape_text(rest, len);
+		g_string_append(message, text);
+		g_free(text);
+	}
+
+	return TRUE;
+}
+
+PurpleLog *
+purple_log_compact_import(PurpleLog *log)
+{
+	PurpleLogCommonLoggerData *data;
+	PurpleLog *copy;
+	gboolean html;
+	char *path, *contents;
+	char **lines;
+	GString *message, *line_message;
+	PurpleMessageFlags type = 0;
+	char *from = NULL;
+	time_t when = 0, last;
+	gboolean pending = FALSE;
+	int i;
+
+	g_return_val_if_fail(log != NULL, NULL);
+
+	if (log->logger != html_logger && log->logger != txt_logger)
+		return NULL;
+	html = (log->logger == html_logger);
+
+	path = log_path_with_ext(log, html ? ".html" : ".txt", ".plog");
+	if (path == NULL)
+		return NULL;
+
+	if (g_file_test(path, G_FILE_TEST_EXISTS)) {
+		purple_debug_info("log", "%s has already been imported\n", path);
+		g_free(path);
+		return NULL;
+	}
+
+	log_writer_sync();
+	data = log->logger_data;
+	if (!g_file_get_contents(data->path, &contents, NULL, NULL)) {
+		g_free(path);
+		return NULL;
+	}
+
+	copy = log_new_for_path(log, compact_logger, g_strdup(path));
+	data = copy->logger_data;
+	if ((data->file = g_fopen(path, "ab")) == NULL) {
+		purple_debug_error("log", "Could not create log file %s\n", path);
+		purple_log_free(copy);
+		g_free(contents);
+		g_free(path);
+		return NULL;
+	}
+
+	message = g_string_new(NULL);
+	line_message = g_string_new(NULL);
+	last = log->time;
+
+	/* Skip the header. */
+	lines = g_strsplit(contents, "\n", -1);
+	g_free(contents);
+	for (i = 1; lines[i] != NULL; i++) {
+		PurpleMessageFlags line_type;
+		char *line_from;
+		char *line = lines[i];
+
+		g_strchomp(line);
+		if (lines[i + 1] == NULL && *line == '\0')
+			break;
+		if (html && (*line == '\0' || purple_strequal(line, "</body></html>")))
+			continue;
+
+		if (log_import_line(log, html, line, &last, &line_type, &line_from, line_message)) {
+			if (pending)
+				purple_log_write(copy, type, from, when, message->str);
+			g_free(from);
+			from = line_from;
+			type = line_type;
+			when = last;
+			g_string_assign(message, line_message->str);
+			pending = TRUE;
+		} else if (pending) {
+			/* A message that ran on to more than one line. */
+			char *text = html ? g_strdup(line) : g_markup_escape_text(line, -1);
+			g_string_append_printf(message, html ? "\n%s" : "<br>%s", text);
+			g_free(text);
+		}
+	}
+	if (pending)
+		purple_log_write(copy, type, from, when, message->str);
+
+	g_strfreev(lines);
+	g_free(from);
+	g_string_free(message, TRUE);
+	g_string_free(line_message, TRUE);
+
+	purple_log_free(copy);
+
+	return log_new_for_path(log, compact_logger, path);
+}
+
+PurpleLog *
+purple_log_compact_export(PurpleLog *log, const char *format)
+{
+	PurpleLogCompactReader *reader;
+	PurpleLogCommonLoggerData *data;
+	PurpleLogLogger *logger;
+	PurpleLog *copy;
+	PurpleMessageFlags type;
+	const char *from;
+	time_t when;
+	char *message, *path;
+
+	g_return_val_if_fail(log != NULL, NULL);
+	g_return_val_if_fail(format != NULL, NULL);
+
+	if (purple_strequal(format, "html"))
+		logger = html_logger;
+	else if (purple_strequal(format, "txt"))
+		logger = txt_logger;
+	else
+		g_return_val_if_reached(NULL);
+
+	/* The other loggers need the account to name the file. */
+	if (log->account == NULL)
+		return NULL;
+
+	path = log_path_with_ext(log, ".plog", logger == html_logger ? ".html" : ".txt");
+	if (path == NULL)
+		return NULL;
+
+	if (g_file_test(path, G_FILE_TEST_EXISTS)) {
+		purple_debug_info("log", "%s already exists\n", path);
+		g_free(path);
+		return NULL;
+	}
+	g_free(path);
+
+	if ((reader = purple_log_compact_reader_new(log)) == NULL)
+		return NULL;
+
+	/* The logger writes its header when it creates the file, so let it. */
+	copy = purple_log_new(log->type, log->name, log->account, NULL, log->time, log->tm);
+	copy->logger = logger;
+	while (purple_log_compact_reader_next(reader, &type, &from, &when, &message)) {
+		purple_log_write(copy, type, from, when, message);
+		g_free(message);
+	}
+	purple_log_compact_reader_free(reader);
+
+	data = copy->logger_data;
+	path = (data != NULL && data->file != NULL) ? g_strdup(data->path) : NULL;
+	purple_log_free(copy);
+
+	return path ? log_new_for_path(log, logger, path) : NULL;
+}
+
+
 /****************
  * OLD LOGGER ***
  ****************/
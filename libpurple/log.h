@@ -38,6 +38,7 @@ typedef struct _PurpleLog PurpleLog;
 typedef struct _PurpleLogLogger PurpleLogLogger;
 typedef struct _PurpleLogCommonLoggerData PurpleLogCommonLoggerData;
 typedef struct _PurpleLogSet PurpleLogSet;
+typedef struct _PurpleLogCompactReader PurpleLogCompactReader;
 
 typedef enum {
 	PURPLE_LOG_IM,
@@ -144,6 +145,26 @@ struct _PurpleLog {
 	 * IMPORTANT: Update that code if you add members here. */
 };
 
+/**
+ * Counters for the background log writer, which does the file I/O for
+ * the built-in loggers when "/purple/logging/async_writes" is set.
+ *
+ * @since 2.10.11
+ */
+typedef struct
+{
+	gboolean active;     /**< Whether the writer thread is running */
+	guint queued;        /**< Writes waiting for the thread right now */
+	guint peak_queued;   /**< The most writes ever waiting at once */
+	guint stalls;        /**< Times logging waited for a full queue */
+	guint errors;        /**< Writes that failed */
+	gulong messages;     /**< Messages written */
+	gulong flushes;      /**< Batches of messages flushed to disk */
+	guint64 bytes;       /**< Bytes written */
+	guint64 total_msecs; /**< Sum of the time messages spent unflushed */
+	guint64 max_msecs;   /**< Longest time a message spent unflushed */
+} PurpleLogWriterStats;
+
 /**
  * A common logger_data struct containing a file handle and path, as well
  * as a pointer to something else for additional data.
@@ -378,6 +399,10 @@ void purple_log_set_free(PurpleLogSet *set);
  * set to a PurpleLogCommonLoggerData struct containing the log
  * file handle and log path.
  *
+ * The path is newly allocated and belongs to the logger, whose
+ * @c finalize function must free it, just as for the logs returned by
+ * purple_log_common_lister().  Before 2.10.11, the path was left NULL.
+ *
  * This function is intended to be used as a "common"
  * implementation of a logger's @c write function.
  * It should only be passed to purple_log_logger_new() and never
@@ -551,6 +576,113 @@ PurpleLogLogger *purple_log_logger_get (void);
  */
 GList *purple_log_logger_get_options(void);
 
+/******************************************/
+/** @name Compact Log Functions           */
+/******************************************/
+/*@{*/
+
+/**
+ * Opens a log written by the "compact" logger for reading.
+ *
+ * Compact logs are binary, with an index of every message's time and
+ * position.  The index is stored at the end of the file once the log is
+ * closed, so opening a log doesn't mean reading all of it.
+ *
+ * @param log  The log, as returned by purple_log_get_logs().
+ *
+ * @return A reader positioned at the first message, or @c NULL if @a log
+ *         isn't a compact log or couldn't be read.
+ *
+ * @since 2.10.11
+ */
+PurpleLogCompactReader *purple_log_compact_reader_new(PurpleLog *log);
+
+/**
+ * Returns the number of messages in a compact log.
+ *
+ * @param reader The reader.
+ *
+ * @return The number of messages.
+ *
+ * @since 2.10.11
+ */
+guint purple_log_compact_reader_get_count(PurpleLogCompactReader *reader);
+
+/**
+ * Moves a reader to the first message logged at or after a given time.
+ *
+ * This is a binary search over the index.
+ *
+ * @param reader The reader.
+ * @param when   The time to seek to.
+ *
+ * @since 2.10.11
+ */
+void purple_log_compact_reader_seek(PurpleLogCompactReader *reader, time_t when);
+
+/**
+ * Reads the next message from a compact log.
+ *
+ * @param reader  The reader.
+ * @param type    Return location for the message's flags, or @c NULL.
+ * @param from    Return location for the sender, or @c NULL.  The string
+ *                belongs to the reader, and is @c NULL for messages
+ *                without a sender.
+ * @param when    Return location for the message's time, or @c NULL.
+ * @param message Return location for the message, or @c NULL.  It must be
+ *                freed with g_free().
+ *
+ * @return @c TRUE if a message was read, or @c FALSE at the end of the log.
+ *
+ * @since 2.10.11
+ */
+gboolean purple_log_compact_reader_next(PurpleLogCompactReader *reader,
+		PurpleMessageFlags *type, const char **from, time_t *when,
+		char **message);
+
+/**
+ * Closes a compact log reader.
+ *
+ * @param reader The reader.
+ *
+ * @since 2.10.11
+ */
+void purple_log_compact_reader_free(PurpleLogCompactReader *reader);
+
+/**
+ * Converts an html or txt log to a compact log in the same directory.
+ *
+ * The html and txt logs only record each message's time formatted for
+ * the locale and its sender as text, so this is a best effort.  Each
+ * message gets the date of the message before it, moving to the next
+ * day when the clock time goes backwards.  In txt logs, a message is
+ * taken to be sent if its sender is the account's username or alias.
+ *
+ * @param log  The html or txt log.
+ *
+ * @return The new compact log, which must be freed with purple_log_free(),
+ *         or @c NULL if @a log couldn't be read or was already converted.
+ *
+ * @since 2.10.11
+ */
+PurpleLog *purple_log_compact_import(PurpleLog *log);
+
+/**
+ * Converts a compact log to an html or txt log in the same directory.
+ *
+ * @param log     The compact log.
+ * @param format  "html" or "txt", as for the "/purple/logging/format"
+ *                preference.
+ *
+ * @return The new log, which must be freed with purple_log_free(), or
+ *         @c NULL if @a log couldn't be read or was already converted.
+ *
+ * @since 2.10.11
+ */
+PurpleLog *purple_log_compact_export(PurpleLog *log, const char *format);
+
+/*@}*/
+
 /**************************************************************************/
 /** @name Log Subsystem                                                   */
 /**************************************************************************/
@@ -573,6 +705,22 @@ void *purple_log_get_handle(void);
  */
 void purple_log_uninit(void);
 
+/**
+ * Gets the background log writer's counters.
+ *
+ * Messages are flushed to disk in batches.  A batch starts when the
+ * writer thread writes its first message, and is flushed
+ * "/purple/logging/flush_interval" milliseconds after that, or once it has
+ * reached "/purple/logging/flush_size" bytes.  Messages that were queued
+ * before the batch started may wait longer than flush_interval.  These
+ * counters show how large the batches are and how long messages wait.
+ *
+ * @param stats The struct to fill in.
+ *
+ * @since 2.10.11
+ */
+void purple_log_writer_get_stats(PurpleLogWriterStats *stats);
+
 /*@}*/
 
 
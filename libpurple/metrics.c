@@ -0,0 +1,312 @@
+/*
+ * purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ *
+ */
+#include "internal.h"
+
+#include "debug.h"
+#include "eventloop.h"
+#include "metrics.h"
+#include "prefs.h"
+#include "util.h"
+
+/*
+ * Values are updated with atomic operations, so metrics can be updated
+ * from any thread without locking.  Older GLibs only have atomic ints.
+ */
+#if GLIB_CHECK_VERSION(2, 30, 0)
+typedef gssize PurpleMetricValue;
+#define metric_value_add(v, n) g_atomic_pointer_add((v), (n))
+#define metric_value_get(v)    ((gssize)g_atomic_pointer_get(v))
+#define metric_value_set(v, n) g_atomic_pointer_set((v), (n))
+#else
+typedef gint PurpleMetricValue;
+#define metric_value_add(v, n) g_atomic_int_add((v), (gint)(n))
+#define metric_value_get(v)    ((gssize)g_atomic_int_get(v))
+#define metric_value_set(v, n) g_atomic_int_set((v), (gint)(n))
+#endif
+
+/* Bucket i counts values below 2^i; the last one counts everything else. */
+#define METRIC_BUCKETS 32
+
+struct _PurpleMetric
+{
+	PurpleMetricType type;
+	char *name;
+	char *description;
+
+	volatile PurpleMetricValue value;   /* The total, for histograms. */
+	volatile gint *buckets;
+};
+
+/* Metrics are never freed, since callers keep pointers to them. */
+static GHashTable *metrics = NULL;
+
+static guint snapshot_timer = 0;
+
+static PurpleMetric *
+metric_get(PurpleMetricType type, const char *name, const char *description)
+{
+	PurpleMetric *metric;
+
+	g_return_val_if_fail(name != NULL, NULL);
+
+	if (metrics == NULL)
+		metrics = g_hash_table_new(g_str_hash, g_str_equal);
+
+	metric = g_hash_table_lookup(metrics, name);
+	if (metric != NULL) {
+		if (metric->type != type)
+			purple_debug_error("metrics", "%s is already registered "
+					"with a different type\n", name);
+		return metric;
+	}
+
+	metric = g_new0(PurpleMetric, 1);
+	metric->type = type;
+	metric->name = g_strdup(name);
+	metric->description = g_strdup(description);
+	if (type == PURPLE_METRIC_HISTOGRAM)
+		metric->buckets = g_new0(gint, METRIC_BUCKETS);
+
+	g_hash_table_insert(metrics, metric->name, metric);
+
+	return metric;
+}
+
+PurpleMetric *
+purple_metrics_get_counter(const char *name, const char *description)
+{
+	return metric_get(PURPLE_METRIC_COUNTER, name, description);
+}
+
+PurpleMetric *
+purple_metrics_get_gauge(const char *name, const char *description)
+{
+	return metric_get(PURPLE_METRIC_GAUGE, name, description);
+}
+
+PurpleMetric *
+purple_metrics_get_histogram(const char *name, const char *description)
+{
+	return metric_get(PURPLE_METRIC_HISTOGRAM, name, description);
+}
+
+void
+purple_metric_add(PurpleMetric *metric, gssize value)
+{
+	g_return_if_fail(metric != NULL);
+	g_return_if_fail(metric->type != PURPLE_METRIC_HISTOGRAM);
+
+	metric_value_add(&metric->value, value);
+}
+
+void
+purple_metric_set(PurpleMetric *metric, gssize value)
+{
+	g_return_if_fail(metric != NULL);
+	g_return_if_fail(metric->type == PURPLE_METRIC_GAUGE);
+
+	metric_value_set(&metric->value, value);
+}
+
+void
+purple_metric_observe(PurpleMetric *metric, gssize value)
+{
+	guint bucket = 0;
+
+	g_return_if_fail(metric != NULL);
+	g_return_if_fail(metric->type == PURPLE_METRIC_HISTOGRAM);
+
+	if (value < 0)
+		value = 0;
+
+	while (bucket < METRIC_BUCKETS - 1 && ((gsize)value >> bucket) != 0)
+		bucket++;
+
+	g_atomic_int_add(&metric->buckets[bucket], 1);
+	metric_value_add(&metric->value, value);
+}
+
+gssize
+purple_metric_get_value(PurpleMetric *metric)
+{
+	gssize count = 0;
+	int i;
+
+	g_return_val_if_fail(metric != NULL, 0);
+
+	if (metric->type != PURPLE_METRIC_HISTOGRAM)
+		return metric_value_get(&metric->value);
+
+	for (i = 0; i < METRIC_BUCKETS; i++)
+		count += g_atomic_int_get(&metric->buckets[i]);
+
+	return count;
+}
+
+PurpleMetricType
+purple_metric_get_type(const PurpleMetric *metric)
+{
+	g_return_val_if_fail(metric != NULL, PURPLE_METRIC_COUNTER);
+
+	return metric->type;
+}
+
+gint64
+purple_metrics_get_time(void)
+{
+#if GLIB_CHECK_VERSION(2, 28, 0)
+	return g_get_monotonic_time();
+#else
+	GTimeVal now;
+
+	g_get_current_time(&now);
+	return (gint64)now.tv_sec * G_USEC_PER_SEC + now.tv_usec;
+#endif
+}
+
+static void
+metric_append(GString *str, PurpleMetric *metric)
+{
+	static const char * const types[] = { "counter", "gauge", "histogram" };
+	gssize count = 0;
+	int i, last = 0;
+
+	if (metric->description != NULL)
+		g_string_append_printf(str, "# HELP %s %s\n", metric->name,
+				metric->description);
+	g_string_append_printf(str, "# TYPE %s %s\n", metric->name,
+			types[metric->type]);
+
+	if (metric->type != PURPLE_METRIC_HISTOGRAM) {
+		g_string_append_printf(str, "%s %" G_GSSIZE_FORMAT "\n", metric->name,
+				metric_value_get(&metric->value));
+		return;
+	}
+
+	/* Leave out the empty buckets at the top. */
+	for (i = 0; i < METRIC_BUCKETS - 1; i++)
+		if (g_atomic_int_get(&metric->buckets[i]) != 0)
+			last = i;
+
+	for (i = 0; i <= last; i++) {
+		count += g_atomic_int_get(&metric->buckets[i]);
+		g_string_append_printf(str, "%s_bucket{le=\"%lu\"} %" G_GSSIZE_FORMAT "\n",
+				metric->name, i == 0 ? 0UL : (1UL << i) - 1, count);
+	}
+	count += g_atomic_int_get(&metric->buckets[METRIC_BUCKETS - 1]);
+	g_string_append_printf(str, "%s_bucket{le=\"+Inf\"} %" G_GSSIZE_FORMAT "\n",
+			metric->name, count);
+	g_string_append_printf(str, "%s_sum %" G_GSSIZE_FORMAT "\n", metric->name,
+			metric_value_get(&metric->value));
+	g_string_append_printf(str, "%s_count %" G_GSSIZE_FORMAT "\n", metric->name,
+			count);
+}
+
+static void
+metric_prepend(gpointer key, gpointer value, gpointer data)
+{
+	GList **list = data;
+
+	*list = g_list_prepend(*list, value);
+}
+
+static gint
+metric_compare(gconstpointer a, gconstpointer b)
+{
+	return strcmp(((const PurpleMetric *)a)->name, ((const PurpleMetric *)b)->name);
+}
+
+char *
+purple_metrics_get_snapshot(void)
+{
+	GString *str = g_string_new(NULL);
+	GList *list = NULL, *l;
+
+	if (metrics != NULL)
+		g_hash_table_foreach(metrics, metric_prepend, &list);
+
+	list = g_list_sort(list, metric_compare);
+	for (l = list; l != NULL; l = l->next)
+		metric_append(str, l->data);
+	g_list_free(list);
+
+	return g_string_free(str, FALSE);
+}
+
+static gboolean
+write_snapshot_cb(gpointer data)
+{
+	char *snapshot = purple_metrics_get_snapshot();
+
+	purple_util_write_data_to_file("metrics.txt", snapshot, -1);
+	g_free(snapshot);
+
+	return TRUE;
+}
+
+static void
+snapshot_interval_changed_cb(const char *name, PurplePrefType type,
+                             gconstpointer value, gpointer data)
+{
+	int interval = GPOINTER_TO_INT(value);
+
+	if (snapshot_timer != 0) {
+		purple_timeout_remove(snapshot_timer);
+		snapshot_timer = 0;
+	}
+
+	if (interval > 0)
+		snapshot_timer = purple_timeout_add_seconds(interval, write_snapshot_cb, NULL);
+}
+
+void *
+purple_metrics_get_handle(void)
+{
+	static int handle;
+
+	return &handle;
+}
+
+void
+purple_metrics_init(void)
+{
+	purple_prefs_add_none("/purple/metrics");
+	purple_prefs_add_int("/purple/metrics/snapshot_interval", 0);
+
+	purple_prefs_connect_callback(purple_metrics_get_handle(),
+			"/purple/metrics/snapshot_interval",
+			snapshot_interval_changed_cb, NULL);
+	purple_prefs_trigger_callback("/purple/metrics/snapshot_interval");
+}
+
+void
+purple_metrics_uninit(void)
+{
+	if (snapshot_timer != 0) {
+		purple_timeout_remove(snapshot_timer);
+		snapshot_timer = 0;
+		write_snapshot_cb(NULL);
+	}
+
+	purple_prefs_disconnect_by_handle(purple_metrics_get_handle());
+}
@@ -0,0 +1,190 @@
+/**
+ * @file metrics.h Metrics API
+ * @ingroup core
+ * @since 2.10.11
+ */
+
+/* purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+#ifndef _PURPLE_METRICS_H_
+#define _PURPLE_METRICS_H_
+
+#include <glib.h>
+
+/**
+ * A metric.  Metrics are created the first time they're asked for, and
+ * live until the process exits, so it's safe to keep pointers to them.
+ */
+typedef struct _PurpleMetric PurpleMetric;
+
+/**
+ * Types of metrics.
+ */
+typedef enum
+{
+	PURPLE_METRIC_COUNTER,    /**< A count that only goes up.                */
+	PURPLE_METRIC_GAUGE,      /**< A value that goes up and down.            */
+	PURPLE_METRIC_HISTOGRAM   /**< A distribution of values, in powers of 2. */
+
+} PurpleMetricType;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**************************************************************************/
+/** @name Metrics API                                                     */
+/**************************************************************************/
+/*@{*/
+
+/**
+ * Finds or creates a counter.
+ *
+ * This must be called from the main thread.  Updating the returned
+ * metric is safe from any thread.
+ *
+ * @param name        The name of the metric.  This should look like
+ *                    @c "subsystem_what_unit", for example
+ *                    @c "jabber_rx_bytes_total".
+ * @param description A short description, shown in snapshots.
+ *
+ * @return The metric.
+ */
+PurpleMetric *purple_metrics_get_counter(const char *name, const char *description);
+
+/**
+ * Finds or creates a gauge.
+ *
+ * @param name        The name of the metric.
+ * @param description A short description, shown in snapshots.
+ *
+ * @return The metric.
+ *
+ * @see purple_metrics_get_counter()
+ */
+PurpleMetric *purple_metrics_get_gauge(const char *name, const char *description);
+
+/**
+ * Finds or creates a histogram.  Values are counted in buckets whose
+ * upper bounds are powers of two, so the unit should be in the name,
+ * for example @c "proxy_connect_ms".
+ *
+ * @param name        The name of the metric.
+ * @param description A short description, shown in snapshots.
+ *
+ * @return The metric.
+ *
+ * @see purple_metrics_get_counter()
+ */
+PurpleMetric *purple_metrics_get_histogram(const char *name, const char *description);
+
+/**
+ * Adds to a counter or gauge.
+ *
+ * @param metric The counter or gauge.
+ * @param value  The amount to add.  This should not be negative for
+ *               counters.
+ */
+void purple_metric_add(PurpleMetric *metric, gssize value);
+
+/**
+ * Sets a gauge.
+ *
+ * @param metric The gauge.
+ * @param value  The new value.
+ */
+void purple_metric_set(PurpleMetric *metric, gssize value);
+
+/**
+ * Records a value in a histogram.
+ *
+ * @param metric The histogram.
+ * @param value  The value.  Negative values are counted as 0.
+ */
+void purple_metric_observe(PurpleMetric *metric, gssize value);
+
+/**
+ * Returns the value of a counter or gauge, or the number of values
+ * recorded in a histogram.
+ *
+ * @param metric The metric.
+ *
+ * @return The value.
+ */
+gssize purple_metric_get_value(PurpleMetric *metric);
+
+/**
+ * Returns the type of a metric.
+ *
+ * @param metric The metric.
+ *
+ * @return The type.
+ */
+PurpleMetricType purple_metric_get_type(const PurpleMetric *metric);
+
+/**
+ * Returns a monotonic time in microseconds, for measuring how long
+ * something took.
+ *
+ * @return The current time.
+ */
+gint64 purple_metrics_get_time(void);
+
+/**
+ * Returns the current value of every metric, in the Prometheus text
+ * format.  This is written to @c metrics.txt in the user directory every
+ * /purple/metrics/snapshot_interval seconds, if that's not 0.
+ *
+ * @return The snapshot.  This must be g_free'd.
+ */
+char *purple_metrics_get_snapshot(void);
+
+/*@}*/
+
+/**************************************************************************/
+/** @name Metrics Subsystem                                               */
+/**************************************************************************/
+/*@{*/
+
+/**
+ * Returns the metrics subsystem handle.
+ *
+ * @return The metrics subsystem handle.
+ */
+void *purple_metrics_get_handle(void);
+
+/**
+ * Initializes the metrics subsystem.
+ */
+void purple_metrics_init(void);
+
+/**
+ * Uninitializes the metrics subsystem.  Metrics themselves are kept.
+ */
+void purple_metrics_uninit(void);
+
+/*@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _PURPLE_METRICS_H_ */
@@ -35,6 +35,7 @@
 #include "util.h"
 #include "valgrind.h"
 #include "version.h"
+#include "xmlnode.h"
 
 typedef struct
 {
@@ -197,50 +198,17 @@ purple_plugin_new(gboolean native, const char *path)
 	return plugin;
 }
 
-PurplePlugin *
-purple_plugin_probe(const char *filename)
-{
 #ifdef PURPLE_PLUGINS
-	PurplePlugin *plugin = NULL;
+/* Opens a plugin's file and fills in its info.  Returns FALSE if it isn't
+ * a plugin at all, or TRUE with plugin->unloadable set if it can't be used. */
+static gboolean
+plugin_open(PurplePlugin *plugin)
+{
+	const char *filename = plugin->path;
 	PurplePlugin *loader;
 	gpointer unpunned;
-	gchar *basename = NULL;
 	gboolean (*purple_init_plugin)(PurplePlugin *);
 
-	purple_debug_misc("plugins", "probing %s\n", filename);
-	g_return_val_if_fail(filename != NULL, NULL);
-
-	if (!g_file_test(filename, G_FILE_TEST_EXISTS))
-		return NULL;
-
-	/* If this plugin has already been probed then exit */
-	basename = purple_plugin_get_basename(filename);
-	plugin = purple_plugins_find_with_basename(basename);
-	g_free(basename);
-	if (plugin != NULL)
-	{
-		if (purple_strequal(filename, plugin->path))
-			return plugin;
-		else if (!purple_plugin_is_unloadable(plugin))
-		{
-			purple_debug_warning("plugins", "Not loading %s. "
-							"Another plugin with the same name (%s) has already been loaded.\n",
-							filename, plugin->path);
-			return plugin;
-		}
-		else
-		{
-			/* The old plugin was a different file and it was unloadable.
-			 * There's no guarantee that this new file with the same name
-			 * will be loadable, but unless it fails in one of the silent
-			 * ways and the first one didn't, it's not any worse.  The user
-			 * will still see a greyed-out plugin, which is what we want. */
-			purple_plugin_destroy(plugin);
-		}
-	}
-
-	plugin = purple_plugin_new(has_file_extension(filename, G_MODULE_SUFFIX), filename);
-
 	if (plugin->native_plugin) {
 		const char *error;
 #ifdef _WIN32
@@ -291,8 +259,7 @@ purple_plugin_probe(const char *filename)
 				/* Restore the original error mode */
 				SetErrorMode(old_error_mode);
 #endif
-				purple_plugin_destroy(plugin);
-				return NULL;
+				return FALSE;
 			}
 			else
 			{
@@ -323,8 +290,7 @@ purple_plugin_probe(const char *filename)
 			/* Restore the original error mode */
 			SetErrorMode(old_error_mode);
 #endif
-			purple_plugin_destroy(plugin);
-			return NULL;
+			return FALSE;
 		}
 		purple_init_plugin = unpunned;
 
@@ -337,8 +303,7 @@ purple_plugin_probe(const char *filename)
 		loader = find_loader_for_plugin(plugin);
 
 		if (loader == NULL) {
-			purple_plugin_destroy(plugin);
-			return NULL;
+			return FALSE;
 		}
 
 		purple_init_plugin = PURPLE_PLUGIN_LOADER_INFO(loader)->probe;
@@ -346,8 +311,7 @@ purple_plugin_probe(const char *filename)
 
 	if (!purple_init_plugin(plugin) || plugin->info == NULL)
 	{
-		purple_plugin_destroy(plugin);
-		return NULL;
+		return FALSE;
 	}
 	else if (plugin->info->ui_requirement &&
 			!purple_strequal(plugin->info->ui_requirement, purple_core_get_ui()))
@@ -356,7 +320,7 @@ purple_plugin_probe(const char *filename)
 					purple_core_get_ui(), plugin->info->ui_requirement);
 		purple_debug_error("plugins", "%s is not loadable: The UI requirement is not met. (%s)\n", plugin->path, plugin->error);
 		plugin->unloadable = TRUE;
-		return plugin;
+		return TRUE;
 	}
 
 	/*
@@ -370,7 +334,7 @@ purple_plugin_probe(const char *filename)
 		plugin->error = g_strdup(_("This plugin has not defined an ID."));
 		purple_debug_error("plugins", "%s is not loadable: info->id is not defined.\n", plugin->path);
 		plugin->unloadable = TRUE;
-		return plugin;
+		return TRUE;
 	}
 
 	/* Really old plugins. */
@@ -440,13 +404,12 @@ purple_plugin_probe(const char *filename)
 			purple_debug_error("plugins", "%s is not loadable: Plugin magic mismatch %d (need %d)\n",
 					  plugin->path, plugin->info->magic, PURPLE_PLUGIN_MAGIC);
 			plugin->unloadable = TRUE;
-			return plugin;
+			return TRUE;
 		}
 
 		purple_debug_error("plugins", "%s is not loadable: Plugin magic mismatch %d (need %d)\n",
 				 plugin->path, plugin->info->magic, PURPLE_PLUGIN_MAGIC);
-		purple_plugin_destroy(plugin);
-		return NULL;
+		return FALSE;
 	}
 
 	if (plugin->info->major_version != PURPLE_MAJOR_VERSION ||
@@ -459,7 +422,7 @@ purple_plugin_probe(const char *filename)
 				 plugin->path, plugin->info->major_version, plugin->info->minor_version,
 				 PURPLE_MAJOR_VERSION, PURPLE_MINOR_VERSION);
 		plugin->unloadable = TRUE;
-		return plugin;
+		return TRUE;
 	}
 
 	if (plugin->info->type == PURPLE_PLUGIN_PROTOCOL)
@@ -473,7 +436,7 @@ purple_plugin_probe(const char *filename)
 			purple_debug_error("plugins", "%s is not loadable: %s\n",
 					 plugin->path, plugin->error);
 			plugin->unloadable = TRUE;
-			return plugin;
+			return TRUE;
 		}
 
 		/* For debugging, let's warn about prpl prefs. */
@@ -484,6 +447,446 @@ purple_plugin_probe(const char *filename)
 		}
 	}
 
+	return TRUE;
+}
+#endif /* PURPLE_PLUGINS */
+
+/**************************************************************************
+ * Plugin Cache
+ **************************************************************************/
+#ifdef PURPLE_PLUGINS
+/*
+ * Probing a plugin means opening it, which for native plugins maps the
+ * module and all of its dependencies, and for scripts means running them
+ * in their loader.  To avoid doing that at every startup for plugins that
+ * aren't going to be loaded, the info of standard plugins is cached,
+ * keyed by the path, modification time and size of the file.  A plugin
+ * found in the cache is listed with a copy of its cached info, and isn't
+ * opened until it's loaded.
+ */
+typedef struct
+{
+	char *path;
+	time_t mtime;
+	gint64 size;
+	gboolean native;
+	PurplePluginInfo *info;
+	gboolean seen;             /* Found by a probe this session. */
+
+} PurplePluginCacheEntry;
+
+static GHashTable *plugin_cache = NULL;   /* path -> PurplePluginCacheEntry */
+static GHashTable *cached_plugins = NULL; /* PurplePlugin -> cached info */
+static gboolean plugin_cache_dirty = FALSE;
+static int probe_depth = 0;
+
+static PurplePluginInfo *
+plugin_info_copy(const PurplePluginInfo *info)
+{
+	PurplePluginInfo *copy = g_new0(PurplePluginInfo, 1);
+	GList *l;
+
+	copy->magic          = PURPLE_PLUGIN_MAGIC;
+	copy->major_version  = info->major_version;
+	copy->minor_version  = info->minor_version;
+	copy->type           = info->type;
+	copy->ui_requirement = g_strdup(info->ui_requirement);
+	copy->flags          = info->flags;
+	copy->priority       = info->priority;
+	copy->id             = g_strdup(info->id);
+	copy->name           = g_strdup(info->name);
+	copy->version        = g_strdup(info->version);
+	copy->summary        = g_strdup(info->summary);
+	copy->description    = g_strdup(info->description);
+	copy->author         = g_strdup(info->author);
+	copy->homepage       = g_strdup(info->homepage);
+
+	for (l = info->dependencies; l != NULL; l = l->next)
+		copy->dependencies = g_list_append(copy->dependencies, g_strdup(l->data));
+
+	return copy;
+}
+
+static void
+plugin_info_free(PurplePluginInfo *info)
+{
+	g_free(info->ui_requirement);
+	g_free(info->id);
+	g_free(info->name);
+	g_free(info->version);
+	g_free(info->summary);
+	g_free(info->description);
+	g_free(info->author);
+	g_free(info->homepage);
+
+	while (info->dependencies != NULL) {
+		g_free(info->dependencies->data);
+		info->dependencies = g_list_delete_link(info->dependencies, info->dependencies);
+	}
+
+	g_free(info);
+}
+
+static void
+plugin_cache_entry_free(PurplePluginCacheEntry *entry)
+{
+	g_free(entry->path);
+	plugin_info_free(entry->info);
+	g_free(entry);
+}
+
+/* Only plugins that would be listed but not loaded at startup are worth
+ * caching, and only if they can be loaded. */
+static gboolean
+plugin_is_cacheable(const PurplePlugin *plugin)
+{
+	return plugin->info != NULL && plugin->error == NULL && !plugin->unloadable &&
+		plugin->info->magic == PURPLE_PLUGIN_MAGIC &&
+		plugin->info->type == PURPLE_PLUGIN_STANDARD;
+}
+
+static char *
+plugin_cache_get_filename(void)
+{
+	const char *ui = purple_core_get_ui();
+
+	/* The UIs share the user directory but not their plugins. */
+	return g_strdup_printf("plugin-cache-%s.xml",
+			purple_escape_filename(ui ? ui : "purple"));
+}
+
+static const char *
+plugin_cache_get_locale(void)
+{
+	/* Plugins translate their info when they're probed. */
+	return g_get_language_names()[0];
+}
+
+static void
+plugin_cache_add_string(xmlnode *node, const char *name, const char *value)
+{
+	if (value != NULL)
+		xmlnode_insert_data(xmlnode_new_child(node, name), value, -1);
+}
+
+static char *
+plugin_cache_get_string(xmlnode *node, const char *name)
+{
+	xmlnode *child = xmlnode_get_child(node, name);
+
+	return child ? xmlnode_get_data(child) : NULL;
+}
+
+static void
+plugin_cache_entry_to_xmlnode(gpointer key, gpointer value, gpointer user_data)
+{
+	PurplePluginCacheEntry *entry = value;
+	PurplePluginInfo *info = entry->info;
+	xmlnode *node;
+	char buf[32];
+	GList *l;
+
+	if (!entry->seen)
+		return;
+
+	node = xmlnode_new_child(user_data, "plugin");
+	xmlnode_set_attrib(node, "path", entry->path);
+	g_snprintf(buf, sizeof(buf), "%" G_GINT64_FORMAT, (gint64)entry->mtime);
+	xmlnode_set_attrib(node, "mtime", buf);
+	g_snprintf(buf, sizeof(buf), "%" G_GINT64_FORMAT, entry->size);
+	xmlnode_set_attrib(node, "size", buf);
+	xmlnode_set_attrib(node, "native", entry->native ? "1" : "0");
+	g_snprintf(buf, sizeof(buf), "%u.%u", info->major_version, info->minor_version);
+	xmlnode_set_attrib(node, "abi", buf);
+	g_snprintf(buf, sizeof(buf), "%d", info->type);
+	xmlnode_set_attrib(node, "type", buf);
+	g_snprintf(buf, sizeof(buf), "%lu", info->flags);
+	xmlnode_set_attrib(node, "flags", buf);
+	g_snprintf(buf, sizeof(buf), "%d", info->priority);
+	xmlnode_set_attrib(node, "priority", buf);
+
+	plugin_cache_add_string(node, "id", info->id);
+	plugin_cache_add_string(node, "name", info->name);
+	plugin_cache_add_string(node, "version", info->version);
+	plugin_cache_add_string(node, "summary", info->summary);
+	plugin_cache_add_string(node, "description", info->description);
+	plugin_cache_add_string(node, "author", info->author);
+	plugin_cache_add_string(node, "homepage", info->homepage);
+	plugin_cache_add_string(node, "ui-requirement", info->ui_requirement);
+
+	for (l = info->dependencies; l != NULL; l = l->next)
+		plugin_cache_add_string(node, "dependency", l->data);
+}
+
+static PurplePluginCacheEntry *
+plugin_cache_entry_from_xmlnode(xmlnode *node)
+{
+	PurplePluginCacheEntry *entry;
+	PurplePluginInfo *info;
+	const char *path, *mtime, *size, *abi, *type;
+	xmlnode *child;
+
+	path = xmlnode_get_attrib(node, "path");
+	mtime = xmlnode_get_attrib(node, "mtime");
+	size = xmlnode_get_attrib(node, "size");
+	abi = xmlnode_get_attrib(node, "abi");
+	type = xmlnode_get_attrib(node, "type");
+	if (path == NULL || mtime == NULL || size == NULL || abi == NULL || type == NULL)
+		return NULL;
+
+	info = g_new0(PurplePluginInfo, 1);
+	info->magic = PURPLE_PLUGIN_MAGIC;
+	info->type = atoi(type);
+	if (sscanf(abi, "%u.%u", &info->major_version, &info->minor_version) != 2 ||
+			info->type != PURPLE_PLUGIN_STANDARD ||
+			(info->id = plugin_cache_get_string(node, "id")) == NULL ||
+			(info->name = plugin_cache_get_string(node, "name")) == NULL) {
+		plugin_info_free(info);
+		return NULL;
+	}
+
+	info->flags = strtoul(xmlnode_get_attrib(node, "flags") ?
+			xmlnode_get_attrib(node, "flags") : "0", NULL, 10);
+	info->priority = atoi(xmlnode_get_attrib(node, "priority") ?
+			xmlnode_get_attrib(node, "priority") : "0");
+	info->version = plugin_cache_get_string(node, "version");
+	info->summary = plugin_cache_get_string(node, "summary");
+	info->description = plugin_cache_get_string(node, "description");
+	info->author = plugin_cache_get_string(node, "author");
+	info->homepage = plugin_cache_get_string(node, "homepage");
+	info->ui_requirement = plugin_cache_get_string(node, "ui-requirement");
+
+	for (child = xmlnode_get_child(node, "dependency"); child != NULL;
+			child = xmlnode_get_next_twin(child)) {
+		char *dep = xmlnode_get_data(child);
+		if (dep != NULL)
+			info->dependencies = g_list_append(info->dependencies, dep);
+	}
+
+	entry = g_new0(PurplePluginCacheEntry, 1);
+	entry->path = g_strdup(path);
+	entry->mtime = (time_t)g_ascii_strtoll(mtime, NULL, 10);
+	entry->size = g_ascii_strtoll(size, NULL, 10);
+	entry->native = purple_strequal(xmlnode_get_attrib(node, "native"), "1");
+	entry->info = info;
+
+	return entry;
+}
+
+static void
+plugin_cache_load(void)
+{
+	xmlnode *root, *node;
+	char *filename;
+
+	plugin_cache = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+			(GDestroyNotify)plugin_cache_entry_free);
+	cached_plugins = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	filename = plugin_cache_get_filename();
+	root = purple_util_read_xml_from_file(filename, _("plugin cache"));
+	g_free(filename);
+	if (root == NULL)
+		return;
+
+	/* A new libpurple may not accept the same plugins, and the cached
+	 * info is translated. */
+	if (!purple_strequal(xmlnode_get_attrib(root, "libpurple"), purple_core_get_version()) ||
+			!purple_strequal(xmlnode_get_attrib(root, "locale"), plugin_cache_get_locale())) {
+		purple_debug_info("plugins", "Ignoring the plugin cache from another "
+				"version or locale\n");
+		xmlnode_free(root);
+		return;
+	}
+
+	for (node = xmlnode_get_child(root, "plugin"); node != NULL;
+			node = xmlnode_get_next_twin(node)) {
+		PurplePluginCacheEntry *entry = plugin_cache_entry_from_xmlnode(node);
+		if (entry != NULL)
+			g_hash_table_replace(plugin_cache, entry->path, entry);
+	}
+
+	xmlnode_free(root);
+
+	purple_debug_info("plugins", "Read %u plugins from the plugin cache\n",
+			g_hash_table_size(plugin_cache));
+}
+
+static void
+plugin_cache_count_seen(gpointer key, gpointer value, gpointer user_data)
+{
+	if (((PurplePluginCacheEntry *)value)->seen)
+		(*(guint *)user_data)++;
+}
+
+static void
+plugin_cache_save(void)
+{
+	xmlnode *root;
+	char *data, *filename;
+	guint seen = 0;
+
+	if (plugin_cache == NULL)
+		return;
+
+	/* Entries for files that weren't found again are dropped. */
+	g_hash_table_foreach(plugin_cache, plugin_cache_count_seen, &seen);
+	if (!plugin_cache_dirty && seen == g_hash_table_size(plugin_cache))
+		return;
+
+	root = xmlnode_new("plugin-cache");
+	xmlnode_set_attrib(root, "version", "1.0");
+	xmlnode_set_attrib(root, "libpurple", purple_core_get_version());
+	xmlnode_set_attrib(root, "locale", plugin_cache_get_locale());
+	g_hash_table_foreach(plugin_cache, plugin_cache_entry_to_xmlnode, root);
+
+	data = xmlnode_to_formatted_str(root, NULL);
+	filename = plugin_cache_get_filename();
+	purple_util_write_data_to_file(filename, data, -1);
+	g_free(filename);
+	g_free(data);
+	xmlnode_free(root);
+
+	plugin_cache_dirty = FALSE;
+}
+
+/* Probes a file found in a search path, listing it from the cache if it
+ * hasn't changed since it was cached. */
+static void
+plugin_cache_probe(const char *path)
+{
+	PurplePluginCacheEntry *entry;
+	PurplePlugin *plugin;
+	struct stat st;
+	char *basename;
+
+	if (g_stat(path, &st) != 0)
+		return;
+
+	entry = g_hash_table_lookup(plugin_cache, path);
+	if (entry != NULL && entry->mtime == st.st_mtime && entry->size == (gint64)st.st_size) {
+		entry->seen = TRUE;
+
+		basename = purple_plugin_get_basename(path);
+		plugin = purple_plugins_find_with_basename(basename);
+		g_free(basename);
+
+		/* Let purple_plugin_probe() sort out plugins with the same name. */
+		if (plugin == NULL) {
+			plugin = purple_plugin_new(entry->native, path);
+			plugin->info = plugin_info_copy(entry->info);
+			g_hash_table_insert(cached_plugins, plugin, plugin->info);
+			plugins = g_list_append(plugins, plugin);
+			return;
+		}
+	}
+
+	plugin = purple_plugin_probe(path);
+
+	if (plugin != NULL && purple_strequal(plugin->path, path) &&
+			!g_hash_table_lookup(cached_plugins, plugin) &&
+			plugin_is_cacheable(plugin) &&
+			(entry == NULL || !entry->seen)) {
+		entry = g_new0(PurplePluginCacheEntry, 1);
+		entry->path = g_strdup(path);
+		entry->mtime = st.st_mtime;
+		entry->size = st.st_size;
+		entry->native = plugin->native_plugin;
+		entry->info = plugin_info_copy(plugin->info);
+		entry->seen = TRUE;
+		g_hash_table_replace(plugin_cache, entry->path, entry);
+		plugin_cache_dirty = TRUE;
+	}
+}
+
+/* Opens a plugin listed from the cache.  Returns FALSE if it can't be
+ * loaded. */
+static gboolean
+plugin_cache_open(PurplePlugin *plugin)
+{
+	PurplePluginInfo *cached;
+
+	if (cached_plugins == NULL ||
+			(cached = g_hash_table_lookup(cached_plugins, plugin)) == NULL)
+		return TRUE;
+
+	purple_debug_info("plugins", "Opening cached plugin %s\n", plugin->path);
+
+	g_hash_table_remove(cached_plugins, plugin);
+	plugin->info = NULL;
+
+	if (!plugin_open(plugin)) {
+		if (plugin->handle != NULL) {
+			g_module_close(plugin->handle);
+			plugin->handle = NULL;
+		}
+		plugin->info = cached;
+		g_hash_table_insert(cached_plugins, plugin, cached);
+		if (plugin->error == NULL)
+			plugin->error = g_strdup(_("Unknown error"));
+		plugin->unloadable = TRUE;
+	} else {
+		plugin_info_free(cached);
+	}
+
+	if (plugin->unloadable) {
+		/* Something it needs has changed, so probe it next time. */
+		g_hash_table_remove(plugin_cache, plugin->path);
+		plugin_cache_dirty = TRUE;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+#endif /* PURPLE_PLUGINS */
+
+PurplePlugin *
+purple_plugin_probe(const char *filename)
+{
+#ifdef PURPLE_PLUGINS
+	PurplePlugin *plugin = NULL;
+	gchar *basename = NULL;
+
+	purple_debug_misc("plugins", "probing %s\n", filename);
+	g_return_val_if_fail(filename != NULL, NULL);
+
+	if (!g_file_test(filename, G_FILE_TEST_EXISTS))
+		return NULL;
+
+	/* If this plugin has already been probed then exit */
+	basename = purple_plugin_get_basename(filename);
+	plugin = purple_plugins_find_with_basename(basename);
+	g_free(basename);
+	if (plugin != NULL)
+	{
+		if (purple_strequal(filename, plugin->path))
+			return plugin;
+		else if (!purple_plugin_is_unloadable(plugin))
+		{
+			purple_debug_warning("plugins", "Not loading %s. "
+							"Another plugin with the same name (%s) has already been loaded.\n",
+							filename, plugin->path);
+			return plugin;
+		}
+		else
+		{
+			/* The old plugin was a different file and it was unloadable.
+			 * There's no guarantee that this new file with the same name
+			 * will be loadable, but unless it fails in one of the silent
+			 * ways and the first one didn't, it's not any worse.  The user
+			 * will still see a greyed-out plugin, which is what we want. */
+			purple_plugin_destroy(plugin);
+		}
+	}
+
+	plugin = purple_plugin_new(has_file_extension(filename, G_MODULE_SUFFIX), filename);
+
+	if (!plugin_open(plugin))
+	{
+		purple_plugin_destroy(plugin);
+		return NULL;
+	}
+
 	return plugin;
 #else
 	return NULL;
@@ -516,6 +919,9 @@ purple_plugin_load(PurplePlugin *plugin)
 	if (purple_plugin_is_unloadable(plugin))
 		return FALSE;
 
+	if (!plugin_cache_open(plugin))
+		return FALSE;
+
 	g_return_val_if_fail(plugin->error == NULL, FALSE);
 
 	/*
@@ -799,6 +1205,14 @@ purple_plugin_destroy(PurplePlugin *plugin)
 	if (load_queue != NULL)
 		load_queue = g_list_remove(load_queue, plugin);
 
+	if (cached_plugins != NULL && g_hash_table_lookup(cached_plugins, plugin) != NULL)
+	{
+		/* It was never opened, so there's nothing else to clean up. */
+		g_hash_table_remove(cached_plugins, plugin);
+		plugin_info_free(plugin->info);
+		plugin->info = NULL;
+	}
+
 	/* true, this may leak a little memory if there is a major version
 	 * mismatch, but it's a lot better than trying to free something
 	 * we shouldn't, and crashing while trying to load an old plugin */
@@ -1205,6 +1619,16 @@ purple_plugins_uninit(void)
 		g_free(search_paths->data);
 		search_paths = g_list_delete_link(search_paths, search_paths);
 	}
+
+#ifdef PURPLE_PLUGINS
+	if (plugin_cache != NULL) {
+		plugin_cache_save();
+		g_hash_table_destroy(plugin_cache);
+		plugin_cache = NULL;
+		g_hash_table_destroy(cached_plugins);
+		cached_plugins = NULL;
+	}
+#endif
 }
 
 /**************************************************************************
@@ -1361,6 +1785,10 @@ purple_plugins_probe(const char *ext)
 	if (!g_module_supported())
 		return;
 
+	if (plugin_cache == NULL)
+		plugin_cache_load();
+	probe_depth++;
+
 	/* Probe plugins */
 	for (cur = search_paths; cur != NULL; cur = cur->next)
 	{
@@ -1375,7 +1803,7 @@ purple_plugins_probe(const char *ext)
 				path = g_build_filename(search_path, file, NULL);
 
 				if (ext == NULL || has_file_extension(file, ext))
-					purple_plugin_probe(path);
+					plugin_cache_probe(path);
 
 				g_free(path);
 			}
@@ -1437,6 +1865,10 @@ purple_plugins_probe(const char *ext)
 		}
 	}
 
+	/* Save once the loaders have probed their scripts, too. */
+	if (--probe_depth == 0)
+		plugin_cache_save();
+
 	if (probe_cb != NULL)
 		probe_cb(probe_cb_data);
 
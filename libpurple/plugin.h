@@ -553,6 +553,10 @@ void purple_plugins_load_saved(const char *key);
 /**
  * Probes for plugins in the registered module paths.
  *
+ * Standard plugins whose files haven't changed since they were last probed
+ * are listed with the info cached from then, and aren't opened until
+ * they're loaded with purple_plugin_load().
+ *
  * @param ext The extension type to probe for, or @c NULL for all.
  *
  * @see purple_plugin_set_probe_path()
@@ -43,6 +43,11 @@ typedef struct
 
 static gnutls_certificate_client_credentials xcred = NULL;
 
+/* Session data from the last full handshake with each "host:port", offered
+ * to the server on the next connection so it can skip the key exchange.
+ * Values are GByteArrays. */
+static GHashTable *session_cache = NULL;
+
 #ifdef HAVE_GNUTLS_PRIORITY_FUNCS
 /* Priority strings.  The default one is, well, the default (and is always
  * set).  The hash table is of the form hostname => priority (both
@@ -189,6 +194,11 @@ ssl_gnutls_init(void)
 static void
 ssl_gnutls_uninit(void)
 {
+	if (session_cache) {
+		g_hash_table_destroy(session_cache);
+		session_cache = NULL;
+	}
+
 	gnutls_global_deinit();
 
 	gnutls_certificate_free_credentials(xcred);
@@ -205,6 +215,70 @@ ssl_gnutls_uninit(void)
 #endif
 }
 
+static void
+session_cache_array_free(GByteArray *array)
+{
+	g_byte_array_free(array, TRUE);
+}
+
+static gchar *
+session_cache_key(PurpleSslConnection *gsc)
+{
+	return g_strdup_printf("%s:%d", gsc->host, gsc->port);
+}
+
+static void
+ssl_gnutls_resume_session(PurpleSslConnection *gsc)
+{
+	PurpleSslGnutlsData *gnutls_data = PURPLE_SSL_GNUTLS_DATA(gsc);
+	GByteArray *data;
+	gchar *key;
+
+	if (gsc->host == NULL || session_cache == NULL)
+		return;
+
+	key = session_cache_key(gsc);
+	data = g_hash_table_lookup(session_cache, key);
+	g_free(key);
+
+	if (data != NULL)
+		gnutls_session_set_data(gnutls_data->session, data->data, data->len);
+}
+
+static void
+ssl_gnutls_save_session(PurpleSslConnection *gsc)
+{
+	PurpleSslGnutlsData *gnutls_data = PURPLE_SSL_GNUTLS_DATA(gsc);
+	GByteArray *data;
+	size_t size = 0;
+
+	if (gsc->host == NULL)
+		return;
+
+	if (gnutls_session_is_resumed(gnutls_data->session)) {
+		purple_debug_info("gnutls", "Resumed session with %s\n", gsc->host);
+		return;
+	}
+
+	if (gnutls_session_get_data(gnutls_data->session, NULL, &size) != 0 ||
+			size == 0)
+		return;
+
+	data = g_byte_array_sized_new(size);
+	g_byte_array_set_size(data, size);
+	if (gnutls_session_get_data(gnutls_data->session, data->data, &size) != 0) {
+		g_byte_array_free(data, TRUE);
+		return;
+	}
+	g_byte_array_set_size(data, size);
+
+	if (session_cache == NULL)
+		session_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+				g_free, (GDestroyNotify)session_cache_array_free);
+
+	g_hash_table_replace(session_cache, session_cache_key(gsc), data);
+}
+
 static void
 ssl_gnutls_verified_cb(PurpleCertificateVerificationStatus st,
 		       gpointer userdata)
@@ -212,6 +286,9 @@ ssl_gnutls_verified_cb(PurpleCertificateVerificationStatus st,
 	PurpleSslConnection *gsc = (PurpleSslConnection *) userdata;
 
 	if (st == PURPLE_CERTIFICATE_VALID) {
+		/* Only sessions with a trusted peer are worth resuming */
+		ssl_gnutls_save_session(gsc);
+
 		/* Certificate valid? Good! Do the connection! */
 		gsc->connect_cb(gsc->connect_cb_data, gsc, PURPLE_INPUT_READ);
 	} else {
@@ -361,7 +438,8 @@ static void ssl_gnutls_handshake_cb(gpointer data, gint source,
 			purple_certificate_destroy_list(peers);
 		} else {
 			/* Otherwise, just call the "connection complete"
-			   callback */
+			   callback.  Without a verifier the peer isn't trusted,
+			   so the session isn't saved for resuming. */
 			gsc->connect_cb(gsc->connect_cb_data, gsc, cond);
 		}
 	}
@@ -415,6 +493,8 @@ ssl_gnutls_connect(PurpleSslConnection *gsc)
 	gnutls_credentials_set(gnutls_data->session, GNUTLS_CRD_CERTIFICATE,
 		xcred);
 
+	ssl_gnutls_resume_session(gsc);
+
 	gnutls_transport_set_ptr(gnutls_data->session, GINT_TO_POINTER(gsc->fd));
 
 	gnutls_data->handshake_handler = purple_input_add(gsc->fd,
@@ -45,6 +45,7 @@ struct pref_cb {
 	gpointer data;
 	guint id;
 	void *handle;
+	struct purple_pref *pref;
 };
 
 /* TODO: This should use PurpleValues? */
@@ -62,6 +63,10 @@ struct purple_pref {
 	struct purple_pref *parent;
 	struct purple_pref *sibling;
 	struct purple_pref *first_child;
+
+	/* The serialization of this subtree, if it hasn't changed since it
+	 * was last written.  Only kept for prefs near the root. */
+	char *xml;
 };
 
 
@@ -79,6 +84,30 @@ static GHashTable *prefs_hash = NULL;
 static guint       save_timer = 0;
 static gboolean    prefs_loaded = FALSE;
 
+/* Callbacks by id, and lists of callbacks by handle, so disconnecting
+ * doesn't have to search the whole tree. */
+static GHashTable *callbacks_by_id = NULL;
+static GHashTable *callbacks_by_handle = NULL;
+
+/* Depth down to which subtrees cache their serialization */
+#define PREFS_CACHE_DEPTH 2
+
+/*
+ * prefs.xml is written by a background thread.  Only the newest
+ * serialization matters, so one that is still waiting to be written when
+ * another comes along is simply replaced.
+ */
+static struct
+{
+	GThreadPool *pool;
+	GMutex *mutex;
+	GCond *idle;   /* Signalled when the writer runs out of work */
+	char *path;
+	char *pending;
+	gboolean busy;
+	char *error;   /* The last error, to be logged on the main thread */
+} prefs_writer;
+
 
 /*********************************************************************
  * Private utility functions                                         *
@@ -109,93 +138,275 @@ purple_pref *find_pref(const char *name)
  * Writing to disk                                                   *
  *********************************************************************/
 
+/* Marks a pref's subtree, and those of all its parents, as changed. */
+static void
+pref_changed(struct purple_pref *pref)
+{
+	for (; pref != NULL; pref = pref->parent) {
+		g_free(pref->xml);
+		pref->xml = NULL;
+	}
+}
+
+static void
+pref_append_attrib(GString *str, const char *name, const char *value)
+{
+	char *escaped = g_markup_escape_text(value, -1);
+
+	g_string_append_printf(str, " %s='%s'", name, escaped);
+	g_free(escaped);
+}
+
+static void
+pref_append_tabs(GString *str, int depth)
+{
+	while (depth-- > 0)
+		g_string_append_c(str, '\t');
+}
+
+static void pref_to_string(GString *str, struct purple_pref *pref, int depth);
+
 /*
- * This function recursively creates the xmlnode tree from the prefs
- * tree structure.  Yay recursion!
+ * This function recursively serializes the prefs tree, in the same
+ * format xmlnode_to_formatted_str() would.  Yay recursion!
  */
 static void
-pref_to_xmlnode(xmlnode *parent, struct purple_pref *pref)
+pref_write_string(GString *str, struct purple_pref *pref, int depth)
 {
-	xmlnode *node, *childnode;
 	struct purple_pref *child;
 	char buf[21];
 	GList *cur;
+	gboolean has_items = FALSE;
 
-	/* Create a new node */
-	node = xmlnode_new_child(parent, "pref");
-	xmlnode_set_attrib(node, "name", pref->name);
+	pref_append_tabs(str, depth);
+	g_string_append(str, "<pref");
+	pref_append_attrib(str, "name", pref->name);
 
 	/* Set the type of this node (if type == PURPLE_PREF_NONE then do nothing) */
 	if (pref->type == PURPLE_PREF_INT) {
-		xmlnode_set_attrib(node, "type", "int");
+		pref_append_attrib(str, "type", "int");
 		g_snprintf(buf, sizeof(buf), "%d", pref->value.integer);
-		xmlnode_set_attrib(node, "value", buf);
+		pref_append_attrib(str, "value", buf);
 	}
 	else if (pref->type == PURPLE_PREF_STRING) {
-		xmlnode_set_attrib(node, "type", "string");
-		xmlnode_set_attrib(node, "value", pref->value.string ? pref->value.string : "");
+		pref_append_attrib(str, "type", "string");
+		pref_append_attrib(str, "value", pref->value.string ? pref->value.string : "");
 	}
 	else if (pref->type == PURPLE_PREF_STRING_LIST) {
-		xmlnode_set_attrib(node, "type", "stringlist");
-		for (cur = pref->value.stringlist; cur != NULL; cur = cur->next)
-		{
-			childnode = xmlnode_new_child(node, "item");
-			xmlnode_set_attrib(childnode, "value", cur->data ? cur->data : "");
-		}
+		pref_append_attrib(str, "type", "stringlist");
+		has_items = (pref->value.stringlist != NULL);
 	}
 	else if (pref->type == PURPLE_PREF_PATH) {
 		char *encoded = g_filename_to_utf8(pref->value.string ? pref->value.string : "", -1, NULL, NULL, NULL);
-		xmlnode_set_attrib(node, "type", "path");
-		xmlnode_set_attrib(node, "value", encoded);
+		pref_append_attrib(str, "type", "path");
+		if (encoded != NULL)
+			pref_append_attrib(str, "value", encoded);
 		g_free(encoded);
 	}
 	else if (pref->type == PURPLE_PREF_PATH_LIST) {
-		xmlnode_set_attrib(node, "type", "pathlist");
-		for (cur = pref->value.stringlist; cur != NULL; cur = cur->next)
-		{
-			char *encoded = g_filename_to_utf8(cur->data ? cur->data : "", -1, NULL, NULL, NULL);
-			childnode = xmlnode_new_child(node, "item");
-			xmlnode_set_attrib(childnode, "value", encoded);
-			g_free(encoded);
-		}
+		pref_append_attrib(str, "type", "pathlist");
+		has_items = (pref->value.stringlist != NULL);
 	}
 	else if (pref->type == PURPLE_PREF_BOOLEAN) {
-		xmlnode_set_attrib(node, "type", "bool");
+		pref_append_attrib(str, "type", "bool");
 		g_snprintf(buf, sizeof(buf), "%d", pref->value.boolean);
-		xmlnode_set_attrib(node, "value", buf);
+		pref_append_attrib(str, "value", buf);
+	}
+
+	if (!has_items && pref->first_child == NULL) {
+		g_string_append(str, "/>\n");
+		return;
+	}
+	g_string_append(str, ">\n");
+
+	for (cur = has_items ? pref->value.stringlist : NULL; cur != NULL; cur = cur->next)
+	{
+		pref_append_tabs(str, depth + 1);
+		g_string_append(str, "<item");
+		if (pref->type == PURPLE_PREF_PATH_LIST) {
+			char *encoded = g_filename_to_utf8(cur->data ? cur->data : "", -1, NULL, NULL, NULL);
+			if (encoded != NULL)
+				pref_append_attrib(str, "value", encoded);
+			g_free(encoded);
+		} else {
+			pref_append_attrib(str, "value", cur->data ? cur->data : "");
+		}
+		g_string_append(str, "/>\n");
 	}
 
 	/* All My Children */
 	for (child = pref->first_child; child != NULL; child = child->sibling)
-		pref_to_xmlnode(node, child);
+		pref_to_string(str, child, depth + 1);
+
+	pref_append_tabs(str, depth);
+	g_string_append(str, "</pref>\n");
 }
 
-static xmlnode *
-prefs_to_xmlnode(void)
+/* Serializes a pref, reusing or updating its cached serialization. */
+static void
+pref_to_string(GString *str, struct purple_pref *pref, int depth)
 {
-	xmlnode *node;
-	struct purple_pref *pref, *child;
+	gsize start = str->len;
+
+	if (pref->xml != NULL) {
+		g_string_append(str, pref->xml);
+		return;
+	}
 
-	pref = &prefs;
+	pref_write_string(str, pref, depth);
+
+	if (depth <= PREFS_CACHE_DEPTH)
+		pref->xml = g_strndup(str->str + start, str->len - start);
+}
+
+static char *
+prefs_to_string(void)
+{
+	GString *str = g_string_new("<?xml version='1.0' encoding='UTF-8' ?>\n\n");
+	struct purple_pref *child;
 
-	/* Create the root preference node */
-	node = xmlnode_new("pref");
-	xmlnode_set_attrib(node, "version", "1");
-	xmlnode_set_attrib(node, "name", "/");
+	/* The root preference node */
+	g_string_append(str, "<pref version='1' name='/'>\n");
 
 	/* All My Children */
-	for (child = pref->first_child; child != NULL; child = child->sibling)
-		pref_to_xmlnode(node, child);
+	for (child = prefs.first_child; child != NULL; child = child->sibling)
+		pref_to_string(str, child, 1);
+
+	g_string_append(str, "</pref>\n");
+
+	return g_string_free(str, FALSE);
+}
 
-	return node;
+char *
+_purple_prefs_to_string(void)
+{
+	return prefs_to_string();
 }
 
 static void
-sync_prefs(void)
+prefs_writer_thread(gpointer data, gpointer user_data)
+{
+	GError *error = NULL;
+	char *xml;
+
+	g_mutex_lock(prefs_writer.mutex);
+	while ((xml = prefs_writer.pending) != NULL) {
+		prefs_writer.pending = NULL;
+		g_mutex_unlock(prefs_writer.mutex);
+
+		_purple_util_write_file(prefs_writer.path, xml, -1, &error);
+		g_free(xml);
+
+		g_mutex_lock(prefs_writer.mutex);
+		if (error != NULL) {
+			g_free(prefs_writer.error);
+			prefs_writer.error = g_strdup(error->message);
+			g_error_free(error);
+			error = NULL;
+		}
+	}
+	prefs_writer.busy = FALSE;
+	g_cond_broadcast(prefs_writer.idle);
+	g_mutex_unlock(prefs_writer.mutex);
+}
+
+static gboolean
+prefs_writer_start(void)
+{
+	const char *user_dir = purple_user_dir();
+	GError *error = NULL;
+
+	if (prefs_writer.pool != NULL)
+		return TRUE;
+
+	if (!g_thread_supported() || user_dir == NULL)
+		return FALSE;
+
+	/* Create the user directory here, where errors can be logged. */
+	if (purple_build_dir(user_dir, S_IRUSR | S_IWUSR | S_IXUSR) != 0) {
+		purple_debug_error("prefs", "Unable to create directory %s: %s\n",
+				user_dir, g_strerror(errno));
+		return FALSE;
+	}
+
+	prefs_writer.pool = g_thread_pool_new(prefs_writer_thread, NULL, 1,
+			FALSE, &error);
+	if (prefs_writer.pool == NULL) {
+		purple_debug_error("prefs", "Unable to start the prefs writer: %s\n",
+				error->message);
+		g_error_free(error);
+		return FALSE;
+	}
+
+	prefs_writer.mutex = g_mutex_new();
+	prefs_writer.idle = g_cond_new();
+	prefs_writer.path = g_build_filename(user_dir, "prefs.xml", NULL);
+
+	return TRUE;
+}
+
+static void
+prefs_writer_report_error(void)
+{
+	char *error;
+
+	g_mutex_lock(prefs_writer.mutex);
+	error = prefs_writer.error;
+	prefs_writer.error = NULL;
+	g_mutex_unlock(prefs_writer.mutex);
+
+	if (error != NULL) {
+		purple_debug_error("prefs", "Error saving prefs: %s\n", error);
+		g_free(error);
+	}
+}
+
+/* Takes ownership of xml. */
+static void
+prefs_writer_push(char *xml)
 {
-	xmlnode *node;
-	char *data;
+	if (!prefs_writer_start()) {
+		purple_util_write_data_to_file("prefs.xml", xml, -1);
+		g_free(xml);
+		return;
+	}
 
+	g_mutex_lock(prefs_writer.mutex);
+	g_free(prefs_writer.pending);
+	prefs_writer.pending = xml;
+	if (!prefs_writer.busy) {
+		prefs_writer.busy = TRUE;
+		g_thread_pool_push(prefs_writer.pool, &prefs_writer, NULL);
+	}
+	g_mutex_unlock(prefs_writer.mutex);
+
+	prefs_writer_report_error();
+}
+
+/* Waits for everything queued to be written, then stops the writer. */
+static void
+prefs_writer_stop(void)
+{
+	if (prefs_writer.pool == NULL)
+		return;
+
+	g_mutex_lock(prefs_writer.mutex);
+	while (prefs_writer.busy)
+		g_cond_wait(prefs_writer.idle, prefs_writer.mutex);
+	g_mutex_unlock(prefs_writer.mutex);
+
+	prefs_writer_report_error();
+
+	g_thread_pool_free(prefs_writer.pool, FALSE, TRUE);
+	g_mutex_free(prefs_writer.mutex);
+	g_cond_free(prefs_writer.idle);
+	g_free(prefs_writer.path);
+	memset(&prefs_writer, 0, sizeof(prefs_writer));
+}
+
+static void
+sync_prefs(void)
+{
 	if (!prefs_loaded)
 	{
 		/*
@@ -207,11 +418,7 @@ sync_prefs(void)
 		return;
 	}
 
-	node = prefs_to_xmlnode();
-	data = xmlnode_to_formatted_str(node, NULL);
-	purple_util_write_data_to_file("prefs.xml", data, -1);
-	g_free(data);
-	xmlnode_free(node);
+	prefs_writer_push(prefs_to_string());
 }
 
 static gboolean
@@ -296,6 +503,7 @@ prefs_start_element_handler (GMarkupParseContext *context,
 		pref = find_pref(pref_name_full->str);
 
 		if(pref) {
+			pref_changed(pref);
 			if(pref->type == PURPLE_PREF_STRING_LIST) {
 				pref->value.stringlist = g_list_append(pref->value.stringlist,
 						g_strdup(pref_value));
@@ -598,6 +806,7 @@ add_pref(PurplePrefType type, const char *name)
 	}
 
 	g_hash_table_insert(prefs_hash, g_strdup(name), (gpointer)me);
+	pref_changed(parent);
 
 	return me;
 }
@@ -693,11 +902,30 @@ purple_prefs_add_path_list(const char *name, GList *value)
 }
 
 
+static void
+pref_cb_free(struct pref_cb *cb)
+{
+	GSList *l;
+
+	cb->pref->callbacks = g_slist_remove(cb->pref->callbacks, cb);
+	g_hash_table_remove(callbacks_by_id, GUINT_TO_POINTER(cb->id));
+
+	if (cb->handle != NULL) {
+		l = g_hash_table_lookup(callbacks_by_handle, cb->handle);
+		l = g_slist_remove(l, cb);
+		if (l != NULL)
+			g_hash_table_insert(callbacks_by_handle, cb->handle, l);
+		else
+			g_hash_table_remove(callbacks_by_handle, cb->handle);
+	}
+
+	g_free(cb);
+}
+
 static void
 remove_pref(struct purple_pref *pref)
 {
 	char *name;
-	GSList *l;
 
 	if(!pref)
 		return;
@@ -708,6 +936,8 @@ remove_pref(struct purple_pref *pref)
 	if(pref == &prefs)
 		return;
 
+	pref_changed(pref);
+
 	if(pref->parent->first_child == pref) {
 		pref->parent->first_child = pref->sibling;
 	} else {
@@ -728,11 +958,9 @@ remove_pref(struct purple_pref *pref)
 
 	free_pref_value(pref);
 
-	while((l = pref->callbacks) != NULL) {
-		pref->callbacks = pref->callbacks->next;
-		g_free(l->data);
-		g_slist_free_1(l);
-	}
+	while (pref->callbacks != NULL)
+		pref_cb_free(pref->callbacks->data);
+
 	g_free(pref->name);
 	g_free(pref);
 }
@@ -759,6 +987,12 @@ do_callbacks(const char* name, struct purple_pref *pref)
 {
 	GSList *cbs;
 	struct purple_pref *cb_pref;
+
+	/* Every change to a value comes through here. */
+	pref_changed(pref);
+
+	/* Callbacks are kept on the pref they were connected to, so only
+	 * the ones on this pref and its parents need to be looked at. */
 	for(cb_pref = pref; cb_pref; cb_pref = cb_pref->parent) {
 		for(cbs = cb_pref->callbacks; cbs; cbs = cbs->next) {
 			struct pref_cb *cb = cbs->data;
@@ -1249,74 +1483,37 @@ purple_prefs_connect_callback(void *handle, const char *name, PurplePrefCallback
 	cb->data = data;
 	cb->id = ++cb_id;
 	cb->handle = handle;
+	cb->pref = pref;
 
 	pref->callbacks = g_slist_append(pref->callbacks, cb);
 
-	return cb->id;
-}
-
-static gboolean
-disco_callback_helper(struct purple_pref *pref, guint callback_id)
-{
-	GSList *cbs;
-	struct purple_pref *child;
-
-	if(!pref)
-		return FALSE;
+	g_hash_table_insert(callbacks_by_id, GUINT_TO_POINTER(cb->id), cb);
+	if (handle != NULL)
+		g_hash_table_insert(callbacks_by_handle, handle,
+				g_slist_prepend(g_hash_table_lookup(callbacks_by_handle, handle), cb));
 
-	for(cbs = pref->callbacks; cbs; cbs = cbs->next) {
-		struct pref_cb *cb = cbs->data;
-		if(cb->id == callback_id) {
-			pref->callbacks = g_slist_delete_link(pref->callbacks, cbs);
-			g_free(cb);
-			return TRUE;
-		}
-	}
-
-	for(child = pref->first_child; child; child = child->sibling) {
-		if(disco_callback_helper(child, callback_id))
-			return TRUE;
-	}
-
-	return FALSE;
+	return cb->id;
 }
 
 void
 purple_prefs_disconnect_callback(guint callback_id)
 {
-	disco_callback_helper(&prefs, callback_id);
-}
+	struct pref_cb *cb = g_hash_table_lookup(callbacks_by_id,
+			GUINT_TO_POINTER(callback_id));
 
-static void
-disco_callback_helper_handle(struct purple_pref *pref, void *handle)
-{
-	GSList *cbs;
-	struct purple_pref *child;
-
-	if(!pref)
-		return;
-
-	cbs = pref->callbacks;
-	while (cbs != NULL) {
-		struct pref_cb *cb = cbs->data;
-		if(cb->handle == handle) {
-			pref->callbacks = g_slist_delete_link(pref->callbacks, cbs);
-			g_free(cb);
-			cbs = pref->callbacks;
-		} else
-			cbs = cbs->next;
-	}
-
-	for(child = pref->first_child; child; child = child->sibling)
-		disco_callback_helper_handle(child, handle);
+	if (cb != NULL)
+		pref_cb_free(cb);
 }
 
 void
 purple_prefs_disconnect_by_handle(void *handle)
 {
+	GSList *l;
+
 	g_return_if_fail(handle != NULL);
 
-	disco_callback_helper_handle(&prefs, handle);
+	while ((l = g_hash_table_lookup(callbacks_by_handle, handle)) != NULL)
+		pref_cb_free(l->data);
 }
 
 GList *
@@ -1391,6 +1588,8 @@ purple_prefs_init(void)
 	void *handle = purple_prefs_get_handle();
 
 	prefs_hash = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	callbacks_by_id = g_hash_table_new(g_direct_hash, g_direct_equal);
+	callbacks_by_handle = g_hash_table_new(g_direct_hash, g_direct_equal);
 
 	purple_prefs_connect_callback(handle, "/", prefs_save_cb, NULL);
 
@@ -1454,6 +1653,7 @@ purple_prefs_uninit()
 		save_timer = 0;
 		sync_prefs();
 	}
+	prefs_writer_stop();
 
 	purple_prefs_disconnect_by_handle(purple_prefs_get_handle());
 
@@ -1461,5 +1661,9 @@ purple_prefs_uninit()
 	purple_prefs_destroy();
 	g_hash_table_destroy(prefs_hash);
 	prefs_hash = NULL;
+	g_hash_table_destroy(callbacks_by_id);
+	callbacks_by_id = NULL;
+	g_hash_table_destroy(callbacks_by_handle);
+	callbacks_by_handle = NULL;
 
 }
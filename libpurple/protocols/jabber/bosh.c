@@ -31,12 +31,21 @@
 
 #include "bosh.h"
 
-/* The number of HTTP connections to use. This MUST be at least 2. */
+/* The number of HTTP connections to use until the server tells us how many
+ * simultaneous requests it allows. This MUST be at least 2. */
 #define NUM_HTTP_CONNECTIONS      2
+/* The most HTTP connections to use, however many the server allows */
+#define MAX_HTTP_CONNECTIONS      4
 /* How many failed connection attempts before it becomes a fatal error */
 #define MAX_FAILED_CONNECTIONS    3
-/* How long in seconds to queue up outgoing messages */
+/* How many times a pipelined connection may drop before we stop going back
+ * to pipelining */
+#define MAX_PIPELINING_FAILURES   3
+/* How long in seconds to hold queued messages when every connection is busy */
 #define BUFFER_SEND_IN_SECS       1
+/* Bucket i of the latency histograms counts samples below 2^i ms; the
+ * last bucket counts everything slower */
+#define HISTOGRAM_BUCKETS         16
 
 typedef struct _PurpleHTTPConnection PurpleHTTPConnection;
 
@@ -53,7 +62,8 @@ typedef enum {
 
 struct _PurpleBOSHConnection {
 	JabberStream *js;
-	PurpleHTTPConnection *connections[NUM_HTTP_CONNECTIONS];
+	PurpleHTTPConnection *connections[MAX_HTTP_CONNECTIONS];
+	int num_connections; /* How many of connections[] we may use */
 
 	PurpleCircBuffer *pending;
 	PurpleBOSHConnectionConnectFunction connect_cb;
@@ -69,6 +79,7 @@ struct _PurpleBOSHConnection {
 	guint16 port;
 
 	gboolean pipelining;
+	guint8 pipelining_failures;
 	gboolean ssl;
 
 	enum {
@@ -84,6 +95,10 @@ struct _PurpleBOSHConnection {
 	int requests;
 
 	guint send_timer;
+	GTimeVal pending_since;
+
+	guint rtt_histogram[HISTOGRAM_BUCKETS];
+	guint queue_histogram[HISTOGRAM_BUCKETS];
 };
 
 struct _PurpleHTTPConnection {
@@ -106,6 +121,7 @@ struct _PurpleHTTPConnection {
 		HTTP_CONN_CONNECTED
 	} state;
 	int requests; /* number of outstanding HTTP requests */
+	GQueue *sent_times; /* when each outstanding request was sent */
 
 	gboolean headers_done;
 	gboolean close;
@@ -118,7 +134,7 @@ debug_dump_http_connections(PurpleBOSHConnection *conn)
 
 	g_return_if_fail(conn != NULL);
 
-	for (i = 0; i < NUM_HTTP_CONNECTIONS; ++i) {
+	for (i = 0; i < conn->num_connections; ++i) {
 		PurpleHTTPConnection *httpconn = conn->connections[i];
 		if (httpconn == NULL)
 			purple_debug_misc("jabber", "BOSH %p->connections[%d] = (nil)\n",
@@ -130,6 +146,53 @@ debug_dump_http_connections(PurpleBOSHConnection *conn)
 	}
 }
 
+static void
+histogram_add(guint *histogram, const GTimeVal *since)
+{
+	GTimeVal now;
+	glong msecs;
+	int bucket = 0;
+
+	g_get_current_time(&now);
+	msecs = (now.tv_sec - since->tv_sec) * 1000 +
+			(now.tv_usec - since->tv_usec) / 1000;
+
+	while (bucket < HISTOGRAM_BUCKETS - 1 && msecs >= (1L << bucket))
+		++bucket;
+
+	histogram[bucket]++;
+}
+
+static void
+debug_dump_histogram(PurpleBOSHConnection *conn, const char *name,
+                     const guint *histogram)
+{
+	GString *str = g_string_new(NULL);
+	int i;
+
+	for (i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+		if (histogram[i] == 0)
+			continue;
+		if (i == HISTOGRAM_BUCKETS - 1)
+			g_string_append_printf(str, " >=%ldms:%u", 1L << (i - 1), histogram[i]);
+		else
+			g_string_append_printf(str, " <%ldms:%u", 1L << i, histogram[i]);
+	}
+
+	purple_debug_info("jabber", "BOSH %p %s:%s\n", conn, name,
+	                  str->len ? str->str : " (none)");
+	g_string_free(str, TRUE);
+}
+
+static void
+http_connection_clear_sent_times(PurpleHTTPConnection *conn)
+{
+	GTimeVal *sent;
+
+	while ((sent = g_queue_pop_head(conn->sent_times)) != NULL)
+		g_free(sent);
+}
+
 static void http_connection_connect(PurpleHTTPConnection *conn);
 static void http_connection_send_request(PurpleHTTPConnection *conn,
                                          const GString *req);
@@ -169,6 +232,7 @@ jabber_bosh_http_connection_init(PurpleBOSHConnection *bosh)
 	conn->state = HTTP_CONN_OFFLINE;
 
 	conn->write_buf = purple_circ_buffer_new(0 /* default grow size */);
+	conn->sent_times = g_queue_new();
 
 	return conn;
 }
@@ -181,6 +245,8 @@ jabber_bosh_http_connection_destroy(PurpleHTTPConnection *conn)
 
 	if (conn->write_buf)
 		purple_circ_buffer_destroy(conn->write_buf);
+	http_connection_clear_sent_times(conn);
+	g_queue_free(conn->sent_times);
 	if (conn->readh)
 		purple_input_remove(conn->readh);
 	if (conn->writeh)
@@ -213,6 +279,7 @@ jabber_bosh_connection_init(JabberStream *js, const char *url)
 	conn->path = g_strdup_printf("/%s", path);
 	g_free(path);
 	conn->pipelining = TRUE;
+	conn->num_connections = NUM_HTTP_CONNECTIONS;
 
 	if (purple_ip_address_is_valid(host))
 		js->serverFQDN = g_strdup(js->user->domain);
@@ -264,7 +331,10 @@ jabber_bosh_connection_destroy(PurpleBOSHConnection *conn)
 
 	purple_circ_buffer_destroy(conn->pending);
 
-	for (i = 0; i < NUM_HTTP_CONNECTIONS; ++i) {
+	debug_dump_histogram(conn, "round trips", conn->rtt_histogram);
+	debug_dump_histogram(conn, "queue waits", conn->queue_histogram);
+
+	for (i = 0; i < MAX_HTTP_CONNECTIONS; ++i) {
 		if (conn->connections[i])
 			jabber_bosh_http_connection_destroy(conn->connections[i]);
 	}
@@ -285,6 +355,10 @@ find_available_http_connection(PurpleBOSHConnection *conn)
 	if (purple_debug_is_verbose())
 		debug_dump_http_connections(conn);
 
+	/* Don't make more simultaneous requests than the server allows */
+	if (conn->max_requests > 0 && conn->requests >= conn->max_requests)
+		return NULL;
+
 	/* Easy solution: Does everyone involved support pipelining? Hooray! Just use
 	 * one TCP connection! */
 	if (conn->pipelining)
@@ -292,7 +366,7 @@ find_available_http_connection(PurpleBOSHConnection *conn)
 				conn->connections[0] : NULL;
 
 	/* First loop, look for a connection that's ready */
-	for (i = 0; i < NUM_HTTP_CONNECTIONS; ++i) {
+	for (i = 0; i < conn->num_connections; ++i) {
 		if (conn->connections[i] &&
 				conn->connections[i]->state == HTTP_CONN_CONNECTED &&
 				conn->connections[i]->requests == 0)
@@ -300,14 +374,14 @@ find_available_http_connection(PurpleBOSHConnection *conn)
 	}
 
 	/* Second loop, is something currently connecting? If so, just queue up. */
-	for (i = 0; i < NUM_HTTP_CONNECTIONS; ++i) {
+	for (i = 0; i < conn->num_connections; ++i) {
 		if (conn->connections[i] &&
 				conn->connections[i]->state == HTTP_CONN_CONNECTING)
 			return NULL;
 	}
 
 	/* Third loop, is something offline that we can connect? */
-	for (i = 0; i < NUM_HTTP_CONNECTIONS; ++i) {
+	for (i = 0; i < conn->num_connections; ++i) {
 		if (conn->connections[i] &&
 				conn->connections[i]->state == HTTP_CONN_OFFLINE) {
 			purple_debug_info("jabber", "bosh: Reconnecting httpconn "
@@ -318,7 +392,7 @@ find_available_http_connection(PurpleBOSHConnection *conn)
 	}
 
 	/* Fourth loop, look for one that's NULL and create a new connection */
-	for (i = 0; i < NUM_HTTP_CONNECTIONS; ++i) {
+	for (i = 0; i < conn->num_connections; ++i) {
 		if (!conn->connections[i]) {
 			conn->connections[i] = jabber_bosh_http_connection_init(conn);
 			purple_debug_info("jabber", "bosh: Creating and connecting new httpconn "
@@ -345,26 +419,37 @@ jabber_bosh_connection_send(PurpleBOSHConnection *conn,
 	if (type != PACKET_FLUSH && type != PACKET_TERMINATE) {
 		/*
 		 * Unless this is a flush (or session terminate, which needs to be
-		 * sent immediately), queue up the data and start a timer to flush
-		 * the buffer.
+		 * sent immediately), queue up the data and flush the buffer once
+		 * we're back in the main loop, so everything sent in this
+		 * iteration shares one request.  When all connections are busy,
+		 * the data keeps collecting until a response frees one up (see
+		 * jabber_bosh_http_connection_process).
 		 */
-		if (data)
+		if (data && *data) {
+			if (conn->pending->bufused == 0)
+				g_get_current_time(&conn->pending_since);
 			purple_circ_buffer_append(conn->pending, data, strlen(data));
+		}
 
 		if (purple_debug_is_verbose())
 			purple_debug_misc("jabber", "bosh: %p has %" G_GSIZE_FORMAT " bytes in "
 			                  "the buffer.\n", conn, conn->pending->bufused);
 		if (conn->send_timer == 0)
-			conn->send_timer = purple_timeout_add_seconds(BUFFER_SEND_IN_SECS,
-					send_timer_cb, conn);
+			conn->send_timer = purple_timeout_add(0, send_timer_cb, conn);
 		return;
 	}
 
 	chosen = find_available_http_connection(conn);
 
 	if (!chosen) {
-		if (type == PACKET_FLUSH)
+		if (type == PACKET_FLUSH) {
+			/* A response normally flushes the buffer before this fires,
+			 * but don't leave data stranded if none comes. */
+			if (conn->pending->bufused > 0 && conn->send_timer == 0)
+				conn->send_timer = purple_timeout_add_seconds(BUFFER_SEND_IN_SECS,
+						send_timer_cb, conn);
 			return;
+		}
 		/*
 		 * For non-ordinary traffic, we can't 'buffer' it, so use the
 		 * first connection.
@@ -408,6 +493,9 @@ jabber_bosh_connection_send(PurpleBOSHConnection *conn,
 
 		packet = g_string_append_c(packet, '>');
 
+		if (conn->pending->bufused > 0)
+			histogram_add(conn->queue_histogram, &conn->pending_since);
+
 		while ((read_amt = purple_circ_buffer_get_max_read(conn->pending)) > 0) {
 			packet = g_string_append_len(packet, conn->pending->outptr, read_amt);
 			purple_circ_buffer_mark_read(conn->pending, read_amt);
@@ -465,24 +553,35 @@ jabber_bosh_connection_send_keepalive(PurpleBOSHConnection *bosh)
 	send_timer_cb(bosh);
 }
 
+/*
+ * Falls back to multiple connections.  If the server refused to keep the
+ * connection open, that's for good.  Otherwise, pipelining is tried again
+ * once the first connection is back (see
+ * jabber_bosh_http_connection_process), unless it has already failed
+ * MAX_PIPELINING_FAILURES times.
+ */
 static void
-jabber_bosh_disable_pipelining(PurpleBOSHConnection *bosh)
+jabber_bosh_disable_pipelining(PurpleBOSHConnection *bosh, gboolean refused)
 {
+	if (refused)
+		bosh->pipelining_failures = MAX_PIPELINING_FAILURES;
+
 	/* Do nothing if it's already disabled */
 	if (!bosh->pipelining)
 		return;
 
+	if (!refused)
+		++bosh->pipelining_failures;
+
 	purple_debug_info("jabber", "BOSH: Disabling pipelining on conn %p\n",
 	                            bosh);
 	bosh->pipelining = FALSE;
+
+	/* The second connection is still around if pipelining was turned off
+	 * before. */
 	if (bosh->connections[1] == NULL) {
 		bosh->connections[1] = jabber_bosh_http_connection_init(bosh);
 		http_connection_connect(bosh->connections[1]);
-	} else {
-		/* Shouldn't happen; this should be the only place pipelining
-		 * is turned off.
-		 */
-		g_warn_if_reached();
 	}
 }
 
@@ -521,7 +620,7 @@ static void jabber_bosh_connection_received(PurpleBOSHConnection *conn, xmlnode
 static void boot_response_cb(PurpleBOSHConnection *conn, xmlnode *node) {
 	JabberStream *js = conn->js;
 	const char *sid, *version;
-	const char *inactivity, *requests;
+	const char *inactivity, *requests, *hold;
 	xmlnode *packet;
 
 	g_return_if_fail(node != NULL);
@@ -533,6 +632,7 @@ static void boot_response_cb(PurpleBOSHConnection *conn, xmlnode *node) {
 
 	inactivity = xmlnode_get_attrib(node, "inactivity");
 	requests = xmlnode_get_attrib(node, "requests");
+	hold = xmlnode_get_attrib(node, "hold");
 
 	if (sid) {
 		conn->sid = g_strdup(sid);
@@ -585,6 +685,25 @@ static void boot_response_cb(PurpleBOSHConnection *conn, xmlnode *node) {
 	if (requests)
 		conn->max_requests = atoi(requests);
 
+	/*
+	 * The server holds up to 'hold' requests open waiting for data, so we
+	 * need one connection more than that to be able to send at any time.
+	 * Beyond that, use as many as the server allows us simultaneous
+	 * requests, so a slow response doesn't hold up the others.
+	 */
+	if (conn->max_requests > 0) {
+		int min_connections = NUM_HTTP_CONNECTIONS;
+
+		if (hold)
+			min_connections = MAX(min_connections, atoi(hold) + 1);
+
+		conn->num_connections = CLAMP(conn->max_requests, min_connections,
+		                              MAX_HTTP_CONNECTIONS);
+		purple_debug_info("jabber", "BOSH server allows %d requests; using up "
+		                  "to %d connections\n", conn->max_requests,
+		                  conn->num_connections);
+	}
+
 	jabber_stream_set_state(js, JABBER_STREAM_AUTHENTICATING);
 
 	/* FIXME: Depending on receiving features might break with some hosts */
@@ -669,6 +788,7 @@ connection_common_established_cb(PurpleHTTPConnection *conn)
 		                   conn, conn->requests);
 
 	conn->requests = 0;
+	http_connection_clear_sent_times(conn);
 	if (conn->read_buf) {
 		g_string_free(conn->read_buf, TRUE);
 		conn->read_buf = NULL;
@@ -724,11 +844,12 @@ static void http_connection_disconnected(PurpleHTTPConnection *conn)
 		                   conn->bosh->requests, conn->bosh->requests - conn->requests);
 		conn->bosh->requests -= conn->requests;
 		conn->requests = 0;
+		http_connection_clear_sent_times(conn);
 	}
 
-	if (conn->bosh->pipelining) {
+	if (conn->bosh->pipelining && conn == conn->bosh->connections[0]) {
 		/* Hmmmm, fall back to multiple connections */
-		jabber_bosh_disable_pipelining(conn->bosh);
+		jabber_bosh_disable_pipelining(conn->bosh, FALSE);
 	}
 
 	if (!had_requests)
@@ -756,6 +877,20 @@ void jabber_bosh_connection_connect(PurpleBOSHConnection *bosh) {
 	http_connection_connect(conn);
 }
 
+void
+jabber_bosh_connection_attach(PurpleBOSHConnection *bosh, int fd,
+                              const char *sid, int max_requests)
+{
+	g_return_if_fail(bosh->state == BOSH_CONN_OFFLINE);
+
+	bosh->sid = g_strdup(sid);
+	bosh->max_requests = max_requests;
+	bosh->state = BOSH_CONN_ONLINE;
+	bosh->receive_cb = jabber_bosh_connection_received;
+
+	connection_established_cb(bosh->connections[0], fd, NULL);
+}
+
 /**
  * @return TRUE if we want to be called again immediately. This happens when
  *         we parse an HTTP response AND there is more data in read_buf. FALSE
@@ -807,7 +942,7 @@ jabber_bosh_http_connection_process(PurpleHTTPConnection *conn)
 
 			if (!g_ascii_strncasecmp(tmp, "close", strlen("close"))) {
 				conn->close = TRUE;
-				jabber_bosh_disable_pipelining(conn->bosh);
+				jabber_bosh_disable_pipelining(conn->bosh, TRUE);
 			}
 		}
 
@@ -831,9 +966,25 @@ jabber_bosh_http_connection_process(PurpleHTTPConnection *conn)
 	--conn->requests;
 	--conn->bosh->requests;
 
+	if (!g_queue_is_empty(conn->sent_times)) {
+		GTimeVal *sent = g_queue_pop_head(conn->sent_times);
+		histogram_add(conn->bosh->rtt_histogram, sent);
+		g_free(sent);
+	}
+
 	http_received_cb(conn->read_buf->str + conn->handled_len, conn->body_len,
 	                 conn->bosh);
 
+	/* The first connection is working again after dropping, so go back
+	 * to pipelining. */
+	if (!conn->bosh->pipelining && !conn->close &&
+			conn == conn->bosh->connections[0] &&
+			conn->bosh->pipelining_failures < MAX_PIPELINING_FAILURES) {
+		purple_debug_info("jabber", "BOSH: Re-enabling pipelining on conn %p\n",
+		                  conn->bosh);
+		conn->bosh->pipelining = TRUE;
+	}
+
 	/* Is there another response in the buffer ? */
 	if (conn->read_buf->len > conn->body_len + conn->handled_len) {
 		g_string_erase(conn->read_buf, 0, conn->handled_len + conn->body_len);
@@ -850,10 +1001,16 @@ jabber_bosh_http_connection_process(PurpleHTTPConnection *conn)
 		http_connection_disconnected(conn);
 	}
 
-	if (conn->bosh->state == BOSH_CONN_ONLINE &&
-			(conn->bosh->requests == 0 || conn->bosh->pending->bufused > 0)) {
-		purple_debug_misc("jabber", "BOSH: Sending an empty request\n");
-		jabber_bosh_connection_send(conn->bosh, PACKET_NORMAL, NULL);
+	if (conn->bosh->state == BOSH_CONN_ONLINE) {
+		if (conn->bosh->pending->bufused > 0) {
+			/* Data was queued while every connection was busy.  One is
+			 * free now, so send it instead of waiting for the fallback
+			 * timer. */
+			jabber_bosh_connection_send_keepalive(conn->bosh);
+		} else if (conn->bosh->requests == 0) {
+			purple_debug_misc("jabber", "BOSH: Sending an empty request\n");
+			jabber_bosh_connection_send(conn->bosh, PACKET_NORMAL, NULL);
+		}
 	}
 
 	g_string_free(conn->read_buf, TRUE);
@@ -884,6 +1041,7 @@ http_connection_read(PurpleHTTPConnection *conn)
 			cnt = read(conn->fd, buffer, sizeof(buffer));
 
 		if (cnt > 0) {
+			jabber_count_rx_bytes(cnt);
 			g_string_append_len(conn->read_buf, buffer, cnt);
 		}
 	} while (cnt > 0);
@@ -1059,6 +1217,7 @@ http_connection_send_request(PurpleHTTPConnection *conn, const GString *req)
 	char *data;
 	int ret;
 	size_t len;
+	GTimeVal *sent;
 
 	/* Sending something to the server, restart the inactivity timer */
 	jabber_stream_restart_inactivity_timer(conn->bosh->js);
@@ -1077,6 +1236,10 @@ http_connection_send_request(PurpleHTTPConnection *conn, const GString *req)
 	++conn->requests;
 	++conn->bosh->requests;
 
+	sent = g_new(GTimeVal, 1);
+	g_get_current_time(sent);
+	g_queue_push_tail(conn->sent_times, sent);
+
 	if (purple_debug_is_unsafe() && purple_debug_is_verbose())
 		/* Will contain passwords for SASL PLAIN and is verbose */
 		purple_debug_misc("jabber", "BOSH (%p): Sending %s\n", conn, data);
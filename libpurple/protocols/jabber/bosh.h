@@ -38,6 +38,14 @@ gboolean jabber_bosh_connection_is_ssl(PurpleBOSHConnection *conn);
 void jabber_bosh_connection_send_keepalive(PurpleBOSHConnection *conn);
 
 void jabber_bosh_connection_connect(PurpleBOSHConnection *conn);
+
+/*
+ * Takes over the already-connected, non-blocking socket fd as if a session
+ * with the given sid had just been booted over it.  This is for the unit
+ * tests, which can't run a real connection manager.
+ */
+void jabber_bosh_connection_attach(PurpleBOSHConnection *conn, int fd,
+                                   const char *sid, int max_requests);
 void jabber_bosh_connection_close(PurpleBOSHConnection *conn);
 void jabber_bosh_connection_send_raw(PurpleBOSHConnection *conn, const char *data);
 #endif /* PURPLE_JABBER_BOSH_H_ */
@@ -797,12 +797,45 @@ void jabber_chat_part(JabberChat *chat, const char *msg)
 	g_free(room_jid);
 }
 
+/* Rooms asked for at a time, from servers that support XEP-0059 */
+#define ROOMLIST_PAGE_SIZE 500
+
+static void roomlist_finished(JabberStream *js)
+{
+	purple_roomlist_set_in_progress(js->roomlist, FALSE);
+	purple_roomlist_unref(js->roomlist);
+	js->roomlist = NULL;
+
+	g_free(js->roomlist_server);
+	js->roomlist_server = NULL;
+	g_free(js->roomlist_last);
+	js->roomlist_last = NULL;
+}
+
+static void roomlist_request_page(JabberStream *js);
+
+static void roomlist_drained_cb(PurpleRoomlist *list, gpointer data)
+{
+	PurpleConnection *gc = purple_account_get_connection(list->account);
+	JabberStream *js;
+
+	if (!gc)
+		return;
+
+	js = gc->proto_data;
+	if (js->roomlist == list)
+		roomlist_request_page(js);
+}
+
 static void roomlist_disco_result_cb(JabberStream *js, const char *from,
                                      JabberIqType type, const char *id,
                                      xmlnode *packet, gpointer data)
 {
 	xmlnode *query;
 	xmlnode *item;
+	xmlnode *set;
+	char *last = NULL;
+	gboolean empty = TRUE;
 
 	if(!js->roomlist)
 		return;
@@ -811,9 +844,7 @@ static void roomlist_disco_result_cb(JabberStream *js, const char *from,
 		char *err = jabber_parse_error(js, packet, NULL);
 		purple_notify_error(js->gc, _("Error"),
 				_("Error retrieving room list"), err);
-		purple_roomlist_set_in_progress(js->roomlist, FALSE);
-		purple_roomlist_unref(js->roomlist);
-		js->roomlist = NULL;
+		roomlist_finished(js);
 		g_free(err);
 		return;
 	}
@@ -822,9 +853,7 @@ static void roomlist_disco_result_cb(JabberStream *js, const char *from,
 		char *err = jabber_parse_error(js, packet, NULL);
 		purple_notify_error(js->gc, _("Error"),
 				_("Error retrieving room list"), err);
-		purple_roomlist_set_in_progress(js->roomlist, FALSE);
-		purple_roomlist_unref(js->roomlist);
-		js->roomlist = NULL;
+		roomlist_finished(js);
 		g_free(err);
 		return;
 	}
@@ -845,26 +874,58 @@ static void roomlist_disco_result_cb(JabberStream *js, const char *from,
 		purple_roomlist_room_add_field(js->roomlist, room, jid->domain);
 		purple_roomlist_room_add_field(js->roomlist, room, name ? name : "");
 		purple_roomlist_room_add(js->roomlist, room);
+		empty = FALSE;
 
 		jabber_id_free(jid);
 	}
-	purple_roomlist_set_in_progress(js->roomlist, FALSE);
-	purple_roomlist_unref(js->roomlist);
-	js->roomlist = NULL;
-}
 
-static void roomlist_cancel_cb(JabberStream *js, const char *server) {
-	if(js->roomlist) {
-		purple_roomlist_set_in_progress(js->roomlist, FALSE);
-		purple_roomlist_unref(js->roomlist);
-		js->roomlist = NULL;
+	/* If the server pages the result, ask for the next page once the UI
+	 * has caught up with this one. */
+	if ((set = xmlnode_get_child_with_namespace(query, "set", NS_RSM)) &&
+			(item = xmlnode_get_child(set, "last")))
+		last = xmlnode_get_data(item);
+
+	if (last && *last && !empty) {
+		g_free(js->roomlist_last);
+		js->roomlist_last = last;
+		purple_roomlist_call_when_drained(js->roomlist, roomlist_drained_cb, NULL);
+		return;
 	}
+
+	g_free(last);
+	roomlist_finished(js);
 }
 
-static void roomlist_ok_cb(JabberStream *js, const char *server)
+static void roomlist_request_page(JabberStream *js)
 {
 	JabberIq *iq;
+	xmlnode *set;
+	char *max;
+
+	iq = jabber_iq_new_query(js, JABBER_IQ_GET, NS_DISCO_ITEMS);
+
+	xmlnode_set_attrib(iq->node, "to", js->roomlist_server);
+
+	set = xmlnode_new_child(xmlnode_get_child(iq->node, "query"), "set");
+	xmlnode_set_namespace(set, NS_RSM);
+	max = g_strdup_printf("%d", ROOMLIST_PAGE_SIZE);
+	xmlnode_insert_data(xmlnode_new_child(set, "max"), max, -1);
+	g_free(max);
+	if (js->roomlist_last)
+		xmlnode_insert_data(xmlnode_new_child(set, "after"), js->roomlist_last, -1);
+
+	jabber_iq_set_callback(iq, roomlist_disco_result_cb, NULL);
 
+	jabber_iq_send(iq);
+}
+
+static void roomlist_cancel_cb(JabberStream *js, const char *server) {
+	if(js->roomlist)
+		roomlist_finished(js);
+}
+
+static void roomlist_ok_cb(JabberStream *js, const char *server)
+{
 	if(!js->roomlist)
 		return;
 
@@ -876,13 +937,12 @@ static void roomlist_ok_cb(JabberStream *js, const char *server)
 
 	purple_roomlist_set_in_progress(js->roomlist, TRUE);
 
-	iq = jabber_iq_new_query(js, JABBER_IQ_GET, NS_DISCO_ITEMS);
-
-	xmlnode_set_attrib(iq->node, "to", server);
+	g_free(js->roomlist_server);
+	js->roomlist_server = g_strdup(server);
+	g_free(js->roomlist_last);
+	js->roomlist_last = NULL;
 
-	jabber_iq_set_callback(iq, roomlist_disco_result_cb, NULL);
-
-	jabber_iq_send(iq);
+	roomlist_request_page(js);
 }
 
 char *jabber_roomlist_room_serialize(PurpleRoomlistRoom *room)
@@ -935,6 +995,7 @@ void jabber_roomlist_cancel(PurpleRoomlist *list)
 	js = gc->proto_data;
 
 	purple_roomlist_set_in_progress(list, FALSE);
+	purple_roomlist_call_when_drained(list, NULL, NULL);
 
 	if (js->roomlist == list) {
 		js->roomlist = NULL;
@@ -26,7 +26,13 @@
 #include "debug.h"
 #include "xmlnode.h"
 
+/* the block size to fall back to when the peer won't accept a larger one */
 #define JABBER_IBB_SESSION_DEFAULT_BLOCK_SIZE 4096
+/* the block size proposed when opening a session, leaving plenty of room
+ below the stanza size limits servers commonly enforce */
+#define JABBER_IBB_SESSION_MAX_BLOCK_SIZE 16384
+/* the number of data blocks sent ahead of acknowledgements */
+#define JABBER_IBB_SESSION_WINDOW 4
 
 static GHashTable *jabber_ibb_sessions = NULL;
 static GList *open_handlers = NULL;
@@ -43,7 +49,8 @@ jabber_ibb_session_create(JabberStream *js, const gchar *sid, const gchar *who,
 		sess->sid = jabber_get_next_id(js);
 	}
 	sess->who = g_strdup(who);
-	sess->block_size = JABBER_IBB_SESSION_DEFAULT_BLOCK_SIZE;
+	sess->block_size = JABBER_IBB_SESSION_MAX_BLOCK_SIZE;
+	sess->window = JABBER_IBB_SESSION_WINDOW;
 	sess->state = JABBER_IBB_SESSION_NOT_OPENED;
 	sess->user_data = user_data;
 
@@ -91,13 +98,16 @@ jabber_ibb_session_destroy(JabberIBBSession *sess)
 		jabber_ibb_session_close(sess);
 	}
 
-	if (sess->last_iq_id) {
+	while (sess->pending_iq_ids) {
+		gchar *iq_id = sess->pending_iq_ids->data;
+
 		purple_debug_info("jabber", "IBB: removing callback for <iq/> %s\n",
-			sess->last_iq_id);
+			iq_id);
 		jabber_iq_remove_callback_by_id(jabber_ibb_session_get_js(sess),
-			sess->last_iq_id);
-		g_free(sess->last_iq_id);
-		sess->last_iq_id = NULL;
+			iq_id);
+		g_free(iq_id);
+		sess->pending_iq_ids =
+			g_list_delete_link(sess->pending_iq_ids, sess->pending_iq_ids);
 	}
 
 	g_hash_table_remove(jabber_ibb_sessions, sess->sid);
@@ -166,6 +176,19 @@ jabber_ibb_session_get_max_data_size(const JabberIBBSession *sess)
 	return (gsize) floor((sess->block_size - 2) * (float) 3 / 4);
 }
 
+gboolean
+jabber_ibb_session_can_send(const JabberIBBSession *sess)
+{
+	return sess->state == JABBER_IBB_SESSION_OPENED &&
+		g_list_length(sess->pending_iq_ids) < sess->window;
+}
+
+gboolean
+jabber_ibb_session_has_unacked_data(const JabberIBBSession *sess)
+{
+	return sess->pending_iq_ids != NULL;
+}
+
 gpointer
 jabber_ibb_session_get_user_data(JabberIBBSession *sess)
 {
@@ -215,6 +238,21 @@ jabber_ibb_session_opened_cb(JabberStream *js, const char *from,
 	JabberIBBSession *sess = (JabberIBBSession *) data;
 
 	if (type == JABBER_IQ_ERROR) {
+		xmlnode *error = xmlnode_get_child(packet, "error");
+
+		/* the peer wants smaller blocks, try again down to the default size */
+		if (error && xmlnode_get_child_with_namespace(error,
+				"resource-constraint", NS_XMPP_STANZAS) &&
+				sess->block_size > JABBER_IBB_SESSION_DEFAULT_BLOCK_SIZE) {
+			sess->block_size = MAX(sess->block_size / 2,
+				JABBER_IBB_SESSION_DEFAULT_BLOCK_SIZE);
+			purple_debug_info("jabber",
+				"IBB: block size refused, retrying with %" G_GSIZE_FORMAT "\n",
+				sess->block_size);
+			jabber_ibb_session_open(sess);
+			return;
+		}
+
 		sess->state = JABBER_IBB_SESSION_ERROR;
 	} else {
 		sess->state = JABBER_IBB_SESSION_OPENED;
@@ -294,9 +332,13 @@ jabber_ibb_session_send_acknowledge_cb(JabberStream *js, const char *from,
 
 	if (sess) {
 		/* reset callback */
-		if (sess->last_iq_id) {
-			g_free(sess->last_iq_id);
-			sess->last_iq_id = NULL;
+		GList *link = g_list_find_custom(sess->pending_iq_ids, id,
+			(GCompareFunc) strcmp);
+
+		if (link) {
+			g_free(link->data);
+			sess->pending_iq_ids =
+				g_list_delete_link(sess->pending_iq_ids, link);
 		}
 
 		if (type == JABBER_IQ_ERROR) {
@@ -333,11 +375,15 @@ jabber_ibb_session_send_data(JabberIBBSession *sess, gconstpointer data,
 	} else if (size > jabber_ibb_session_get_max_data_size(sess)) {
 		purple_debug_error("jabber",
 			"trying to send a too large packet in the IBB session\n");
+	} else if (!jabber_ibb_session_can_send(sess)) {
+		purple_debug_error("jabber",
+			"trying to send more IBB data than the window allows\n");
 	} else {
 		JabberIq *set = jabber_iq_new(jabber_ibb_session_get_js(sess),
 			JABBER_IQ_SET);
 		xmlnode *data_element = xmlnode_new("data");
-		char *base64 = purple_base64_encode(data, size);
+		GString *base64 = g_string_sized_new(((size + 2) / 3) * 4);
+		gchar *iq_id;
 		char seq[10];
 		g_snprintf(seq, sizeof(seq), "%u", jabber_ibb_session_get_send_seq(sess));
 
@@ -345,7 +391,9 @@ jabber_ibb_session_send_data(JabberIBBSession *sess, gconstpointer data,
 		xmlnode_set_namespace(data_element, NS_IBB);
 		xmlnode_set_attrib(data_element, "sid", jabber_ibb_session_get_sid(sess));
 		xmlnode_set_attrib(data_element, "seq", seq);
-		xmlnode_insert_data(data_element, base64, -1);
+		purple_base64_encode_append(base64, data, size);
+		if (base64->len > 0)
+			xmlnode_insert_data(data_element, base64->str, base64->len);
 
 		xmlnode_insert_child(set->node, data_element);
 
@@ -353,16 +401,63 @@ jabber_ibb_session_send_data(JabberIBBSession *sess, gconstpointer data,
 			"IBB: setting send <iq/> callback for session %p %s\n", sess,
 			sess->sid);
 		jabber_iq_set_callback(set, jabber_ibb_session_send_acknowledge_cb, sess);
-		sess->last_iq_id = g_strdup(xmlnode_get_attrib(set->node, "id"));
-		purple_debug_info("jabber", "IBB: set sess->last_iq_id: %s\n",
-			sess->last_iq_id);
+		iq_id = g_strdup(xmlnode_get_attrib(set->node, "id"));
+		sess->pending_iq_ids = g_list_append(sess->pending_iq_ids, iq_id);
+		purple_debug_info("jabber", "IBB: sent <iq/> %s, %u awaiting ack\n",
+			iq_id, g_list_length(sess->pending_iq_ids));
 		jabber_iq_send(set);
 
-		g_free(base64);
+		g_string_free(base64, TRUE);
 		(sess->send_seq)++;
 	}
 }
 
+/*
+ * Decodes the base-64 content of a <data/> element straight from its text
+ * nodes, without gathering it into one string first.
+ */
+static guchar *
+jabber_ibb_decode_data(const xmlnode *data, gsize *size)
+{
+	PurpleBase64DecodeState state = { 0, 0, FALSE };
+	const xmlnode *child;
+	gsize encoded_len = 0;
+	guchar *decoded, *out;
+	gssize len;
+
+	for (child = data->child; child; child = child->next)
+		if (child->type == XMLNODE_TYPE_DATA)
+			encoded_len += child->data_sz;
+
+	if (encoded_len == 0)
+		return NULL;
+
+	decoded = out = g_malloc(encoded_len / 4 * 3 + 3);
+
+	for (child = data->child; child; child = child->next) {
+		if (child->type != XMLNODE_TYPE_DATA)
+			continue;
+
+		len = purple_base64_decode_step(&state, child->data, child->data_sz,
+			out);
+		if (len < 0) {
+			g_free(decoded);
+			return NULL;
+		}
+		out += len;
+	}
+
+	len = purple_base64_decode_close(&state, out);
+	if (len < 0) {
+		g_free(decoded);
+		return NULL;
+	}
+	out += len;
+
+	*size = out - decoded;
+	return decoded;
+}
+
 static void
 jabber_ibb_send_error_response(JabberStream *js, const char *to, const char *id)
 {
@@ -415,11 +510,8 @@ jabber_ibb_parse(JabberStream *js, const char *who, JabberIqType type,
 				xmlnode_set_attrib(result->node, "to", who);
 
 				if (sess->data_received_cb) {
-					gchar *base64 = xmlnode_get_data(child);
 					gsize size;
-					gpointer rawdata = purple_base64_decode(base64, &size);
-
-					g_free(base64);
+					gpointer rawdata = jabber_ibb_decode_data(child, &size);
 
 					if (rawdata) {
 						purple_debug_info("jabber",
@@ -55,6 +55,8 @@ struct _JabberIBBSession {
 	guint16 send_seq;
 	guint16 recv_seq;
 	gsize block_size;
+	/* how many data blocks may be awaiting acknowledgement at once */
+	guint window;
 
 	/* session state */
 	JabberIBBSessionState state;
@@ -70,8 +72,9 @@ struct _JabberIBBSession {
 	JabberIBBDataCallback *data_received_cb;
 	JabberIBBErrorCallback *error_cb;
 
-	/* store the last sent IQ (to permit cancel of callback) */
-	gchar *last_iq_id;
+	/* IDs of the sent data IQs still awaiting acknowledgement (to permit
+	  cancel of callbacks) */
+	GList *pending_iq_ids;
 };
 
 JabberIBBSession *jabber_ibb_session_create(JabberStream *js, const gchar *sid,
@@ -114,6 +117,13 @@ void jabber_ibb_session_set_block_size(JabberIBBSession *sess, gsize size);
  (before encoded to BASE64) */
 gsize jabber_ibb_session_get_max_data_size(const JabberIBBSession *sess);
 
+/* whether another data block can be sent before earlier ones have been
+ acknowledged */
+gboolean jabber_ibb_session_can_send(const JabberIBBSession *sess);
+
+/* whether any sent data blocks are still awaiting acknowledgement */
+gboolean jabber_ibb_session_has_unacked_data(const JabberIBBSession *sess);
+
 gpointer jabber_ibb_session_get_user_data(JabberIBBSession *sess);
 
 /* handle incoming packet */
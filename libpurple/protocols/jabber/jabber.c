@@ -33,6 +33,7 @@
 #include "dnssrv.h"
 #include "imgstore.h"
 #include "message.h"
+#include "metrics.h"
 #include "notify.h"
 #include "pluginpref.h"
 #include "privacy.h"
@@ -83,6 +84,11 @@ GList *jabber_identities = NULL;
 
 static GHashTable *jabber_cmds = NULL; /* PurplePlugin * => GSList of ids */
 
+static PurpleMetric *rx_bytes = NULL;
+static PurpleMetric *rx_stanzas = NULL;
+static PurpleMetric *tx_bytes = NULL;
+static PurpleMetric *tx_stanzas = NULL;
+
 static gint plugin_ref = 0;
 
 static void jabber_unregister_account_cb(JabberStream *js);
@@ -338,6 +344,8 @@ void jabber_process_packet(JabberStream *js, xmlnode **packet)
 	if(NULL == *packet)
 		return;
 
+	purple_metric_add(rx_stanzas, 1);
+
 	name = (*packet)->name;
 	xmlns = xmlnode_get_namespace(*packet);
 
@@ -474,7 +482,8 @@ void jabber_send_raw(JabberStream *js, const char *data, int len)
 	g_return_if_fail(data != NULL);
 
 	/* because printing a tab to debug every minute gets old */
-	if (data && strcmp(data, "\t") != 0) {
+	if (data && strcmp(data, "\t") != 0 &&
+			purple_debug_is_active(PURPLE_DEBUG_MISC, "jabber")) {
 		const char *username;
 		char *text = NULL, *last_part = NULL, *tag_start = NULL;
 
@@ -520,6 +529,8 @@ void jabber_send_raw(JabberStream *js, const char *data, int len)
 	if (len == -1)
 		len = strlen(data);
 
+	purple_metric_add(tx_bytes, len);
+
 	/* If we've got a security layer, we need to encode the data,
 	 * splitting it on the maximum buffer length negotiated */
 #ifdef HAVE_CYRUS_SASL
@@ -613,6 +624,7 @@ void jabber_send_signal_cb(PurpleConnection *pc, xmlnode **packet,
 
 void jabber_send(JabberStream *js, xmlnode *packet)
 {
+	purple_metric_add(tx_stanzas, 1);
 	purple_signal_emit(purple_connection_get_prpl(js->gc), "jabber-sending-xmlnode", js->gc, &packet);
 }
 
@@ -639,6 +651,15 @@ void jabber_keepalive(PurpleConnection *gc)
 	}
 }
 
+void
+jabber_count_rx_bytes(int len)
+{
+	/* The metrics are registered when the plugin is initialized, which
+	 * the unit tests don't do. */
+	if (rx_bytes != NULL)
+		purple_metric_add(rx_bytes, len);
+}
+
 static void
 jabber_recv_cb_ssl(gpointer data, PurpleSslConnection *gsc,
 		PurpleInputCondition cond)
@@ -656,6 +677,7 @@ jabber_recv_cb_ssl(gpointer data, PurpleSslConnection *gsc,
 
 	while((len = purple_ssl_read(gsc, buf, sizeof(buf) - 1)) > 0) {
 		gc->last_received = time(NULL);
+		jabber_count_rx_bytes(len);
 		buf[len] = '\0';
 		purple_debug_info("jabber", "Recv (ssl)(%d): %s\n", len, buf);
 		jabber_parser_process(js, buf, len);
@@ -690,6 +712,7 @@ jabber_recv_cb(gpointer data, gint source, PurpleInputCondition condition)
 
 	if((len = read(js->fd, buf, sizeof(buf) - 1)) > 0) {
 		gc->last_received = time(NULL);
+		jabber_count_rx_bytes(len);
 #ifdef HAVE_CYRUS_SASL
 		if (js->sasl_maxbuf > 0) {
 			const char *out;
@@ -1630,6 +1653,9 @@ void jabber_close(PurpleConnection *gc)
 	if(js->chats)
 		g_hash_table_destroy(js->chats);
 
+	g_free(js->roomlist_server);
+	g_free(js->roomlist_last);
+
 	while(js->chat_servers) {
 		g_free(js->chat_servers->data);
 		js->chat_servers = g_list_delete_link(js->chat_servers, js->chat_servers);
@@ -3830,6 +3856,15 @@ jabber_do_init(void)
 
 	jabber_cmds = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, cmds_free_func);
 
+	rx_bytes = purple_metrics_get_counter("jabber_rx_bytes_total",
+			"Bytes read from XMPP server connections");
+	rx_stanzas = purple_metrics_get_counter("jabber_rx_stanzas_total",
+			"Stanzas received from XMPP servers");
+	tx_bytes = purple_metrics_get_counter("jabber_tx_bytes_total",
+			"Bytes sent to XMPP servers");
+	tx_stanzas = purple_metrics_get_counter("jabber_tx_stanzas_total",
+			"Stanzas sent to XMPP servers");
+
 	ui_type = ui_info ? g_hash_table_lookup(ui_info, "client_type") : NULL;
 	if (ui_type) {
 		if (strcmp(ui_type, "pc") == 0 ||
@@ -160,6 +160,8 @@ struct _JabberStream
 	GHashTable *chats;
 	GList *chat_servers;
 	PurpleRoomlist *roomlist;
+	char *roomlist_server;  /* The server being listed */
+	char *roomlist_last;    /* The last room of the previous page */
 	GList *user_directories;
 
 	GHashTable *iq_callbacks;
@@ -323,6 +325,8 @@ void jabber_stream_features_parse(JabberStream *js, xmlnode *packet);
 void jabber_process_packet(JabberStream *js, xmlnode **packet);
 void jabber_send(JabberStream *js, xmlnode *data);
 void jabber_send_raw(JabberStream *js, const char *data, int len);
+/* Counts bytes read from the server, over a socket or BOSH. */
+void jabber_count_rx_bytes(int len);
 void jabber_send_signal_cb(PurpleConnection *pc, xmlnode **packet,
                            gpointer unused);
 
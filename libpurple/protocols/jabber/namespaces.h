@@ -42,6 +42,9 @@
 /* XEP-0047 IBB (In-band bytestreams) */
 #define NS_IBB "http://jabber.org/protocol/ibb"
 
+/* XEP-0059 Result Set Management */
+#define NS_RSM "http://jabber.org/protocol/rsm"
+
 /* XEP-0065 SOCKS5 Bytestreams */
 #define NS_BYTESTREAMS "http://jabber.org/protocol/bytestreams"
 
@@ -71,6 +71,7 @@ typedef struct _JabberSIXfer {
 
 	JabberIBBSession *ibb_session;
 	guint ibb_timeout_handle;
+	guint ibb_ready_handle;
 	PurpleCircBuffer *ibb_buffer;
 } JabberSIXfer;
 
@@ -1098,6 +1099,20 @@ jabber_si_xfer_ibb_open_cb(JabberStream *js, const char *who, const char *id,
 	}
 }
 
+static gboolean
+jabber_si_xfer_ibb_ready_cb(gpointer data)
+{
+	PurpleXfer *xfer = (PurpleXfer *) data;
+	JabberSIXfer *jsx = (JabberSIXfer *) xfer->data;
+
+	jsx->ibb_ready_handle = 0;
+
+	if (jabber_ibb_session_can_send(jsx->ibb_session))
+		purple_xfer_prpl_ready(xfer);
+
+	return FALSE;
+}
+
 static gssize
 jabber_si_xfer_ibb_write(const guchar *buffer, size_t len, PurpleXfer *xfer)
 {
@@ -1108,6 +1123,13 @@ jabber_si_xfer_ibb_write(const guchar *buffer, size_t len, PurpleXfer *xfer)
 
 	jabber_ibb_session_send_data(sess, buffer, packet_size);
 
+	/* keep sending until the window is full, rather than waiting for each
+	 block to be acknowledged */
+	if (purple_xfer_get_bytes_remaining(xfer) > packet_size &&
+			jabber_ibb_session_can_send(sess) && !jsx->ibb_ready_handle)
+		jsx->ibb_ready_handle =
+			purple_timeout_add(0, jabber_si_xfer_ibb_ready_cb, xfer);
+
 	return packet_size;
 }
 
@@ -1115,15 +1137,21 @@ static void
 jabber_si_xfer_ibb_sent_cb(JabberIBBSession *sess)
 {
 	PurpleXfer *xfer = (PurpleXfer *) jabber_ibb_session_get_user_data(sess);
+	JabberSIXfer *jsx = (JabberSIXfer *) xfer->data;
 	gsize remaining = purple_xfer_get_bytes_remaining(xfer);
 
 	if (remaining == 0) {
+		/* wait for every block to be acknowledged; an error reply to any
+		 of them fails the transfer instead */
+		if (jabber_ibb_session_has_unacked_data(sess))
+			return;
+
 		/* close the session */
 		jabber_ibb_session_close(sess);
 		purple_xfer_set_completed(xfer, TRUE);
 		purple_xfer_end(xfer);
-	} else {
-		/* send more... */
+	} else if (!jsx->ibb_ready_handle) {
+		/* send more, unless already scheduled to... */
 		purple_xfer_prpl_ready(xfer);
 	}
 }
@@ -1329,6 +1357,8 @@ static void jabber_si_xfer_free(PurpleXfer *xfer)
 			purple_timeout_remove(jsx->connect_timeout);
 		if (jsx->ibb_timeout_handle > 0)
 			purple_timeout_remove(jsx->ibb_timeout_handle);
+		if (jsx->ibb_ready_handle > 0)
+			purple_timeout_remove(jsx->ibb_ready_handle);
 
 		if (jsx->streamhosts) {
 			g_list_foreach(jsx->streamhosts, jabber_si_free_streamhost, NULL);
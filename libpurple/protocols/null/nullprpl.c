@@ -357,17 +357,11 @@ static GHashTable *nullprpl_chat_info_defaults(PurpleConnection *gc,
   return defaults;
 }
 
-static void nullprpl_login(PurpleAccount *acct)
+static void nullprpl_login_finish(PurpleConnection *gc)
 {
-  PurpleConnection *gc = purple_account_get_connection(acct);
+  PurpleAccount *acct = purple_connection_get_account(gc);
   GList *offline_messages;
 
-  purple_debug_info("nullprpl", "logging in %s\n", acct->username);
-
-  purple_connection_update_progress(gc, _("Connecting"),
-                                    0,   /* which connection step this is */
-                                    2);  /* total number of steps */
-
   purple_connection_update_progress(gc, _("Connected"),
                                     1,   /* which connection step this is */
                                     2);  /* total number of steps */
@@ -400,8 +394,58 @@ static void nullprpl_login(PurpleAccount *acct)
   g_hash_table_remove(goffline_messages, &acct->username);
 }
 
+/*
+ * The "login_delay" and "login_failure" account options make signing on
+ * take a while, and fail some of the time, like a real server would. Add a
+ * few dozen accounts with them set to watch how the login queue copes.
+ */
+static gboolean nullprpl_login_timeout(gpointer data)
+{
+  PurpleConnection *gc = (PurpleConnection *)data;
+  int failure = purple_account_get_int(gc->account, "login_failure", 0);
+
+  gc->proto_data = NULL;
+
+  if (g_random_int_range(0, 100) < failure) {
+    purple_debug_info("nullprpl", "failing login for %s\n",
+                      gc->account->username);
+    purple_connection_error_reason(gc, PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+                                   _("Simulated login failure"));
+    return FALSE;
+  }
+
+  nullprpl_login_finish(gc);
+  return FALSE;
+}
+
+static void nullprpl_login(PurpleAccount *acct)
+{
+  PurpleConnection *gc = purple_account_get_connection(acct);
+  int delay = purple_account_get_int(acct, "login_delay", 0);
+  int failure = purple_account_get_int(acct, "login_failure", 0);
+
+  purple_debug_info("nullprpl", "logging in %s\n", acct->username);
+
+  purple_connection_update_progress(gc, _("Connecting"),
+                                    0,   /* which connection step this is */
+                                    2);  /* total number of steps */
+
+  if (delay > 0 || failure > 0) {
+    /* remember the timer, in case we're closed before it fires */
+    guint timer = purple_timeout_add(MAX(delay, 0), nullprpl_login_timeout, gc);
+    gc->proto_data = GUINT_TO_POINTER(timer);
+    return;
+  }
+
+  nullprpl_login_finish(gc);
+}
+
 static void nullprpl_close(PurpleConnection *gc)
 {
+  /* still waiting on a simulated login? */
+  if (gc->proto_data != NULL)
+    purple_timeout_remove(GPOINTER_TO_UINT(gc->proto_data));
+
   /* notify other nullprpl accounts */
   foreach_nullprpl_gc(report_status_change, gc, NULL);
 }
@@ -1138,11 +1182,23 @@ static void nullprpl_init(PurplePlugin *plugin)
     _("Example option"),      /* text shown to user */
     "example",                /* pref name */
     "default");               /* default value */
+  PurpleAccountOption *delay_option = purple_account_option_int_new(
+    _("Simulated login time (ms)"),
+    "login_delay",
+    0);
+  PurpleAccountOption *failure_option = purple_account_option_int_new(
+    _("Simulated login failures (%)"),
+    "login_failure",
+    0);
 
   purple_debug_info("nullprpl", "starting up\n");
 
   prpl_info.user_splits = g_list_append(NULL, split);
   prpl_info.protocol_options = g_list_append(NULL, option);
+  prpl_info.protocol_options = g_list_append(prpl_info.protocol_options,
+                                             delay_option);
+  prpl_info.protocol_options = g_list_append(prpl_info.protocol_options,
+                                             failure_option);
 
   /* register whisper chat command, /msg */
   purple_cmd_register("msg",
@@ -21,6 +21,7 @@
 #include "oscar.h"
 
 #include "eventloop.h"
+#include "metrics.h"
 #include "proxy.h"
 
 #ifndef _WIN32
@@ -33,6 +34,19 @@
 #include "win32dep.h"
 #endif
 
+/*
+ * How often, in milliseconds, to check a rateclass whose limits don't
+ * tell us when we'll next be able to send.
+ */
+#define FLAP_QUEUE_POLL_INTERVAL 500
+
+static PurpleMetric *rx_flaps = NULL;
+static PurpleMetric *rx_bytes = NULL;
+static PurpleMetric *tx_flaps = NULL;
+static PurpleMetric *tx_bytes = NULL;
+static PurpleMetric *queued_snacs = NULL;
+static PurpleMetric *queue_delay = NULL;
+
 /**
  * This sends a channel 1 SNAC containing the FLAP version.
  * The FLAP version is sent by itself at the beginning of every
@@ -135,89 +149,177 @@ rateclass_get_new_current(FlapConnection *conn, struct rateclass *rateclass, str
 }
 
 /*
- * Attempt to send the contents of a given queue
- *
- * @return TRUE if the queue was completely emptied or was initially
- *         empty; FALSE if rate limiting prevented it from being
- *         emptied.
+ * How long, in milliseconds, until a SNAC in this rateclass can be sent
+ * without going over the alert level.  0 means one can be sent now.
  */
-static gboolean flap_connection_send_snac_queue(FlapConnection *conn, struct timeval now, GQueue *queue)
+static guint
+rateclass_get_delay(FlapConnection *conn, struct rateclass *rateclass, struct timeval *now)
 {
-	while (!g_queue_is_empty(queue))
-	{
-		QueuedSnac *queued_snac;
-		struct rateclass *rateclass;
+	long elapsed, needed;
 
-		queued_snac = g_queue_peek_head(queue);
+	/*
+	 * If the server is dropping our SNACs, or the limits never allow
+	 * sending, there's no telling when that will change.  Check back
+	 * every so often.
+	 */
+	if (rateclass->dropping_snacs || rateclass->max <= rateclass->alert)
+		return FLAP_QUEUE_POLL_INTERVAL;
 
-		rateclass = flap_connection_get_rateclass(conn, queued_snac->family, queued_snac->subtype);
-		if (rateclass != NULL)
-		{
-			guint32 new_current;
+	if (rateclass_get_new_current(conn, rateclass, now) > rateclass->alert)
+		return 0;
+
+	/*
+	 * Solve the formula in rateclass_get_new_current() for the time
+	 * difference that takes the average above the alert level.
+	 */
+	elapsed = (now->tv_sec - rateclass->last.tv_sec) * 1000 + (now->tv_usec - rateclass->last.tv_usec) / 1000;
+	needed = (long)(rateclass->alert + 1) * rateclass->windowsize - (long)rateclass->current * (rateclass->windowsize - 1);
+
+	return MAX(needed - elapsed, 1);
+}
 
-			new_current = rateclass_get_new_current(conn, rateclass, &now);
+static void
+rateclass_update(struct rateclass *rateclass, guint32 new_current, struct timeval *now)
+{
+	rateclass->current = new_current;
+	rateclass->last.tv_sec = now->tv_sec;
+	rateclass->last.tv_usec = now->tv_usec;
+}
+
+static gboolean
+rateclass_has_queued_snacs(struct rateclass *rateclass)
+{
+	int i;
 
-			if (rateclass->dropping_snacs || new_current <= rateclass->alert)
+	for (i = 0; i < SNAC_PRIORITY_COUNT; i++)
+		if (rateclass->queued_snacs[i] && !g_queue_is_empty(rateclass->queued_snacs[i]))
+			return TRUE;
+
+	return FALSE;
+}
+
+/*
+ * Send as many queued SNACs of this rateclass as it allows right now,
+ * highest priority first.
+ */
+static void
+rateclass_send_queued(FlapConnection *conn, struct rateclass *rateclass, struct timeval *now)
+{
+	int i;
+
+	for (i = 0; i < SNAC_PRIORITY_COUNT; i++)
+	{
+		GQueue *queue = rateclass->queued_snacs[i];
+
+		while (queue && !g_queue_is_empty(queue))
+		{
+			QueuedSnac *queued_snac;
+			unsigned long delay;
+
+			if (rateclass_get_delay(conn, rateclass, now) > 0)
 				/* Not ready to send this SNAC yet--keep waiting. */
-				return FALSE;
+				return;
+
+			rateclass_update(rateclass, rateclass_get_new_current(conn, rateclass, now), now);
+
+			queued_snac = g_queue_pop_head(queue);
+			delay = (now->tv_sec - queued_snac->queued.tv_sec) * 1000 + (now->tv_usec - queued_snac->queued.tv_usec) / 1000;
+			conn->queued_count--;
+			conn->delayed_snacs++;
+			conn->delayed_msecs += delay;
+			conn->delayed_max_msecs = MAX(conn->delayed_max_msecs, delay);
+			purple_metric_add(queued_snacs, -1);
+			purple_metric_observe(queue_delay, delay);
 
-			rateclass->current = new_current;
-			rateclass->last.tv_sec = now.tv_sec;
-			rateclass->last.tv_usec = now.tv_usec;
+			flap_connection_send(conn, queued_snac->frame);
+			g_free(queued_snac);
 		}
+	}
+}
 
-		flap_connection_send(conn, queued_snac->frame);
-		g_free(queued_snac);
-		g_queue_pop_head(queue);
+static gboolean flap_connection_send_queued(gpointer data);
+
+/*
+ * Set a timer for when the first rateclass with queued SNACs will allow
+ * sending one, replacing any timer already set.
+ */
+static void
+flap_connection_schedule_queued(FlapConnection *conn, struct timeval *now)
+{
+	GSList *tmp;
+	guint delay = G_MAXUINT;
+
+	if (conn->queued_timeout != 0)
+	{
+		purple_timeout_remove(conn->queued_timeout);
+		conn->queued_timeout = 0;
 	}
 
-	/* We emptied the queue */
-	return TRUE;
+	for (tmp = conn->rateclasses; tmp != NULL; tmp = tmp->next)
+	{
+		struct rateclass *rateclass = tmp->data;
+
+		if (rateclass_has_queued_snacs(rateclass))
+			delay = MIN(delay, rateclass_get_delay(conn, rateclass, now));
+	}
+
+	if (delay != G_MAXUINT)
+		conn->queued_timeout = purple_timeout_add(delay, flap_connection_send_queued, conn);
 }
 
 static gboolean flap_connection_send_queued(gpointer data)
 {
 	FlapConnection *conn;
 	struct timeval now;
+	GSList *tmp;
 
 	conn = data;
+	conn->queued_timeout = 0;
 	gettimeofday(&now, NULL);
 
-	purple_debug_info("oscar", "Attempting to send %u queued SNACs and %u queued low-priority SNACs for %p\n",
-					  (conn->queued_snacs ? conn->queued_snacs->length : 0),
-					  (conn->queued_lowpriority_snacs ? conn->queued_lowpriority_snacs->length : 0),
-					  conn);
-	if (!conn->queued_snacs || flap_connection_send_snac_queue(conn, now, conn->queued_snacs)) {
-		if (!conn->queued_lowpriority_snacs || flap_connection_send_snac_queue(conn, now, conn->queued_lowpriority_snacs)) {
-			/* Both queues emptied. */
-			conn->queued_timeout = 0;
-			return FALSE;
-		}
-	}
+	purple_debug_info("oscar", "Attempting to send %u queued SNACs for %p\n",
+					  conn->queued_count, conn);
+
+	/* Rateclasses are independent, so one being limited doesn't hold up the others */
+	for (tmp = conn->rateclasses; tmp != NULL; tmp = tmp->next)
+		rateclass_send_queued(conn, tmp->data, &now);
 
-	/* We couldn't send all our SNACs. Keep trying */
-	return TRUE;
+	if (conn->queued_count == 0)
+		purple_debug_info("oscar", "Sent all queued SNACs for %p; %u delayed so far, "
+						  "%lu ms on average and %lu ms at most, with up to %u queued at once\n",
+						  conn, conn->delayed_snacs,
+						  conn->delayed_snacs ? conn->delayed_msecs / conn->delayed_snacs : 0,
+						  conn->delayed_max_msecs, conn->queued_max);
+	else
+		/* We couldn't send all our SNACs. Try again when we can */
+		flap_connection_schedule_queued(conn, &now);
+
+	return FALSE;
 }
 
 /**
  * This sends a channel 2 FLAP containing a SNAC.  The SNAC family and
  * subtype are looked up in the rate info for this connection, and if
  * sending this SNAC will induce rate limiting then we delay sending
- * of the SNAC by putting it into an outgoing holding queue.
+ * of the SNAC by putting it into an outgoing holding queue for its
+ * rate class.
  *
  * @param data The optional bytestream that makes up the data portion
  *        of this SNAC.  For empty SNACs this should be NULL.
  * @param high_priority If TRUE, the SNAC will be queued normally if
  *        needed. If FALSE, it will be queued separately, to be sent
- *        only if all high priority SNACs have been sent.
+ *        only if all high priority SNACs in its rate class have been
+ *        sent.  IMs and typing notifications go ahead of both.
  */
 void
 flap_connection_send_snac_with_priority(OscarData *od, FlapConnection *conn, guint16 family, const guint16 subtype, aim_snacid_t snacid, ByteStream *data, gboolean high_priority)
 {
 	FlapFrame *frame;
 	guint32 length;
-	gboolean enqueue = FALSE;
 	struct rateclass *rateclass;
+	struct timeval now;
+	QueuedSnac *queued_snac;
+	SnacPriority priority;
 
 	length = data != NULL ? data->offset : 0;
 
@@ -230,57 +332,49 @@ flap_connection_send_snac_with_priority(OscarData *od, FlapConnection *conn, gui
 		byte_stream_putbs(&frame->data, data, length);
 	}
 
-	if (conn->queued_timeout != 0)
-		enqueue = TRUE;
-	else if ((rateclass = flap_connection_get_rateclass(conn, family, subtype)) != NULL)
+	rateclass = flap_connection_get_rateclass(conn, family, subtype);
+	if (rateclass == NULL)
 	{
-		struct timeval now;
-		guint32 new_current;
-
-		gettimeofday(&now, NULL);
-		new_current = rateclass_get_new_current(conn, rateclass, &now);
+		flap_connection_send(conn, frame);
+		return;
+	}
 
-		if (rateclass->dropping_snacs || new_current <= rateclass->alert)
-		{
-			purple_debug_info("oscar", "Current rate for conn %p would be %u, but we alert at %u; enqueueing\n", conn, new_current, rateclass->alert);
+	gettimeofday(&now, NULL);
 
-			enqueue = TRUE;
-		}
-		else
-		{
-			rateclass->current = new_current;
-			rateclass->last.tv_sec = now.tv_sec;
-			rateclass->last.tv_usec = now.tv_usec;
-		}
+	/* Queue behind anything already waiting in this rateclass, to keep order */
+	if (!rateclass_has_queued_snacs(rateclass) && rateclass_get_delay(conn, rateclass, &now) == 0)
+	{
+		rateclass_update(rateclass, rateclass_get_new_current(conn, rateclass, &now), &now);
+		flap_connection_send(conn, frame);
+		return;
 	}
 
-	if (enqueue)
-	{
-		/* We've been sending too fast, so delay this message */
-		QueuedSnac *queued_snac;
-
-		queued_snac = g_new(QueuedSnac, 1);
-		queued_snac->family = family;
-		queued_snac->subtype = subtype;
-		queued_snac->frame = frame;
-
-		if (high_priority) {
-			if (!conn->queued_snacs)
-				conn->queued_snacs = g_queue_new();
-			g_queue_push_tail(conn->queued_snacs, queued_snac);
-		} else {
-			if (!conn->queued_lowpriority_snacs)
-				conn->queued_lowpriority_snacs = g_queue_new();
-			g_queue_push_tail(conn->queued_lowpriority_snacs, queued_snac);
-		}
+	/* We've been sending too fast, so delay this message */
+	purple_debug_info("oscar", "Current rate for conn %p would be %u, but we alert at %u; enqueueing\n",
+					  conn, rateclass_get_new_current(conn, rateclass, &now), rateclass->alert);
 
-		if (conn->queued_timeout == 0)
-			conn->queued_timeout = purple_timeout_add(500, flap_connection_send_queued, conn);
+	if (!high_priority)
+		priority = SNAC_PRIORITY_LOW;
+	else if (family == SNAC_FAMILY_ICBM && (subtype == 0x0006 || subtype == SNAC_SUBTYPE_ICBM_MTN))
+		priority = SNAC_PRIORITY_INTERACTIVE;
+	else
+		priority = SNAC_PRIORITY_NORMAL;
 
-		return;
-	}
+	queued_snac = g_new(QueuedSnac, 1);
+	queued_snac->family = family;
+	queued_snac->subtype = subtype;
+	queued_snac->frame = frame;
+	queued_snac->queued = now;
 
-	flap_connection_send(conn, frame);
+	if (!rateclass->queued_snacs[priority])
+		rateclass->queued_snacs[priority] = g_queue_new();
+	g_queue_push_tail(rateclass->queued_snacs[priority], queued_snac);
+
+	conn->queued_count++;
+	conn->queued_max = MAX(conn->queued_max, conn->queued_count);
+	purple_metric_add(queued_snacs, 1);
+
+	flap_connection_schedule_queued(conn, &now);
 }
 
 void
@@ -334,6 +428,21 @@ flap_connection_new(OscarData *od, int type)
 {
 	FlapConnection *conn;
 
+	if (rx_flaps == NULL) {
+		rx_flaps = purple_metrics_get_counter("oscar_rx_flaps_total",
+				"FLAP frames received from OSCAR servers");
+		rx_bytes = purple_metrics_get_counter("oscar_rx_bytes_total",
+				"Bytes of FLAP frames received from OSCAR servers");
+		tx_flaps = purple_metrics_get_counter("oscar_tx_flaps_total",
+				"FLAP frames sent to OSCAR servers");
+		tx_bytes = purple_metrics_get_counter("oscar_tx_bytes_total",
+				"Bytes of FLAP frames sent to OSCAR servers");
+		queued_snacs = purple_metrics_get_gauge("oscar_queued_snacs",
+				"SNACs waiting for their rate class to allow sending them");
+		queue_delay = purple_metrics_get_histogram("oscar_snac_queue_delay_ms",
+				"Time SNACs spent queued by rate limiting");
+	}
+
 	conn = g_new0(FlapConnection, 1);
 	conn->od = od;
 	conn->buffer_outgoing = purple_circ_buffer_new(0);
@@ -506,34 +615,33 @@ flap_connection_destroy_cb(gpointer data)
 	g_slist_free(conn->groups);
 	while (conn->rateclasses != NULL)
 	{
-		g_free(conn->rateclasses->data);
-		conn->rateclasses = g_slist_delete_link(conn->rateclasses, conn->rateclasses);
-	}
-
-	g_hash_table_destroy(conn->rateclass_members);
+		struct rateclass *rateclass = conn->rateclasses->data;
+		int i;
 
-	if (conn->queued_snacs) {
-		while (!g_queue_is_empty(conn->queued_snacs))
+		for (i = 0; i < SNAC_PRIORITY_COUNT; i++)
 		{
-			QueuedSnac *queued_snac;
-			queued_snac = g_queue_pop_head(conn->queued_snacs);
-			flap_frame_destroy(queued_snac->frame);
-			g_free(queued_snac);
-		}
-		g_queue_free(conn->queued_snacs);
-	}
+			if (rateclass->queued_snacs[i] == NULL)
+				continue;
 
-	if (conn->queued_lowpriority_snacs) {
-		while (!g_queue_is_empty(conn->queued_lowpriority_snacs))
-		{
-			QueuedSnac *queued_snac;
-			queued_snac = g_queue_pop_head(conn->queued_lowpriority_snacs);
-			flap_frame_destroy(queued_snac->frame);
-			g_free(queued_snac);
+			while (!g_queue_is_empty(rateclass->queued_snacs[i]))
+			{
+				QueuedSnac *queued_snac;
+				queued_snac = g_queue_pop_head(rateclass->queued_snacs[i]);
+				flap_frame_destroy(queued_snac->frame);
+				g_free(queued_snac);
+			}
+			g_queue_free(rateclass->queued_snacs[i]);
 		}
-		g_queue_free(conn->queued_lowpriority_snacs);
+
+		g_free(rateclass);
+		conn->rateclasses = g_slist_delete_link(conn->rateclasses, conn->rateclasses);
 	}
 
+	g_hash_table_destroy(conn->rateclass_members);
+
+	/* The SNACs still queued were dropped above. */
+	purple_metric_add(queued_snacs, -(gssize)conn->queued_count);
+
 	if (conn->queued_timeout > 0)
 		purple_timeout_remove(conn->queued_timeout);
 
@@ -981,6 +1089,8 @@ flap_connection_recv(FlapConnection *conn)
 		}
 
 		/* We have a complete FLAP!  Handle it and continue reading */
+		purple_metric_add(rx_flaps, 1);
+		purple_metric_add(rx_bytes, 6 + conn->buffer_incoming.data.len);
 		byte_stream_rewind(&conn->buffer_incoming.data);
 		parse_flap(conn->od, conn, &conn->buffer_incoming);
 		conn->lastactivity = time(NULL);
@@ -1115,6 +1225,9 @@ sendframe_flap(FlapConnection *conn, FlapFrame *frame)
 	byte_stream_rewind(&bs);
 	flap_connection_send_byte_stream(&bs, conn, bslen);
 
+	purple_metric_add(tx_flaps, 1);
+	purple_metric_add(tx_bytes, bslen);
+
 	byte_stream_destroy(&bs);
 }
 
@@ -247,6 +247,7 @@ struct _QueuedSnac
 	guint16 family;
 	guint16 subtype;
 	FlapFrame *frame;
+	struct timeval queued; /**< When this SNAC was queued. */
 };
 
 struct _FlapFrame
@@ -290,9 +291,14 @@ struct _FlapConnection
 	struct rateclass *default_rateclass;
 	GHashTable *rateclass_members; /* Key is family and subtype, value is pointer to the rateclass struct to use. */
 
-	GQueue *queued_snacs; /**< Contains QueuedSnacs. */
-	GQueue *queued_lowpriority_snacs; /**< Contains QueuedSnacs to send only once queued_snacs is empty */
-	guint queued_timeout;
+	guint queued_timeout; /**< Fires when the next queued SNAC may be sent. */
+
+	/* Statistics about SNACs delayed by rate limiting */
+	guint queued_count; /**< SNACs currently queued, in all rate classes. */
+	guint queued_max; /**< The most SNACs that have been queued at once. */
+	guint delayed_snacs; /**< SNACs that have been sent after queueing. */
+	gulong delayed_msecs; /**< Total time those SNACs spent queued. */
+	gulong delayed_max_msecs; /**< Longest time one of them spent queued. */
 
 	void *internal; /* internal conn-specific libfaim data */
 };
@@ -1277,6 +1283,15 @@ struct chatsnacinfo {
 	guint16 instance;
 };
 
+/* Priorities of SNACs queued by rate limiting, highest first */
+typedef enum
+{
+	SNAC_PRIORITY_INTERACTIVE, /**< IMs and typing notifications */
+	SNAC_PRIORITY_NORMAL,
+	SNAC_PRIORITY_LOW,
+	SNAC_PRIORITY_COUNT
+} SnacPriority;
+
 struct rateclass {
 	guint16 classid;
 	guint32 windowsize;
@@ -1289,6 +1304,12 @@ struct rateclass {
 	guint8 dropping_snacs;
 
 	struct timeval last; /**< The time when we last sent a SNAC of this rate class. */
+
+	/**
+	 * SNACs waiting for this rate class to allow sending, one queue per
+	 * priority, highest first.  Each contains QueuedSnacs.
+	 */
+	GQueue *queued_snacs[SNAC_PRIORITY_COUNT];
 };
 
 int aim_cachecookie(OscarData *od, IcbmCookie *cookie);
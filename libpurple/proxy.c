@@ -35,6 +35,7 @@
 #include "cipher.h"
 #include "debug.h"
 #include "dnsquery.h"
+#include "metrics.h"
 #include "notify.h"
 #include "ntlm.h"
 #include "prefs.h"
@@ -73,6 +74,7 @@ struct _PurpleProxyConnectData {
 	gsize read_buf_len;
 	gsize read_len;
 	PurpleAccount *account;
+	gint64 started;
 };
 
 static const char * const socks5errors[] = {
@@ -89,6 +91,9 @@ static const char * const socks5errors[] = {
 
 static PurpleProxyInfo *global_proxy_info = NULL;
 
+static PurpleMetric *proxy_connect_time = NULL;
+static PurpleMetric *proxy_connect_failures = NULL;
+
 static GSList *handles = NULL;
 
 static void try_connect(PurpleProxyConnectData *connect_data);
@@ -639,6 +644,7 @@ purple_proxy_connect_data_disconnect(PurpleProxyConnectData *connect_data, const
 		else
 		{
 			/* Everything failed!  Tell the originator of the request. */
+			purple_metric_add(proxy_connect_failures, 1);
 			connect_data->connect_cb(connect_data->data, -1, error_message);
 			purple_proxy_connect_data_destroy(connect_data);
 		}
@@ -668,6 +674,8 @@ purple_proxy_connect_data_connected(PurpleProxyConnectData *connect_data)
 {
 	purple_debug_info("proxy", "Connected to %s:%d.\n",
 	                  connect_data->host, connect_data->port);
+	purple_metric_observe(proxy_connect_time,
+			(purple_metrics_get_time() - connect_data->started) / 1000);
 
 	connect_data->connect_cb(connect_data->data, connect_data->fd, NULL);
 
@@ -2313,6 +2321,7 @@ purple_proxy_connect(void *handle, PurpleAccount *account,
 	g_return_val_if_fail(connect_cb != NULL, NULL);
 
 	connect_data = g_new0(PurpleProxyConnectData, 1);
+	connect_data->started = purple_metrics_get_time();
 	connect_data->fd = -1;
 	connect_data->socket_type = SOCK_STREAM;
 	connect_data->handle = handle;
@@ -2381,6 +2390,7 @@ purple_proxy_connect_udp(void *handle, PurpleAccount *account,
 	g_return_val_if_fail(connect_cb != NULL, NULL);
 
 	connect_data = g_new0(PurpleProxyConnectData, 1);
+	connect_data->started = purple_metrics_get_time();
 	connect_data->fd = -1;
 	connect_data->socket_type = SOCK_DGRAM;
 	connect_data->handle = handle;
@@ -2504,6 +2514,7 @@ purple_proxy_connect_socks5_account(void *handle, PurpleAccount *account,
 	g_return_val_if_fail(connect_cb != NULL, NULL);
 
 	connect_data = g_new0(PurpleProxyConnectData, 1);
+	connect_data->started = purple_metrics_get_time();
 	connect_data->fd = -1;
 	connect_data->socket_type = SOCK_STREAM;
 	connect_data->handle = handle;
@@ -2612,6 +2623,11 @@ purple_proxy_init(void)
 	/* Initialize a default proxy info struct. */
 	global_proxy_info = purple_proxy_info_new();
 
+	proxy_connect_time = purple_metrics_get_histogram("proxy_connect_ms",
+			"Time taken to establish outgoing connections, in milliseconds");
+	proxy_connect_failures = purple_metrics_get_counter("proxy_connect_failures_total",
+			"Outgoing connections that could not be established");
+
 	/* Proxy */
 	purple_prefs_add_none("/purple/proxy");
 	purple_prefs_add_string("/purple/proxy/type", "none");
@@ -29,12 +29,111 @@
 #include "account.h"
 #include "connection.h"
 #include "debug.h"
+#include "eventloop.h"
 #include "roomlist.h"
 #include "server.h"
 
 
+/* Number of rooms handed to the UI at a time */
+#define ROOMLIST_BATCH_SIZE 200
+
 static PurpleRoomlistUiOps *ops = NULL;
 
+static GHashTable *roomlists_data = NULL;
+
+typedef struct _PurpleRoomlistPrivData {
+	GList *last_room;           /* The tail of list->rooms */
+	GStringChunk *strings;      /* Interned values of the string fields */
+
+	GQueue pending;             /* Rooms not yet handed to the UI */
+	guint flush_timeout;
+	gboolean in_progress_pending;  /* Tell the UI the listing is over once
+	                                  it has all the rooms */
+
+	PurpleRoomlistFilterFunc filter;
+	gpointer filter_data;
+
+	PurpleRoomlistDrainedFunc drained;
+	gpointer drained_data;
+} PurpleRoomlistPrivData;
+
+static void
+purple_roomlist_priv_data_destroy(gpointer data)
+{
+	PurpleRoomlistPrivData *priv = data;
+
+	if (priv->flush_timeout)
+		purple_timeout_remove(priv->flush_timeout);
+	g_queue_clear(&priv->pending);
+	g_string_chunk_free(priv->strings);
+	g_free(priv);
+}
+
+static void
+add_rooms_to_ui(PurpleRoomlist *list, GList *rooms)
+{
+	if (ops && ops->add_rooms) {
+		ops->add_rooms(list, rooms);
+		return;
+	}
+
+	if (ops && ops->add_room)
+		for (; rooms; rooms = rooms->next)
+			ops->add_room(list, rooms->data);
+}
+
+static gboolean
+flush_pending_rooms(gpointer data)
+{
+	PurpleRoomlist *list = data;
+	PurpleRoomlistPrivData *priv = g_hash_table_lookup(roomlists_data, list);
+	GList *batch = NULL;
+	int count;
+
+	for (count = 0; count < ROOMLIST_BATCH_SIZE && !g_queue_is_empty(&priv->pending); count++)
+		batch = g_list_prepend(batch, g_queue_pop_head(&priv->pending));
+	batch = g_list_reverse(batch);
+
+	add_rooms_to_ui(list, batch);
+	g_list_free(batch);
+
+	if (g_queue_is_empty(&priv->pending)) {
+		PurpleRoomlistDrainedFunc drained = priv->drained;
+
+		priv->flush_timeout = 0;
+
+		if (priv->in_progress_pending) {
+			priv->in_progress_pending = FALSE;
+			if (ops && ops->in_progress)
+				ops->in_progress(list, list->in_progress);
+		}
+
+		/* This may drop the last reference to the list */
+		if (drained) {
+			priv->drained = NULL;
+			drained(list, priv->drained_data);
+		}
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Queue a room to be handed to the UI, unless the filter hides it. The
+ * categories are always shown, so that the rooms in them have a place to go. */
+static void
+queue_room(PurpleRoomlist *list, PurpleRoomlistPrivData *priv, PurpleRoomlistRoom *room)
+{
+	if (priv->filter && !(room->type & PURPLE_ROOMLIST_ROOMTYPE_CATEGORY) &&
+			!priv->filter(list, room, priv->filter_data))
+		return;
+
+	g_queue_push_tail(&priv->pending, room);
+	if (priv->flush_timeout == 0)
+		priv->flush_timeout = purple_timeout_add(0, flush_pending_rooms, list);
+}
+
 /**************************************************************************/
 /** @name Room List API                                                   */
 /**************************************************************************/
@@ -49,6 +148,7 @@ void purple_roomlist_show_with_account(PurpleAccount *account)
 PurpleRoomlist *purple_roomlist_new(PurpleAccount *account)
 {
 	PurpleRoomlist *list;
+	PurpleRoomlistPrivData *priv;
 
 	g_return_val_if_fail(account != NULL, NULL);
 
@@ -58,6 +158,14 @@ PurpleRoomlist *purple_roomlist_new(PurpleAccount *account)
 	list->fields = NULL;
 	list->ref = 1;
 
+	if (roomlists_data == NULL)
+		roomlists_data = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+				NULL, purple_roomlist_priv_data_destroy);
+	priv = g_new0(PurpleRoomlistPrivData, 1);
+	priv->strings = g_string_chunk_new(4096);
+	g_queue_init(&priv->pending);
+	g_hash_table_insert(roomlists_data, list, priv);
+
 	if (ops && ops->create)
 		ops->create(list);
 
@@ -74,14 +182,7 @@ void purple_roomlist_ref(PurpleRoomlist *list)
 
 static void purple_roomlist_room_destroy(PurpleRoomlist *list, PurpleRoomlistRoom *r)
 {
-	GList *l, *j;
-
-	for (l = list->fields, j = r->fields; l && j; l = l->next, j = j->next) {
-		PurpleRoomlistField *f = l->data;
-		if (f->type == PURPLE_ROOMLIST_FIELD_STRING)
-			g_free(j->data);
-	}
-
+	/* The string fields are interned in the list, and freed with it. */
 	g_list_free(r->fields);
 	g_free(r->name);
 	g_free(r);
@@ -103,6 +204,8 @@ static void purple_roomlist_destroy(PurpleRoomlist *list)
 	if (ops && ops->destroy)
 		ops->destroy(list);
 
+	g_hash_table_remove(roomlists_data, list);
+
 	for (l = list->rooms; l; l = l->next) {
 		PurpleRoomlistRoom *r = l->data;
 		purple_roomlist_room_destroy(list, r);
@@ -139,10 +242,20 @@ void purple_roomlist_set_fields(PurpleRoomlist *list, GList *fields)
 
 void purple_roomlist_set_in_progress(PurpleRoomlist *list, gboolean in_progress)
 {
+	PurpleRoomlistPrivData *priv;
+
 	g_return_if_fail(list != NULL);
 
 	list->in_progress = in_progress;
 
+	/* Let the UI catch up with the rooms before telling it we're done */
+	priv = g_hash_table_lookup(roomlists_data, list);
+	if (!in_progress && !g_queue_is_empty(&priv->pending)) {
+		priv->in_progress_pending = TRUE;
+		return;
+	}
+	priv->in_progress_pending = FALSE;
+
 	if (ops && ops->in_progress)
 		ops->in_progress(list, in_progress);
 }
@@ -156,13 +269,58 @@ gboolean purple_roomlist_get_in_progress(PurpleRoomlist *list)
 
 void purple_roomlist_room_add(PurpleRoomlist *list, PurpleRoomlistRoom *room)
 {
+	PurpleRoomlistPrivData *priv;
+
 	g_return_if_fail(list != NULL);
 	g_return_if_fail(room != NULL);
 
-	list->rooms = g_list_append(list->rooms, room);
+	priv = g_hash_table_lookup(roomlists_data, list);
 
-	if (ops && ops->add_room)
-		ops->add_room(list, room);
+	/* Keep the rooms in the order they were added, without walking the list */
+	if (priv->last_room == NULL) {
+		list->rooms = g_list_append(list->rooms, room);
+		priv->last_room = g_list_last(list->rooms);
+	} else {
+		priv->last_room = g_list_append(priv->last_room, room)->next;
+	}
+
+	queue_room(list, priv, room);
+}
+
+void purple_roomlist_set_filter(PurpleRoomlist *list, PurpleRoomlistFilterFunc filter,
+                                gpointer data)
+{
+	PurpleRoomlistPrivData *priv;
+	GList *l;
+
+	g_return_if_fail(list != NULL);
+
+	priv = g_hash_table_lookup(roomlists_data, list);
+	priv->filter = filter;
+	priv->filter_data = data;
+
+	/* Hand the UI all the rooms again, as seen through the new filter. */
+	g_queue_clear(&priv->pending);
+	for (l = list->rooms; l; l = l->next)
+		queue_room(list, priv, l->data);
+}
+
+void purple_roomlist_call_when_drained(PurpleRoomlist *list,
+                                       PurpleRoomlistDrainedFunc func, gpointer data)
+{
+	PurpleRoomlistPrivData *priv;
+
+	g_return_if_fail(list != NULL);
+
+	priv = g_hash_table_lookup(roomlists_data, list);
+	if (func == NULL || !g_queue_is_empty(&priv->pending)) {
+		priv->drained = func;
+		priv->drained_data = data;
+		return;
+	}
+
+	priv->drained = NULL;
+	func(list, data);
 }
 
 PurpleRoomlist *purple_roomlist_get_list(PurpleConnection *gc)
@@ -278,7 +436,13 @@ void purple_roomlist_room_add_field(PurpleRoomlist *list, PurpleRoomlistRoom *ro
 
 	switch(f->type) {
 		case PURPLE_ROOMLIST_FIELD_STRING:
-			room->fields = g_list_append(room->fields, g_strdup(field));
+			/* A lot of rooms share values (like an empty topic, or the
+			 * server), so keep a single copy of each. */
+			if (field != NULL) {
+				PurpleRoomlistPrivData *priv = g_hash_table_lookup(roomlists_data, list);
+				field = g_string_chunk_insert_const(priv->strings, field);
+			}
+			room->fields = g_list_append(room->fields, (gpointer)field);
 			break;
 		case PURPLE_ROOMLIST_FIELD_BOOL:
 		case PURPLE_ROOMLIST_FIELD_INT:
@@ -52,13 +52,35 @@ typedef enum
 {
 	PURPLE_ROOMLIST_FIELD_BOOL,
 	PURPLE_ROOMLIST_FIELD_INT,
-	PURPLE_ROOMLIST_FIELD_STRING /**< We do a g_strdup on the passed value if it's this type. */
+	PURPLE_ROOMLIST_FIELD_STRING /**< We keep a copy of the passed value if it's this type. */
 
 } PurpleRoomlistFieldType;
 
 #include "account.h"
 #include <glib.h>
 
+/**
+ * Decides whether a room is shown in the UI.
+ *
+ * @param list The room list.
+ * @param room The room.
+ * @param data The data passed to purple_roomlist_set_filter().
+ *
+ * @return @c TRUE to show the room.
+ * @since 2.10.11
+ */
+typedef gboolean (*PurpleRoomlistFilterFunc)(PurpleRoomlist *list, PurpleRoomlistRoom *room,
+                                             gpointer data);
+
+/**
+ * Called when the UI has been handed all the rooms added to a list.
+ *
+ * @param list The room list.
+ * @param data The data passed to purple_roomlist_call_when_drained().
+ * @since 2.10.11
+ */
+typedef void (*PurpleRoomlistDrainedFunc)(PurpleRoomlist *list, gpointer data);
+
 /**************************************************************************/
 /** Data Structures                                                       */
 /**************************************************************************/
@@ -108,7 +130,20 @@ struct _PurpleRoomlistUiOps {
 	void (*in_progress)(PurpleRoomlist *list, gboolean flag); /**< Are we fetching stuff still? */
 	void (*destroy)(PurpleRoomlist *list); /**< We're destroying list. */
 
-	void (*_purple_reserved1)(void);
+	/**
+	 * Add a batch of rooms to the list. The rooms are handed over in
+	 * batches from an idle callback, so big lists don't keep the UI busy
+	 * for long. If this is not implemented, @c add_room is called for
+	 * each of the rooms instead.
+	 *
+	 * @param list  The room list.
+	 * @param rooms A list of PurpleRoomlistRoom's, in the order they were
+	 *              added. The list is freed by the core.
+	 *
+	 * @since 2.10.11
+	 */
+	void (*add_rooms)(PurpleRoomlist *list, GList *rooms);
+
 	void (*_purple_reserved2)(void);
 	void (*_purple_reserved3)(void);
 	void (*_purple_reserved4)(void);
@@ -198,12 +233,48 @@ gboolean purple_roomlist_get_in_progress(PurpleRoomlist *list);
 /**
  * Adds a room to the list of them.
  *
+ * The room is not handed to the UI right away: the rooms are queued, and
+ * passed on in batches when the UI has time for them.
+ *
  * @param list The room list.
  * @param room The room to add to the list. The GList of fields must be in the same
                order as was given in purple_roomlist_set_fields().
 */
 void purple_roomlist_room_add(PurpleRoomlist *list, PurpleRoomlistRoom *room);
 
+/**
+ * Sets a filter for the rooms that are shown in the UI.
+ *
+ * Rooms the filter rejects are still kept in the list, but are not handed
+ * to the UI. Categories are never filtered. Setting a filter queues all the
+ * rooms already in the list again, so the UI should forget the rooms it is
+ * showing before calling this.
+ *
+ * @param list   The room list.
+ * @param filter The filter, or @c NULL to show all the rooms.
+ * @param data   Data to pass to the filter.
+ *
+ * @since 2.10.11
+ */
+void purple_roomlist_set_filter(PurpleRoomlist *list, PurpleRoomlistFilterFunc filter,
+                                gpointer data);
+
+/**
+ * Calls a function once the UI has been handed all the rooms added so far.
+ *
+ * Protocols that can fetch a list in pages can use this to ask for the next
+ * page only when the UI has caught up. The function is called right away
+ * if no rooms are waiting. Only one function can be waiting at a time.
+ *
+ * @param list The room list.
+ * @param func The function to call, or @c NULL to cancel the one waiting.
+ * @param data Data to pass to @a func.
+ *
+ * @since 2.10.11
+ */
+void purple_roomlist_call_when_drained(PurpleRoomlist *list,
+                                       PurpleRoomlistDrainedFunc func, gpointer data);
+
 /**
  * Returns a PurpleRoomlist structure from the prpl, and
  * instructs the prpl to start fetching the list.
@@ -271,7 +342,13 @@ PurpleRoomlistRoom *purple_roomlist_room_new(PurpleRoomlistRoomType type, const
  *
  * @param list The room list the room belongs to.
  * @param room The room.
- * @param field The field to append. Strings get g_strdup'd internally.
+ * @param field The field to append. Strings are copied internally. Equal
+ *              strings in a list share a single copy, which belongs to the
+ *              list and lives until the list is freed. They must not be
+ *              freed or modified.
+ *
+ * @note Before 2.10.11, each room had its own copy of its string fields,
+ *       freed along with the room.
  */
 void purple_roomlist_room_add_field(PurpleRoomlist *list, PurpleRoomlistRoom *room, gconstpointer field);
 
@@ -311,7 +388,8 @@ PurpleRoomlistRoom * purple_roomlist_room_get_parent(PurpleRoomlistRoom *room);
  * Get the list of fields for a room.
  *
  * @param room  The room, which must not be @c NULL.
- * @constreturn A list of fields
+ * @constreturn A list of fields.  String fields are shared with other rooms
+ *              in the list, so they must not be freed or modified.
  * @since 2.4.0
  */
 GList * purple_roomlist_room_get_fields(PurpleRoomlistRoom *room);
@@ -27,6 +27,7 @@
 
 #include "dbus-maybe.h"
 #include "debug.h"
+#include "metrics.h"
 #include "signals.h"
 #include "value.h"
 
@@ -73,6 +74,8 @@ typedef struct
 
 static GHashTable *instance_table = NULL;
 
+static PurpleMetric *signal_emits = NULL;
+
 static void
 destroy_instance_data(PurpleInstanceData *instance_data)
 {
@@ -462,6 +465,8 @@ purple_signal_emit_vargs(void *instance, const char *signal, va_list args)
 		return;
 	}
 
+	purple_metric_add(signal_emits, 1);
+
 	for (l = signal_data->handlers; l != NULL; l = l_next)
 	{
 		l_next = l->next;
@@ -537,6 +542,8 @@ purple_signal_emit_vargs_return_1(void *instance, const char *signal,
 		return 0;
 	}
 
+	purple_metric_add(signal_emits, 1);
+
 #ifdef HAVE_DBUS
 	G_VA_COPY(tmp, args);
 	purple_dbus_signal_emit_purple(signal, signal_data->num_values,
@@ -580,6 +587,9 @@ purple_signals_init()
 	instance_table =
 		g_hash_table_new_full(g_direct_hash, g_direct_equal,
 							  NULL, (GDestroyNotify)destroy_instance_data);
+
+	signal_emits = purple_metrics_get_counter("signal_emits_total",
+			"Signals emitted");
 }
 
 void
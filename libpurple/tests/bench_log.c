@@ -0,0 +1,237 @@
+/*
+ * Times reading compact logs, compared with reading the same messages as a
+ * txt log.  This isn't part of "make check"; build it with
+ * "make bench_log" and run it by hand.
+ *
+ * Usage: bench_log [messages]
+ */
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../core.h"
+#include "../eventloop.h"
+#include "../log.h"
+#include "../prefs.h"
+#include "../util.h"
+
+#define SEEKS 1000
+
+static guint
+bench_input_add(gint fd, PurpleInputCondition condition,
+                PurpleInputFunction function, gpointer data)
+{
+	return 0;
+}
+
+static PurpleEventLoopUiOps eventloop_ui_ops = {
+	g_timeout_add,
+	g_source_remove,
+	bench_input_add,
+	g_source_remove,
+	NULL, /* input_get_error */
+#if GLIB_CHECK_VERSION(2,14,0)
+	g_timeout_add_seconds,
+#else
+	NULL,
+#endif
+	NULL,
+	NULL,
+	NULL
+};
+
+static char *bench_dir = NULL;
+
+/* Makes a compact log for a file in the benchmark directory. */
+static PurpleLog *
+log_for_file(const char *filename, time_t time, gboolean open)
+{
+	PurpleLog *log = purple_log_new(PURPLE_LOG_IM, "bob", NULL, NULL, time, NULL);
+	PurpleLogCommonLoggerData *data;
+
+	log->logger_data = data = g_slice_new0(PurpleLogCommonLoggerData);
+	data->path = g_build_filename(bench_dir, filename, NULL);
+	if (open)
+		data->file = g_fopen(data->path, "ab");
+
+	return log;
+}
+
+static double
+elapsed_ms(GTimer *timer)
+{
+	return g_timer_elapsed(timer, NULL) * 1000;
+}
+
+static void
+write_logs(int count, time_t start)
+{
+	PurpleLog *log = log_for_file("bench.plog", start, TRUE);
+	char *path = g_build_filename(bench_dir, "bench.txt", NULL);
+	FILE *txt = g_fopen(path, "w");
+	char *contents;
+	const guchar *trailer;
+	gsize len, footer;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		const char *from = (i % 2) ? "bob" : "alice";
+		char *message = g_strdup_printf("message number %d with some text", i);
+
+		purple_log_write(log, (i % 2) ? PURPLE_MESSAGE_RECV : PURPLE_MESSAGE_SEND,
+				from, start + i, message);
+		fprintf(txt, "(%02d:%02d:%02d) %s: %s\n",
+				(i / 3600) % 24, (i / 60) % 60, i % 60, from, message);
+		g_free(message);
+	}
+	purple_log_free(log);
+	fclose(txt);
+	g_free(path);
+
+	/* A copy without the footer, as a crash would leave it.  The footer
+	 * starts at the offset stored in the third byte of the trailer. */
+	path = g_build_filename(bench_dir, "bench.plog", NULL);
+	if (!g_file_get_contents(path, &contents, &len, NULL) || len < 30) {
+		fprintf(stderr, "Unable to read %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+	trailer = (const guchar *)contents + len - 30;
+	footer = trailer[2] | trailer[3] << 8 | trailer[4] << 16 | (gsize)trailer[5] << 24;
+	g_free(path);
+	path = g_build_filename(bench_dir, "crash.plog", NULL);
+	g_file_set_contents(path, contents, footer, NULL);
+	g_free(contents);
+	g_free(path);
+}
+
+static void
+bench_size(const char *filename, const char *what)
+{
+	GTimer *timer = g_timer_new();
+	int size = 0, i;
+
+	for (i = 0; i < 20; i++) {
+		PurpleLog *log = log_for_file(filename, 0, FALSE);
+		size = purple_log_get_size(log);
+		purple_log_free(log);
+	}
+	printf("size %s: %d bytes, %.3f ms\n", what, size, elapsed_ms(timer) / 20);
+	g_timer_destroy(timer);
+}
+
+static void
+bench_read(int count, time_t start)
+{
+	PurpleLog *log = log_for_file("bench.plog", start, FALSE);
+	PurpleLogCompactReader *reader;
+	GTimer *timer = g_timer_new();
+	char *message, *path, *contents, **lines;
+	gsize len;
+	time_t when;
+	int n = 0, i;
+
+	reader = purple_log_compact_reader_new(log);
+	printf("open: %.3f ms\n", elapsed_ms(timer));
+	if (reader == NULL) {
+		fprintf(stderr, "Unable to open the compact log\n");
+		exit(EXIT_FAILURE);
+	}
+
+	g_timer_start(timer);
+	while (purple_log_compact_reader_next(reader, NULL, NULL, NULL, &message)) {
+		g_free(message);
+		n++;
+	}
+	printf("stream %d messages: %.3f ms\n", n, elapsed_ms(timer));
+
+	g_timer_start(timer);
+	for (i = 0; i < SEEKS; i++) {
+		purple_log_compact_reader_seek(reader, start + (i * 7919) % count);
+		if (purple_log_compact_reader_next(reader, NULL, NULL, &when, &message))
+			g_free(message);
+	}
+	printf("%d seeks and reads: %.3f ms\n", SEEKS, elapsed_ms(timer));
+	purple_log_compact_reader_free(reader);
+	purple_log_free(log);
+
+	path = g_build_filename(bench_dir, "bench.txt", NULL);
+	g_timer_start(timer);
+	if (g_file_get_contents(path, &contents, &len, NULL)) {
+		lines = g_strsplit(contents, "\n", -1);
+		g_free(contents);
+		n = g_strv_length(lines);
+		g_strfreev(lines);
+		printf("txt read and split %d lines: %.3f ms\n", n, elapsed_ms(timer));
+	}
+	g_free(path);
+
+	g_timer_destroy(timer);
+}
+
+static void
+print_file_size(const char *filename)
+{
+	char *path = g_build_filename(bench_dir, filename, NULL);
+	struct stat st;
+
+	if (g_stat(path, &st) == 0)
+		printf("%s: %ld bytes\n", filename, (long)st.st_size);
+	g_free(path);
+}
+
+static void
+remove_bench_dir(void)
+{
+	GDir *dir = g_dir_open(bench_dir, 0, NULL);
+	const char *name;
+
+	if (dir != NULL) {
+		while ((name = g_dir_read_name(dir)) != NULL) {
+			char *path = g_build_filename(bench_dir, name, NULL);
+			g_unlink(path);
+			g_free(path);
+		}
+		g_dir_close(dir);
+	}
+	g_rmdir(bench_dir);
+}
+
+int main(int argc, char *argv[])
+{
+	int count = (argc > 1) ? atoi(argv[1]) : 200000;
+	time_t start = time(NULL) - count;
+
+	if (count <= 0) {
+		fprintf(stderr, "Usage: %s [messages]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+#if !GLIB_CHECK_VERSION(2, 36, 0)
+	g_type_init();
+#endif
+
+	bench_dir = g_strdup_printf("%s" G_DIR_SEPARATOR_S "bench_log_%d",
+			g_get_tmp_dir(), (int)getpid());
+	g_mkdir(bench_dir, S_IRUSR | S_IWUSR | S_IXUSR);
+
+	purple_eventloop_set_ui_ops(&eventloop_ui_ops);
+	purple_util_set_user_dir("/dev/null");
+	purple_core_init("bench");
+	purple_prefs_set_string("/purple/logging/format", "compact");
+
+	write_logs(count, start);
+	bench_size("bench.plog", "from the footer");
+	bench_size("crash.plog", "by scanning");
+	bench_read(count, start);
+	print_file_size("bench.plog");
+	print_file_size("bench.txt");
+
+	purple_core_quit();
+	remove_bench_dir();
+	g_free(bench_dir);
+
+	return EXIT_SUCCESS;
+}
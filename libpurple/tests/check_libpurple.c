@@ -5,18 +5,65 @@
 
 #include "../core.h"
 #include "../eventloop.h"
+#include "../plugin.h"
 #include "../util.h"
 
 
+/* nullprpl is built into check_libpurple, as a static protocol. */
+gboolean purple_init_null_plugin(void);
+
 /******************************************************************************
  * libpurple goodies
  *****************************************************************************/
+#define PURPLE_CHECK_READ_COND  (G_IO_IN | G_IO_HUP | G_IO_ERR)
+#define PURPLE_CHECK_WRITE_COND (G_IO_OUT | G_IO_HUP | G_IO_ERR | G_IO_NVAL)
+
+typedef struct {
+	PurpleInputFunction function;
+	gpointer data;
+} PurpleCheckIOClosure;
+
+static gboolean
+purple_check_io_invoke(GIOChannel *source, GIOCondition condition,
+                       gpointer data)
+{
+	PurpleCheckIOClosure *closure = data;
+	PurpleInputCondition purple_cond = 0;
+
+	if (condition & PURPLE_CHECK_READ_COND)
+		purple_cond |= PURPLE_INPUT_READ;
+	if (condition & PURPLE_CHECK_WRITE_COND)
+		purple_cond |= PURPLE_INPUT_WRITE;
+
+	closure->function(closure->data, g_io_channel_unix_get_fd(source),
+	                  purple_cond);
+
+	return TRUE;
+}
+
 static guint
 purple_check_input_add(gint fd, PurpleInputCondition condition,
                      PurpleInputFunction function, gpointer data)
 {
-	/* this is a no-op for now, feel free to implement it */
-	return 0;
+	PurpleCheckIOClosure *closure = g_new0(PurpleCheckIOClosure, 1);
+	GIOChannel *channel;
+	GIOCondition cond = 0;
+	guint result;
+
+	closure->function = function;
+	closure->data = data;
+
+	if (condition & PURPLE_INPUT_READ)
+		cond |= PURPLE_CHECK_READ_COND;
+	if (condition & PURPLE_INPUT_WRITE)
+		cond |= PURPLE_CHECK_WRITE_COND;
+
+	channel = g_io_channel_unix_new(fd);
+	result = g_io_add_watch_full(channel, G_PRIORITY_DEFAULT, cond,
+	                             purple_check_io_invoke, closure, g_free);
+	g_io_channel_unref(channel);
+
+	return result;
 }
 
 static PurpleEventLoopUiOps eventloop_ui_ops = {
@@ -58,6 +105,10 @@ purple_check_init(void) {
 #endif
 
 	purple_core_init("check");
+
+	/* Probing loads it, like the core does with its static protocols. */
+	purple_init_null_plugin();
+	purple_plugins_probe(G_MODULE_SUFFIX);
 }
 
 /******************************************************************************
@@ -76,6 +127,12 @@ int main(void)
 	int number_failed;
 	SRunner *sr;
 
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+	/* GLib threading system is automaticaly initialized since 2.32.
+	 * The log writer and buddy icon cache tests need threads. */
+	g_thread_init(NULL);
+#endif
+
 	if (g_getenv("PURPLE_CHECK_DEBUG"))
 		purple_debug_set_enabled(TRUE);
 
@@ -86,12 +143,19 @@ int main(void)
 
 	sr = srunner_create (master_suite());
 
+	srunner_add_suite(sr, account_suite());
+	srunner_add_suite(sr, buddyicon_suite());
 	srunner_add_suite(sr, cipher_suite());
+	srunner_add_suite(sr, imgstore_suite());
+	srunner_add_suite(sr, jabber_bosh_suite());
 	srunner_add_suite(sr, jabber_caps_suite());
 	srunner_add_suite(sr, jabber_digest_md5_suite());
 	srunner_add_suite(sr, jabber_jutil_suite());
 	srunner_add_suite(sr, jabber_scram_suite());
+	srunner_add_suite(sr, log_suite());
+	srunner_add_suite(sr, metrics_suite());
 	srunner_add_suite(sr, oscar_util_suite());
+	srunner_add_suite(sr, prefs_suite());
 	srunner_add_suite(sr, yahoo_util_suite());
 	srunner_add_suite(sr, util_suite());
 	srunner_add_suite(sr, xmlnode_suite());
@@ -0,0 +1,366 @@
+#include <string.h>
+
+#include "tests.h"
+#include "../account.h"
+
+/* As in account.c. */
+#define LOGIN_HOST_DELAY_MIN   5000
+#define LOGIN_HOST_DELAY_MAX 600000
+
+/*
+ * The login queue tests run the event loop's timers on a fake clock, so
+ * the backoff can be followed through minutes of retries without waiting
+ * for them.  The accounts are nullprpl's, which is built into the tests.
+ */
+#define FAKE_TIMER_FIRST 0x80000000
+
+typedef struct
+{
+	guint handle;
+	guint interval;
+	guint64 due;
+	GSourceFunc function;
+	gpointer data;
+} FakeTimer;
+
+static PurpleEventLoopUiOps *real_ops;
+static PurpleEventLoopUiOps fake_ops;
+static GList *fake_timers = NULL;   /* In the order they're due */
+static guint64 fake_now = 0;
+static guint fake_next_handle = FAKE_TIMER_FIRST;
+
+static GList *login_accounts = NULL;
+static GList *connected = NULL;     /* In the order they started connecting */
+static guint64 connecting_at = 0, failed_at = 0;
+static int old_max_connecting;
+static int handle;
+
+static void
+fake_timer_schedule(FakeTimer *timer)
+{
+	GList *l;
+
+	/* Behind everything due at the same time, like a real loop. */
+	timer->due = fake_now + timer->interval;
+	for (l = fake_timers; l != NULL; l = l->next)
+		if (((FakeTimer *)l->data)->due > timer->due)
+			break;
+
+	fake_timers = g_list_insert_before(fake_timers, l, timer);
+}
+
+static guint
+fake_timeout_add(guint interval, GSourceFunc function, gpointer data)
+{
+	FakeTimer *timer = g_new0(FakeTimer, 1);
+
+	timer->handle = fake_next_handle++;
+	timer->interval = interval;
+	timer->function = function;
+	timer->data = data;
+	fake_timer_schedule(timer);
+
+	return timer->handle;
+}
+
+static guint
+fake_timeout_add_seconds(guint interval, GSourceFunc function, gpointer data)
+{
+	return fake_timeout_add(1000 * interval, function, data);
+}
+
+static gboolean
+fake_timeout_remove(guint tag)
+{
+	GList *l;
+
+	/* Added before the test started. */
+	if (tag < FAKE_TIMER_FIRST)
+		return real_ops->timeout_remove(tag);
+
+	for (l = fake_timers; l != NULL; l = l->next) {
+		FakeTimer *timer = l->data;
+
+		if (timer->handle == tag) {
+			fake_timers = g_list_delete_link(fake_timers, l);
+			g_free(timer);
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/* Runs the next timer, moving the clock on to when it's due. */
+static gboolean
+fake_timer_run_next(void)
+{
+	FakeTimer *timer;
+
+	if (fake_timers == NULL)
+		return FALSE;
+
+	timer = fake_timers->data;
+	fake_timers = g_list_delete_link(fake_timers, fake_timers);
+	fake_now = MAX(fake_now, timer->due);
+
+	if (timer->function(timer->data))
+		fake_timer_schedule(timer);
+	else
+		g_free(timer);
+
+	return TRUE;
+}
+
+/* Runs every timer that's due within ms from now. */
+static void
+fake_timers_run(guint ms)
+{
+	guint64 until = fake_now + ms;
+
+	while (fake_timers != NULL && ((FakeTimer *)fake_timers->data)->due <= until)
+		fake_timer_run_next();
+
+	fake_now = until;
+}
+
+static void
+account_connecting_cb(PurpleAccount *account, gpointer data)
+{
+	connected = g_list_append(connected, account);
+	connecting_at = fake_now;
+}
+
+static void
+connection_error_cb(PurpleConnection *gc, PurpleConnectionError reason,
+                    const char *description, gpointer data)
+{
+	failed_at = fake_now;
+}
+
+static void
+setup_login_queue(void)
+{
+	real_ops = purple_eventloop_get_ui_ops();
+	fake_ops = *real_ops;
+	fake_ops.timeout_add = fake_timeout_add;
+	fake_ops.timeout_remove = fake_timeout_remove;
+	fake_ops.timeout_add_seconds = fake_timeout_add_seconds;
+	purple_eventloop_set_ui_ops(&fake_ops);
+
+	if (purple_get_blist() == NULL)
+		purple_set_blist(purple_blist_new());
+
+	old_max_connecting = purple_prefs_get_int("/purple/login/max_connecting");
+
+	purple_signal_connect(purple_accounts_get_handle(), "account-connecting",
+	                      &handle, PURPLE_CALLBACK(account_connecting_cb), NULL);
+	purple_signal_connect(purple_connections_get_handle(), "connection-error",
+	                      &handle, PURPLE_CALLBACK(connection_error_cb), NULL);
+}
+
+static void
+teardown_login_queue(void)
+{
+	GList *l;
+
+	for (l = login_accounts; l != NULL; l = l->next) {
+		PurpleAccount *account = l->data;
+
+		purple_accounts_unqueue_connect(account);
+		if (!purple_account_is_disconnected(account))
+			purple_account_disconnect(account);
+		purple_account_destroy(account);
+	}
+	g_list_free(login_accounts);
+	login_accounts = NULL;
+	g_list_free(connected);
+	connected = NULL;
+
+	purple_signals_disconnect_by_handle(&handle);
+	purple_prefs_set_int("/purple/login/max_connecting", old_max_connecting);
+
+	purple_eventloop_set_ui_ops(real_ops);
+	g_list_foreach(fake_timers, (GFunc)g_free, NULL);
+	g_list_free(fake_timers);
+	fake_timers = NULL;
+}
+
+/* Makes an enabled account that takes delay ms to sign on, or to fail. */
+static PurpleAccount *
+login_account(const char *username, int delay, gboolean fail)
+{
+	PurpleAccount *account = purple_account_new(username, "prpl-null");
+
+	purple_account_set_int(account, "login_delay", delay);
+	purple_account_set_int(account, "login_failure", fail ? 100 : 0);
+
+	/* Not purple_account_set_enabled(), which would connect it. */
+	purple_account_set_ui_bool(account, purple_core_get_ui(), "auto-login", TRUE);
+
+	login_accounts = g_list_append(login_accounts, account);
+	return account;
+}
+
+START_TEST(test_login_queue_order)
+{
+	PurpleAccount *a = login_account("a@one.example.com", 1000, FALSE);
+	PurpleAccount *b = login_account("b@two.example.com", 1000, FALSE);
+	PurpleAccount *c = login_account("c@three.example.com", 1000, FALSE);
+	PurpleAccount *d = login_account("d@four.example.com", 1000, FALSE);
+	GList *queue;
+
+	purple_prefs_set_int("/purple/login/max_connecting", 2);
+	purple_account_set_login_priority(b, 10);
+	purple_account_set_login_priority(d, 5);
+
+	purple_accounts_queue_connect(a);
+	purple_accounts_queue_connect(b);
+	purple_accounts_queue_connect(c);
+	purple_accounts_queue_connect(d);
+
+	/* Highest priority first, and otherwise in the order they were queued. */
+	queue = purple_accounts_get_login_queue();
+	fail_unless(g_list_length(queue) == 4, NULL);
+	fail_unless(g_list_nth_data(queue, 0) == b, NULL);
+	fail_unless(g_list_nth_data(queue, 1) == d, NULL);
+	fail_unless(g_list_nth_data(queue, 2) == a, NULL);
+	fail_unless(g_list_nth_data(queue, 3) == c, NULL);
+
+	/* Only two connect at once... */
+	fake_timers_run(0);
+	fail_unless(purple_account_is_connecting(b), NULL);
+	fail_unless(purple_account_is_connecting(d), NULL);
+	fail_unless(purple_account_is_disconnected(a), NULL);
+	fail_unless(purple_account_is_disconnected(c), NULL);
+	fail_unless(g_list_length(purple_accounts_get_login_queue()) == 2, NULL);
+
+	/* ...and the others follow once they've signed on. */
+	fake_timers_run(1000);
+	fail_unless(purple_account_is_connected(b), NULL);
+	fail_unless(purple_account_is_connected(d), NULL);
+	fail_unless(purple_account_is_connecting(a), NULL);
+	fail_unless(purple_account_is_connecting(c), NULL);
+	fail_unless(purple_accounts_get_login_queue() == NULL, NULL);
+
+	fail_unless(g_list_length(connected) == 4, NULL);
+	fail_unless(g_list_nth_data(connected, 0) == b, NULL);
+	fail_unless(g_list_nth_data(connected, 1) == d, NULL);
+	fail_unless(g_list_nth_data(connected, 2) == a, NULL);
+	fail_unless(g_list_nth_data(connected, 3) == c, NULL);
+}
+END_TEST
+
+START_TEST(test_login_host_backoff)
+{
+	PurpleAccount *alice = login_account("alice@down.example.com", 0, TRUE);
+	PurpleAccount *bob = login_account("bob@down.example.com", 0, TRUE);
+	PurpleAccount *carol = login_account("carol@up.example.com", 0, FALSE);
+	int delay, round;
+
+	purple_prefs_set_int("/purple/login/max_connecting", 0);
+
+	purple_accounts_queue_connect(alice);
+	fake_timers_run(0);
+	fail_unless(purple_account_is_disconnected(alice), NULL);
+
+	/* The failure holds back others on the same server, but not on others. */
+	purple_accounts_queue_connect(bob);
+	purple_accounts_queue_connect(carol);
+	fake_timers_run(0);
+	fail_unless(purple_account_is_connected(carol), NULL);
+	fail_unless(g_list_find(purple_accounts_get_login_queue(), bob) != NULL, NULL);
+	fail_unless(purple_account_get_login_delay(bob) > 0, NULL);
+
+	/*
+	 * Each failed retry doubles the backoff, up to the limit, and the
+	 * wait is somewhere between half of it and all of it.  Both accounts
+	 * fail on each retry, which only counts as one failure.
+	 */
+	delay = LOGIN_HOST_DELAY_MIN;
+	for (round = 0; round < 9; round++) {
+		guint64 waited;
+
+		purple_accounts_queue_connect(alice);
+		purple_accounts_queue_connect(bob);
+
+		while (purple_account_is_disconnected(alice)) {
+			fail_unless(fake_timer_run_next(), NULL);
+			fail_if(fake_now > failed_at + delay,
+			        "Round %d: not retried within %d ms", round, delay);
+		}
+		fail_unless(purple_account_is_connecting(bob), NULL);
+
+		waited = connecting_at - failed_at;
+		fail_unless(waited >= (guint64)delay / 2 && waited <= (guint64)delay,
+		            "Round %d: retried after %d ms, not %d to %d ms",
+		            round, (int)waited, delay / 2, delay);
+
+		fake_timers_run(0);
+		fail_unless(purple_account_is_disconnected(alice), NULL);
+		fail_unless(purple_account_is_disconnected(bob), NULL);
+
+		delay = MIN(2 * delay, LOGIN_HOST_DELAY_MAX);
+	}
+
+	/* Signing on ends the backoff. */
+	purple_account_set_int(alice, "login_failure", 0);
+	purple_accounts_queue_connect(alice);
+	while (purple_account_is_disconnected(alice))
+		fail_unless(fake_timer_run_next(), NULL);
+	fail_unless(purple_account_is_connected(alice), NULL);
+	fail_unless(purple_account_get_login_delay(bob) == 0, NULL);
+}
+END_TEST
+
+START_TEST(test_accounts_find)
+{
+	PurpleAccount *alice = purple_account_new("alice@example.com", "prpl-check");
+	PurpleAccount *bob = purple_account_new("bob@example.com", "prpl-check");
+	PurpleAccount *other = purple_account_new("alice@example.com", "prpl-check-other");
+
+	purple_accounts_add(alice);
+	fail_unless(purple_accounts_find("alice@example.com", "prpl-check") == alice, NULL);
+
+	/* Accounts added after the index is built are found too. */
+	purple_accounts_add(bob);
+	purple_accounts_add(other);
+	fail_unless(purple_accounts_find("bob@example.com", "prpl-check") == bob, NULL);
+	fail_unless(purple_accounts_find("alice@example.com", "prpl-check-other") == other, NULL);
+	fail_unless(purple_accounts_find("carol@example.com", "prpl-check") == NULL, NULL);
+	fail_unless(purple_accounts_find("alice@example.com", "prpl-none") == NULL, NULL);
+
+	purple_account_set_username(bob, "robert@example.com");
+	fail_unless(purple_accounts_find("bob@example.com", "prpl-check") == NULL, NULL);
+	fail_unless(purple_accounts_find("robert@example.com", "prpl-check") == bob, NULL);
+
+	purple_accounts_remove(alice);
+	fail_unless(purple_accounts_find("alice@example.com", "prpl-check") == NULL, NULL);
+	fail_unless(purple_accounts_find("robert@example.com", "prpl-check") == bob, NULL);
+
+	purple_accounts_remove(bob);
+	purple_accounts_remove(other);
+	purple_account_destroy(alice);
+	purple_account_destroy(bob);
+	purple_account_destroy(other);
+}
+END_TEST
+
+Suite *
+account_suite(void)
+{
+	Suite *s = suite_create("Account");
+	TCase *tc;
+
+	tc = tcase_create("Find");
+	tcase_add_test(tc, test_accounts_find);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("Login Queue");
+	tcase_add_checked_fixture(tc, setup_login_queue, teardown_login_queue);
+	tcase_add_test(tc, test_login_queue_order);
+	tcase_add_test(tc, test_login_host_backoff);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
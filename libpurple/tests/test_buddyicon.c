@@ -0,0 +1,197 @@
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#include "tests.h"
+#include "../internal.h"
+#include "../buddyicon.h"
+
+/* The most operations the icon cache thread takes at once is 64, so this
+ * many icons take more than one batch. */
+#define MANY_ICONS 100
+
+static char *cache_dir = NULL;
+
+static void
+setup_icon_cache(void)
+{
+	cache_dir = g_strdup_printf("%s" G_DIR_SEPARATOR_S "check_icons_%d",
+			g_get_tmp_dir(), (int)getpid());
+	g_mkdir(cache_dir, S_IRUSR | S_IWUSR | S_IXUSR);
+
+	purple_buddy_icons_set_cache_dir(cache_dir);
+	purple_buddy_icons_set_caching(TRUE);
+
+	if (purple_get_blist() == NULL)
+		purple_set_blist(purple_blist_new());
+}
+
+static void
+teardown_icon_cache(void)
+{
+	GDir *dir;
+	const char *name;
+
+	_purple_buddy_icons_sync_cache();
+
+	if ((dir = g_dir_open(cache_dir, 0, NULL)) != NULL) {
+		while ((name = g_dir_read_name(dir)) != NULL) {
+			char *path = g_build_filename(cache_dir, name, NULL);
+			g_unlink(path);
+			g_free(path);
+		}
+		g_dir_close(dir);
+	}
+	g_rmdir(cache_dir);
+	g_free(cache_dir);
+	cache_dir = NULL;
+}
+
+/* Makes up the data of a PNG icon, different for each n. */
+static guchar *
+icon_data(int n, size_t *len)
+{
+	char *data = g_strdup_printf("\x89PNG\r\n\x1a\nicon %d", n);
+
+	*len = strlen(data);
+	return (guchar *)data;
+}
+
+static char *
+icon_filename(int n)
+{
+	size_t len;
+	guchar *data = icon_data(n, &len);
+	char *filename = purple_util_get_image_filename(data, len);
+
+	g_free(data);
+	return filename;
+}
+
+static gboolean
+icon_file_exists(int n)
+{
+	char *filename = icon_filename(n);
+	char *path = g_build_filename(cache_dir, filename, NULL);
+	gboolean exists = g_file_test(path, G_FILE_TEST_EXISTS);
+
+	g_free(path);
+	g_free(filename);
+	return exists;
+}
+
+static PurpleBlistNode *
+group_node(int n)
+{
+	char *name = g_strdup_printf("icons %d", n);
+	PurpleGroup *group = purple_group_new(name);
+
+	g_free(name);
+	return (PurpleBlistNode *)group;
+}
+
+static void
+set_icon(PurpleBlistNode *node, int n)
+{
+	size_t len;
+	guchar *data = icon_data(n, &len);
+
+	purple_buddy_icons_node_set_custom_icon(node, data, len);
+}
+
+START_TEST(test_icon_cache_write)
+{
+	set_icon(group_node(0), 0);
+	_purple_buddy_icons_sync_cache();
+
+	fail_unless(icon_file_exists(0));
+}
+END_TEST
+
+START_TEST(test_icon_cache_last_op_wins)
+{
+	PurpleBlistNode *node = group_node(0);
+
+	set_icon(node, 0);
+	_purple_buddy_icons_sync_cache();
+
+	/* The delete queued by clearing the icon is replaced by the write of
+	 * setting it again... */
+	purple_buddy_icons_node_set_custom_icon(node, NULL, 0);
+	set_icon(node, 0);
+	_purple_buddy_icons_sync_cache();
+	fail_unless(icon_file_exists(0));
+
+	/* ...and the other way around. */
+	purple_buddy_icons_node_set_custom_icon(node, NULL, 0);
+	set_icon(node, 0);
+	purple_buddy_icons_node_set_custom_icon(node, NULL, 0);
+	_purple_buddy_icons_sync_cache();
+	fail_if(icon_file_exists(0));
+}
+END_TEST
+
+START_TEST(test_icon_cache_order)
+{
+	int i;
+
+	/* Each icon is cleared before its write is done, so its delete is
+	 * queued behind the write, in a later batch. */
+	for (i = 0; i < MANY_ICONS; i++)
+		set_icon(group_node(i), i);
+	for (i = 1; i < MANY_ICONS; i++)
+		purple_buddy_icons_node_set_custom_icon(group_node(i), NULL, 0);
+	_purple_buddy_icons_sync_cache();
+
+	fail_unless(icon_file_exists(0));
+	for (i = 1; i < MANY_ICONS; i++)
+		fail_if(icon_file_exists(i), "Icon %d wasn't deleted", i);
+}
+END_TEST
+
+START_TEST(test_icon_cache_missing)
+{
+	PurpleBlistNode *node = group_node(0);
+	PurpleStoredImage *img;
+	char *filename = icon_filename(0);
+	char *path = g_build_filename(cache_dir, filename, NULL);
+	size_t len;
+	guchar *data;
+
+	/* Once a file is known to be missing, it isn't looked for again... */
+	purple_blist_node_set_string(node, "custom_buddy_icon", filename);
+	fail_unless(purple_buddy_icons_node_find_custom_icon(node) == NULL);
+
+	data = icon_data(0, &len);
+	fail_unless(g_file_set_contents(path, (char *)data, len, NULL));
+	g_free(data);
+	fail_unless(purple_buddy_icons_node_find_custom_icon(node) == NULL);
+
+	/* ...until the cache directory is set again. */
+	purple_buddy_icons_set_cache_dir(cache_dir);
+	img = purple_buddy_icons_node_find_custom_icon(node);
+	fail_unless(img != NULL);
+	purple_imgstore_unref(img);
+
+	g_free(path);
+	g_free(filename);
+}
+END_TEST
+
+Suite *
+buddyicon_suite(void)
+{
+	Suite *s = suite_create("Buddy Icons");
+	TCase *tc;
+
+	tc = tcase_create("Icon Cache");
+	tcase_add_checked_fixture(tc, setup_icon_cache, teardown_icon_cache);
+	tcase_add_test(tc, test_icon_cache_write);
+	tcase_add_test(tc, test_icon_cache_last_op_wins);
+	tcase_add_test(tc, test_icon_cache_order);
+	tcase_add_test(tc, test_icon_cache_missing);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -0,0 +1,83 @@
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#include "tests.h"
+#include "../imgstore.h"
+
+static const char png[] = "\x89PNG\r\n\x1a\n" "not really a png";
+
+START_TEST(test_imgstore_dedup)
+{
+	size_t total = purple_imgstore_get_total_bytes();
+	size_t unique = purple_imgstore_get_unique_bytes();
+	PurpleStoredImage *a, *b, *c;
+
+	a = purple_imgstore_add(g_memdup(png, sizeof(png)), sizeof(png), "a.png");
+	b = purple_imgstore_add(g_memdup(png, sizeof(png)), sizeof(png), "b.png");
+	c = purple_imgstore_add(g_memdup(png, sizeof(png) - 1), sizeof(png) - 1, NULL);
+
+	fail_unless(purple_imgstore_get_data(a) == purple_imgstore_get_data(b), NULL);
+	fail_if(purple_imgstore_get_data(a) == purple_imgstore_get_data(c), NULL);
+	assert_string_equal("a.png", purple_imgstore_get_filename(a));
+	assert_string_equal("b.png", purple_imgstore_get_filename(b));
+	assert_string_equal("png", purple_imgstore_get_extension(b));
+
+	fail_unless(purple_imgstore_get_total_bytes() == total + 3 * sizeof(png) - 1, NULL);
+	fail_unless(purple_imgstore_get_unique_bytes() == unique + 2 * sizeof(png) - 1, NULL);
+
+	/* The shared data must outlive the image that added it. */
+	purple_imgstore_unref(a);
+	fail_unless(memcmp(purple_imgstore_get_data(b), png, sizeof(png)) == 0, NULL);
+	fail_unless(purple_imgstore_get_unique_bytes() == unique + 2 * sizeof(png) - 1, NULL);
+
+	purple_imgstore_unref(b);
+	purple_imgstore_unref(c);
+	fail_unless(purple_imgstore_get_total_bytes() == total, NULL);
+	fail_unless(purple_imgstore_get_unique_bytes() == unique, NULL);
+}
+END_TEST
+
+START_TEST(test_imgstore_mapped_file)
+{
+	size_t unique = purple_imgstore_get_unique_bytes();
+	PurpleStoredImage *mapped, *copy;
+	char *path;
+
+	path = g_strdup_printf("%s" G_DIR_SEPARATOR_S "check_imgstore_%d.png",
+			g_get_tmp_dir(), (int)getpid());
+	fail_unless(g_file_set_contents(path, png, sizeof(png), NULL), NULL);
+
+	mapped = purple_imgstore_new_from_mapped_file(path, "icon.png");
+	fail_unless(mapped != NULL, NULL);
+	assert_string_equal("icon.png", purple_imgstore_get_filename(mapped));
+	fail_unless(purple_imgstore_get_size(mapped) == sizeof(png), NULL);
+
+	copy = purple_imgstore_add(g_memdup(png, sizeof(png)), sizeof(png), NULL);
+	fail_unless(purple_imgstore_get_data(copy) == purple_imgstore_get_data(mapped), NULL);
+	fail_unless(purple_imgstore_get_unique_bytes() == unique + sizeof(png), NULL);
+
+	/* Deleting the file does not affect the image. */
+	g_unlink(path);
+	purple_imgstore_unref(mapped);
+	fail_unless(memcmp(purple_imgstore_get_data(copy), png, sizeof(png)) == 0, NULL);
+	purple_imgstore_unref(copy);
+
+	fail_unless(purple_imgstore_new_from_mapped_file(path, "icon.png") == NULL, NULL);
+	g_free(path);
+}
+END_TEST
+
+Suite *
+imgstore_suite(void)
+{
+	Suite *s = suite_create("Image Store");
+	TCase *tc;
+
+	tc = tcase_create("Deduplication");
+	tcase_add_test(tc, test_imgstore_dedup);
+	tcase_add_test(tc, test_imgstore_mapped_file);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -0,0 +1,118 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "tests.h"
+#include "../protocols/jabber/bosh.h"
+#include "../protocols/jabber/jutil.h"
+
+#define EMPTY_RESPONSE "HTTP/1.1 200 OK\r\n" \
+	"Content-Type: text/xml; charset=utf-8\r\n" \
+	"Content-Length: 59\r\n" \
+	"\r\n" \
+	"<body xmlns='http://jabber.org/protocol/httpbind' sid='s'/>"
+
+static JabberStream *js;
+static PurpleBOSHConnection *bosh;
+static int client, server;
+
+static void
+setup_bosh(void)
+{
+	int fds[2];
+
+	fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	client = fds[0];
+	server = fds[1];
+
+	jabber_bosh_init();
+
+	js = g_new0(JabberStream, 1);
+	js->user = jabber_id_new("alice@example.com");
+	js->max_inactivity = 60;
+
+	bosh = jabber_bosh_connection_init(js, "http://example.com/http-bind");
+	fail_unless(bosh != NULL);
+}
+
+static void
+teardown_bosh(void)
+{
+	jabber_bosh_connection_destroy(bosh);
+	close(server);
+
+	if (js->inactivity_timer != 0)
+		purple_timeout_remove(js->inactivity_timer);
+	jabber_id_free(js->user);
+	g_free(js->serverFQDN);
+	g_free(js);
+
+	jabber_bosh_uninit();
+}
+
+/* Returns whatever the client has sent so far, or NULL if nothing. */
+static char *
+server_read(void)
+{
+	char buf[4096];
+	ssize_t len = recv(server, buf, sizeof(buf) - 1, MSG_DONTWAIT);
+
+	if (len <= 0) {
+		fail_unless(len < 0 && errno == EAGAIN);
+		return NULL;
+	}
+
+	return g_strndup(buf, len);
+}
+
+static void
+run_pending_events(void)
+{
+	while (g_main_context_iteration(NULL, FALSE))
+		;
+}
+
+START_TEST(test_send_when_connection_frees)
+{
+	char *request;
+
+	/* The server allows one request at a time, and the session starts
+	 * by holding that one with an empty request. */
+	jabber_bosh_connection_attach(bosh, client, "s", 1);
+	request = server_read();
+	fail_unless(request != NULL);
+	fail_unless(strstr(request, "sid='s'") != NULL);
+	g_free(request);
+
+	/* With the only request held, the message has to wait... */
+	jabber_bosh_connection_send_raw(bosh, "<message to='bob@example.com'/>");
+	run_pending_events();
+	fail_unless(server_read() == NULL);
+
+	/* ...but it goes out as soon as the response comes back, not when the
+	 * fallback timer fires. */
+	fail_unless(write(server, EMPTY_RESPONSE, strlen(EMPTY_RESPONSE)) ==
+	            (ssize_t)strlen(EMPTY_RESPONSE));
+	g_main_context_iteration(NULL, TRUE);
+	request = server_read();
+	fail_unless(request != NULL);
+	fail_unless(strstr(request, "<message to='bob@example.com'/>") != NULL);
+	g_free(request);
+}
+END_TEST
+
+Suite *
+jabber_bosh_suite(void)
+{
+	Suite *s = suite_create("Jabber BOSH");
+
+	TCase *tc = tcase_create("Sending");
+	tcase_add_checked_fixture(tc, setup_bosh, teardown_bosh);
+	tcase_add_test(tc, test_send_when_connection_frees);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
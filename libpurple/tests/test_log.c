@@ -0,0 +1,329 @@
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#include "tests.h"
+#include "../log.h"
+
+static char *log_dir = NULL;
+
+static void
+setup_log_dir(void)
+{
+	log_dir = g_strdup_printf("%s" G_DIR_SEPARATOR_S "check_log_%d",
+			g_get_tmp_dir(), (int)getpid());
+	g_mkdir(log_dir, S_IRUSR | S_IWUSR | S_IXUSR);
+}
+
+static void
+teardown_log_dir(void)
+{
+	GDir *dir = g_dir_open(log_dir, 0, NULL);
+	const char *name;
+
+	if (dir != NULL) {
+		while ((name = g_dir_read_name(dir)) != NULL) {
+			char *path = g_build_filename(log_dir, name, NULL);
+			g_unlink(path);
+			g_free(path);
+		}
+		g_dir_close(dir);
+	}
+	g_rmdir(log_dir);
+	g_free(log_dir);
+	log_dir = NULL;
+}
+
+/* Makes a log for a file in the test directory, with the given logger. */
+static PurpleLog *
+log_for_file(const char *format, const char *filename, time_t time, gboolean open)
+{
+	PurpleLog *log;
+	PurpleLogCommonLoggerData *data;
+
+	purple_prefs_set_string("/purple/logging/format", format);
+	log = purple_log_new(PURPLE_LOG_IM, "bob", NULL, NULL, time, NULL);
+	fail_unless(purple_strequal(log->logger->id, format), NULL);
+
+	log->logger_data = data = g_slice_new0(PurpleLogCommonLoggerData);
+	data->path = g_build_filename(log_dir, filename, NULL);
+	if (open)
+		data->file = g_fopen(data->path, "ab");
+
+	return log;
+}
+
+/*
+ * Cuts the footer off a compact log, along with the last two bytes before
+ * it, as a crash while writing the last message would.  The footer starts
+ * at the offset stored in the third byte of the trailer.
+ */
+static void
+crash_compact_log(const char *filename)
+{
+	char *path = g_build_filename(log_dir, filename, NULL);
+	char *contents;
+	const guchar *trailer;
+	gsize len, footer;
+
+	fail_unless(g_file_get_contents(path, &contents, &len, NULL), NULL);
+	fail_unless(len > 30, NULL);
+	trailer = (const guchar *)contents + len - 30;
+	footer = trailer[2] | trailer[3] << 8 | trailer[4] << 16 | (gsize)trailer[5] << 24;
+	fail_unless(footer > 2 && footer < len - 30, NULL);
+	fail_unless(g_file_set_contents(path, contents, footer - 2, NULL), NULL);
+	g_free(contents);
+	g_free(path);
+}
+
+static time_t
+log_start_time(void)
+{
+	struct tm tm;
+	time_t now = time(NULL);
+
+	tm = *localtime(&now);
+	tm.tm_hour = 9;
+	tm.tm_min = 0;
+	tm.tm_sec = 0;
+	tm.tm_isdst = -1;
+	return mktime(&tm);
+}
+
+START_TEST(test_log_compact_write_read)
+{
+	time_t start = log_start_time();
+	PurpleLog *log = log_for_file("compact", "write.plog", start, TRUE);
+	PurpleLogCompactReader *reader;
+	PurpleMessageFlags type;
+	const char *from;
+	time_t when;
+	char *message;
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		char *text = g_strdup_printf("message %d", i);
+		purple_log_write(log, (i % 2) ? PURPLE_MESSAGE_SEND : PURPLE_MESSAGE_RECV,
+				(i % 2) ? "alice" : "bob", start + i * 10, text);
+		g_free(text);
+	}
+	purple_log_write(log, PURPLE_MESSAGE_SYSTEM, NULL, start + 10000, "bob has signed off.");
+	purple_log_free(log);
+
+	log = log_for_file("compact", "write.plog", start, FALSE);
+	reader = purple_log_compact_reader_new(log);
+	fail_unless(reader != NULL, NULL);
+	assert_int_equal(1001, purple_log_compact_reader_get_count(reader));
+
+	fail_unless(purple_log_compact_reader_next(reader, &type, &from, &when, &message), NULL);
+	assert_int_equal(PURPLE_MESSAGE_RECV, type);
+	assert_string_equal("bob", from);
+	fail_unless(when == start, NULL);
+	assert_string_equal_free("message 0", message);
+
+	purple_log_compact_reader_seek(reader, start + 5005);
+	fail_unless(purple_log_compact_reader_next(reader, &type, &from, &when, &message), NULL);
+	assert_int_equal(PURPLE_MESSAGE_SEND, type);
+	assert_string_equal("alice", from);
+	fail_unless(when == start + 5010, NULL);
+	assert_string_equal_free("message 501", message);
+
+	purple_log_compact_reader_seek(reader, start + 9995);
+	fail_unless(purple_log_compact_reader_next(reader, &type, &from, &when, &message), NULL);
+	assert_int_equal(PURPLE_MESSAGE_SYSTEM, type);
+	fail_unless(from == NULL, NULL);
+	assert_string_equal_free("bob has signed off.", message);
+	fail_if(purple_log_compact_reader_next(reader, NULL, NULL, NULL, NULL), NULL);
+
+	purple_log_compact_reader_free(reader);
+	purple_log_free(log);
+}
+END_TEST
+
+START_TEST(test_log_compact_no_footer)
+{
+	time_t start = log_start_time();
+	PurpleLog *log = log_for_file("compact", "crash.plog", start, TRUE);
+	PurpleLogCompactReader *reader;
+	time_t when;
+	char *message;
+
+	purple_log_write(log, PURPLE_MESSAGE_RECV, "bob", start, "one");
+	purple_log_write(log, PURPLE_MESSAGE_RECV, "bob", start + 1, "two");
+	purple_log_free(log);
+
+	crash_compact_log("crash.plog");
+
+	log = log_for_file("compact", "crash.plog", start, FALSE);
+	reader = purple_log_compact_reader_new(log);
+	fail_unless(reader != NULL, NULL);
+	assert_int_equal(1, purple_log_compact_reader_get_count(reader));
+	fail_unless(purple_log_compact_reader_next(reader, NULL, NULL, &when, &message), NULL);
+	fail_unless(when == start, NULL);
+	assert_string_equal_free("one", message);
+	fail_if(purple_log_compact_reader_next(reader, NULL, NULL, NULL, NULL), NULL);
+	purple_log_compact_reader_free(reader);
+	purple_log_free(log);
+}
+END_TEST
+
+START_TEST(test_log_compact_append_after_crash)
+{
+	time_t start = log_start_time();
+	PurpleLog *log = log_for_file("compact", "append.plog", start, TRUE);
+	PurpleLogCompactReader *reader;
+	time_t when;
+	char *message;
+
+	purple_log_write(log, PURPLE_MESSAGE_RECV, "bob", start, "one");
+	purple_log_write(log, PURPLE_MESSAGE_RECV, "bob", start + 1, "two");
+	purple_log_free(log);
+
+	/* Leave a partial last message behind, then carry on writing. */
+	crash_compact_log("append.plog");
+
+	log = log_for_file("compact", "append.plog", start, TRUE);
+	purple_log_write(log, PURPLE_MESSAGE_RECV, "carol", start + 2, "three");
+	purple_log_free(log);
+
+	log = log_for_file("compact", "append.plog", start, FALSE);
+	reader = purple_log_compact_reader_new(log);
+	fail_unless(reader != NULL, NULL);
+	assert_int_equal(2, purple_log_compact_reader_get_count(reader));
+	fail_unless(purple_log_compact_reader_next(reader, NULL, NULL, &when, &message), NULL);
+	fail_unless(when == start, NULL);
+	assert_string_equal_free("one", message);
+	fail_unless(purple_log_compact_reader_next(reader, NULL, NULL, &when, &message), NULL);
+	fail_unless(when == start + 2, NULL);
+	assert_string_equal_free("three", message);
+	fail_if(purple_log_compact_reader_next(reader, NULL, NULL, NULL, NULL), NULL);
+	purple_log_compact_reader_free(reader);
+	purple_log_free(log);
+}
+END_TEST
+
+START_TEST(test_log_compact_import_txt)
+{
+	time_t start = log_start_time();
+	PurpleLog *log, *compact;
+	PurpleLogCompactReader *reader;
+	PurpleMessageFlags type;
+	const char *from;
+	time_t when;
+	char *message, *path;
+
+	path = g_build_filename(log_dir, "import.txt", NULL);
+	fail_unless(g_file_set_contents(path,
+			"Conversation with bob at today on alice (prpl-test)\n"
+			"(10:00:00) bob: hello\n"
+			"(10:00:05) alice: fish & chips\n"
+			"(10:00:10) bob: line one\n"
+			"line two\n", -1, NULL), NULL);
+	g_free(path);
+
+	log = log_for_file("txt", "import.txt", start, FALSE);
+	compact = purple_log_compact_import(log);
+	fail_unless(compact != NULL, NULL);
+	fail_unless(purple_log_compact_import(log) == NULL, NULL);
+
+	reader = purple_log_compact_reader_new(compact);
+	fail_unless(reader != NULL, NULL);
+	assert_int_equal(3, purple_log_compact_reader_get_count(reader));
+
+	purple_log_compact_reader_seek(reader, start + 60 * 60 + 1);
+	fail_unless(purple_log_compact_reader_next(reader, &type, &from, &when, &message), NULL);
+	assert_string_equal("alice", from);
+	fail_unless(when == start + 60 * 60 + 5, NULL);
+	assert_string_equal_free("fish &amp; chips", message);
+
+	fail_unless(purple_log_compact_reader_next(reader, &type, &from, &when, &message), NULL);
+	assert_string_equal("bob", from);
+	assert_int_equal(PURPLE_MESSAGE_RECV, type);
+	assert_string_equal_free("line one<br>line two", message);
+	fail_if(purple_log_compact_reader_next(reader, NULL, NULL, NULL, NULL), NULL);
+
+	purple_log_compact_reader_free(reader);
+	purple_log_free(compact);
+	purple_log_free(log);
+}
+END_TEST
+
+START_TEST(test_log_writer_sync)
+{
+	time_t start = log_start_time();
+	int old_interval = purple_prefs_get_int("/purple/logging/flush_interval");
+	int old_size = purple_prefs_get_int("/purple/logging/flush_size");
+	PurpleLogWriterStats before, after;
+	PurpleLogCompactReader *reader;
+	PurpleLog *log, *copy;
+	char *message;
+	int i;
+
+	/* Nothing is flushed until something waits for it. */
+	purple_prefs_set_int("/purple/logging/flush_interval", 60000);
+	purple_prefs_set_int("/purple/logging/flush_size", 1 << 24);
+	purple_prefs_set_bool("/purple/logging/async_writes", TRUE);
+	purple_log_writer_get_stats(&before);
+	fail_unless(before.active, NULL);
+
+	log = log_for_file("compact", "writer.plog", start, TRUE);
+	for (i = 0; i < 100; i++) {
+		char *text = g_strdup_printf("message %d", i);
+		purple_log_write(log, PURPLE_MESSAGE_RECV, "bob", start + i, text);
+		g_free(text);
+	}
+
+	/* Reading the file waits for everything queued so far, in order... */
+	copy = log_for_file("compact", "writer.plog", start, FALSE);
+	reader = purple_log_compact_reader_new(copy);
+	fail_unless(reader != NULL, NULL);
+	assert_int_equal(100, purple_log_compact_reader_get_count(reader));
+	for (i = 0; i < 100; i++) {
+		char *text = g_strdup_printf("message %d", i);
+		fail_unless(purple_log_compact_reader_next(reader, NULL, NULL, NULL, &message), NULL);
+		assert_string_equal_free(text, message);
+		g_free(text);
+	}
+	purple_log_compact_reader_free(reader);
+	purple_log_free(copy);
+
+	/* ...which the writer flushed together. */
+	purple_log_writer_get_stats(&after);
+	assert_int_equal(1, (int)(after.flushes - before.flushes));
+	fail_unless(after.messages - before.messages > 100, NULL);
+	assert_int_equal(0, (int)after.errors);
+
+	/* Stopping the writer closes the file it was left to close. */
+	purple_log_free(log);
+	purple_prefs_set_bool("/purple/logging/async_writes", FALSE);
+	purple_log_writer_get_stats(&after);
+	fail_if(after.active, NULL);
+	assert_int_equal(0, (int)after.queued);
+
+	purple_prefs_set_int("/purple/logging/flush_interval", old_interval);
+	purple_prefs_set_int("/purple/logging/flush_size", old_size);
+}
+END_TEST
+
+Suite *
+log_suite(void)
+{
+	Suite *s = suite_create("Log Functions");
+	TCase *tc;
+
+	tc = tcase_create("Compact");
+	tcase_add_checked_fixture(tc, setup_log_dir, teardown_log_dir);
+	tcase_add_test(tc, test_log_compact_write_read);
+	tcase_add_test(tc, test_log_compact_no_footer);
+	tcase_add_test(tc, test_log_compact_append_after_crash);
+	tcase_add_test(tc, test_log_compact_import_txt);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("Writer");
+	tcase_add_checked_fixture(tc, setup_log_dir, teardown_log_dir);
+	tcase_add_test(tc, test_log_writer_sync);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
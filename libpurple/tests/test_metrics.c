@@ -0,0 +1,121 @@
+#include <string.h>
+
+#include "tests.h"
+#include "../metrics.h"
+
+/* Returns the lines of a snapshot that belong to one metric. */
+static char *
+metric_snapshot(const char *name)
+{
+	char *snapshot = purple_metrics_get_snapshot();
+	char **lines = g_strsplit(snapshot, "\n", -1);
+	GString *str = g_string_new(NULL);
+	size_t len = strlen(name);
+	int i;
+
+	for (i = 0; lines[i] != NULL; i++) {
+		const char *line = lines[i];
+
+		if (g_str_has_prefix(line, "# HELP ") || g_str_has_prefix(line, "# TYPE "))
+			line += 7;
+		if (strncmp(line, name, len) == 0 && strchr(" _{", line[len]) != NULL)
+			g_string_append_printf(str, "%s\n", lines[i]);
+	}
+
+	g_strfreev(lines);
+	g_free(snapshot);
+
+	return g_string_free(str, FALSE);
+}
+
+START_TEST(test_metrics_counter_gauge)
+{
+	PurpleMetric *counter = purple_metrics_get_counter("check_counter_total", "Things counted");
+	PurpleMetric *gauge = purple_metrics_get_gauge("check_gauge", NULL);
+
+	fail_unless(purple_metrics_get_counter("check_counter_total", NULL) == counter, NULL);
+
+	purple_metric_add(counter, 3);
+	purple_metric_add(counter, 4);
+	purple_metric_set(gauge, 5);
+	purple_metric_set(gauge, -2);
+	assert_int_equal(7, (int)purple_metric_get_value(counter));
+	assert_int_equal(-2, (int)purple_metric_get_value(gauge));
+
+	assert_string_equal_free(
+		"# HELP check_counter_total Things counted\n"
+		"# TYPE check_counter_total counter\n"
+		"check_counter_total 7\n",
+		metric_snapshot("check_counter_total"));
+
+	/* Without a description, there's no HELP line. */
+	assert_string_equal_free(
+		"# TYPE check_gauge gauge\n"
+		"check_gauge -2\n",
+		metric_snapshot("check_gauge"));
+}
+END_TEST
+
+START_TEST(test_metrics_histogram)
+{
+	PurpleMetric *histogram = purple_metrics_get_histogram("check_histogram", "Values seen");
+
+	/* Bucket i counts values below 2^i, so each pair straddles a bucket
+	 * boundary.  Negative values count as 0, and anything 2^30 or more
+	 * only shows up in +Inf. */
+	purple_metric_observe(histogram, -5);
+	purple_metric_observe(histogram, 0);
+	purple_metric_observe(histogram, 1);
+	purple_metric_observe(histogram, 2);
+	purple_metric_observe(histogram, 3);
+	purple_metric_observe(histogram, 4);
+	purple_metric_observe(histogram, 7);
+	purple_metric_observe(histogram, 8);
+	purple_metric_observe(histogram, 1 << 30);
+	assert_int_equal(9, (int)purple_metric_get_value(histogram));
+
+	/* The buckets are cumulative, and the empty ones above the highest
+	 * used bucket are left out. */
+	assert_string_equal_free(
+		"# HELP check_histogram Values seen\n"
+		"# TYPE check_histogram histogram\n"
+		"check_histogram_bucket{le=\"0\"} 2\n"
+		"check_histogram_bucket{le=\"1\"} 3\n"
+		"check_histogram_bucket{le=\"3\"} 5\n"
+		"check_histogram_bucket{le=\"7\"} 7\n"
+		"check_histogram_bucket{le=\"15\"} 8\n"
+		"check_histogram_bucket{le=\"+Inf\"} 9\n"
+		"check_histogram_sum 1073741849\n"
+		"check_histogram_count 9\n",
+		metric_snapshot("check_histogram"));
+}
+END_TEST
+
+START_TEST(test_metrics_histogram_empty)
+{
+	purple_metrics_get_histogram("check_empty", NULL);
+
+	assert_string_equal_free(
+		"# TYPE check_empty histogram\n"
+		"check_empty_bucket{le=\"0\"} 0\n"
+		"check_empty_bucket{le=\"+Inf\"} 0\n"
+		"check_empty_sum 0\n"
+		"check_empty_count 0\n",
+		metric_snapshot("check_empty"));
+}
+END_TEST
+
+Suite *
+metrics_suite(void)
+{
+	Suite *s = suite_create("Metrics");
+	TCase *tc;
+
+	tc = tcase_create("Snapshot");
+	tcase_add_test(tc, test_metrics_counter_gauge);
+	tcase_add_test(tc, test_metrics_histogram);
+	tcase_add_test(tc, test_metrics_histogram_empty);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
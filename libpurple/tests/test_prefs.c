@@ -0,0 +1,232 @@
+#include <string.h>
+
+#include "tests.h"
+#include "../internal.h"
+#include "../prefs.h"
+#include "../xmlnode.h"
+
+static int handle_a, handle_b;
+static GString *fired = NULL;
+
+static void
+record_cb(const char *name, PurplePrefType type, gconstpointer val, gpointer data)
+{
+	g_string_append_printf(fired, "%s:%s;", (const char *)data, name);
+}
+
+static void
+setup_prefs(void)
+{
+	fired = g_string_new(NULL);
+	purple_prefs_add_none("/check");
+	purple_prefs_add_none("/check/sub");
+	purple_prefs_add_int("/check/sub/value", 0);
+	purple_prefs_add_bool("/check/other", FALSE);
+}
+
+static void
+teardown_prefs(void)
+{
+	purple_prefs_disconnect_by_handle(&handle_a);
+	purple_prefs_disconnect_by_handle(&handle_b);
+	purple_prefs_remove("/check");
+	g_string_free(fired, TRUE);
+	fired = NULL;
+}
+
+START_TEST(test_prefs_callback_parents)
+{
+	purple_prefs_connect_callback(&handle_a, "/check/sub/value", record_cb, "value");
+	purple_prefs_connect_callback(&handle_a, "/check/sub", record_cb, "sub");
+	purple_prefs_connect_callback(&handle_a, "/check/other", record_cb, "other");
+
+	purple_prefs_set_int("/check/sub/value", 1);
+	assert_string_equal("value:/check/sub/value;sub:/check/sub/value;", fired->str);
+
+	/* Setting the same value again doesn't call anything. */
+	g_string_truncate(fired, 0);
+	purple_prefs_set_int("/check/sub/value", 1);
+	assert_string_equal("", fired->str);
+}
+END_TEST
+
+START_TEST(test_prefs_disconnect)
+{
+	guint id;
+
+	id = purple_prefs_connect_callback(&handle_a, "/check/sub/value", record_cb, "a1");
+	purple_prefs_connect_callback(&handle_a, "/check", record_cb, "a2");
+	purple_prefs_connect_callback(&handle_b, "/check/sub/value", record_cb, "b");
+
+	purple_prefs_disconnect_callback(id);
+	purple_prefs_set_int("/check/sub/value", 2);
+	assert_string_equal("b:/check/sub/value;a2:/check/sub/value;", fired->str);
+
+	g_string_truncate(fired, 0);
+	purple_prefs_disconnect_by_handle(&handle_a);
+	purple_prefs_set_int("/check/sub/value", 3);
+	assert_string_equal("b:/check/sub/value;", fired->str);
+
+	/* Removing a pref drops its callbacks. */
+	g_string_truncate(fired, 0);
+	purple_prefs_remove("/check/sub");
+	purple_prefs_add_none("/check/sub");
+	purple_prefs_add_int("/check/sub/value", 0);
+	purple_prefs_set_int("/check/sub/value", 4);
+	assert_string_equal("", fired->str);
+	purple_prefs_disconnect_by_handle(&handle_b);
+}
+END_TEST
+
+/*
+ * Builds the xmlnode tree prefs.xml used to be formatted from, using only
+ * the public API.  prefs.c now serializes prefs straight into a string,
+ * which must come out the same.
+ */
+static void
+pref_to_xmlnode(xmlnode *parent, const char *name)
+{
+	xmlnode *node, *item;
+	GList *children, *items, *cur;
+	const char *value;
+	char buf[21];
+	char *encoded;
+
+	node = xmlnode_new_child(parent, "pref");
+	xmlnode_set_attrib(node, "name", strrchr(name, '/') + 1);
+
+	switch (purple_prefs_get_type(name)) {
+	case PURPLE_PREF_INT:
+		xmlnode_set_attrib(node, "type", "int");
+		g_snprintf(buf, sizeof(buf), "%d", purple_prefs_get_int(name));
+		xmlnode_set_attrib(node, "value", buf);
+		break;
+	case PURPLE_PREF_STRING:
+		value = purple_prefs_get_string(name);
+		xmlnode_set_attrib(node, "type", "string");
+		xmlnode_set_attrib(node, "value", value ? value : "");
+		break;
+	case PURPLE_PREF_STRING_LIST:
+		xmlnode_set_attrib(node, "type", "stringlist");
+		items = purple_prefs_get_string_list(name);
+		for (cur = items; cur != NULL; cur = cur->next) {
+			item = xmlnode_new_child(node, "item");
+			xmlnode_set_attrib(item, "value", cur->data ? cur->data : "");
+			g_free(cur->data);
+		}
+		g_list_free(items);
+		break;
+	case PURPLE_PREF_PATH:
+		value = purple_prefs_get_path(name);
+		encoded = g_filename_to_utf8(value ? value : "", -1, NULL, NULL, NULL);
+		xmlnode_set_attrib(node, "type", "path");
+		xmlnode_set_attrib(node, "value", encoded);
+		g_free(encoded);
+		break;
+	case PURPLE_PREF_PATH_LIST:
+		xmlnode_set_attrib(node, "type", "pathlist");
+		items = purple_prefs_get_path_list(name);
+		for (cur = items; cur != NULL; cur = cur->next) {
+			encoded = g_filename_to_utf8(cur->data ? cur->data : "", -1, NULL, NULL, NULL);
+			item = xmlnode_new_child(node, "item");
+			xmlnode_set_attrib(item, "value", encoded);
+			g_free(encoded);
+			g_free(cur->data);
+		}
+		g_list_free(items);
+		break;
+	case PURPLE_PREF_BOOLEAN:
+		xmlnode_set_attrib(node, "type", "bool");
+		g_snprintf(buf, sizeof(buf), "%d", purple_prefs_get_bool(name));
+		xmlnode_set_attrib(node, "value", buf);
+		break;
+	case PURPLE_PREF_NONE:
+		break;
+	}
+
+	children = purple_prefs_get_children_names(name);
+	for (cur = children; cur != NULL; cur = cur->next) {
+		pref_to_xmlnode(node, cur->data);
+		g_free(cur->data);
+	}
+	g_list_free(children);
+}
+
+static void
+assert_prefs_serialized(void)
+{
+	xmlnode *root = xmlnode_new("pref");
+	GList *children, *cur;
+	char *expected;
+
+	xmlnode_set_attrib(root, "version", "1");
+	xmlnode_set_attrib(root, "name", "/");
+
+	children = purple_prefs_get_children_names("/");
+	for (cur = children; cur != NULL; cur = cur->next) {
+		pref_to_xmlnode(root, cur->data);
+		g_free(cur->data);
+	}
+	g_list_free(children);
+
+	expected = xmlnode_to_formatted_str(root, NULL);
+	assert_string_equal_free(expected, _purple_prefs_to_string());
+	g_free(expected);
+	xmlnode_free(root);
+}
+
+START_TEST(test_prefs_to_string)
+{
+	GList *list = NULL;
+
+	purple_prefs_add_string("/check/markup", "<a href=\"x\">'Tom' & \"Jerry\"</a>");
+	purple_prefs_add_string("/check/sub/empty", "");
+	purple_prefs_add_bool("/check/odd & <name>", TRUE);
+	purple_prefs_add_path("/check/path", "/tmp/a dir/<file> & 'more'");
+	purple_prefs_add_none("/check/sub/deeper");
+	purple_prefs_add_int("/check/sub/deeper/number", -42);
+
+	list = g_list_append(list, "one");
+	list = g_list_append(list, "<two> & 'three'");
+	list = g_list_append(list, "");
+	purple_prefs_add_string_list("/check/list", list);
+	purple_prefs_add_path_list("/check/sub/paths", list);
+	purple_prefs_add_string_list("/check/sub/none", NULL);
+	g_list_free(list);
+
+	assert_prefs_serialized();
+
+	/* Changes deep in the tree are seen past the cached serializations of
+	 * the subtrees above them. */
+	purple_prefs_set_int("/check/sub/deeper/number", 7);
+	purple_prefs_set_string("/check/markup", "</pref>");
+	list = g_list_append(NULL, "only");
+	purple_prefs_set_path_list("/check/sub/paths", list);
+	g_list_free(list);
+	assert_prefs_serialized();
+
+	purple_prefs_remove("/check/sub/deeper");
+	purple_prefs_add_int("/check/added", 1);
+	assert_prefs_serialized();
+}
+END_TEST
+
+Suite *
+prefs_suite(void)
+{
+	Suite *s = suite_create("Prefs");
+	TCase *tc;
+
+	tc = tcase_create("Callbacks");
+	tcase_add_checked_fixture(tc, setup_prefs, teardown_prefs);
+	tcase_add_test(tc, test_prefs_callback_parents);
+	tcase_add_test(tc, test_prefs_disconnect);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("Serialization");
+	tcase_add_checked_fixture(tc, setup_prefs, teardown_prefs);
+	tcase_add_test(tc, test_prefs_to_string);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -33,6 +33,47 @@ START_TEST(test_util_base64_decode)
 }
 END_TEST
 
+START_TEST(test_util_base64_encode_append)
+{
+	GString *str = g_string_new("x");
+	purple_base64_encode_append(str, (const guchar *)"forty-two", 9);
+	purple_base64_encode_append(str, (const guchar *)"", 0);
+	purple_base64_encode_append(str, (const guchar *)"a", 1);
+	assert_string_equal_free("xZm9ydHktdHdvYQ==", g_string_free(str, FALSE));
+}
+END_TEST
+
+START_TEST(test_util_base64_decode_step)
+{
+	PurpleBase64DecodeState state = { 0, 0, FALSE };
+	guchar out[32];
+	gssize len = 0;
+
+	/* Split in the middle of quantums, with whitespace in between */
+	len += purple_base64_decode_step(&state, "b3d0L", 5, out + len);
+	len += purple_base64_decode_step(&state, "Xl0\ncm9", 7, out + len);
+	len += purple_base64_decode_step(&state, "mAA=", 4, out + len);
+	len += purple_base64_decode_step(&state, "=", 1, out + len);
+	len += purple_base64_decode_close(&state, out + len);
+	fail_unless(len == 10, NULL);
+	assert_string_equal("owt-ytrof", (char *)out);
+
+	/* Missing padding is fine */
+	len = purple_base64_decode_step(&state, "Zm9vYg", 6, out);
+	len += purple_base64_decode_close(&state, out + len);
+	fail_unless(len == 4, NULL);
+	fail_unless(memcmp(out, "foob", 4) == 0, NULL);
+
+	/* Garbage isn't */
+	fail_unless(purple_base64_decode_step(&state, "Zm9v*", 5, out) == -1, NULL);
+	memset(&state, 0, sizeof(state));
+	fail_unless(purple_base64_decode_step(&state, "Zg==Zg==", 8, out) == -1, NULL);
+	memset(&state, 0, sizeof(state));
+	len = purple_base64_decode_step(&state, "Zm9vY", 5, out);
+	fail_unless(purple_base64_decode_close(&state, out + len) == -1, NULL);
+}
+END_TEST
+
 START_TEST(test_util_escape_filename)
 {
 	assert_string_equal("foo", purple_escape_filename("foo"));
@@ -187,6 +228,268 @@ START_TEST(test_markup_html_to_xhtml)
 }
 END_TEST
 
+static const char *markup_corpus[] = {
+	"",
+	"plain text",
+	"<b>bold</b> and <i>italic</i>",
+	"a &amp; b &lt;c&gt; &#65;&nbsp;",
+	"<font color=\"#ff0000\" face=\"Arial\" size=\"4\">red</font>",
+	"<font size=3 back=blue>x</font>",
+	"<a href=\"http://pidgin.im/\">Pidgin</a>",
+	"<a href=\"http://pidgin.im/\">http://pidgin.im/</a> http://pidgin.im/",
+	"see http://www.example.com/foo.html. or (http://example.com/a)",
+	"www.pidgin.im, ftp.example.com and xmpp:me@jabber.org",
+	"mail joe@example.com or mailto:joe@example.com",
+	"line<br>break<br/>and<br />more",
+	"<p>para</p><div>div</div><hr>",
+	"<table><tr><td>a</td> <td>b</td></tr></table>",
+	"<script>alert(1)</script><style>b{}</style>after",
+	"<img src=\"smile.png\" alt=\":)\">",
+	"<span style='color: red'>s</span><blockquote>q</blockquote>",
+	"<body bgcolor='#fff'>bg</body>",
+	"unclosed <b>bold <u>underline",
+	"<b>overlapping <i>tags</b> here</i>",
+	"</b>stray closing tag",
+	"<unknown>tag</unknown>",
+	"text\nwith\tsome  white space",
+	"caf\xc3\xa9 http://\xc3\xa9t\xc3\xa9.com/",
+	NULL
+};
+
+static char *
+run_markup_filter(PurpleMarkupFilter *(*filter_new)(PurpleMarkupFilter *next),
+		const char *markup)
+{
+	GString *out = g_string_new(NULL);
+	PurpleMarkupFilter *filter = filter_new(purple_markup_filter_string_new(out));
+
+	purple_markup_filter_feed(filter, markup);
+	purple_markup_filter_finish(filter);
+	purple_markup_filter_free(filter);
+
+	return g_string_free(out, FALSE);
+}
+
+static char *
+run_slice_filter(const char *markup, guint x, guint y)
+{
+	GString *out = g_string_new(NULL);
+	PurpleMarkupFilter *filter;
+
+	filter = purple_markup_filter_slice_new(purple_markup_filter_string_new(out), x, y);
+	purple_markup_filter_feed(filter, markup);
+	purple_markup_filter_finish(filter);
+	purple_markup_filter_free(filter);
+
+	return g_string_free(out, FALSE);
+}
+
+START_TEST(test_markup_next_token)
+{
+	const char *markup = "a <b class='x>y'>c</B><br/><!-- <i> -->1 < 2<3";
+	PurpleMarkupToken token;
+
+	fail_unless(purple_markup_next_token(&markup, &token));
+	fail_unless(token.type == PURPLE_MARKUP_TOKEN_TEXT);
+	fail_unless(token.len == 2);
+
+	fail_unless(purple_markup_next_token(&markup, &token));
+	fail_unless(token.type == PURPLE_MARKUP_TOKEN_TAG);
+	fail_unless(token.len == strlen("<b class='x>y'>"));
+	fail_unless(token.name_len == 1 && *token.name == 'b');
+	fail_unless(!token.closing && !token.empty);
+
+	fail_unless(purple_markup_next_token(&markup, &token));
+	fail_unless(token.type == PURPLE_MARKUP_TOKEN_TEXT && token.len == 1);
+
+	fail_unless(purple_markup_next_token(&markup, &token));
+	fail_unless(token.type == PURPLE_MARKUP_TOKEN_TAG);
+	fail_unless(token.name_len == 1 && *token.name == 'B');
+	fail_unless(token.closing && !token.empty);
+
+	fail_unless(purple_markup_next_token(&markup, &token));
+	fail_unless(token.type == PURPLE_MARKUP_TOKEN_TAG);
+	fail_unless(token.name_len == 2 && !strncmp(token.name, "br", 2));
+	fail_unless(!token.closing && token.empty);
+
+	fail_unless(purple_markup_next_token(&markup, &token));
+	fail_unless(token.type == PURPLE_MARKUP_TOKEN_COMMENT);
+	fail_unless(token.len == strlen("<!-- <i> -->"));
+
+	/* Neither "< " nor "<3" starts a tag. */
+	fail_unless(purple_markup_next_token(&markup, &token));
+	fail_unless(token.type == PURPLE_MARKUP_TOKEN_TEXT);
+	fail_unless(token.len == strlen("1 < 2<3"));
+
+	fail_if(purple_markup_next_token(&markup, &token));
+
+	/* An unterminated comment runs to the end as text. */
+	markup = "a<!-- <b>c</b>";
+	fail_unless(purple_markup_next_token(&markup, &token));
+	fail_unless(token.type == PURPLE_MARKUP_TOKEN_TEXT);
+	fail_unless(token.len == strlen("a<!-- <b>c</b>"));
+	fail_if(purple_markup_next_token(&markup, &token));
+
+	markup = "<!-- <b>c</b>";
+	fail_unless(purple_markup_next_token(&markup, &token));
+	fail_unless(token.type == PURPLE_MARKUP_TOKEN_TEXT);
+	fail_unless(token.len == strlen("<!-- <b>c</b>"));
+	fail_if(purple_markup_next_token(&markup, &token));
+}
+END_TEST
+
+START_TEST(test_markup_filters)
+{
+	int i;
+
+	/* The filters give the same results as the functions they follow. */
+	for (i = 0; markup_corpus[i] != NULL; i++) {
+		const char *markup = markup_corpus[i];
+		char *expected;
+		guint x, y;
+
+		expected = purple_markup_strip_html(markup);
+		assert_string_equal_free(expected,
+				run_markup_filter(purple_markup_filter_strip_new, markup));
+		g_free(expected);
+
+		expected = purple_markup_linkify(markup);
+		assert_string_equal_free(expected,
+				run_markup_filter(purple_markup_filter_linkify_new, markup));
+		g_free(expected);
+
+		purple_markup_html_to_xhtml(markup, &expected, NULL);
+		assert_string_equal_free(expected,
+				run_markup_filter(purple_markup_filter_xhtml_new, markup));
+		g_free(expected);
+
+		for (x = 0; x < 4; x++) {
+			for (y = x; y < 12; y++) {
+				expected = purple_markup_slice(markup, x, y);
+				assert_string_equal_free(expected, run_slice_filter(markup, x, y));
+				g_free(expected);
+			}
+		}
+	}
+
+	assert_string_equal_free("&lt;b&gt;x &amp; y&lt;/b&gt;",
+			run_markup_filter(purple_markup_filter_escape_new, "<b>x & y</b>"));
+
+	/* A '<' that doesn't start a tag is text, not the start of one. */
+	assert_string_equal_free("I <3 you",
+			run_markup_filter(purple_markup_filter_strip_new, "I <3 <b>you</b>"));
+	assert_string_equal_free("1 &lt; 2 and 3 > 2",
+			run_markup_filter(purple_markup_filter_xhtml_new, "1 < 2 and 3 > 2"));
+	assert_string_equal_free("1 < 2",
+			run_slice_filter("1 < 2 and 3 > 2", 0, 5));
+	assert_string_equal_free("<b>bo</b>",
+			run_slice_filter("<!-- x --><b>bold</b>", 0, 2));
+}
+END_TEST
+
+START_TEST(test_markup_filter_chain)
+{
+	GString *plain = g_string_new(NULL);
+	GString *linked = g_string_new(NULL);
+	GString *xhtml = g_string_new(NULL);
+	PurpleMarkupFilter *filter;
+	const char *markup = "<b>Go</b> to <font color=red>www.pidgin.im</font> & <i>relax</i>";
+
+	filter = purple_markup_filter_tee_new(
+			purple_markup_filter_strip_new(
+				purple_markup_filter_escape_new(
+					purple_markup_filter_string_new(plain))),
+			purple_markup_filter_tee_new(
+				purple_markup_filter_linkify_new(
+					purple_markup_filter_string_new(linked)),
+				purple_markup_filter_linkify_new(
+					purple_markup_filter_xhtml_new(
+						purple_markup_filter_string_new(xhtml)))));
+	purple_markup_filter_feed(filter, markup);
+	purple_markup_filter_finish(filter);
+	purple_markup_filter_free(filter);
+
+	assert_string_equal("Go to www.pidgin.im &amp; relax", plain->str);
+	assert_string_equal("<b>Go</b> to <font color=red><A HREF=\"http://www.pidgin.im\">www.pidgin.im</A></font> & <i>relax</i>",
+			linked->str);
+	assert_string_equal("<span style='font-weight: bold;'>Go</span> to <span style='color: red;'><a href=\"http://www.pidgin.im\">www.pidgin.im</a></span> & <em>relax</em>",
+			xhtml->str);
+
+	g_string_free(plain, TRUE);
+	g_string_free(linked, TRUE);
+	g_string_free(xhtml, TRUE);
+}
+END_TEST
+
+START_TEST(test_markup_filter_push)
+{
+	GString *linked = g_string_new(NULL);
+	PurpleMarkupFilter *filter;
+	PurpleMarkupToken token;
+	char *text;
+
+	/* A pushed token needn't be followed by a NUL or a '<'.  Use a copy
+	 * without a terminator so that reading past it shows up in valgrind. */
+	text = g_memdup("go to www.pidgin.im", 19);
+	memset(&token, 0, sizeof(token));
+	token.type = PURPLE_MARKUP_TOKEN_TEXT;
+	token.start = text;
+	token.len = 19;
+
+	filter = purple_markup_filter_linkify_new(
+			purple_markup_filter_string_new(linked));
+	purple_markup_filter_push(filter, &token);
+	purple_markup_filter_finish(filter);
+	purple_markup_filter_free(filter);
+
+	assert_string_equal("go to <A HREF=\"http://www.pidgin.im\">www.pidgin.im</A>",
+			linked->str);
+
+	g_free(text);
+	g_string_free(linked, TRUE);
+}
+END_TEST
+
+START_TEST(test_markup_filter_large)
+{
+	GString *markup = g_string_new(NULL);
+	GString *plain = g_string_new(NULL);
+	GString *linked = g_string_new(NULL);
+	GString *xhtml = g_string_new(NULL);
+	PurpleMarkupFilter *filter;
+	char *expected;
+	int i;
+
+	for (i = 0; i < 20000; i++)
+		g_string_append(markup, "<font color=\"red\"><b>Hi</b> see http://pidgin.im/ &amp; mail a@b.com</font><br>");
+
+	/* Tokenize once, for all three outputs. */
+	filter = purple_markup_filter_tee_new(
+			purple_markup_filter_strip_new(purple_markup_filter_string_new(plain)),
+			purple_markup_filter_tee_new(
+				purple_markup_filter_linkify_new(purple_markup_filter_string_new(linked)),
+				purple_markup_filter_xhtml_new(purple_markup_filter_string_new(xhtml))));
+	purple_markup_filter_feed(filter, markup->str);
+	purple_markup_filter_finish(filter);
+	purple_markup_filter_free(filter);
+
+	expected = purple_markup_strip_html(markup->str);
+	assert_string_equal(expected, plain->str);
+	g_free(expected);
+	expected = purple_markup_linkify(markup->str);
+	assert_string_equal(expected, linked->str);
+	g_free(expected);
+	purple_markup_html_to_xhtml(markup->str, &expected, NULL);
+	assert_string_equal(expected, xhtml->str);
+	g_free(expected);
+
+	g_string_free(markup, TRUE);
+	g_string_free(plain, TRUE);
+	g_string_free(linked, TRUE);
+	g_string_free(xhtml, TRUE);
+}
+END_TEST
+
 START_TEST(test_utf8_strip_unprintables)
 {
 	fail_unless(NULL == purple_utf8_strip_unprintables(NULL));
@@ -245,6 +548,8 @@ util_suite(void)
 	tc = tcase_create("Base64");
 	tcase_add_test(tc, test_util_base64_encode);
 	tcase_add_test(tc, test_util_base64_decode);
+	tcase_add_test(tc, test_util_base64_encode_append);
+	tcase_add_test(tc, test_util_base64_decode_step);
 	suite_add_tcase(s, tc);
 
 	tc = tcase_create("Filenames");
@@ -270,6 +575,11 @@ util_suite(void)
 
 	tc = tcase_create("Markup");
 	tcase_add_test(tc, test_markup_html_to_xhtml);
+	tcase_add_test(tc, test_markup_next_token);
+	tcase_add_test(tc, test_markup_filters);
+	tcase_add_test(tc, test_markup_filter_chain);
+	tcase_add_test(tc, test_markup_filter_push);
+	tcase_add_test(tc, test_markup_filter_large);
 	suite_add_tcase(s, tc);
 
 	tc = tcase_create("Stripping Unparseables");
@@ -8,12 +8,19 @@
 /* define the test suites here */
 /* remember to add the suite to the runner in check_libpurple.c */
 Suite * master_suite(void);
+Suite * account_suite(void);
+Suite * buddyicon_suite(void);
 Suite * cipher_suite(void);
+Suite * imgstore_suite(void);
+Suite * jabber_bosh_suite(void);
 Suite * jabber_caps_suite(void);
 Suite * jabber_digest_md5_suite(void);
 Suite * jabber_jutil_suite(void);
 Suite * jabber_scram_suite(void);
+Suite * log_suite(void);
+Suite * metrics_suite(void);
 Suite * oscar_util_suite(void);
+Suite * prefs_suite(void);
 Suite * yahoo_util_suite(void);
 Suite * util_suite(void);
 Suite * xmlnode_suite(void);
@@ -23,12 +23,31 @@
 #include "internal.h"
 #include "theme-manager.h"
 #include "util.h"
+#include "xmlnode.h"
 
 /******************************************************************************
  * Globals
  *****************************************************************************/
 
+/*
+ * Themes are only built when they're asked for.  Refreshing just finds
+ * each theme's name, which the index saved in theme-index.xml remembers
+ * until the theme's theme.xml changes.
+ */
+typedef struct
+{
+	gchar *type;
+	gchar *name;
+	gchar *dir;
+	time_t mtime;
+	gint64 size;
+	gboolean tried;   /* It has been built, or failed to build. */
+
+} PurpleThemeIndexEntry;
+
 static GHashTable *theme_table = NULL;
+static GHashTable *theme_index = NULL;   /* <type>/<name> -> PurpleThemeIndexEntry */
+static gboolean theme_index_changed = FALSE;
 
 /*****************************************************************************
  * GObject Stuff
@@ -96,8 +115,202 @@ purple_theme_manager_function_wrapper(gchar *key,
 		(* user_data)(value);
 }
 
+static PurpleThemeIndexEntry *
+purple_theme_index_entry_new(const gchar *type, const gchar *name,
+		const gchar *dir, time_t mtime, gint64 size)
+{
+	PurpleThemeIndexEntry *entry = g_new0(PurpleThemeIndexEntry, 1);
+
+	entry->type = g_strdup(type);
+	entry->name = g_strdup(name);
+	entry->dir = g_strdup(dir);
+	entry->mtime = mtime;
+	entry->size = size;
+
+	return entry;
+}
+
+static void
+purple_theme_index_entry_free(PurpleThemeIndexEntry *entry)
+{
+	g_free(entry->type);
+	g_free(entry->name);
+	g_free(entry->dir);
+	g_free(entry);
+}
+
+static GHashTable *
+purple_theme_index_new(void)
+{
+	return g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+			(GDestroyNotify)purple_theme_index_entry_free);
+}
+
 static void
-purple_theme_manager_build_dir(const gchar *root)
+purple_theme_index_read(void)
+{
+	xmlnode *root, *node;
+
+	root = purple_util_read_xml_from_file("theme-index.xml", _("theme index"));
+	if (root == NULL)
+		return;
+
+	for (node = xmlnode_get_child(root, "theme"); node != NULL;
+			node = xmlnode_get_next_twin(node)) {
+		const char *type = xmlnode_get_attrib(node, "type");
+		const char *name = xmlnode_get_attrib(node, "name");
+		const char *dir = xmlnode_get_attrib(node, "dir");
+		const char *mtime = xmlnode_get_attrib(node, "mtime");
+		const char *size = xmlnode_get_attrib(node, "size");
+		gchar *key;
+
+		if (type == NULL || name == NULL || dir == NULL || mtime == NULL || size == NULL)
+			continue;
+
+		key = purple_theme_manager_make_key(name, type);
+		if (key == NULL)
+			continue;
+
+		g_hash_table_replace(theme_index, key,
+				purple_theme_index_entry_new(type, name, dir,
+					(time_t)g_ascii_strtoll(mtime, NULL, 10),
+					g_ascii_strtoll(size, NULL, 10)));
+	}
+
+	xmlnode_free(root);
+}
+
+static void
+purple_theme_index_entry_to_xmlnode(gpointer key, gpointer value, gpointer user_data)
+{
+	PurpleThemeIndexEntry *entry = value;
+	xmlnode *node = xmlnode_new_child(user_data, "theme");
+	char buf[32];
+
+	xmlnode_set_attrib(node, "type", entry->type);
+	xmlnode_set_attrib(node, "name", entry->name);
+	xmlnode_set_attrib(node, "dir", entry->dir);
+	g_snprintf(buf, sizeof(buf), "%" G_GINT64_FORMAT, (gint64)entry->mtime);
+	xmlnode_set_attrib(node, "mtime", buf);
+	g_snprintf(buf, sizeof(buf), "%" G_GINT64_FORMAT, entry->size);
+	xmlnode_set_attrib(node, "size", buf);
+}
+
+static void
+purple_theme_index_write(void)
+{
+	xmlnode *root;
+	char *data;
+
+	root = xmlnode_new("themes");
+	xmlnode_set_attrib(root, "version", "1.0");
+	g_hash_table_foreach(theme_index, purple_theme_index_entry_to_xmlnode, root);
+
+	data = xmlnode_to_formatted_str(root, NULL);
+	purple_util_write_data_to_file("theme-index.xml", data, -1);
+	g_free(data);
+	xmlnode_free(root);
+}
+
+/* Builds an indexed theme and adds it to the manager. */
+static PurpleTheme *
+purple_theme_index_entry_build(PurpleThemeIndexEntry *entry)
+{
+	PurpleThemeLoader *loader;
+	PurpleTheme *theme;
+
+	if (entry->tried)
+		return NULL;
+	entry->tried = TRUE;
+
+	loader = g_hash_table_lookup(theme_table, entry->type);
+	if (!PURPLE_IS_THEME_LOADER(loader))
+		return NULL;
+
+	theme = purple_theme_loader_build(loader, entry->dir);
+	if (!PURPLE_IS_THEME(theme))
+		return NULL;
+
+	if (purple_theme_manager_find_theme(purple_theme_get_name(theme),
+				purple_theme_get_type_string(theme)) != NULL) {
+		/* Something else got there first. */
+		g_object_unref(theme);
+		return NULL;
+	}
+
+	purple_theme_manager_add_theme(theme);
+
+	/* The name is different if theme.xml changed since the refresh. */
+	if (!purple_strequal(purple_theme_get_name(theme), entry->name))
+		return NULL;
+
+	return theme;
+}
+
+static void
+purple_theme_index_entry_build_foreach(gpointer key, gpointer value, gpointer user_data)
+{
+	purple_theme_index_entry_build(value);
+}
+
+/* Adds a theme directory to the index, only reading its theme.xml if it
+ * changed since it was last indexed. */
+static void
+purple_theme_manager_index_dir(const gchar *theme_dir, const gchar *type,
+		PurpleThemeLoader *loader, GHashTable *known)
+{
+	PurpleThemeIndexEntry *entry;
+	gchar *xml, *key;
+	struct stat st;
+	int ret;
+
+	xml = g_build_filename(theme_dir, "theme.xml", NULL);
+	ret = g_stat(xml, &st);
+	g_free(xml);
+
+	if (ret != 0) {
+		/* There's no name to index without a theme.xml, so let the
+		 * loader deal with it now. */
+		PurpleTheme *theme = purple_theme_loader_build(loader, theme_dir);
+
+		if (PURPLE_IS_THEME(theme))
+			purple_theme_manager_add_theme(theme);
+		return;
+	}
+
+	entry = g_hash_table_lookup(known, theme_dir);
+	if (entry != NULL && purple_strequal(entry->type, type) &&
+			entry->mtime == st.st_mtime && entry->size == (gint64)st.st_size) {
+		entry = purple_theme_index_entry_new(type, entry->name, theme_dir,
+				entry->mtime, entry->size);
+	} else {
+		xmlnode *root = xmlnode_from_file(theme_dir, "theme.xml",
+				_("theme"), "theme-manager");
+		const char *name = root ? xmlnode_get_attrib(root, "name") : NULL;
+
+		if (name == NULL || *name == '\0') {
+			xmlnode_free(root);
+			return;
+		}
+
+		entry = purple_theme_index_entry_new(type, name, theme_dir,
+				st.st_mtime, st.st_size);
+		xmlnode_free(root);
+		theme_index_changed = TRUE;
+	}
+
+	/* The first theme found with a name wins. */
+	key = purple_theme_manager_make_key(entry->name, type);
+	if (g_hash_table_lookup(theme_index, key) == NULL) {
+		g_hash_table_insert(theme_index, key, entry);
+	} else {
+		g_free(key);
+		purple_theme_index_entry_free(entry);
+	}
+}
+
+static void
+purple_theme_manager_build_dir(const gchar *root, GHashTable *known)
 {
 	gchar *purple_dir, *theme_dir;
 	const gchar *name = NULL, *type = NULL;
@@ -122,15 +335,9 @@ purple_theme_manager_build_dir(const gchar *root)
 
 		while ((type = g_dir_read_name(tdir))) {
 			if ((loader = g_hash_table_lookup(theme_table, type))) {
-				PurpleTheme *theme = NULL;
-
 				theme_dir = g_build_filename(purple_dir, type, NULL);
-
-				theme = purple_theme_loader_build(loader, theme_dir);
+				purple_theme_manager_index_dir(theme_dir, type, loader, known);
 				g_free(theme_dir);
-
-				if (PURPLE_IS_THEME(theme))
-					purple_theme_manager_add_theme(theme);
 			}
 		}
 
@@ -152,19 +359,40 @@ purple_theme_manager_init(void)
 			g_str_equal, g_free, g_object_unref);
 }
 
+static void
+purple_theme_manager_add_known(gpointer key, gpointer value, gpointer user_data)
+{
+	PurpleThemeIndexEntry *entry = value;
+
+	g_hash_table_insert(user_data, entry->dir, entry);
+}
+
 void
 purple_theme_manager_refresh(void)
 {
 	gchar *path = NULL;
 	const gchar *xdg = NULL;
 	gint i = 0;
+	GHashTable *old_index, *known;
 
 	g_hash_table_foreach_remove(theme_table,
 			(GHRFunc) purple_theme_manager_is_theme, NULL);
 
+	if (theme_index == NULL) {
+		theme_index = purple_theme_index_new();
+		purple_theme_index_read();
+	}
+
+	/* What's already indexed, by directory. */
+	old_index = theme_index;
+	known = g_hash_table_new(g_str_hash, g_str_equal);
+	g_hash_table_foreach(old_index, purple_theme_manager_add_known, known);
+	theme_index = purple_theme_index_new();
+	theme_index_changed = FALSE;
+
 	/* Add themes from ~/.purple */
 	path = g_build_filename(purple_user_dir(), "themes", NULL);
-	purple_theme_manager_build_dir(path);
+	purple_theme_manager_build_dir(path, known);
 	g_free(path);
 
 	/* look for XDG_DATA_HOME.  If we don't have it use ~/.local, and add it */
@@ -173,7 +401,7 @@ purple_theme_manager_refresh(void)
 	else
 		path = g_build_filename(purple_home_dir(), ".local", "themes", NULL);
 
-	purple_theme_manager_build_dir(path);
+	purple_theme_manager_build_dir(path, known);
 	g_free(path);
 
 	/* now dig through XDG_DATA_DIRS and add those too */
@@ -183,18 +411,31 @@ purple_theme_manager_refresh(void)
 
 		for (i = 0; xdg_dirs[i]; i++) {
 			path = g_build_filename(xdg_dirs[i], "themes", NULL);
-			purple_theme_manager_build_dir(path);
+			purple_theme_manager_build_dir(path, known);
 			g_free(path);
 		}
 
 		g_strfreev(xdg_dirs);
 	}
+
+	/* Themes that went away need to be dropped from the saved index. */
+	if (theme_index_changed ||
+			g_hash_table_size(theme_index) != g_hash_table_size(old_index))
+		purple_theme_index_write();
+
+	g_hash_table_destroy(known);
+	g_hash_table_destroy(old_index);
 }
 
 void
 purple_theme_manager_uninit(void)
 {
 	g_hash_table_destroy(theme_table);
+
+	if (theme_index != NULL) {
+		g_hash_table_destroy(theme_index);
+		theme_index = NULL;
+	}
 }
 
 void
@@ -228,6 +469,9 @@ purple_theme_manager_unregister_type(PurpleThemeLoader *loader)
 
 		g_hash_table_foreach_remove(theme_table,
 				(GHRFunc)purple_theme_manager_is_theme_type, (gpointer)type);
+		if (theme_index != NULL)
+			g_hash_table_foreach_remove(theme_index,
+					(GHRFunc)purple_theme_manager_is_theme_type, (gpointer)type);
 	} /* only free if given registered loader */
 }
 
@@ -244,6 +488,13 @@ purple_theme_manager_find_theme(const gchar *name,
 
 	theme = g_hash_table_lookup(theme_table, key);
 
+	if (theme == NULL && theme_index != NULL) {
+		PurpleThemeIndexEntry *entry = g_hash_table_lookup(theme_index, key);
+
+		if (entry != NULL)
+			theme = purple_theme_index_entry_build(entry);
+	}
+
 	g_free(key);
 
 	return theme;
@@ -280,6 +531,13 @@ purple_theme_manager_remove_theme(PurpleTheme *theme)
 
 	g_hash_table_remove(theme_table, key);
 
+	/* Don't let it come back from the index. */
+	if (theme_index != NULL) {
+		PurpleThemeIndexEntry *entry = g_hash_table_lookup(theme_index, key);
+		if (entry != NULL)
+			entry->tried = TRUE;
+	}
+
 	g_free(key);
 }
 
@@ -288,6 +546,11 @@ purple_theme_manager_for_each_theme(PTFunc func)
 {
 	g_return_if_fail(func);
 
+	/* Everything has to be built to be listed. */
+	if (theme_index != NULL)
+		g_hash_table_foreach(theme_index,
+				purple_theme_index_entry_build_foreach, NULL);
+
 	g_hash_table_foreach(theme_table,
 			(GHFunc) purple_theme_manager_function_wrapper, func);
 }
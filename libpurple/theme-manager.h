@@ -78,6 +78,10 @@ void purple_theme_manager_uninit(void);
 /**
  * Rebuilds all the themes in the theme manager.
  * (Removes all current themes but keeps the added loaders.)
+ *
+ * Themes found on disk are only indexed by name here; each one is built
+ * the first time it is looked up with purple_theme_manager_find_theme()
+ * or listed with purple_theme_manager_for_each_theme().
  */
 void purple_theme_manager_refresh(void);
 
@@ -121,7 +125,8 @@ void purple_theme_manager_register_type(PurpleThemeLoader *loader);
 void purple_theme_manager_unregister_type(PurpleThemeLoader *loader);
 
 /**
- * Calls the given function on each purple theme.
+ * Calls the given function on each purple theme.  This builds any
+ * indexed themes which haven't been built yet.
  *
  * @param func The PTFunc to be applied to each theme.
  */
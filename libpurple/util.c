@@ -39,6 +39,10 @@
 
 #define MAX_HTTP_CHUNK_SIZE (10 * 1024 * 1024)
 
+/* How many idle kept-alive connections to hold per host, and for how long */
+#define MAX_IDLE_HTTP_CONNECTIONS 4
+#define IDLE_HTTP_CONNECTION_TIMEOUT 30
+
 struct _PurpleUtilFetchUrlData
 {
 	PurpleUtilFetchUrlCallback callback;
@@ -76,9 +80,33 @@ struct _PurpleUtilFetchUrlData
 	unsigned long data_len;
 	gsize max_len;
 	gboolean chunked;
+	gsize chunk_pos;
+	gsize body_offset;
+	gboolean overrun;
+	gboolean keepalive;
+	gboolean reused;
 	PurpleAccount *account;
+
+	GTimeVal start;
+	PurpleUtilFetchUrlStats *stats;
 };
 
+/** An HTTP connection that finished a request and waits to be reused */
+typedef struct
+{
+	char *key;
+	int fd;
+	PurpleSslConnection *ssl_connection;
+	guint inpa;
+	guint timeout;
+} PurpleUtilFetchUrlIdleConn;
+
+/* Idle connections, keyed by url_fetch_pool_key(). Values are GLists of
+ * PurpleUtilFetchUrlIdleConn. */
+static GHashTable *url_fetch_idle = NULL;
+/* PurpleUtilFetchUrlStats, keyed by "host:port" */
+static GHashTable *url_fetch_stats = NULL;
+
 static char *custom_user_dir = NULL;
 static char *user_dir = NULL;
 
@@ -121,6 +149,12 @@ purple_util_uninit(void)
 
 	g_free(user_dir);
 	user_dir = NULL;
+
+	_purple_util_fetch_url_close_idle();
+	if (url_fetch_stats) {
+		g_hash_table_destroy(url_fetch_stats);
+		url_fetch_stats = NULL;
+	}
 }
 
 /**************************************************************************
@@ -225,10 +259,81 @@ static const char alphabet[] =
 static const char xdigits[] =
 	"0123456789abcdef";
 
+/* Maps each byte to its base-64 value, or -1 if it's not in the alphabet */
+static const gint8 base64_values[256] = {
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+	52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+	-1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+	15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+	-1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+	41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+/*
+ * Encodes len bytes of data into out, which must have room for
+ * ((len + 2) / 3) * 4 characters.  Returns the number of characters
+ * written; the output is not nul-terminated.
+ */
+static gsize
+base64_encode_block(const guchar *data, gsize len, gchar *out)
+{
+	gchar *start = out;
+	guint32 value;
+
+	/* Each 3 bytes of input become 4 characters of output */
+	for (; len >= 3; len -= 3, data += 3, out += 4) {
+		value = (data[0] << 16) | (data[1] << 8) | data[2];
+		out[0] = alphabet[value >> 18];
+		out[1] = alphabet[(value >> 12) & 0x3f];
+		out[2] = alphabet[(value >> 6) & 0x3f];
+		out[3] = alphabet[value & 0x3f];
+	}
+
+	if (len > 0) {
+		value = data[0] << 16;
+		if (len == 2)
+			value |= data[1] << 8;
+
+		out[0] = alphabet[value >> 18];
+		out[1] = alphabet[(value >> 12) & 0x3f];
+		out[2] = (len == 2) ? alphabet[(value >> 6) & 0x3f] : '=';
+		out[3] = '=';
+		out += 4;
+	}
+
+	return out - start;
+}
+
 gchar *
 purple_base64_encode(const guchar *data, gsize len)
 {
-	return g_base64_encode(data, len);
+	gchar *out = g_malloc(((len + 2) / 3) * 4 + 1);
+
+	out[base64_encode_block(data, len, out)] = '\0';
+
+	return out;
+}
+
+void
+purple_base64_encode_append(GString *str, const guchar *data, gsize len)
+{
+	gsize start;
+
+	g_return_if_fail(str != NULL);
+
+	start = str->len;
+	g_string_set_size(str, start + ((len + 2) / 3) * 4);
+	base64_encode_block(data, len, str->str + start);
 }
 
 guchar *
@@ -243,6 +348,118 @@ purple_base64_decode(const char *str, gsize *ret_len)
 	return g_base64_decode(str, ret_len != NULL ? ret_len : &unused);
 }
 
+gssize
+purple_base64_decode_step(PurpleBase64DecodeState *state, const char *str,
+                          gsize len, guchar *out)
+{
+	const guchar *in = (const guchar *)str;
+	const guchar *end = in + len;
+	guchar *start = out;
+	guint32 value;
+	guint count;
+
+	g_return_val_if_fail(state != NULL, -1);
+	g_return_val_if_fail(str != NULL || len == 0, -1);
+
+	value = state->value;
+	count = state->count;
+
+	while (in < end) {
+		gint8 sextet;
+
+		/* Decode whole quantums at once while the input is clean */
+		if (count == 0 && !state->padding) {
+			while (end - in >= 4) {
+				gint8 a = base64_values[in[0]];
+				gint8 b = base64_values[in[1]];
+				gint8 c = base64_values[in[2]];
+				gint8 d = base64_values[in[3]];
+
+				if ((a | b | c | d) < 0)
+					break;
+
+				value = (a << 18) | (b << 12) | (c << 6) | d;
+				out[0] = value >> 16;
+				out[1] = (value >> 8) & 0xff;
+				out[2] = value & 0xff;
+				out += 3;
+				in += 4;
+			}
+			value = 0;
+
+			if (in == end)
+				break;
+		}
+
+		sextet = base64_values[*in];
+		if (sextet >= 0) {
+			/* Nothing but padding may follow padding */
+			if (state->padding)
+				return -1;
+
+			value = (value << 6) | sextet;
+			if (++count == 4) {
+				out[0] = value >> 16;
+				out[1] = (value >> 8) & 0xff;
+				out[2] = value & 0xff;
+				out += 3;
+				value = 0;
+				count = 0;
+			}
+		} else if (*in == '=') {
+			if (!state->padding) {
+				/* Flush the bytes completed by the last quantum */
+				if (count == 2) {
+					*out++ = (value >> 4) & 0xff;
+				} else if (count == 3) {
+					*out++ = (value >> 10) & 0xff;
+					*out++ = (value >> 2) & 0xff;
+				} else {
+					return -1;
+				}
+				state->padding = TRUE;
+				value = 0;
+				count = 0;
+			}
+		} else if (!g_ascii_isspace(*in)) {
+			return -1;
+		}
+
+		in++;
+	}
+
+	state->value = value;
+	state->count = count;
+
+	return out - start;
+}
+
+gssize
+purple_base64_decode_close(PurpleBase64DecodeState *state, guchar *out)
+{
+	gssize written = 0;
+
+	g_return_val_if_fail(state != NULL, -1);
+
+	/* Allow the padding to be left off the final quantum */
+	if (state->count == 1) {
+		written = -1;
+	} else if (state->count == 2) {
+		out[0] = (state->value >> 4) & 0xff;
+		written = 1;
+	} else if (state->count == 3) {
+		out[0] = (state->value >> 10) & 0xff;
+		out[1] = (state->value >> 2) & 0xff;
+		written = 2;
+	}
+
+	state->value = 0;
+	state->count = 0;
+	state->padding = FALSE;
+
+	return written;
+}
+
 /**************************************************************************
  * Quoted Printable Functions (see RFC 2045).
  **************************************************************************/
@@ -1652,7 +1869,8 @@ purple_markup_html_to_xhtml(const char *html, char **xhtml_out,
 							xhtml = g_string_append(xhtml, alt->str);
 						g_string_free(alt, TRUE);
 					}
-					g_string_free(src, TRUE);
+					if (src)
+						g_string_free(src, TRUE);
 					continue;
 				}
 				if (!g_ascii_strncasecmp(c, "<a", 2) && (*(c+2) == '>' || *(c+2) == ' ')) {
@@ -1864,6 +2082,7 @@ purple_markup_html_to_xhtml(const char *html, char **xhtml_out,
 				g_string_append_printf(xhtml, "</%s>", pt->dest_tag);
 		}
 	}
+	g_list_foreach(tags, (GFunc)g_free, NULL);
 	g_list_free(tags);
 	if(xhtml_out)
 		*xhtml_out = g_string_free(xhtml, FALSE);
@@ -2141,12 +2360,148 @@ process_link(GString *ret,
 	return c;
 }
 
-char *
-purple_markup_linkify(const char *text)
+/*
+ * Tries to match a link starting at c, which points into the text run
+ * starting at text.  If one is found, it is appended to ret as an anchor
+ * and a pointer past it is returned; otherwise c is returned unchanged.
+ */
+static const char *
+linkify_at(GString *ret, const char *text, const char *c, int inside_paren)
 {
-	const char *c, *t, *q = NULL;
+	const char *t;
 	char *tmpurlbuf, *url_buf;
 	gunichar g;
+
+	/* Most characters can't start a link; don't try every prefix on them. */
+	switch (g_ascii_tolower(*c)) {
+	case 'h': case 'f': case 's': case 'w': case 'x': case 'm': case '@':
+		break;
+	default:
+		return c;
+	}
+
+	if (!g_ascii_strncasecmp(c, "http://", 7)) {
+		c = process_link(ret, text, c, 7, "", inside_paren);
+	} else if (!g_ascii_strncasecmp(c, "https://", 8)) {
+		c = process_link(ret, text, c, 8, "", inside_paren);
+	} else if (!g_ascii_strncasecmp(c, "ftp://", 6)) {
+		c = process_link(ret, text, c, 6, "", inside_paren);
+	} else if (!g_ascii_strncasecmp(c, "sftp://", 7)) {
+		c = process_link(ret, text, c, 7, "", inside_paren);
+	} else if (!g_ascii_strncasecmp(c, "file://", 7)) {
+		c = process_link(ret, text, c, 7, "", inside_paren);
+	} else if (!g_ascii_strncasecmp(c, "www.", 4) && c[4] != '.' && (c == text || badchar(c[-1]) || badentity(c-1))) {
+		c = process_link(ret, text, c, 4, "http://", inside_paren);
+	} else if (!g_ascii_strncasecmp(c, "ftp.", 4) && c[4] != '.' && (c == text || badchar(c[-1]) || badentity(c-1))) {
+		c = process_link(ret, text, c, 4, "ftp://", inside_paren);
+	} else if (!g_ascii_strncasecmp(c, "xmpp:", 5) && (c == text || badchar(c[-1]) || badentity(c-1))) {
+		c = process_link(ret, text, c, 5, "", inside_paren);
+	} else if (!g_ascii_strncasecmp(c, "mailto:", 7)) {
+		t = c;
+		while (1) {
+			if (badchar(*t) || badentity(t)) {
+				char *d;
+				if (t - c == 7) {
+					break;
+				}
+				if (t > text && *(t - 1) == '.')
+					t--;
+				if ((d = strstr(c + 7, "?")) != NULL && d < t)
+					url_buf = g_strndup(c + 7, d - c - 7);
+				else
+					url_buf = g_strndup(c + 7, t - c - 7);
+				if (!purple_email_is_valid(url_buf)) {
+					g_free(url_buf);
+					break;
+				}
+				g_free(url_buf);
+				url_buf = g_strndup(c, t - c);
+				tmpurlbuf = purple_unescape_html(url_buf);
+				g_string_append_printf(ret, "<A HREF=\"%s\">%s</A>",
+						  tmpurlbuf, url_buf);
+				g_free(url_buf);
+				g_free(tmpurlbuf);
+				c = t;
+				break;
+			}
+			t++;
+		}
+	} else if (c != text && (*c == '@')) {
+		int flag;
+		GString *gurl_buf = NULL;
+		const char illegal_chars[] = "!@#$%^&*()[]{}/|\\<>\":;\r\n \0";
+
+		if (strchr(illegal_chars,*(c - 1)) || strchr(illegal_chars, *(c + 1)))
+			flag = 0;
+		else {
+			flag = 1;
+			gurl_buf = g_string_new("");
+		}
+
+		t = c;
+		while (flag) {
+			/* iterate backwards grabbing the local part of an email address */
+			g = g_utf8_get_char(t);
+			if (badchar(*t) || (g >= 127) || (*t == '(') ||
+				((*t == ';') && ((t > (text+2) && (!g_ascii_strncasecmp(t - 3, "&lt;", 4) ||
+			                                       !g_ascii_strncasecmp(t - 3, "&gt;", 4))) ||
+			                     (t > (text+4) && (!g_ascii_strncasecmp(t - 5, "&quot;", 6)))))) {
+				/* local part will already be part of ret, strip it out */
+				ret = g_string_truncate(ret, ret->len - (c - t));
+				ret = g_string_append_unichar(ret, g);
+				break;
+			} else {
+				g_string_prepend_unichar(gurl_buf, g);
+				t = g_utf8_find_prev_char(text, t);
+				if (t < text) {
+					ret = g_string_assign(ret, "");
+					break;
+				}
+			}
+		}
+
+		t = g_utf8_find_next_char(c, NULL);
+
+		while (flag) {
+			/* iterate forwards grabbing the domain part of an email address */
+			g = g_utf8_get_char(t);
+			if (badchar(*t) || (g >= 127) || (*t == ')') || badentity(t)) {
+				char *d;
+
+				url_buf = g_string_free(gurl_buf, FALSE);
+
+				/* strip off trailing periods */
+				if (strlen(url_buf) > 0) {
+					for (d = url_buf + strlen(url_buf) - 1; *d == '.'; d--, t--)
+						*d = '\0';
+				}
+
+				tmpurlbuf = purple_unescape_html(url_buf);
+				if (purple_email_is_valid(tmpurlbuf)) {
+					g_string_append_printf(ret, "<A HREF=\"mailto:%s\">%s</A>",
+							tmpurlbuf, url_buf);
+				} else {
+					g_string_append(ret, url_buf);
+				}
+				g_free(url_buf);
+				g_free(tmpurlbuf);
+				c = t;
+
+				break;
+			} else {
+				g_string_append_unichar(gurl_buf, g);
+				t = g_utf8_find_next_char(t, NULL);
+			}
+		}
+	}
+
+	return c;
+}
+
+char *
+purple_markup_linkify(const char *text)
+{
+	const char *c, *q = NULL;
 	gboolean inside_html = FALSE;
 	int inside_paren = 0;
 	GString *ret;
@@ -2188,119 +2543,8 @@ purple_markup_linkify(const char *text)
 						break;
 				}
 			}
-		} else if (!g_ascii_strncasecmp(c, "http://", 7)) {
-			c = process_link(ret, text, c, 7, "", inside_paren);
-		} else if (!g_ascii_strncasecmp(c, "https://", 8)) {
-			c = process_link(ret, text, c, 8, "", inside_paren);
-		} else if (!g_ascii_strncasecmp(c, "ftp://", 6)) {
-			c = process_link(ret, text, c, 6, "", inside_paren);
-		} else if (!g_ascii_strncasecmp(c, "sftp://", 7)) {
-			c = process_link(ret, text, c, 7, "", inside_paren);
-		} else if (!g_ascii_strncasecmp(c, "file://", 7)) {
-			c = process_link(ret, text, c, 7, "", inside_paren);
-		} else if (!g_ascii_strncasecmp(c, "www.", 4) && c[4] != '.' && (c == text || badchar(c[-1]) || badentity(c-1))) {
-			c = process_link(ret, text, c, 4, "http://", inside_paren);
-		} else if (!g_ascii_strncasecmp(c, "ftp.", 4) && c[4] != '.' && (c == text || badchar(c[-1]) || badentity(c-1))) {
-			c = process_link(ret, text, c, 4, "ftp://", inside_paren);
-		} else if (!g_ascii_strncasecmp(c, "xmpp:", 5) && (c == text || badchar(c[-1]) || badentity(c-1))) {
-			c = process_link(ret, text, c, 5, "", inside_paren);
-		} else if (!g_ascii_strncasecmp(c, "mailto:", 7)) {
-			t = c;
-			while (1) {
-				if (badchar(*t) || badentity(t)) {
-					char *d;
-					if (t - c == 7) {
-						break;
-					}
-					if (t > text && *(t - 1) == '.')
-						t--;
-					if ((d = strstr(c + 7, "?")) != NULL && d < t)
-						url_buf = g_strndup(c + 7, d - c - 7);
-					else
-						url_buf = g_strndup(c + 7, t - c - 7);
-					if (!purple_email_is_valid(url_buf)) {
-						g_free(url_buf);
-						break;
-					}
-					g_free(url_buf);
-					url_buf = g_strndup(c, t - c);
-					tmpurlbuf = purple_unescape_html(url_buf);
-					g_string_append_printf(ret, "<A HREF=\"%s\">%s</A>",
-							  tmpurlbuf, url_buf);
-					g_free(url_buf);
-					g_free(tmpurlbuf);
-					c = t;
-					break;
-				}
-				t++;
-			}
-		} else if (c != text && (*c == '@')) {
-			int flag;
-			GString *gurl_buf = NULL;
-			const char illegal_chars[] = "!@#$%^&*()[]{}/|\\<>\":;\r\n \0";
-
-			if (strchr(illegal_chars,*(c - 1)) || strchr(illegal_chars, *(c + 1)))
-				flag = 0;
-			else {
-				flag = 1;
-				gurl_buf = g_string_new("");
-			}
-
-			t = c;
-			while (flag) {
-				/* iterate backwards grabbing the local part of an email address */
-				g = g_utf8_get_char(t);
-				if (badchar(*t) || (g >= 127) || (*t == '(') ||
-					((*t == ';') && ((t > (text+2) && (!g_ascii_strncasecmp(t - 3, "&lt;", 4) ||
-				                                       !g_ascii_strncasecmp(t - 3, "&gt;", 4))) ||
-				                     (t > (text+4) && (!g_ascii_strncasecmp(t - 5, "&quot;", 6)))))) {
-					/* local part will already be part of ret, strip it out */
-					ret = g_string_truncate(ret, ret->len - (c - t));
-					ret = g_string_append_unichar(ret, g);
-					break;
-				} else {
-					g_string_prepend_unichar(gurl_buf, g);
-					t = g_utf8_find_prev_char(text, t);
-					if (t < text) {
-						ret = g_string_assign(ret, "");
-						break;
-					}
-				}
-			}
-
-			t = g_utf8_find_next_char(c, NULL);
-
-			while (flag) {
-				/* iterate forwards grabbing the domain part of an email address */
-				g = g_utf8_get_char(t);
-				if (badchar(*t) || (g >= 127) || (*t == ')') || badentity(t)) {
-					char *d;
-
-					url_buf = g_string_free(gurl_buf, FALSE);
-
-					/* strip off trailing periods */
-					if (strlen(url_buf) > 0) {
-						for (d = url_buf + strlen(url_buf) - 1; *d == '.'; d--, t--)
-							*d = '\0';
-					}
-
-					tmpurlbuf = purple_unescape_html(url_buf);
-					if (purple_email_is_valid(tmpurlbuf)) {
-						g_string_append_printf(ret, "<A HREF=\"mailto:%s\">%s</A>",
-								tmpurlbuf, url_buf);
-					} else {
-						g_string_append(ret, url_buf);
-					}
-					g_free(url_buf);
-					g_free(tmpurlbuf);
-					c = t;
-
-					break;
-				} else {
-					g_string_append_unichar(gurl_buf, g);
-					t = g_utf8_find_next_char(t, NULL);
-				}
-			}
+		} else {
+			c = linkify_at(ret, text, c, inside_paren);
 		}
 
 		if(*c == ')' && !inside_html) {
@@ -2496,147 +2740,1178 @@ purple_markup_get_tag_name(const char *tag)
 }
 
 /**************************************************************************
- * Path/Filename Functions
+ * Markup Tokenizer and Filters
  **************************************************************************/
-const char *
-purple_home_dir(void)
-{
-#ifndef _WIN32
-	return g_get_home_dir();
-#else
-	return wpurple_data_dir();
-#endif
-}
-
-/* Returns the argument passed to -c IFF it was present, or ~/.purple. */
-const char *
-purple_user_dir(void)
-{
-	if (custom_user_dir != NULL)
-		return custom_user_dir;
-	else if (!user_dir)
-		user_dir = g_build_filename(purple_home_dir(), ".purple", NULL);
-
-	return user_dir;
-}
 
-void purple_util_set_user_dir(const char *dir)
+struct _PurpleMarkupFilter
 {
-	g_free(custom_user_dir);
-
-	if (dir != NULL && *dir)
-		custom_user_dir = g_strdup(dir);
-	else
-		custom_user_dir = NULL;
-}
+	void (*token)(PurpleMarkupFilter *filter, const PurpleMarkupToken *token);
+	void (*finish)(PurpleMarkupFilter *filter);
+	void (*destroy)(PurpleMarkupFilter *filter);
+	PurpleMarkupFilter *next;
+};
 
-int purple_build_dir (const char *path, int mode)
-{
-	return g_mkdir_with_parents(path, mode);
-}
+#define markup_comment_start(c) \
+	((c)[0] == '<' && (c)[1] == '!' && (c)[2] == '-' && (c)[3] == '-')
 
 /*
- * This function is long and beautiful, like my--um, yeah.  Anyway,
- * it includes lots of error checking so as we don't overwrite
- * people's settings if there is a problem writing the new values.
+ * If c (which points to a '<') starts a tag or a comment, returns a
+ * pointer to the '>' that ends it.  A '<' is never allowed inside a tag,
+ * which keeps scanning a run of stray '<'s linear.
  */
-gboolean
-purple_util_write_data_to_file(const char *filename, const char *data, gssize size)
+static const char *
+markup_tag_end(const char *c)
 {
-	const char *user_dir = purple_user_dir();
-	gchar *filename_full;
-	gboolean ret = FALSE;
+	const char *p;
+	char quote = '\0';
 
-	g_return_val_if_fail(user_dir != NULL, FALSE);
+	if (markup_comment_start(c)) {
+		p = strstr(c + 4, "-->");
+		return p ? p + 2 : NULL;
+	}
 
-	purple_debug_info("util", "Writing file %s to directory %s\n",
-					filename, user_dir);
+	if (!g_ascii_isalpha(c[1]) && !(c[1] == '/' && g_ascii_isalpha(c[2])) &&
+			c[1] != '!' && c[1] != '?')
+		return NULL;
 
-	/* Ensure the user directory exists */
-	if (!g_file_test(user_dir, G_FILE_TEST_IS_DIR))
-	{
-		if (g_mkdir(user_dir, S_IRUSR | S_IWUSR | S_IXUSR) == -1)
-		{
-			purple_debug_error("util", "Error creating directory %s: %s\n",
-							 user_dir, g_strerror(errno));
-			return FALSE;
+	for (p = c + 1; *p && *p != '<'; p++) {
+		if (quote) {
+			if (*p == quote)
+				quote = '\0';
+		} else if (*p == '"' || *p == '\'') {
+			quote = *p;
+		} else if (*p == '>') {
+			return p;
 		}
 	}
 
-	filename_full = g_strdup_printf("%s" G_DIR_SEPARATOR_S "%s", user_dir, filename);
-
-	ret = purple_util_write_data_to_file_absolute(filename_full, data, size);
+	/* An unbalanced quote, as in <font face=Joe's>; ignore quoting. */
+	if (quote) {
+		for (p = c + 1; *p && *p != '<'; p++)
+			if (*p == '>')
+				return p;
+	}
 
-	g_free(filename_full);
-	return ret;
+	return NULL;
 }
 
 gboolean
-purple_util_write_data_to_file_absolute(const char *filename_full, const char *data, gssize size)
+purple_markup_next_token(const char **markup, PurpleMarkupToken *token)
 {
-	gchar *filename_temp;
-	FILE *file;
-	size_t real_size, byteswritten;
-	struct stat st;
-#ifndef HAVE_FILENO
-	int fd;
-#endif
+	const char *c, *end;
 
-	purple_debug_info("util", "Writing file %s\n",
-					filename_full);
+	g_return_val_if_fail(markup != NULL, FALSE);
+	g_return_val_if_fail(token != NULL, FALSE);
 
-	g_return_val_if_fail((size >= -1), FALSE);
+	c = *markup;
+	if (c == NULL || *c == '\0')
+		return FALSE;
 
-	filename_temp = g_strdup_printf("%s.save", filename_full);
+	memset(token, 0, sizeof(PurpleMarkupToken));
+	token->start = c;
 
-	/* Remove an old temporary file, if one exists */
-	if (g_file_test(filename_temp, G_FILE_TEST_EXISTS))
-	{
-		if (g_unlink(filename_temp) == -1)
-		{
-			purple_debug_error("util", "Error removing old file "
-					   "%s: %s\n",
-					   filename_temp, g_strerror(errno));
+	if (*c == '<' && (end = markup_tag_end(c)) != NULL) {
+		token->len = end + 1 - c;
+		if (markup_comment_start(c)) {
+			token->type = PURPLE_MARKUP_TOKEN_COMMENT;
+		} else {
+			const char *p = c + 1;
+
+			token->type = PURPLE_MARKUP_TOKEN_TAG;
+			if (*p == '/') {
+				token->closing = TRUE;
+				p++;
+			}
+			token->name = p;
+			while (p < end && *p != '/' && !g_ascii_isspace(*p))
+				p++;
+			token->name_len = p - token->name;
+			token->empty = !token->closing && end[-1] == '/';
 		}
-	}
+	} else if (markup_comment_start(c)) {
+		/* An unterminated comment, and everything after it, is text.  Any
+		 * later comment can't be terminated either, so don't look for one
+		 * again on every '<'. */
+		token->type = PURPLE_MARKUP_TOKEN_TEXT;
+		token->len = strlen(c);
+	} else {
+		const char *p;
 
-	/* Open file */
-	file = g_fopen(filename_temp, "wb");
-	if (file == NULL)
-	{
-		purple_debug_error("util", "Error opening file %s for "
-				   "writing: %s\n",
-				   filename_temp, g_strerror(errno));
-		g_free(filename_temp);
-		return FALSE;
+		token->type = PURPLE_MARKUP_TOKEN_TEXT;
+		for (p = c + 1; *p; p++) {
+			if (*p != '<')
+				continue;
+			if (markup_tag_end(p) != NULL)
+				break;
+			if (markup_comment_start(p)) {
+				p += strlen(p);
+				break;
+			}
+		}
+		token->len = p - c;
 	}
 
-	/* Write to file */
-	real_size = (size == -1) ? strlen(data) : (size_t) size;
-	byteswritten = fwrite(data, 1, real_size, file);
+	*markup = c + token->len;
+	return TRUE;
+}
 
-#ifdef HAVE_FILENO
-#ifndef _WIN32
-	/* Set file permissions */
-	if (fchmod(fileno(file), S_IRUSR | S_IWUSR) == -1) {
-		purple_debug_error("util", "Error setting permissions of "
-			"file %s: %s\n", filename_temp, g_strerror(errno));
-	}
-#endif
+static gboolean
+markup_token_is(const PurpleMarkupToken *token, const char *name)
+{
+	return token->type == PURPLE_MARKUP_TOKEN_TAG &&
+		token->name_len == strlen(name) &&
+		g_ascii_strncasecmp(token->name, name, token->name_len) == 0;
+}
 
-	/* Apparently XFS (and possibly other filesystems) do not
-	 * guarantee that file data is flushed before file metadata,
-	 * so this procedure is insufficient without some flushage. */
-	if (fflush(file) < 0) {
-		purple_debug_error("util", "Error flushing %s: %s\n",
-				   filename_temp, g_strerror(errno));
-		g_free(filename_temp);
-		fclose(file);
+/*
+ * Returns the start of a tag token's attributes, and in *end the end of
+ * them (the closing '>' or "/>").
+ */
+static const char *
+markup_token_attributes(const PurpleMarkupToken *token, const char **end)
+{
+	*end = token->start + token->len - (token->empty ? 2 : 1);
+	return token->name + token->name_len;
+}
+
+/*
+ * Reads the next name=value attribute of a tag, starting at *p and ending
+ * at end.  Returns FALSE when there are none left.
+ */
+static gboolean
+markup_next_attribute(const char **p, const char *end,
+		const char **name, gsize *name_len, char **value)
+{
+	const char *c = *p;
+
+	while (c < end) {
+		const char *v;
+		char quote = '\0';
+
+		while (c < end && g_ascii_isspace(*c))
+			c++;
+		*name = c;
+		while (c < end && *c != '=' && !g_ascii_isspace(*c))
+			c++;
+		*name_len = c - *name;
+		if (c >= end || *c != '=') {
+			c++;
+			continue;
+		}
+
+		v = ++c;
+		if (c < end && (*c == '"' || *c == '\'')) {
+			quote = *c;
+			v = ++c;
+			while (c < end && *c != quote)
+				c++;
+		} else {
+			while (c < end && !g_ascii_isspace(*c))
+				c++;
+		}
+		*value = g_strndup(v, c - v);
+		*p = (quote && c < end) ? c + 1 : c;
+		return TRUE;
+	}
+
+	*p = c;
+	return FALSE;
+}
+
+/* Returns the raw value of a tag token's attribute, or NULL. */
+static char *
+markup_token_get_attribute(const PurpleMarkupToken *token, const char *attr)
+{
+	const char *p, *end, *name;
+	gsize name_len, attr_len = strlen(attr);
+	char *value;
+
+	p = markup_token_attributes(token, &end);
+	while (markup_next_attribute(&p, end, &name, &name_len, &value)) {
+		if (name_len == attr_len && g_ascii_strncasecmp(name, attr, attr_len) == 0)
+			return value;
+		g_free(value);
+	}
+
+	return NULL;
+}
+
+static void
+filter_emit(PurpleMarkupFilter *filter, const PurpleMarkupToken *token)
+{
+	if (filter->next != NULL)
+		filter->next->token(filter->next, token);
+}
+
+static void
+filter_emit_text(PurpleMarkupFilter *filter, const char *text, gssize len)
+{
+	PurpleMarkupToken token;
+
+	if (len < 0)
+		len = strlen(text);
+	if (len == 0)
+		return;
+
+	memset(&token, 0, sizeof(PurpleMarkupToken));
+	token.type = PURPLE_MARKUP_TOKEN_TEXT;
+	token.start = text;
+	token.len = len;
+	filter_emit(filter, &token);
+}
+
+/* Tokenizes markup a filter generated and passes it on. */
+static void
+filter_emit_markup(PurpleMarkupFilter *filter, const char *markup)
+{
+	PurpleMarkupToken token;
+
+	while (purple_markup_next_token(&markup, &token))
+		filter_emit(filter, &token);
+}
+
+static PurpleMarkupFilter *
+filter_new(gsize size, PurpleMarkupFilter *next,
+		void (*token)(PurpleMarkupFilter *, const PurpleMarkupToken *),
+		void (*finish)(PurpleMarkupFilter *),
+		void (*destroy)(PurpleMarkupFilter *))
+{
+	PurpleMarkupFilter *filter = g_malloc0(size);
+
+	filter->token = token;
+	filter->finish = finish;
+	filter->destroy = destroy;
+	filter->next = next;
+
+	return filter;
+}
+
+void
+purple_markup_filter_push(PurpleMarkupFilter *filter, const PurpleMarkupToken *token)
+{
+	g_return_if_fail(filter != NULL);
+	g_return_if_fail(token != NULL);
+
+	filter->token(filter, token);
+}
+
+void
+purple_markup_filter_feed(PurpleMarkupFilter *filter, const char *markup)
+{
+	PurpleMarkupToken token;
+
+	g_return_if_fail(filter != NULL);
+
+	while (purple_markup_next_token(&markup, &token))
+		filter->token(filter, &token);
+}
+
+void
+purple_markup_filter_finish(PurpleMarkupFilter *filter)
+{
+	g_return_if_fail(filter != NULL);
+
+	if (filter->finish != NULL)
+		filter->finish(filter);
+	if (filter->next != NULL)
+		purple_markup_filter_finish(filter->next);
+}
+
+void
+purple_markup_filter_free(PurpleMarkupFilter *filter)
+{
+	while (filter != NULL) {
+		PurpleMarkupFilter *next = filter->next;
+
+		if (filter->destroy != NULL)
+			filter->destroy(filter);
+		g_free(filter);
+		filter = next;
+	}
+}
+
+/* String sink */
+
+typedef struct
+{
+	PurpleMarkupFilter filter;
+	GString *out;
+} MarkupStringFilter;
+
+static void
+string_filter_token(PurpleMarkupFilter *filter, const PurpleMarkupToken *token)
+{
+	g_string_append_len(((MarkupStringFilter *)filter)->out, token->start, token->len);
+}
+
+PurpleMarkupFilter *
+purple_markup_filter_string_new(GString *out)
+{
+	MarkupStringFilter *sf;
+
+	g_return_val_if_fail(out != NULL, NULL);
+
+	sf = (MarkupStringFilter *)filter_new(sizeof(MarkupStringFilter), NULL,
+			string_filter_token, NULL, NULL);
+	sf->out = out;
+
+	return &sf->filter;
+}
+
+/* Tee */
+
+typedef struct
+{
+	PurpleMarkupFilter filter;
+	PurpleMarkupFilter *second;
+} MarkupTeeFilter;
+
+static void
+tee_filter_token(PurpleMarkupFilter *filter, const PurpleMarkupToken *token)
+{
+	filter_emit(filter, token);
+	((MarkupTeeFilter *)filter)->second->token(((MarkupTeeFilter *)filter)->second, token);
+}
+
+static void
+tee_filter_finish(PurpleMarkupFilter *filter)
+{
+	purple_markup_filter_finish(((MarkupTeeFilter *)filter)->second);
+}
+
+static void
+tee_filter_destroy(PurpleMarkupFilter *filter)
+{
+	purple_markup_filter_free(((MarkupTeeFilter *)filter)->second);
+}
+
+PurpleMarkupFilter *
+purple_markup_filter_tee_new(PurpleMarkupFilter *first, PurpleMarkupFilter *second)
+{
+	MarkupTeeFilter *tf;
+
+	g_return_val_if_fail(first != NULL, NULL);
+	g_return_val_if_fail(second != NULL, NULL);
+
+	tf = (MarkupTeeFilter *)filter_new(sizeof(MarkupTeeFilter), first,
+			tee_filter_token, tee_filter_finish, tee_filter_destroy);
+	tf->second = second;
+
+	return &tf->filter;
+}
+
+/* Escape */
+
+static void
+escape_filter_token(PurpleMarkupFilter *filter, const PurpleMarkupToken *token)
+{
+	char *escaped = g_markup_escape_text(token->start, token->len);
+
+	filter_emit_text(filter, escaped, -1);
+	g_free(escaped);
+}
+
+PurpleMarkupFilter *
+purple_markup_filter_escape_new(PurpleMarkupFilter *next)
+{
+	return filter_new(sizeof(PurpleMarkupFilter), next,
+			escape_filter_token, NULL, NULL);
+}
+
+/* Strip; this follows purple_markup_strip_html() */
+
+typedef struct
+{
+	PurpleMarkupFilter filter;
+	GString *buf;
+	gboolean visible;
+	gboolean closing_td;
+	gboolean started;
+	const char *cdata_close;
+	char *href;
+	GString *link_text;
+} MarkupStripFilter;
+
+static void
+strip_filter_append(MarkupStripFilter *sf, const char *text, gssize len)
+{
+	if (len < 0)
+		len = strlen(text);
+	if (len == 0)
+		return;
+
+	if (sf->link_text != NULL)
+		g_string_append_len(sf->link_text, text, len);
+	filter_emit_text(&sf->filter, text, len);
+	sf->started = TRUE;
+}
+
+static void
+strip_filter_tag(MarkupStripFilter *sf, const PurpleMarkupToken *token)
+{
+	if (sf->cdata_close != NULL) {
+		if (token->closing && markup_token_is(token, sf->cdata_close))
+			sf->cdata_close = NULL;
+		return;
+	}
+
+	if (markup_token_is(token, "td") && !token->closing && sf->closing_td) {
+		strip_filter_append(sf, "\t", 1);
+		sf->visible = TRUE;
+	} else if (markup_token_is(token, "td") && token->closing) {
+		sf->closing_td = TRUE;
+		sf->visible = FALSE;
+	} else {
+		sf->closing_td = FALSE;
+		sf->visible = TRUE;
+	}
+
+	if (token->closing) {
+		if (markup_token_is(token, "a") && sf->href != NULL) {
+			const char *text = sf->link_text->str;
+			const char *href = sf->href;
+
+			/* Only add the address if it differs from the link text. */
+			if (!purple_strequal(text, href) &&
+					!(g_str_has_prefix(href, "http://") && purple_strequal(text, href + 7))) {
+				char *tmp = g_strdup_printf(" (%s)", href);
+				g_string_free(sf->link_text, TRUE);
+				sf->link_text = NULL;
+				strip_filter_append(sf, tmp, -1);
+				g_free(tmp);
+			} else {
+				g_string_free(sf->link_text, TRUE);
+				sf->link_text = NULL;
+			}
+			g_free(sf->href);
+			sf->href = NULL;
+		} else if (markup_token_is(token, "table")) {
+			strip_filter_append(sf, "\n", 1);
+		}
+		return;
+	}
+
+	if (markup_token_is(token, "a")) {
+		char *href = markup_token_get_attribute(token, "href");
+		if (href != NULL) {
+			g_free(sf->href);
+			sf->href = purple_unescape_html(href);
+			g_free(href);
+			if (sf->link_text != NULL)
+				g_string_truncate(sf->link_text, 0);
+			else
+				sf->link_text = g_string_new(NULL);
+		}
+	} else if (markup_token_is(token, "br") ||
+			(sf->started && (markup_token_is(token, "p") ||
+			                 markup_token_is(token, "tr") ||
+			                 markup_token_is(token, "hr") ||
+			                 markup_token_is(token, "li") ||
+			                 markup_token_is(token, "div")))) {
+		strip_filter_append(sf, "\n", 1);
+	} else if (markup_token_is(token, "script")) {
+		sf->cdata_close = "script";
+	} else if (markup_token_is(token, "style")) {
+		sf->cdata_close = "style";
+	}
+}
+
+static void
+strip_filter_token(PurpleMarkupFilter *filter, const PurpleMarkupToken *token)
+{
+	MarkupStripFilter *sf = (MarkupStripFilter *)filter;
+	const char *c, *end;
+
+	if (token->type == PURPLE_MARKUP_TOKEN_TAG) {
+		strip_filter_tag(sf, token);
+		return;
+	}
+
+	if (token->type != PURPLE_MARKUP_TOKEN_TEXT || sf->cdata_close != NULL)
+		return;
+
+	g_string_truncate(sf->buf, 0);
+	for (c = token->start, end = c + token->len; c < end; c++) {
+		const char *ent;
+		int len;
+
+		if (!g_ascii_isspace(*c))
+			sf->visible = TRUE;
+
+		if (*c == '&' && (ent = purple_markup_unescape_entity(c, &len)) != NULL) {
+			g_string_append(sf->buf, ent);
+			c += len - 1;
+		} else if (sf->visible) {
+			g_string_append_c(sf->buf, g_ascii_isspace(*c) ? ' ' : *c);
+		}
+	}
+	strip_filter_append(sf, sf->buf->str, sf->buf->len);
+}
+
+static void
+strip_filter_destroy(PurpleMarkupFilter *filter)
+{
+	MarkupStripFilter *sf = (MarkupStripFilter *)filter;
+
+	g_string_free(sf->buf, TRUE);
+	if (sf->link_text != NULL)
+		g_string_free(sf->link_text, TRUE);
+	g_free(sf->href);
+}
+
+PurpleMarkupFilter *
+purple_markup_filter_strip_new(PurpleMarkupFilter *next)
+{
+	MarkupStripFilter *sf;
+
+	sf = (MarkupStripFilter *)filter_new(sizeof(MarkupStripFilter), next,
+			strip_filter_token, NULL, strip_filter_destroy);
+	sf->buf = g_string_new(NULL);
+	sf->visible = TRUE;
+
+	return &sf->filter;
+}
+
+/* Linkify; this follows purple_markup_linkify() */
+
+typedef struct
+{
+	PurpleMarkupFilter filter;
+	GString *text;
+	GString *buf;
+	gboolean inside_a;
+	int inside_paren;
+} MarkupLinkifyFilter;
+
+static void
+linkify_filter_token(PurpleMarkupFilter *filter, const PurpleMarkupToken *token)
+{
+	MarkupLinkifyFilter *lf = (MarkupLinkifyFilter *)filter;
+	const char *text, *c, *end;
+
+	if (token->type == PURPLE_MARKUP_TOKEN_TAG && markup_token_is(token, "a"))
+		lf->inside_a = !token->closing;
+
+	if (token->type != PURPLE_MARKUP_TOKEN_TEXT || lf->inside_a) {
+		filter_emit(filter, token);
+		return;
+	}
+
+	/*
+	 * The link matching runs until a NUL or a '<', and a pushed token
+	 * needn't be followed by either, so it works on a terminated copy.
+	 */
+	g_string_truncate(lf->text, 0);
+	g_string_append_len(lf->text, token->start, token->len);
+	text = lf->text->str;
+	end = text + lf->text->len;
+
+	g_string_truncate(lf->buf, 0);
+	c = text;
+	while (c < end) {
+		if (*c == '(') {
+			lf->inside_paren++;
+			g_string_append_c(lf->buf, *c);
+			c++;
+		}
+
+		c = linkify_at(lf->buf, text, c, lf->inside_paren);
+
+		if (*c == ')') {
+			lf->inside_paren--;
+			g_string_append_c(lf->buf, *c);
+			c++;
+		}
+
+		if (c >= end)
+			break;
+
+		g_string_append_c(lf->buf, *c);
+		c++;
+	}
+
+	if (strchr(lf->buf->str, '<') != NULL)
+		filter_emit_markup(filter, lf->buf->str);
+	else
+		filter_emit_text(filter, lf->buf->str, lf->buf->len);
+}
+
+static void
+linkify_filter_destroy(PurpleMarkupFilter *filter)
+{
+	MarkupLinkifyFilter *lf = (MarkupLinkifyFilter *)filter;
+
+	g_string_free(lf->text, TRUE);
+	g_string_free(lf->buf, TRUE);
+}
+
+PurpleMarkupFilter *
+purple_markup_filter_linkify_new(PurpleMarkupFilter *next)
+{
+	MarkupLinkifyFilter *lf;
+
+	lf = (MarkupLinkifyFilter *)filter_new(sizeof(MarkupLinkifyFilter), next,
+			linkify_filter_token, NULL, linkify_filter_destroy);
+	lf->text = g_string_new(NULL);
+	lf->buf = g_string_new(NULL);
+
+	return &lf->filter;
+}
+
+/* XHTML; this follows the XHTML output of purple_markup_html_to_xhtml() */
+
+typedef struct
+{
+	char *src;
+	const char *dest;
+	gboolean ignore;
+} MarkupXhtmlTag;
+
+typedef struct
+{
+	PurpleMarkupFilter filter;
+	GString *buf;
+	GList *tags;
+	gboolean started;
+} MarkupXhtmlFilter;
+
+static void
+xhtml_filter_push(MarkupXhtmlFilter *xf, const PurpleMarkupToken *token,
+		const char *dest, gboolean ignore)
+{
+	MarkupXhtmlTag *tag = g_new0(MarkupXhtmlTag, 1);
+
+	tag->src = g_ascii_strdown(token->name, token->name_len);
+	tag->dest = dest;
+	tag->ignore = ignore;
+	xf->tags = g_list_prepend(xf->tags, tag);
+}
+
+static void
+xhtml_filter_pop(MarkupXhtmlFilter *xf)
+{
+	MarkupXhtmlTag *tag = xf->tags->data;
+
+	if (!tag->ignore) {
+		g_string_printf(xf->buf, "</%s>", tag->dest);
+		filter_emit_markup(&xf->filter, xf->buf->str);
+	}
+	xf->tags = g_list_delete_link(xf->tags, xf->tags);
+	g_free(tag->src);
+	g_free(tag);
+}
+
+/* Copies a tag through, re-escaping quoted attribute values. */
+static void
+xhtml_filter_copy(MarkupXhtmlFilter *xf, const PurpleMarkupToken *token,
+		const char *dest)
+{
+	const char *p, *end = token->start + token->len - 1;
+
+	g_string_printf(xf->buf, "<%s", dest);
+	for (p = token->name + token->name_len; p < end; p++) {
+		if (*p == '"' || *p == '\'') {
+			const char *q = strchr(p + 1, *p);
+			char *unescaped, *escaped;
+
+			if (q == NULL || q > end)
+				q = end;
+			unescaped = g_strndup(p + 1, q - p - 1);
+			escaped = g_markup_escape_text(unescaped, -1);
+			g_string_append_printf(xf->buf, "%c%s%c", *p, escaped, *p);
+			g_free(unescaped);
+			g_free(escaped);
+			p = q;
+		} else {
+			g_string_append_c(xf->buf, *p);
+		}
+	}
+	g_string_append_c(xf->buf, '>');
+
+	if (!token->empty)
+		xhtml_filter_push(xf, token, dest, FALSE);
+	filter_emit_markup(&xf->filter, xf->buf->str);
+}
+
+static void
+xhtml_filter_span(MarkupXhtmlFilter *xf, const PurpleMarkupToken *token,
+		const char *style)
+{
+	g_string_printf(xf->buf, "<span style='%s'>", style);
+	xhtml_filter_push(xf, token, "span", FALSE);
+	filter_emit_markup(&xf->filter, xf->buf->str);
+}
+
+static const char *
+xhtml_font_size(const char *size)
+{
+	switch (atoi(size)) {
+	case 1:
+		return "xx-small";
+	case 2:
+		return "small";
+	case 4:
+		return "large";
+	case 5:
+		return "x-large";
+	case 6:
+	case 7:
+		return "xx-large";
+	default:
+		return "medium";
+	}
+}
+
+static void
+xhtml_filter_tag(MarkupXhtmlFilter *xf, const PurpleMarkupToken *token)
+{
+	static const char *allowed[] = {
+		"blockquote", "cite", "div", "em", "h1", "h2", "h3", "h4", "h5",
+		"h6", "li", "ol", "p", "pre", "q", "span", "ul", "body", NULL
+	};
+	char *value;
+	int i;
+
+	if (token->closing) {
+		GList *l;
+
+		for (l = xf->tags; l != NULL; l = l->next) {
+			MarkupXhtmlTag *tag = l->data;
+			if (markup_token_is(token, tag->src))
+				break;
+		}
+		/* Closing tags we weren't expecting are dropped. */
+		if (l != NULL) {
+			while (xf->tags != l)
+				xhtml_filter_pop(xf);
+			xhtml_filter_pop(xf);
+		}
+		return;
+	}
+
+	if (markup_token_is(token, "body") &&
+			(value = markup_token_get_attribute(token, "bgcolor")) != NULL) {
+		char *style = g_strdup_printf("background: %s;", g_strstrip(value));
+		xhtml_filter_span(xf, token, style);
+		g_free(style);
+		g_free(value);
+		return;
+	}
+
+	for (i = 0; allowed[i] != NULL; i++) {
+		if (markup_token_is(token, allowed[i])) {
+			xhtml_filter_copy(xf, token, allowed[i]);
+			return;
+		}
+	}
+
+	/* We only allow html to start the message. */
+	if (markup_token_is(token, "html") && !xf->started) {
+		xhtml_filter_copy(xf, token, "html");
+	} else if (markup_token_is(token, "i") || markup_token_is(token, "italic")) {
+		xhtml_filter_copy(xf, token, "em");
+	} else if (markup_token_is(token, "br") || markup_token_is(token, "hr")) {
+		/* <hr> isn't legal in XHTML-IM, so it becomes a line break. */
+		filter_emit_markup(&xf->filter, "<br/>");
+	} else if (markup_token_is(token, "b") || markup_token_is(token, "bold") ||
+			markup_token_is(token, "strong")) {
+		xhtml_filter_span(xf, token, "font-weight: bold;");
+	} else if (markup_token_is(token, "u") || markup_token_is(token, "underline")) {
+		xhtml_filter_span(xf, token, "text-decoration: underline;");
+	} else if (markup_token_is(token, "s") || markup_token_is(token, "strike")) {
+		xhtml_filter_span(xf, token, "text-decoration: line-through;");
+	} else if (markup_token_is(token, "sub")) {
+		xhtml_filter_span(xf, token, "vertical-align:sub;");
+	} else if (markup_token_is(token, "sup")) {
+		xhtml_filter_span(xf, token, "vertical-align:super;");
+	} else if (markup_token_is(token, "img")) {
+		char *src = markup_token_get_attribute(token, "src");
+		char *alt = markup_token_get_attribute(token, "alt");
+
+		/* src and alt are required! */
+		if (src != NULL) {
+			g_string_printf(xf->buf, "<img src='%s' alt='%s' />",
+					g_strstrip(src), alt ? alt : "");
+			filter_emit_markup(&xf->filter, xf->buf->str);
+		} else if (alt != NULL) {
+			filter_emit_text(&xf->filter, alt, -1);
+		}
+		g_free(src);
+		g_free(alt);
+	} else if (markup_token_is(token, "a")) {
+		char *href = markup_token_get_attribute(token, "href");
+		const char *c;
+
+		g_string_assign(xf->buf, "<a href=\"");
+		for (c = href; c != NULL && *c; c++) {
+			int len;
+			if (*c == '&' && purple_markup_unescape_entity(c, &len) == NULL)
+				g_string_append(xf->buf, "&amp;");
+			else
+				g_string_append_c(xf->buf, *c);
+		}
+		g_string_append(xf->buf, "\">");
+		g_free(href);
+
+		xhtml_filter_push(xf, token, "a", FALSE);
+		filter_emit_markup(&xf->filter, xf->buf->str);
+	} else if (markup_token_is(token, "font")) {
+		GString *style = g_string_new(NULL);
+		const char *p, *end, *name;
+		gsize name_len;
+
+		p = markup_token_attributes(token, &end);
+		while (markup_next_attribute(&p, end, &name, &name_len, &value)) {
+			if (name_len == 4 && !g_ascii_strncasecmp(name, "back", 4))
+				g_string_append_printf(style, "background: %s; ", value);
+			else if (name_len == 5 && !g_ascii_strncasecmp(name, "color", 5))
+				g_string_append_printf(style, "color: %s; ", value);
+			else if (name_len == 4 && !g_ascii_strncasecmp(name, "face", 4))
+				g_string_append_printf(style, "font-family: %s; ", g_strstrip(value));
+			else if (name_len == 4 && !g_ascii_strncasecmp(name, "size", 4))
+				g_string_append_printf(style, "font-size: %s; ", xhtml_font_size(value));
+			g_free(value);
+		}
+
+		if (style->len) {
+			xhtml_filter_span(xf, token, g_strstrip(style->str));
+		} else {
+			xhtml_filter_push(xf, token, "span", TRUE);
+		}
+		g_string_free(style, TRUE);
+	} else {
+		/* Anything else is shown as text. */
+		filter_emit_text(&xf->filter, "&lt;", 4);
+		filter_emit_text(&xf->filter, token->start + 1, token->len - 1);
+	}
+}
+
+static void
+xhtml_filter_token(PurpleMarkupFilter *filter, const PurpleMarkupToken *token)
+{
+	MarkupXhtmlFilter *xf = (MarkupXhtmlFilter *)filter;
+
+	if (token->type == PURPLE_MARKUP_TOKEN_TAG) {
+		xhtml_filter_tag(xf, token);
+	} else if (token->type == PURPLE_MARKUP_TOKEN_TEXT &&
+			memchr(token->start, '<', token->len) != NULL) {
+		/* A '<' that doesn't start a tag. */
+		const char *c;
+
+		g_string_truncate(xf->buf, 0);
+		for (c = token->start; c < token->start + token->len; c++) {
+			if (*c == '<')
+				g_string_append(xf->buf, "&lt;");
+			else
+				g_string_append_c(xf->buf, *c);
+		}
+		filter_emit_text(filter, xf->buf->str, xf->buf->len);
+	} else {
+		filter_emit(filter, token);
+	}
+
+	xf->started = TRUE;
+}
+
+static void
+xhtml_filter_finish(PurpleMarkupFilter *filter)
+{
+	MarkupXhtmlFilter *xf = (MarkupXhtmlFilter *)filter;
+
+	while (xf->tags != NULL)
+		xhtml_filter_pop(xf);
+}
+
+static void
+xhtml_filter_destroy(PurpleMarkupFilter *filter)
+{
+	MarkupXhtmlFilter *xf = (MarkupXhtmlFilter *)filter;
+
+	while (xf->tags != NULL) {
+		MarkupXhtmlTag *tag = xf->tags->data;
+		g_free(tag->src);
+		g_free(tag);
+		xf->tags = g_list_delete_link(xf->tags, xf->tags);
+	}
+	g_string_free(xf->buf, TRUE);
+}
+
+PurpleMarkupFilter *
+purple_markup_filter_xhtml_new(PurpleMarkupFilter *next)
+{
+	MarkupXhtmlFilter *xf;
+
+	xf = (MarkupXhtmlFilter *)filter_new(sizeof(MarkupXhtmlFilter), next,
+			xhtml_filter_token, xhtml_filter_finish, xhtml_filter_destroy);
+	xf->buf = g_string_new(NULL);
+
+	return &xf->filter;
+}
+
+/* Slice; this follows purple_markup_slice() */
+
+typedef struct
+{
+	PurpleMarkupFilter filter;
+	guint x, y, z;
+	gboolean reopened;
+	GQueue *tags;
+} MarkupSliceFilter;
+
+static void
+slice_filter_reopen(MarkupSliceFilter *sf)
+{
+	GList *l;
+
+	if (sf->reopened || sf->z != sf->x || sf->z == 0)
+		return;
+
+	/* Reopen the tags that were opened before the slice started. */
+	for (l = sf->tags->tail; l != NULL; l = l->prev)
+		filter_emit_markup(&sf->filter, l->data);
+	sf->reopened = TRUE;
+}
+
+static void
+slice_filter_token(PurpleMarkupFilter *filter, const PurpleMarkupToken *token)
+{
+	MarkupSliceFilter *sf = (MarkupSliceFilter *)filter;
+	const char *c, *start, *end;
+
+	/* An empty slice is empty, without any tags either. */
+	if (sf->x == sf->y || sf->z >= sf->y ||
+			token->type == PURPLE_MARKUP_TOKEN_COMMENT)
+		return;
+
+	if (token->type == PURPLE_MARKUP_TOKEN_TAG) {
+		if (markup_token_is(token, "img") && !token->closing) {
+			sf->z += strlen("[Image]");
+		} else if (markup_token_is(token, "br") && !token->closing) {
+			sf->z += 1;
+		} else if (markup_token_is(token, "hr") && !token->closing) {
+			sf->z += strlen("\n---\n");
+		} else if (token->closing) {
+			g_free(g_queue_pop_head(sf->tags));
+		} else if (!token->empty) {
+			g_queue_push_head(sf->tags, g_strndup(token->start, token->len));
+		}
+
+		if (sf->z >= sf->x)
+			filter_emit(filter, token);
+		return;
+	}
+
+	/* Emit the part of the text run that falls inside the slice. */
+	start = NULL;
+	end = token->start + token->len;
+	for (c = token->start; c < end && sf->z < sf->y; ) {
+		const char *next;
+		int len;
+
+		if (*c == '&' && purple_markup_unescape_entity(c, &len) != NULL)
+			next = c + len;
+		else
+			next = g_utf8_next_char(c);
+
+		if (start == NULL) {
+			slice_filter_reopen(sf);
+			if (sf->z >= sf->x)
+				start = c;
+		}
+		sf->z++;
+		c = next > end ? end : next;
+	}
+
+	if (start != NULL)
+		filter_emit_text(filter, start, c - start);
+}
+
+static void
+slice_filter_finish(PurpleMarkupFilter *filter)
+{
+	MarkupSliceFilter *sf = (MarkupSliceFilter *)filter;
+	char *tag;
+
+	if (sf->x == sf->y)
+		return;
+
+	while ((tag = g_queue_pop_head(sf->tags)) != NULL) {
+		char *name = purple_markup_get_tag_name(tag);
+		char *close = g_strdup_printf("</%s>", name);
+
+		filter_emit_markup(filter, close);
+		g_free(close);
+		g_free(name);
+		g_free(tag);
+	}
+}
+
+static void
+slice_filter_destroy(PurpleMarkupFilter *filter)
+{
+	MarkupSliceFilter *sf = (MarkupSliceFilter *)filter;
+	char *tag;
+
+	while ((tag = g_queue_pop_head(sf->tags)) != NULL)
+		g_free(tag);
+	g_queue_free(sf->tags);
+}
+
+PurpleMarkupFilter *
+purple_markup_filter_slice_new(PurpleMarkupFilter *next, guint x, guint y)
+{
+	MarkupSliceFilter *sf;
+
+	g_return_val_if_fail(x <= y, NULL);
+
+	sf = (MarkupSliceFilter *)filter_new(sizeof(MarkupSliceFilter), next,
+			slice_filter_token, slice_filter_finish, slice_filter_destroy);
+	sf->x = x;
+	sf->y = y;
+	sf->tags = g_queue_new();
+
+	return &sf->filter;
+}
+
+/**************************************************************************
+ * Path/Filename Functions
+ **************************************************************************/
+const char *
+purple_home_dir(void)
+{
+#ifndef _WIN32
+	return g_get_home_dir();
+#else
+	return wpurple_data_dir();
+#endif
+}
+
+/* Returns the argument passed to -c IFF it was present, or ~/.purple. */
+const char *
+purple_user_dir(void)
+{
+	if (custom_user_dir != NULL)
+		return custom_user_dir;
+	else if (!user_dir)
+		user_dir = g_build_filename(purple_home_dir(), ".purple", NULL);
+
+	return user_dir;
+}
+
+void purple_util_set_user_dir(const char *dir)
+{
+	g_free(custom_user_dir);
+
+	if (dir != NULL && *dir)
+		custom_user_dir = g_strdup(dir);
+	else
+		custom_user_dir = NULL;
+}
+
+int purple_build_dir (const char *path, int mode)
+{
+	return g_mkdir_with_parents(path, mode);
+}
+
+/*
+ * This function is long and beautiful, like my--um, yeah.  Anyway,
+ * it includes lots of error checking so as we don't overwrite
+ * people's settings if there is a problem writing the new values.
+ */
+gboolean
+purple_util_write_data_to_file(const char *filename, const char *data, gssize size)
+{
+	const char *user_dir = purple_user_dir();
+	gchar *filename_full;
+	gboolean ret = FALSE;
+
+	g_return_val_if_fail(user_dir != NULL, FALSE);
+
+	purple_debug_info("util", "Writing file %s to directory %s\n",
+					filename, user_dir);
+
+	/* Ensure the user directory exists */
+	if (!g_file_test(user_dir, G_FILE_TEST_IS_DIR))
+	{
+		if (g_mkdir(user_dir, S_IRUSR | S_IWUSR | S_IXUSR) == -1)
+		{
+			purple_debug_error("util", "Error creating directory %s: %s\n",
+							 user_dir, g_strerror(errno));
+			return FALSE;
+		}
+	}
+
+	filename_full = g_strdup_printf("%s" G_DIR_SEPARATOR_S "%s", user_dir, filename);
+
+	ret = purple_util_write_data_to_file_absolute(filename_full, data, size);
+
+	g_free(filename_full);
+	return ret;
+}
+
+/* Sets error from errno, with a message naming the file. */
+static void
+write_file_set_error(GError **error, const char *format, const char *filename)
+{
+	int err = errno;
+
+	g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+			format, filename, g_strerror(err));
+}
+
+gboolean
+_purple_util_write_file(const char *filename_full, const char *data,
+                        gssize size, GError **error)
+{
+	gchar *filename_temp;
+	FILE *file;
+	size_t real_size, byteswritten;
+	struct stat st;
+#ifndef HAVE_FILENO
+	int fd;
+#endif
+
+	g_return_val_if_fail((size >= -1), FALSE);
+
+	filename_temp = g_strdup_printf("%s.save", filename_full);
+
+	/* Remove an old temporary file, if one exists.  If this fails, opening
+	 * the file will fail too, so that's where the error is reported. */
+	if (g_file_test(filename_temp, G_FILE_TEST_EXISTS))
+		g_unlink(filename_temp);
+
+	/* Open file */
+	file = g_fopen(filename_temp, "wb");
+	if (file == NULL)
+	{
+		write_file_set_error(error, "Error opening file %s for writing: %s",
+				filename_temp);
+		g_free(filename_temp);
+		return FALSE;
+	}
+
+	/* Write to file */
+	real_size = (size == -1) ? strlen(data) : (size_t) size;
+	byteswritten = fwrite(data, 1, real_size, file);
+
+#ifdef HAVE_FILENO
+#ifndef _WIN32
+	/* Set file permissions.  A failure here isn't worth losing the data. */
+	fchmod(fileno(file), S_IRUSR | S_IWUSR);
+#endif
+
+	/* Apparently XFS (and possibly other filesystems) do not
+	 * guarantee that file data is flushed before file metadata,
+	 * so this procedure is insufficient without some flushage. */
+	if (fflush(file) < 0) {
+		write_file_set_error(error, "Error flushing %s: %s", filename_temp);
+		g_free(filename_temp);
+		fclose(file);
 		return FALSE;
 	}
 	if (fsync(fileno(file)) < 0) {
-		purple_debug_error("util", "Error syncing file contents for %s: %s\n",
-				   filename_temp, g_strerror(errno));
+		write_file_set_error(error, "Error syncing file contents for %s: %s",
+				filename_temp);
 		g_free(filename_temp);
 		fclose(file);
 		return FALSE;
@@ -2646,8 +3921,7 @@ purple_util_write_data_to_file_absolute(const char *filename_full, const char *d
 	/* Close file */
 	if (fclose(file) != 0)
 	{
-		purple_debug_error("util", "Error closing file %s: %s\n",
-				   filename_temp, g_strerror(errno));
+		write_file_set_error(error, "Error closing file %s: %s", filename_temp);
 		g_free(filename_temp);
 		return FALSE;
 	}
@@ -2656,30 +3930,26 @@ purple_util_write_data_to_file_absolute(const char *filename_full, const char *d
 	/* This is the same effect (we hope) as the HAVE_FILENO block
 	 * above, but for systems without fileno(). */
 	if ((fd = open(filename_temp, O_RDWR)) < 0) {
-		purple_debug_error("util", "Error opening file %s for flush: %s\n",
-				   filename_temp, g_strerror(errno));
+		write_file_set_error(error, "Error opening file %s for flush: %s",
+				filename_temp);
 		g_free(filename_temp);
 		return FALSE;
 	}
 
 #ifndef _WIN32
 	/* copy-pasta! */
-	if (fchmod(fd, S_IRUSR | S_IWUSR) == -1) {
-		purple_debug_error("util", "Error setting permissions of "
-			"file %s: %s\n", filename_temp, g_strerror(errno));
-	}
+	fchmod(fd, S_IRUSR | S_IWUSR);
 #endif
 
 	if (fsync(fd) < 0) {
-		purple_debug_error("util", "Error syncing %s: %s\n",
-				   filename_temp, g_strerror(errno));
+		write_file_set_error(error, "Error syncing %s: %s", filename_temp);
 		g_free(filename_temp);
 		close(fd);
 		return FALSE;
 	}
 	if (close(fd) < 0) {
-		purple_debug_error("util", "Error closing %s after sync: %s\n",
-				   filename_temp, g_strerror(errno));
+		write_file_set_error(error, "Error closing %s after sync: %s",
+				filename_temp);
 		g_free(filename_temp);
 		return FALSE;
 	}
@@ -2688,11 +3958,11 @@ purple_util_write_data_to_file_absolute(const char *filename_full, const char *d
 	/* Ensure the file is the correct size */
 	if (byteswritten != real_size)
 	{
-		purple_debug_error("util", "Error writing to file %s: Wrote %"
-				   G_GSIZE_FORMAT " bytes "
-				   "but should have written %" G_GSIZE_FORMAT
-				   "; is your disk full?\n",
-				   filename_temp, byteswritten, real_size);
+		g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_NOSPC,
+				"Error writing to file %s: Wrote %" G_GSIZE_FORMAT " bytes "
+				"but should have written %" G_GSIZE_FORMAT
+				"; is your disk full?",
+				filename_temp, byteswritten, real_size);
 		g_free(filename_temp);
 		return FALSE;
 	}
@@ -2703,10 +3973,9 @@ purple_util_write_data_to_file_absolute(const char *filename_full, const char *d
 	 */
 	if ((g_stat(filename_temp, &st) == -1) || (st.st_size != real_size))
 	{
-		purple_debug_error("util", "Error writing data to file %s: "
-				   "Incomplete file written; is your disk "
-				   "full?\n",
-				   filename_temp);
+		g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_NOSPC,
+				"Error writing data to file %s: Incomplete file written; "
+				"is your disk full?", filename_temp);
 		g_free(filename_temp);
 		return FALSE;
 	}
@@ -2715,12 +3984,35 @@ purple_util_write_data_to_file_absolute(const char *filename_full, const char *d
 	/* Rename to the REAL name */
 	if (g_rename(filename_temp, filename_full) == -1)
 	{
-		purple_debug_error("util", "Error renaming %s to %s: %s\n",
-				   filename_temp, filename_full,
-				   g_strerror(errno));
+		int err = errno;
+
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+				"Error renaming %s to %s: %s",
+				filename_temp, filename_full, g_strerror(err));
+		g_free(filename_temp);
+		return FALSE;
 	}
 
-	g_free(filename_temp);
+	g_free(filename_temp);
+
+	return TRUE;
+}
+
+gboolean
+purple_util_write_data_to_file_absolute(const char *filename_full, const char *data, gssize size)
+{
+	GError *error = NULL;
+
+	purple_debug_info("util", "Writing file %s\n",
+					filename_full);
+
+	g_return_val_if_fail((size >= -1), FALSE);
+
+	if (!_purple_util_write_file(filename_full, data, size, &error)) {
+		purple_debug_error("util", "%s\n", error->message);
+		g_error_free(error);
+		return FALSE;
+	}
 
 	return TRUE;
 }
@@ -3586,6 +4878,12 @@ purple_url_parse(const char *url, char **ret_host, int *ret_port,
 #undef PASSWD_CTRL
 }
 
+static void url_fetch_connect_cb(gpointer url_data, gint source, const gchar *error_message);
+static void ssl_url_fetch_connect_cb(gpointer data, PurpleSslConnection *ssl_connection, PurpleInputCondition cond);
+static void ssl_url_fetch_error_cb(PurpleSslConnection *ssl_connection, PurpleSslErrorType error, gpointer data);
+static void url_fetch_send_cb(gpointer data, gint source, PurpleInputCondition cond);
+static void url_fetch_record_latency(PurpleUtilFetchUrlData *gfud, gboolean success);
+
 /**
  * The arguments to this function are similar to printf.
  */
@@ -3599,14 +4897,350 @@ purple_util_fetch_url_error(PurpleUtilFetchUrlData *gfud, const char *format, ..
 	error_message = g_strdup_vprintf(format, args);
 	va_end(args);
 
+	url_fetch_record_latency(gfud, FALSE);
 	gfud->callback(gfud, gfud->user_data, NULL, 0, error_message);
 	g_free(error_message);
 	purple_util_fetch_url_cancel(gfud);
 }
 
-static void url_fetch_connect_cb(gpointer url_data, gint source, const gchar *error_message);
-static void ssl_url_fetch_connect_cb(gpointer data, PurpleSslConnection *ssl_connection, PurpleInputCondition cond);
-static void ssl_url_fetch_error_cb(PurpleSslConnection *ssl_connection, PurpleSslErrorType error, gpointer data);
+static void
+url_fetch_stats_free(PurpleUtilFetchUrlStats *stats)
+{
+	g_free(stats->host);
+	g_free(stats);
+}
+
+static PurpleUtilFetchUrlStats *
+url_fetch_get_stats(const char *host, int port)
+{
+	PurpleUtilFetchUrlStats *stats;
+	char *key;
+
+	if (url_fetch_stats == NULL)
+		url_fetch_stats = g_hash_table_new_full(g_str_hash, g_str_equal,
+				NULL, (GDestroyNotify)url_fetch_stats_free);
+
+	key = g_strdup_printf("%s:%d", host ? host : "", port);
+	stats = g_hash_table_lookup(url_fetch_stats, key);
+	if (stats == NULL) {
+		stats = g_new0(PurpleUtilFetchUrlStats, 1);
+		stats->host = key;
+		g_hash_table_insert(url_fetch_stats, stats->host, stats);
+	} else
+		g_free(key);
+
+	return stats;
+}
+
+/*
+ * Connections can only be shared between requests that would have made
+ * the same connection: same scheme, same host and port, and the same
+ * proxy settings.
+ */
+static char *
+url_fetch_pool_key(PurpleUtilFetchUrlData *gfud)
+{
+	return g_strdup_printf("%s://%s:%d/%p", gfud->is_ssl ? "https" : "http",
+			gfud->website.address ? gfud->website.address : "",
+			gfud->website.port, purple_proxy_get_setup(gfud->account));
+}
+
+static void
+url_fetch_idle_destroy(PurpleUtilFetchUrlIdleConn *conn)
+{
+	GList *idle;
+
+	idle = g_hash_table_lookup(url_fetch_idle, conn->key);
+	idle = g_list_remove(idle, conn);
+	if (idle != NULL)
+		g_hash_table_insert(url_fetch_idle, g_strdup(conn->key), idle);
+	else
+		g_hash_table_remove(url_fetch_idle, conn->key);
+
+	if (conn->timeout > 0)
+		purple_timeout_remove(conn->timeout);
+	if (conn->inpa > 0)
+		purple_input_remove(conn->inpa);
+	if (conn->ssl_connection != NULL)
+		purple_ssl_close(conn->ssl_connection);
+	if (conn->fd >= 0)
+		close(conn->fd);
+
+	g_free(conn->key);
+	g_free(conn);
+}
+
+static gboolean
+url_fetch_idle_timeout_cb(gpointer data)
+{
+	PurpleUtilFetchUrlIdleConn *conn = data;
+
+	conn->timeout = 0;
+	url_fetch_idle_destroy(conn);
+
+	return FALSE;
+}
+
+/*
+ * Anything arriving on an idle connection is either the server hanging up
+ * or something we can't make sense of.  Either way the connection is no
+ * longer usable.
+ */
+static void
+url_fetch_idle_cb(gpointer data, gint source, PurpleInputCondition cond)
+{
+	char buf[1];
+
+	if (read(source, buf, sizeof(buf)) < 0 && errno == EAGAIN)
+		return;
+
+	url_fetch_idle_destroy(data);
+}
+
+static void
+ssl_url_fetch_idle_cb(gpointer data, PurpleSslConnection *ssl_connection, PurpleInputCondition cond)
+{
+	char buf[1];
+
+	/* The TLS layer may have consumed a record of its own (a session
+	 * ticket, say) without there being anything for us to read. */
+	if ((int)purple_ssl_read(ssl_connection, buf, sizeof(buf)) < 0 && errno == EAGAIN)
+		return;
+
+	url_fetch_idle_destroy(data);
+}
+
+/* Hands the finished request's connection over to the idle pool */
+static void
+url_fetch_release_connection(PurpleUtilFetchUrlData *gfud)
+{
+	PurpleUtilFetchUrlIdleConn *conn;
+	GList *idle;
+	char *key;
+
+	key = url_fetch_pool_key(gfud);
+
+	if (url_fetch_idle == NULL)
+		url_fetch_idle = g_hash_table_new_full(g_str_hash, g_str_equal,
+				g_free, NULL);
+
+	idle = g_hash_table_lookup(url_fetch_idle, key);
+	if (g_list_length(idle) >= MAX_IDLE_HTTP_CONNECTIONS) {
+		g_free(key);
+		return;
+	}
+
+	if (gfud->inpa > 0) {
+		purple_input_remove(gfud->inpa);
+		gfud->inpa = 0;
+	}
+
+	conn = g_new0(PurpleUtilFetchUrlIdleConn, 1);
+	conn->key = key;
+	conn->fd = -1;
+
+	if (gfud->is_ssl) {
+		conn->ssl_connection = gfud->ssl_connection;
+		gfud->ssl_connection = NULL;
+
+		if (conn->ssl_connection->inpa > 0) {
+			purple_input_remove(conn->ssl_connection->inpa);
+			conn->ssl_connection->inpa = 0;
+		}
+		purple_ssl_input_add(conn->ssl_connection, ssl_url_fetch_idle_cb, conn);
+	} else {
+		conn->fd = gfud->fd;
+		gfud->fd = -1;
+
+		conn->inpa = purple_input_add(conn->fd, PURPLE_INPUT_READ,
+				url_fetch_idle_cb, conn);
+	}
+
+	conn->timeout = purple_timeout_add_seconds(IDLE_HTTP_CONNECTION_TIMEOUT,
+			url_fetch_idle_timeout_cb, conn);
+
+	idle = g_list_prepend(idle, conn);
+	g_hash_table_insert(url_fetch_idle, g_strdup(key), idle);
+}
+
+/* Moves an idle connection to the same server onto gfud, if there is one */
+static gboolean
+url_fetch_take_idle_connection(PurpleUtilFetchUrlData *gfud)
+{
+	PurpleUtilFetchUrlIdleConn *conn;
+	GList *idle;
+	char *key;
+
+	if (url_fetch_idle == NULL)
+		return FALSE;
+
+	key = url_fetch_pool_key(gfud);
+	idle = g_hash_table_lookup(url_fetch_idle, key);
+	g_free(key);
+
+	if (idle == NULL)
+		return FALSE;
+
+	conn = idle->data;
+
+	if (conn->ssl_connection != NULL) {
+		gfud->ssl_connection = conn->ssl_connection;
+		conn->ssl_connection = NULL;
+
+		if (gfud->ssl_connection->inpa > 0) {
+			purple_input_remove(gfud->ssl_connection->inpa);
+			gfud->ssl_connection->inpa = 0;
+		}
+	} else {
+		gfud->fd = conn->fd;
+		conn->fd = -1;
+	}
+
+	url_fetch_idle_destroy(conn);
+
+	return TRUE;
+}
+
+void
+_purple_util_fetch_url_close_idle(void)
+{
+	if (url_fetch_idle == NULL)
+		return;
+
+	while (g_hash_table_size(url_fetch_idle) > 0) {
+		GList *idle = NULL;
+		GHashTableIter iter;
+
+		g_hash_table_iter_init(&iter, url_fetch_idle);
+		g_hash_table_iter_next(&iter, NULL, (gpointer *)&idle);
+		url_fetch_idle_destroy(idle->data);
+	}
+
+	g_hash_table_destroy(url_fetch_idle);
+	url_fetch_idle = NULL;
+}
+
+/* Closes whatever connection gfud currently has */
+static void
+url_fetch_close_connection(PurpleUtilFetchUrlData *gfud)
+{
+	if (gfud->inpa > 0) {
+		purple_input_remove(gfud->inpa);
+		gfud->inpa = 0;
+	}
+
+	if (gfud->ssl_connection != NULL) {
+		purple_ssl_close(gfud->ssl_connection);
+		gfud->ssl_connection = NULL;
+	}
+
+	if (gfud->fd >= 0) {
+		close(gfud->fd);
+		gfud->fd = -1;
+	}
+}
+
+/*
+ * Starts sending gfud's request, either over an idle connection to the
+ * same server or over a new one.  Returns FALSE if no connection attempt
+ * could be started.
+ */
+static gboolean
+url_fetch_start_connection(PurpleUtilFetchUrlData *gfud, gboolean allow_reuse)
+{
+	gfud->reused = allow_reuse && url_fetch_take_idle_connection(gfud);
+
+	if (gfud->reused) {
+		purple_debug_misc("util", "Reusing kept-alive connection to %s\n",
+				gfud->website.address);
+		gfud->stats->reused++;
+
+		/* Don't write from here; the caller may not have the handle yet */
+		gfud->inpa = purple_input_add(
+				gfud->is_ssl ? gfud->ssl_connection->fd : gfud->fd,
+				PURPLE_INPUT_WRITE, url_fetch_send_cb, gfud);
+		return TRUE;
+	}
+
+	gfud->stats->connects++;
+
+	if (gfud->is_ssl) {
+		gfud->ssl_connection = purple_ssl_connect(gfud->account,
+				gfud->website.address, gfud->website.port,
+				ssl_url_fetch_connect_cb, ssl_url_fetch_error_cb, gfud);
+	} else {
+		gfud->connect_data = purple_proxy_connect(NULL, gfud->account,
+				gfud->website.address, gfud->website.port,
+				url_fetch_connect_cb, gfud);
+	}
+
+	return (gfud->ssl_connection != NULL || gfud->connect_data != NULL);
+}
+
+static gboolean
+url_fetch_begin(PurpleUtilFetchUrlData *gfud)
+{
+	gfud->stats = url_fetch_get_stats(gfud->website.address, gfud->website.port);
+	gfud->stats->requests++;
+	g_get_current_time(&gfud->start);
+
+	return url_fetch_start_connection(gfud, TRUE);
+}
+
+/*
+ * A kept-alive connection can be closed by the server at any time while
+ * it sits idle.  If that happened before we got any response, quietly
+ * try again over a fresh connection.  A request that isn't a GET or a
+ * HEAD (a POST made with purple_util_fetch_url_request(), say) is only
+ * retried if none of it was sent, because the server may have acted on
+ * it already.
+ */
+static gboolean
+url_fetch_retry_stale(PurpleUtilFetchUrlData *gfud)
+{
+	if (!gfud->reused || gfud->got_headers || gfud->len > 0)
+		return FALSE;
+
+	if (gfud->request_written > 0 && gfud->request != NULL &&
+			!g_str_has_prefix(gfud->request, "GET ") &&
+			!g_str_has_prefix(gfud->request, "HEAD "))
+		return FALSE;
+
+	purple_debug_info("util", "Kept-alive connection to %s went away, "
+			"reconnecting\n", gfud->website.address);
+
+	url_fetch_close_connection(gfud);
+	gfud->request_written = 0;
+
+	if (!url_fetch_start_connection(gfud, FALSE))
+		purple_util_fetch_url_error(gfud, _("Unable to connect to %s"),
+				gfud->website.address);
+
+	return TRUE;
+}
+
+static void
+url_fetch_record_latency(PurpleUtilFetchUrlData *gfud, gboolean success)
+{
+	GTimeVal now;
+	gulong msecs;
+
+	if (gfud->stats == NULL)
+		return;
+
+	if (!success) {
+		gfud->stats->failures++;
+		return;
+	}
+
+	g_get_current_time(&now);
+	msecs = (now.tv_sec - gfud->start.tv_sec) * 1000 +
+			(now.tv_usec - gfud->start.tv_usec) / 1000;
+
+	gfud->stats->total_msecs += msecs;
+	if (msecs > gfud->stats->max_msecs)
+		gfud->stats->max_msecs = msecs;
+}
 
 static gboolean
 parse_redirect(const char *data, gsize data_len,
@@ -3673,16 +5307,8 @@ parse_redirect(const char *data, gsize data_len,
 	g_free(gfud->request);
 	gfud->request = NULL;
 
-	if (gfud->is_ssl) {
-		gfud->is_ssl = FALSE;
-		purple_ssl_close(gfud->ssl_connection);
-		gfud->ssl_connection = NULL;
-	} else {
-		purple_input_remove(gfud->inpa);
-		gfud->inpa = 0;
-		close(gfud->fd);
-		gfud->fd = -1;
-	}
+	url_fetch_close_connection(gfud);
+	gfud->is_ssl = FALSE;
 	gfud->request_written = 0;
 	gfud->len = 0;
 	gfud->data_len = 0;
@@ -3694,18 +5320,10 @@ parse_redirect(const char *data, gsize data_len,
 	purple_url_parse(new_url, &gfud->website.address, &gfud->website.port,
 				   &gfud->website.page, &gfud->website.user, &gfud->website.passwd);
 
-	if (purple_strcasestr(new_url, "https://") != NULL) {
+	if (purple_strcasestr(new_url, "https://") != NULL)
 		gfud->is_ssl = TRUE;
-		gfud->ssl_connection = purple_ssl_connect(gfud->account,
-				gfud->website.address, gfud->website.port,
-				ssl_url_fetch_connect_cb, ssl_url_fetch_error_cb, gfud);
-	} else {
-		gfud->connect_data = purple_proxy_connect(NULL, gfud->account,
-				gfud->website.address, gfud->website.port,
-				url_fetch_connect_cb, gfud);
-	}
 
-	if (gfud->ssl_connection == NULL && gfud->connect_data == NULL)
+	if (!url_fetch_begin(gfud))
 	{
 		purple_util_fetch_url_error(gfud, _("Unable to connect to %s"),
 				gfud->website.address);
@@ -3772,6 +5390,80 @@ content_is_chunked(const char *data, gsize data_len)
 	return FALSE;
 }
 
+/* Whether the server will keep the connection open after this response */
+static gboolean
+response_is_keepalive(const char *data, gsize data_len)
+{
+	const char *p;
+
+	if (data_len < 8)
+		return FALSE;
+
+	p = find_header_content(data, data_len, "\nConnection: ");
+
+	if (g_ascii_strncasecmp(data, "HTTP/1.1", 8) == 0)
+		return !(p && g_ascii_strncasecmp(p, "close", 5) == 0);
+
+	return (p && g_ascii_strncasecmp(p, "keep-alive", 10) == 0);
+}
+
+/* Responses with these status codes never carry a body */
+static gboolean
+response_has_no_body(const char *data)
+{
+	int status;
+
+	if (sscanf(data, "HTTP/%*d.%*d %d", &status) != 1)
+		return FALSE;
+
+	return (status / 100 == 1 || status == 204 || status == 304);
+}
+
+/*
+ * Walks the chunks received so far, starting at *pos.  Returns TRUE once
+ * the terminating zero-length chunk and the trailer following it have
+ * arrived, leaving *pos just past the end of the body.  Otherwise *pos is
+ * left at the first incomplete chunk, so the next call can resume there.
+ */
+static gboolean
+chunked_data_complete(const char *data, gsize len, gsize *pos)
+{
+	const char *end = data + len;
+	const char *p = data + *pos;
+	const char *eol;
+	gsize sz;
+
+	while (p < end) {
+		eol = g_strstr_len(p, end - p, "\r\n");
+		if (eol == NULL)
+			return FALSE;
+
+		if (sscanf(p, "%" G_GSIZE_MODIFIER "x", &sz) != 1)
+			return FALSE;
+
+		if (sz == 0) {
+			/* Skip any footers, up to the blank line ending the body */
+			p = eol + 2;
+			while ((eol = g_strstr_len(p, end - p, "\r\n")) != NULL) {
+				if (eol == p) {
+					*pos = eol + 2 - data;
+					return TRUE;
+				}
+				p = eol + 2;
+			}
+			return FALSE;
+		}
+
+		if (sz > MAX_HTTP_CHUNK_SIZE || sz + 2 > (gsize)(end - (eol + 2)))
+			return FALSE;
+
+		p = eol + 2 + sz + 2;
+		*pos = p - data;
+	}
+
+	return FALSE;
+}
+
 /* Process in-place */
 static void
 process_chunked_data(char *data, gsize *len)
@@ -3898,8 +5590,17 @@ url_fetch_recv_cb(gpointer url_data, gint source, PurpleInputCondition cond)
 				/* No redirect. See if we can find a content length. */
 				content_len = parse_content_len(gfud->webdata, header_len);
 				gfud->chunked = content_is_chunked(gfud->webdata, header_len);
+				gfud->keepalive = response_is_keepalive(gfud->webdata, header_len);
 
-				if (content_len == 0) {
+				if (response_has_no_body(gfud->webdata) ||
+						(content_len == 0 && !gfud->chunked &&
+						 find_header_content(gfud->webdata, header_len, "\nContent-Length: "))) {
+					/* Nothing follows the headers.  We can't wait for
+					 * the server to close a kept-alive connection. */
+					gfud->has_explicit_data_len = TRUE;
+					gfud->chunked = FALSE;
+					content_len = 0;
+				} else if (content_len == 0) {
 					/* We'll stick with an initial 8192 */
 					content_len = 8192;
 				} else {
@@ -3909,6 +5610,7 @@ url_fetch_recv_cb(gpointer url_data, gint source, PurpleInputCondition cond)
 								"Overriding explicit Content-Length of %" G_GSIZE_FORMAT " with max of %" G_GSSIZE_FORMAT "\n",
 								content_len, gfud->max_len);
 						content_len = gfud->max_len;
+						gfud->overrun = TRUE;
 					}
 				}
 
@@ -3931,13 +5633,16 @@ url_fetch_recv_cb(gpointer url_data, gint source, PurpleInputCondition cond)
 						return;
 					}
 					gfud->webdata = new_data;
+					gfud->body_offset = header_len;
 				} else {
 					char *new_data;
 					gsize body_len = gfud->len - header_len;
 
+					if (gfud->has_explicit_data_len && body_len > content_len)
+						gfud->overrun = TRUE;
 					content_len = MAX(content_len, body_len);
 
-					new_data = g_try_malloc(content_len);
+					new_data = g_try_malloc(content_len + 1);
 					if (new_data == NULL) {
 						purple_debug_error("util",
 								"Failed to allocate %" G_GSIZE_FORMAT " bytes: %s\n",
@@ -3971,19 +5676,35 @@ url_fetch_recv_cb(gpointer url_data, gint source, PurpleInputCondition cond)
 			got_eof = TRUE;
 			break;
 		}
+
+		if (gfud->got_headers && gfud->chunked &&
+				chunked_data_complete(gfud->webdata + gfud->body_offset,
+						gfud->len - gfud->body_offset, &gfud->chunk_pos)) {
+			got_eof = TRUE;
+			break;
+		}
 	}
 
 	if(len < 0) {
-		if(errno == EAGAIN) {
-			return;
-		} else {
+		if(errno != EAGAIN && !url_fetch_retry_stale(gfud)) {
 			purple_util_fetch_url_error(gfud, _("Error reading from %s: %s"),
 					gfud->website.address, g_strerror(errno));
-			return;
 		}
+		return;
 	}
 
+	if (len == 0 && !got_eof && url_fetch_retry_stale(gfud))
+		return;
+
 	if((len == 0) || got_eof) {
+		/* The connection can serve another request if the response ended
+		 * exactly where its headers said it would. */
+		if (got_eof && gfud->keepalive && !gfud->overrun &&
+				(gfud->chunked ?
+				 gfud->chunk_pos == gfud->len - gfud->body_offset :
+				 gfud->len == gfud->data_len))
+			url_fetch_release_connection(gfud);
+
 		gfud->webdata = g_realloc(gfud->webdata, gfud->len + 1);
 		gfud->webdata[gfud->len] = '\0';
 
@@ -3992,6 +5713,7 @@ url_fetch_recv_cb(gpointer url_data, gint source, PurpleInputCondition cond)
 			process_chunked_data(gfud->webdata, &gfud->len);
 		}
 
+		url_fetch_record_latency(gfud, TRUE);
 		gfud->callback(gfud, gfud->user_data, gfud->webdata, gfud->len, NULL);
 		purple_util_fetch_url_cancel(gfud);
 	}
@@ -4025,11 +5747,14 @@ url_fetch_send_cb(gpointer data, gint source, PurpleInputCondition cond)
 		PurpleProxyInfo *gpi = purple_proxy_get_setup(gfud->account);
 		GString *request_str = g_string_new(NULL);
 
+		/* HTTP/1.1 connections are kept open for the next request to the
+		 * same server; see url_fetch_release_connection(). */
 		g_string_append_printf(request_str, "GET %s%s HTTP/%s\r\n"
-						    "Connection: close\r\n",
+						    "Connection: %s\r\n",
 			(gfud->full ? "" : "/"),
 			(gfud->full ? (gfud->url ? gfud->url : "") : (gfud->website.page ? gfud->website.page : "")),
-			(gfud->http11 ? "1.1" : "1.0"));
+			(gfud->http11 ? "1.1" : "1.0"),
+			(gfud->http11 ? "keep-alive" : "close"));
 
 		if (gfud->user_agent)
 			g_string_append_printf(request_str, "User-Agent: %s\r\n", gfud->user_agent);
@@ -4101,8 +5826,9 @@ url_fetch_send_cb(gpointer data, gint source, PurpleInputCondition cond)
 	if (len < 0 && errno == EAGAIN)
 		return;
 	else if (len < 0) {
-		purple_util_fetch_url_error(gfud, _("Error writing to %s: %s"),
-				gfud->website.address, g_strerror(errno));
+		if (!url_fetch_retry_stale(gfud))
+			purple_util_fetch_url_error(gfud, _("Error writing to %s: %s"),
+					gfud->website.address, g_strerror(errno));
 		return;
 	}
 	gfud->request_written += len;
@@ -4239,16 +5965,9 @@ purple_util_fetch_url_request_len_with_account(PurpleAccount *account,
 		}
 
 		gfud->is_ssl = TRUE;
-		gfud->ssl_connection = purple_ssl_connect(account,
-				gfud->website.address, gfud->website.port,
-				ssl_url_fetch_connect_cb, ssl_url_fetch_error_cb, gfud);
-	} else {
-		gfud->connect_data = purple_proxy_connect(NULL, account,
-				gfud->website.address, gfud->website.port,
-				url_fetch_connect_cb, gfud);
 	}
 
-	if (gfud->ssl_connection == NULL && gfud->connect_data == NULL)
+	if (!url_fetch_begin(gfud))
 	{
 		purple_util_fetch_url_error(gfud, _("Unable to connect to %s"),
 				gfud->website.address);
@@ -4285,6 +6004,15 @@ purple_util_fetch_url_cancel(PurpleUtilFetchUrlData *gfud)
 	g_free(gfud);
 }
 
+GList *
+purple_util_fetch_url_get_stats(void)
+{
+	if (url_fetch_stats == NULL)
+		return NULL;
+
+	return g_hash_table_get_values(url_fetch_stats);
+}
+
 const char *
 purple_url_decode(const char *str)
 {
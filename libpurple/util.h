@@ -61,6 +61,19 @@ struct _PurpleMenuAction
 
 typedef char *(*PurpleInfoFieldFormatCallback)(const char *field, size_t len);
 
+/**
+ * State for decoding base-64 data a piece at a time.
+ *
+ * @see purple_base64_decode_step()
+ * @since 2.10.11
+ */
+typedef struct
+{
+	guint32 value;     /**< Bits of the quantum being decoded. */
+	guint count;       /**< How many characters of it have been seen. */
+	gboolean padding;  /**< Whether padding has been seen. */
+} PurpleBase64DecodeState;
+
 /**
  * A key-value pair.
  *
@@ -228,6 +241,55 @@ gchar *purple_base64_encode(const guchar *data, gsize len);
  */
 guchar *purple_base64_decode(const char *str, gsize *ret_len);
 
+/**
+ * Converts a chunk of binary data to its base-64 equivalent, appending
+ * it to an existing string.  This avoids allocating a temporary copy of
+ * the encoded data when it's going into a larger buffer anyway.
+ *
+ * @param str  The string to append the encoded data to.
+ * @param data The data to convert.
+ * @param len  The length of the data.
+ *
+ * @see purple_base64_encode()
+ * @since 2.10.11
+ */
+void purple_base64_encode_append(GString *str, const guchar *data, gsize len);
+
+/**
+ * Decodes a piece of a base-64 stream that may be split into arbitrarily
+ * sized pieces.  Whitespace is skipped; any other character outside the
+ * base-64 alphabet is an error.
+ *
+ * @param state The decoder state.  Zero it before decoding the first
+ *              piece, and finish with purple_base64_decode_close().
+ * @param str   The piece of base-64 text to decode.
+ * @param len   The length of @a str.
+ * @param out   Where to write the decoded data.  It must have room for
+ *              (@a len / 4) * 3 + 3 bytes.
+ *
+ * @return The number of bytes written to @a out, or -1 if the data
+ *         isn't valid base-64.
+ *
+ * @since 2.10.11
+ */
+gssize purple_base64_decode_step(PurpleBase64DecodeState *state,
+                                 const char *str, gsize len, guchar *out);
+
+/**
+ * Finishes decoding a base-64 stream, writing out any bytes left in an
+ * unpadded final quantum and resetting @a state.
+ *
+ * @param state The decoder state.
+ * @param out   Where to write the final bytes.  It must have room for
+ *              2 bytes.
+ *
+ * @return The number of bytes written to @a out, or -1 if the stream
+ *         ended in the middle of a byte.
+ *
+ * @since 2.10.11
+ */
+gssize purple_base64_decode_close(PurpleBase64DecodeState *state, guchar *out);
+
 /*@}*/
 
 /**************************************************************************/
@@ -632,6 +694,202 @@ gboolean purple_markup_is_rtl(const char *html);
 /*@}*/
 
 
+/**************************************************************************/
+/** @name Markup Tokenizer and Filters                                    */
+/**************************************************************************/
+/*@{*/
+
+/**
+ * The types of markup tokens.
+ *
+ * @since 2.10.11
+ */
+typedef enum
+{
+	PURPLE_MARKUP_TOKEN_TEXT,    /**< A run of text, including entities. */
+	PURPLE_MARKUP_TOKEN_TAG,     /**< An opening, closing or empty tag.  */
+	PURPLE_MARKUP_TOKEN_COMMENT  /**< A comment.                         */
+} PurpleMarkupTokenType;
+
+/**
+ * A token of markup.  Tokens point into the markup they were read from
+ * and are not NUL terminated.
+ *
+ * @since 2.10.11
+ */
+typedef struct
+{
+	PurpleMarkupTokenType type;
+	const char *start;   /**< The start of the token.                   */
+	gsize len;           /**< The length of the token in bytes.         */
+	const char *name;    /**< For tags, the start of the tag name.      */
+	gsize name_len;      /**< For tags, the length of the tag name.     */
+	gboolean closing;    /**< For tags, whether this is a closing tag.  */
+	gboolean empty;      /**< For tags, whether the tag ends in "/>".   */
+} PurpleMarkupToken;
+
+/**
+ * A stage in a chain of markup filters.  Each filter receives tokens,
+ * transforms them and passes the result on to the next filter.
+ *
+ * @since 2.10.11
+ */
+typedef struct _PurpleMarkupFilter PurpleMarkupFilter;
+
+/**
+ * Reads the next token from a string of markup, without copying.
+ *
+ * A '<' starts a tag only if it is followed by a letter, "/" and a letter,
+ * "!" or "?", and is closed by a '>' before any other '<'.  Any other '<'
+ * is part of the surrounding text.  A comment that is never closed is
+ * text, as is everything after it.
+ *
+ * @param markup A pointer to the markup to read, which is advanced past
+ *               the token.
+ * @param token  The token to fill in.
+ *
+ * @return @c TRUE if a token was read, or @c FALSE at the end of the markup.
+ *
+ * @since 2.10.11
+ */
+gboolean purple_markup_next_token(const char **markup, PurpleMarkupToken *token);
+
+/**
+ * Creates a filter that appends everything it receives to a string.
+ * This is normally the last filter of a chain.
+ *
+ * @param out The string to append to.
+ *
+ * @return The new filter.
+ *
+ * @since 2.10.11
+ */
+PurpleMarkupFilter *purple_markup_filter_string_new(GString *out);
+
+/**
+ * Creates a filter that passes everything it receives to two chains,
+ * so that a message only needs to be tokenized once for several outputs.
+ *
+ * @param first  The first chain.
+ * @param second The second chain.
+ *
+ * @return The new filter, which owns both chains.
+ *
+ * @since 2.10.11
+ */
+PurpleMarkupFilter *purple_markup_filter_tee_new(PurpleMarkupFilter *first,
+		PurpleMarkupFilter *second);
+
+/**
+ * Creates a filter that treats everything it receives as plain text and
+ * escapes it, like purple_markup_escape_text().
+ *
+ * @param next The next filter, or @c NULL.
+ *
+ * @return The new filter.
+ *
+ * @since 2.10.11
+ */
+PurpleMarkupFilter *purple_markup_filter_escape_new(PurpleMarkupFilter *next);
+
+/**
+ * Creates a filter that turns markup into plain text, like
+ * purple_markup_strip_html().
+ *
+ * @param next The next filter, or @c NULL.
+ *
+ * @return The new filter.
+ *
+ * @since 2.10.11
+ */
+PurpleMarkupFilter *purple_markup_filter_strip_new(PurpleMarkupFilter *next);
+
+/**
+ * Creates a filter that turns URLs and e-mail addresses in text into
+ * links, like purple_markup_linkify().
+ *
+ * @param next The next filter, or @c NULL.
+ *
+ * @return The new filter.
+ *
+ * @since 2.10.11
+ */
+PurpleMarkupFilter *purple_markup_filter_linkify_new(PurpleMarkupFilter *next);
+
+/**
+ * Creates a filter that turns HTML into XHTML-IM, like the XHTML output
+ * of purple_markup_html_to_xhtml().  Tags left open are closed when the
+ * filter is finished.
+ *
+ * @param next The next filter, or @c NULL.
+ *
+ * @return The new filter.
+ *
+ * @since 2.10.11
+ */
+PurpleMarkupFilter *purple_markup_filter_xhtml_new(PurpleMarkupFilter *next);
+
+/**
+ * Creates a filter that passes on only a slice of the markup it receives,
+ * like purple_markup_slice().
+ *
+ * @param next The next filter, or @c NULL.
+ * @param x    The character offset into the unformatted text to begin at.
+ * @param y    The character offset of one past the last character to
+ *             include.
+ *
+ * @return The new filter.
+ *
+ * @since 2.10.11
+ */
+PurpleMarkupFilter *purple_markup_filter_slice_new(PurpleMarkupFilter *next,
+		guint x, guint y);
+
+/**
+ * Passes a single token to a filter.
+ *
+ * @param filter The filter.
+ * @param token  The token.
+ *
+ * @since 2.10.11
+ */
+void purple_markup_filter_push(PurpleMarkupFilter *filter,
+		const PurpleMarkupToken *token);
+
+/**
+ * Tokenizes markup and passes the tokens to a filter.  This can be called
+ * several times to feed a message in pieces, as long as no piece ends in
+ * the middle of a tag or an entity.
+ *
+ * @param filter The filter.
+ * @param markup The markup.
+ *
+ * @since 2.10.11
+ */
+void purple_markup_filter_feed(PurpleMarkupFilter *filter, const char *markup);
+
+/**
+ * Tells a chain of filters that there is no more input, so that they can
+ * flush anything they held back, such as closing tags.
+ *
+ * @param filter The first filter of the chain.
+ *
+ * @since 2.10.11
+ */
+void purple_markup_filter_finish(PurpleMarkupFilter *filter);
+
+/**
+ * Frees a chain of filters.
+ *
+ * @param filter The first filter of the chain.
+ *
+ * @since 2.10.11
+ */
+void purple_markup_filter_free(PurpleMarkupFilter *filter);
+
+/*@}*/
+
+
 /**************************************************************************/
 /** @name Path/Filename Functions                                         */
 /**************************************************************************/
@@ -1216,6 +1474,36 @@ PurpleUtilFetchUrlData *purple_util_fetch_url_request_len_with_account(
  */
 void purple_util_fetch_url_cancel(PurpleUtilFetchUrlData *url_data);
 
+/**
+ * Per-server counters for URL fetches.
+ *
+ * @since 2.10.11
+ */
+typedef struct
+{
+	char *host;          /**< The server, as "host:port". */
+	guint requests;      /**< Requests made, including redirects. */
+	guint connects;      /**< New connections opened. */
+	guint reused;        /**< Requests sent over a kept-alive connection. */
+	guint failures;      /**< Requests that ended in an error. */
+	gulong total_msecs;  /**< Sum of the latencies of successful requests. */
+	gulong max_msecs;    /**< Latency of the slowest successful request. */
+} PurpleUtilFetchUrlStats;
+
+/**
+ * Gets the URL fetch counters for every server contacted so far.
+ *
+ * HTTP/1.1 requests keep their connection open after the response, and
+ * later requests to the same server reuse it instead of connecting (and
+ * doing a TLS handshake) again.  These counters show how well that works.
+ *
+ * @return A list of PurpleUtilFetchUrlStats.  The list must be freed with
+ *         g_list_free(), but the elements belong to libpurple.
+ *
+ * @since 2.10.11
+ */
+GList *purple_util_fetch_url_get_stats(void);
+
 /**
  * Decodes a URL into a plain string.
  *
@@ -2639,6 +2639,55 @@ do_alphashift(GdkPixbuf *pixbuf, int shift)
 }
 
 
+/* Decodes a buddy icon and scales it for the buddy list or a tooltip. */
+static GdkPixbuf *pidgin_blist_render_buddy_icon(const guchar *data, gsize len,
+                                                 PurplePluginProtocolInfo *prpl_info,
+                                                 gboolean scaled)
+{
+	GdkPixbuf *buf, *ret;
+	gint orig_width, orig_height, scale_width, scale_height;
+
+	buf = pidgin_pixbuf_from_data(data, len);
+	if (!buf)
+		return NULL;
+
+	/* I'd use the pidgin_buddy_icon_get_scale_size() thing, but it won't
+	 * tell me the original size, which I need for scaling purposes. */
+	scale_width = orig_width = gdk_pixbuf_get_width(buf);
+	scale_height = orig_height = gdk_pixbuf_get_height(buf);
+
+	if (prpl_info && prpl_info->icon_spec.scale_rules & PURPLE_ICON_SCALE_DISPLAY)
+		purple_buddy_icon_get_scale_size(&prpl_info->icon_spec, &scale_width, &scale_height);
+
+	if (scaled || scale_height > 200 || scale_width > 200) {
+		GdkPixbuf *tmpbuf;
+		float scale_size = scaled ? 32.0 : 200.0;
+		if(scale_height > scale_width) {
+			scale_width = scale_size * (double)scale_width / (double)scale_height;
+			scale_height = scale_size;
+		} else {
+			scale_height = scale_size * (double)scale_height / (double)scale_width;
+			scale_width = scale_size;
+		}
+		/* Scale & round before making square, so rectangular (but
+		 * non-square) images get rounded corners too. */
+		tmpbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, scale_width, scale_height);
+		gdk_pixbuf_fill(tmpbuf, 0x00000000);
+		gdk_pixbuf_scale(buf, tmpbuf, 0, 0, scale_width, scale_height, 0, 0, (double)scale_width/(double)orig_width, (double)scale_height/(double)orig_height, GDK_INTERP_BILINEAR);
+		if (pidgin_gdk_pixbuf_is_opaque(tmpbuf))
+			pidgin_gdk_pixbuf_make_round(tmpbuf);
+		ret = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, scale_size, scale_size);
+		gdk_pixbuf_fill(ret, 0x00000000);
+		gdk_pixbuf_copy_area(tmpbuf, 0, 0, scale_width, scale_height, ret, (scale_size-scale_width)/2, (scale_size-scale_height)/2);
+		g_object_unref(G_OBJECT(tmpbuf));
+	} else {
+		ret = gdk_pixbuf_scale_simple(buf,scale_width,scale_height, GDK_INTERP_BILINEAR);
+	}
+	g_object_unref(G_OBJECT(buf));
+
+	return ret;
+}
+
 static GdkPixbuf *pidgin_blist_get_buddy_icon(PurpleBlistNode *node,
                                               gboolean scaled, gboolean greyed)
 {
@@ -2646,13 +2695,16 @@ static GdkPixbuf *pidgin_blist_get_buddy_icon(PurpleBlistNode *node,
 	PurpleBuddy *buddy = NULL;
 	PurpleGroup *group = NULL;
 	const guchar *data = NULL;
+	const char *filename = NULL;
 	GdkPixbuf *buf, *ret = NULL;
 	PurpleBuddyIcon *icon = NULL;
 	PurpleAccount *account = NULL;
 	PurpleContact *contact = NULL;
 	PurpleStoredImage *custom_img;
 	PurplePluginProtocolInfo *prpl_info = NULL;
-	gint orig_width, orig_height, scale_width, scale_height;
+	gboolean offline = FALSE, idle = FALSE;
+	const char *scale_id;
+	char *key;
 
 	if (PURPLE_BLIST_NODE_IS_CONTACT(node)) {
 		buddy = purple_contact_get_priority_buddy((PurpleContact*)node);
@@ -2695,6 +2747,7 @@ static GdkPixbuf *pidgin_blist_get_buddy_icon(PurpleBlistNode *node,
 	if (custom_img) {
 		data = purple_imgstore_get_data(custom_img);
 		len = purple_imgstore_get_size(custom_img);
+		filename = purple_imgstore_get_filename(custom_img);
 	}
 
 	if (data == NULL) {
@@ -2703,13 +2756,59 @@ static GdkPixbuf *pidgin_blist_get_buddy_icon(PurpleBlistNode *node,
 			if (!(icon = purple_buddy_icons_find(buddy->account, buddy->name)))
 				return NULL;
 			data = purple_buddy_icon_get_data(icon, &len);
+			filename = purple_buddy_icon_get_filename(icon);
 		}
 
 		if(data == NULL)
 			return NULL;
 	}
 
-	buf = pidgin_pixbuf_from_data(data, len);
+	if (greyed) {
+		if (buddy) {
+			PurplePresence *presence = purple_buddy_get_presence(buddy);
+			if (!PURPLE_BUDDY_IS_ONLINE(buddy))
+				offline = TRUE;
+			if (purple_presence_is_idle(presence))
+				idle = TRUE;
+		} else if (group) {
+			if (purple_blist_get_group_online_count(group) == 0)
+				offline = TRUE;
+		}
+	}
+
+	/* Every row update ends up here, so don't decode and scale the same
+	 * image over and over.  Icons are named for a hash of their data, so
+	 * the file name identifies the image. */
+	scale_id = (prpl_info && prpl_info->icon_spec.scale_rules & PURPLE_ICON_SCALE_DISPLAY) ?
+			purple_account_get_protocol_id(account) : "";
+	key = g_strdup_printf("%s:blist:%s:%d:%d:%d", filename ? filename : "",
+			scale_id, scaled, offline, idle);
+
+	if (filename != NULL && (ret = pidgin_pixbuf_cache_lookup(key)) != NULL) {
+		purple_buddy_icon_unref(icon);
+		purple_imgstore_unref(custom_img);
+		g_free(key);
+		return ret;
+	}
+
+	/* The faded icon of an idle or offline buddy is made from the plain
+	 * one, so a status change doesn't mean decoding the image again. */
+	buf = NULL;
+	if ((offline || idle) && filename != NULL) {
+		char *plain_key = g_strdup_printf("%s:blist:%s:%d:0:0", filename,
+				scale_id, scaled);
+
+		buf = pidgin_pixbuf_cache_lookup(plain_key);
+		if (buf == NULL) {
+			buf = pidgin_blist_render_buddy_icon(data, len, prpl_info, scaled);
+			if (buf)
+				pidgin_pixbuf_cache_insert(plain_key, buf);
+		}
+		g_free(plain_key);
+	} else {
+		buf = pidgin_blist_render_buddy_icon(data, len, prpl_info, scaled);
+	}
+
 	purple_buddy_icon_unref(icon);
 	if (!buf) {
 		purple_debug_warning("gtkblist", "Couldn't load buddy icon "
@@ -2720,64 +2819,28 @@ static GdkPixbuf *pidgin_blist_get_buddy_icon(PurpleBlistNode *node,
 				buddy ? purple_buddy_get_name(buddy) : "(no buddy)",
 				custom_img ? purple_imgstore_get_data(custom_img) : NULL);
 		purple_imgstore_unref(custom_img);
+		g_free(key);
 		return NULL;
 	}
 	purple_imgstore_unref(custom_img);
 
-	if (greyed) {
-		gboolean offline = FALSE, idle = FALSE;
-
-		if (buddy) {
-			PurplePresence *presence = purple_buddy_get_presence(buddy);
-			if (!PURPLE_BUDDY_IS_ONLINE(buddy))
-				offline = TRUE;
-			if (purple_presence_is_idle(presence))
-				idle = TRUE;
-		} else if (group) {
-			if (purple_blist_get_group_online_count(group) == 0)
-				offline = TRUE;
-		}
+	if (offline || idle) {
+		/* Cached pixbufs are shared, so fade a copy. */
+		ret = gdk_pixbuf_copy(buf);
+		g_object_unref(G_OBJECT(buf));
 
 		if (offline)
-			gdk_pixbuf_saturate_and_pixelate(buf, buf, 0.0, FALSE);
+			gdk_pixbuf_saturate_and_pixelate(ret, ret, 0.0, FALSE);
 
 		if (idle)
-			gdk_pixbuf_saturate_and_pixelate(buf, buf, 0.25, FALSE);
-	}
-
-	/* I'd use the pidgin_buddy_icon_get_scale_size() thing, but it won't
-	 * tell me the original size, which I need for scaling purposes. */
-	scale_width = orig_width = gdk_pixbuf_get_width(buf);
-	scale_height = orig_height = gdk_pixbuf_get_height(buf);
-
-	if (prpl_info && prpl_info->icon_spec.scale_rules & PURPLE_ICON_SCALE_DISPLAY)
-		purple_buddy_icon_get_scale_size(&prpl_info->icon_spec, &scale_width, &scale_height);
-
-	if (scaled || scale_height > 200 || scale_width > 200) {
-		GdkPixbuf *tmpbuf;
-		float scale_size = scaled ? 32.0 : 200.0;
-		if(scale_height > scale_width) {
-			scale_width = scale_size * (double)scale_width / (double)scale_height;
-			scale_height = scale_size;
-		} else {
-			scale_height = scale_size * (double)scale_height / (double)scale_width;
-			scale_width = scale_size;
-		}
-		/* Scale & round before making square, so rectangular (but
-		 * non-square) images get rounded corners too. */
-		tmpbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, scale_width, scale_height);
-		gdk_pixbuf_fill(tmpbuf, 0x00000000);
-		gdk_pixbuf_scale(buf, tmpbuf, 0, 0, scale_width, scale_height, 0, 0, (double)scale_width/(double)orig_width, (double)scale_height/(double)orig_height, GDK_INTERP_BILINEAR);
-		if (pidgin_gdk_pixbuf_is_opaque(tmpbuf))
-			pidgin_gdk_pixbuf_make_round(tmpbuf);
-		ret = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, scale_size, scale_size);
-		gdk_pixbuf_fill(ret, 0x00000000);
-		gdk_pixbuf_copy_area(tmpbuf, 0, 0, scale_width, scale_height, ret, (scale_size-scale_width)/2, (scale_size-scale_height)/2);
-		g_object_unref(G_OBJECT(tmpbuf));
+			gdk_pixbuf_saturate_and_pixelate(ret, ret, 0.25, FALSE);
 	} else {
-		ret = gdk_pixbuf_scale_simple(buf,scale_width,scale_height, GDK_INTERP_BILINEAR);
+		ret = buf;
 	}
-	g_object_unref(G_OBJECT(buf));
+
+	if (filename != NULL)
+		pidgin_pixbuf_cache_insert(key, ret);
+	g_free(key);
 
 	return ret;
 }
@@ -6509,6 +6572,10 @@ static void buddy_node(PurpleBuddy *buddy, GtkTreeIter *iter, PurpleBlistNode *n
 		g_object_ref(G_OBJECT(gtkblist->empty_avatar));
 		avatar = gtkblist->empty_avatar;
 	} else if ((!PURPLE_BUDDY_IS_ONLINE(buddy) || purple_presence_is_idle(presence))) {
+		/* The icon may be shared through the pixbuf cache */
+		GdkPixbuf *faded = gdk_pixbuf_copy(avatar);
+		g_object_unref(avatar);
+		avatar = faded;
 		do_alphashift(avatar, 77);
 	}
 
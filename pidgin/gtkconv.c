@@ -45,6 +45,7 @@
 #include "idle.h"
 #include "imgstore.h"
 #include "log.h"
+#include "metrics.h"
 #include "notify.h"
 #include "prpl.h"
 #include "request.h"
@@ -103,6 +104,10 @@ enum {
 #define BUDDYICON_SIZE_MIN    32
 #define BUDDYICON_SIZE_MAX    96
 
+/* Number of messages reloaded from the message history each time the user
+ * scrolls to the top of a trimmed conversation. */
+#define SCROLLBACK_PAGE_MESSAGES 50
+
 /* Undef this to turn off "custom-smiley" debug messages */
 #define DEBUG_CUSTOM_SMILEY
 
@@ -168,6 +173,7 @@ static void hide_conv(PidginConversation *gtkconv, gboolean closetimer);
 static void pidgin_conv_set_position_size(PidginWindow *win, int x, int y,
 		int width, int height);
 static gboolean pidgin_conv_xy_to_right_infopane(PidginWindow *win, int x, int y);
+static int message_compare(gconstpointer p1, gconstpointer p2);
 
 static const GdkColor *get_nick_color(PidginConversation *gtkconv, const char *name)
 {
@@ -369,14 +375,294 @@ debug_command_cb(PurpleConversation *conv,
 	return PURPLE_CMD_RET_OK;
 }
 
+static PurpleCmdRet
+metrics_command_cb(PurpleConversation *conv,
+                   const char *cmd, char **args, char **error, void *data)
+{
+	char *snapshot, *tmp, *markup;
+
+	snapshot = purple_metrics_get_snapshot();
+	tmp = g_markup_escape_text(snapshot, -1);
+	markup = purple_strreplace(tmp, "\n", "<br>");
+	purple_conversation_write(conv, NULL, markup, PURPLE_MESSAGE_NO_LOG, time(NULL));
+
+	g_free(snapshot);
+	g_free(tmp);
+	g_free(markup);
+	return PURPLE_CMD_RET_OK;
+}
+
+/* Scrollback paging.  Every message written to the conversation leaves a
+ * mark at its start, so that the buffer can be trimmed on message boundaries
+ * and trimmed messages can be brought back from the message history when the
+ * user scrolls up to them. */
+
+static gboolean
+scrollback_at_bottom(PidginConversation *gtkconv)
+{
+	GtkAdjustment *adj = GTK_TEXT_VIEW(gtkconv->imhtml)->vadjustment;
+
+	if (adj == NULL)
+		return TRUE;
+
+	return (adj->value >= adj->upper - adj->page_size - 1);
+}
+
+static void
+scrollback_reset(PidginConversation *gtkconv)
+{
+	GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(gtkconv->imhtml));
+	GtkTextMark *mark;
+
+	while ((mark = g_queue_pop_head(gtkconv->scrollback.marks)) != NULL)
+		gtk_text_buffer_delete_mark(buffer, mark);
+
+	gtkconv->scrollback.oldest = 0;
+	gtkconv->scrollback.oldest_skipped = 0;
+	gtkconv->scrollback.trimmed = FALSE;
+
+	if (gtkconv->scrollback.load_timer) {
+		g_source_remove(gtkconv->scrollback.load_timer);
+		gtkconv->scrollback.load_timer = 0;
+	}
+}
+
+/* Marks store a full time_t; it doesn't fit in a pointer on every platform. */
+static void
+scrollback_mark_set_time(GtkTextMark *mark, time_t when)
+{
+	time_t *data = g_new(time_t, 1);
+
+	*data = when;
+	g_object_set_data_full(G_OBJECT(mark), "when", data, g_free);
+}
+
+static time_t
+scrollback_mark_get_time(GtkTextMark *mark)
+{
+	time_t *data = g_object_get_data(G_OBJECT(mark), "when");
+
+	return data ? *data : 0;
+}
+
+static void
+scrollback_add_mark(PidginConversation *gtkconv, time_t mtime)
+{
+	GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(gtkconv->imhtml));
+	GtkTextMark *mark;
+	GtkTextIter end;
+
+	gtk_text_buffer_get_end_iter(buffer, &end);
+	mark = gtk_text_buffer_create_mark(buffer, NULL, &end, TRUE);
+	scrollback_mark_set_time(mark, mtime);
+	g_queue_push_tail(gtkconv->scrollback.marks, mark);
+}
+
+/* Removes whole messages from the top of the buffer until it is down to
+ * about max_lines lines.  Nothing the user is looking at is removed. */
+static void
+scrollback_trim(PidginConversation *gtkconv, int max_lines)
+{
+	GtkTextView *view = GTK_TEXT_VIEW(gtkconv->imhtml);
+	GtkTextBuffer *buffer = gtk_text_view_get_buffer(view);
+	GtkTextMark *mark, *anchor = NULL;
+	GtkTextIter start, end;
+	int target;
+	guint evicted = 0, run = 0;
+	time_t when, last = 0;
+
+	target = gtk_text_buffer_get_line_count(buffer) - max_lines;
+
+	if (GTK_WIDGET_MAPPED(gtkconv->imhtml) && !scrollback_at_bottom(gtkconv)) {
+		/* The user scrolled back to read something; keep it in place. */
+		GdkRectangle rect;
+		int top;
+
+		gtk_text_view_get_visible_rect(view, &rect);
+		gtk_text_view_get_line_at_y(view, &end, rect.y, NULL);
+		top = gtk_text_iter_get_line(&end);
+		if (top < target)
+			target = top;
+		anchor = gtk_text_buffer_create_mark(buffer, NULL, &end, TRUE);
+	}
+
+	if (g_queue_is_empty(gtkconv->scrollback.marks)) {
+		if (target > 0) {
+			gtk_text_buffer_get_start_iter(buffer, &start);
+			gtk_text_buffer_get_iter_at_line(buffer, &end, target);
+			gtk_imhtml_delete(GTK_IMHTML(gtkconv->imhtml), &start, &end);
+		}
+	} else {
+		/* Always keep the newest message, however long it is. */
+		while (g_queue_get_length(gtkconv->scrollback.marks) > 1) {
+			mark = g_queue_peek_nth(gtkconv->scrollback.marks, 1);
+			gtk_text_buffer_get_iter_at_mark(buffer, &end, mark);
+			if (gtk_text_iter_get_line(&end) > target)
+				break;
+
+			mark = g_queue_pop_head(gtkconv->scrollback.marks);
+			when = scrollback_mark_get_time(mark);
+			if (evicted == 0 || when != last)
+				run = 0;
+			last = when;
+			run++;
+			evicted++;
+			gtk_text_buffer_delete_mark(buffer, mark);
+		}
+
+		if (evicted > 0) {
+			mark = g_queue_peek_head(gtkconv->scrollback.marks);
+			when = scrollback_mark_get_time(mark);
+
+			gtk_text_buffer_get_start_iter(buffer, &start);
+			gtk_text_buffer_get_iter_at_mark(buffer, &end, mark);
+			gtk_imhtml_delete(GTK_IMHTML(gtkconv->imhtml), &start, &end);
+
+			/* Remember how many trimmed messages share a timestamp with
+			 * the oldest one still shown, so paging back in doesn't
+			 * duplicate or drop any of them. */
+			if (gtkconv->scrollback.trimmed && gtkconv->scrollback.oldest == when)
+				gtkconv->scrollback.oldest_skipped += (last == when) ? run : 0;
+			else
+				gtkconv->scrollback.oldest_skipped = (last == when) ? run : 0;
+			gtkconv->scrollback.oldest = when;
+			gtkconv->scrollback.trimmed = TRUE;
+
+			purple_debug_misc("gtkconv", "Trimmed %u messages from the scrollback\n",
+					evicted);
+		}
+	}
+
+	if (anchor != NULL) {
+		gtk_text_view_scroll_to_mark(view, anchor, 0, TRUE, 0, 0);
+		gtk_text_buffer_delete_mark(buffer, anchor);
+	}
+}
+
+static char *
+scrollback_format_message(PurpleConvMessage *msg)
+{
+	const char *timestamp = purple_time_format(localtime(&msg->when));
+	char *name, *ret;
+
+	if ((msg->flags & (PURPLE_MESSAGE_SYSTEM | PURPLE_MESSAGE_ERROR)) ||
+			msg->who == NULL || *msg->who == '\0')
+		return g_strdup_printf("<font size=\"2\">(%s)</font> <b>%s</b><BR>",
+				timestamp, msg->what ? msg->what : "");
+
+	name = g_markup_escape_text((msg->alias && *msg->alias) ? msg->alias : msg->who, -1);
+	ret = g_strdup_printf("<font size=\"2\">(%s)</font> <b>%s:</b> %s<BR>",
+			timestamp, name, msg->what ? msg->what : "");
+	g_free(name);
+
+	return ret;
+}
+
+/* Puts the newest page of trimmed messages back at the top of the buffer. */
+static gboolean
+scrollback_load_older_cb(gpointer data)
+{
+	PidginConversation *gtkconv = data;
+	GtkTextView *view = GTK_TEXT_VIEW(gtkconv->imhtml);
+	GtkTextBuffer *buffer = gtk_text_view_get_buffer(view);
+	GtkTextMark *pos, *mark;
+	GtkTextIter iter;
+	GList *msgs = NULL, *first, *added = NULL, *l;
+	time_t oldest = gtkconv->scrollback.oldest;
+	guint skipped = 0, total;
+
+	gtkconv->scrollback.load_timer = 0;
+
+	for (l = gtkconv->convs; l != NULL; l = l->next) {
+		GList *history = purple_conversation_get_message_history(l->data);
+		for (; history != NULL; history = history->next) {
+			PurpleConvMessage *msg = history->data;
+			if (msg->when <= oldest)
+				msgs = g_list_prepend(msgs, msg);
+		}
+	}
+	msgs = g_list_sort(msgs, message_compare);
+
+	/* Only the first oldest_skipped messages from the oldest displayed
+	 * second were trimmed; the rest are still in the buffer. */
+	for (l = msgs; l != NULL; ) {
+		GList *next = l->next;
+		PurpleConvMessage *msg = l->data;
+		if (msg->when == oldest && skipped++ >= gtkconv->scrollback.oldest_skipped)
+			msgs = g_list_delete_link(msgs, l);
+		l = next;
+	}
+
+	total = g_list_length(msgs);
+	if (total == 0) {
+		gtkconv->scrollback.trimmed = FALSE;
+		return FALSE;
+	}
+
+	first = g_list_nth(msgs, total - MIN(total, SCROLLBACK_PAGE_MESSAGES));
+
+	gtk_text_buffer_get_start_iter(buffer, &iter);
+	pos = gtk_text_buffer_create_mark(buffer, NULL, &iter, FALSE);
+
+	for (l = first; l != NULL; l = l->next) {
+		PurpleConvMessage *msg = l->data;
+		char *html = scrollback_format_message(msg);
+
+		gtk_text_buffer_get_iter_at_mark(buffer, &iter, pos);
+		mark = gtk_text_buffer_create_mark(buffer, NULL, &iter, TRUE);
+		scrollback_mark_set_time(mark, msg->when);
+		added = g_list_prepend(added, mark);
+
+		gtk_imhtml_insert_html_at_iter(GTK_IMHTML(gtkconv->imhtml), html, 0, &iter);
+		g_free(html);
+	}
+
+	/* The previous oldest mark stayed at the start of the buffer. */
+	mark = g_queue_peek_head(gtkconv->scrollback.marks);
+	if (mark != NULL) {
+		gtk_text_buffer_get_iter_at_mark(buffer, &iter, pos);
+		gtk_text_buffer_move_mark(buffer, mark, &iter);
+	}
+	for (l = added; l != NULL; l = g_list_delete_link(l, l))
+		g_queue_push_head(gtkconv->scrollback.marks, l->data);
+
+	gtkconv->scrollback.oldest = ((PurpleConvMessage *)first->data)->when;
+	gtkconv->scrollback.oldest_skipped = 0;
+	for (l = msgs; l != first; l = l->next) {
+		if (((PurpleConvMessage *)l->data)->when == gtkconv->scrollback.oldest)
+			gtkconv->scrollback.oldest_skipped++;
+	}
+	gtkconv->scrollback.trimmed = (first != msgs);
+
+	/* Keep the text the user was looking at where it was. */
+	gtk_text_view_scroll_to_mark(view, pos, 0, TRUE, 0, 0);
+	gtk_text_buffer_delete_mark(buffer, pos);
+
+	g_list_free(msgs);
+
+	return FALSE;
+}
+
+static void
+scrollback_value_changed_cb(GtkAdjustment *adj, PidginConversation *gtkconv)
+{
+	if (adj->value > adj->lower || !gtkconv->scrollback.trimmed ||
+			gtkconv->scrollback.load_timer)
+		return;
+
+	gtkconv->scrollback.load_timer = g_idle_add(scrollback_load_older_cb, gtkconv);
+}
+
 static void clear_conversation_scrollback_cb(PurpleConversation *conv,
                                              void *data)
 {
 	PidginConversation *gtkconv = NULL;
 
 	gtkconv = PIDGIN_CONVERSATION(conv);
-	if (gtkconv)
+	if (gtkconv) {
 		gtk_imhtml_clear(GTK_IMHTML(gtkconv->imhtml));
+		scrollback_reset(gtkconv);
+	}
 }
 
 static PurpleCmdRet
@@ -5047,6 +5333,10 @@ setup_common_pane(PidginConversation *gtkconv)
 
 	g_object_set(G_OBJECT(imhtml_sw), "vscrollbar-policy", GTK_POLICY_ALWAYS, NULL);
 
+	gtkconv->scrollback.marks = g_queue_new();
+	g_signal_connect(G_OBJECT(gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(imhtml_sw))),
+	                 "value-changed", G_CALLBACK(scrollback_value_changed_cb), gtkconv);
+
 	g_signal_connect_after(G_OBJECT(gtkconv->imhtml), "button_press_event",
 	                       G_CALLBACK(entry_stop_rclick_cb), NULL);
 	g_signal_connect(G_OBJECT(gtkconv->imhtml), "key_press_event",
@@ -5565,6 +5855,10 @@ pidgin_conv_destroy(PurpleConversation *conv)
 		g_source_remove(gtkconv->attach.timer);
 	}
 
+	if (gtkconv->scrollback.load_timer)
+		g_source_remove(gtkconv->scrollback.load_timer);
+	g_queue_free(gtkconv->scrollback.marks);
+
 	g_free(gtkconv);
 }
 
@@ -5824,8 +6118,17 @@ pidgin_conv_write_conv(PurpleConversation *conv, const char *name, const char *a
 	/* Make sure URLs are clickable */
 	if(flags & PURPLE_MESSAGE_NO_LINKIFY)
 		displaying = g_strdup(message);
-	else
-		displaying = purple_markup_linkify(message);
+	else {
+		GString *linkified = g_string_new(NULL);
+		PurpleMarkupFilter *filter;
+
+		filter = purple_markup_filter_linkify_new(
+				purple_markup_filter_string_new(linkified));
+		purple_markup_filter_feed(filter, message);
+		purple_markup_filter_finish(filter);
+		purple_markup_filter_free(filter);
+		displaying = g_string_free(linkified, FALSE);
+	}
 
 	plugin_return = GPOINTER_TO_INT(purple_signal_emit_return_1(
 							pidgin_conversations_get_handle(), (type == PURPLE_CONV_TYPE_IM ?
@@ -5861,14 +6164,7 @@ pidgin_conv_write_conv(PurpleConversation *conv, const char *name, const char *a
 	   max scrollback, trim down to max scrollback */
 	if (max_scrollback_lines > 0
 			&& line_count > (max_scrollback_lines + 100)) {
-		GtkTextBuffer *text_buffer = gtk_text_view_get_buffer(
-			GTK_TEXT_VIEW(gtkconv->imhtml));
-		GtkTextIter start, end;
-
-		gtk_text_buffer_get_start_iter(text_buffer, &start);
-		gtk_text_buffer_get_iter_at_line(text_buffer, &end,
-			(line_count - max_scrollback_lines));
-		gtk_imhtml_delete(GTK_IMHTML(gtkconv->imhtml), &start, &end);
+		scrollback_trim(gtkconv, max_scrollback_lines);
 	}
 
 	if (type == PURPLE_CONV_TYPE_CHAT)
@@ -5889,6 +6185,8 @@ pidgin_conv_write_conv(PurpleConversation *conv, const char *name, const char *a
 	if (gtk_text_buffer_get_char_count(gtk_text_view_get_buffer(GTK_TEXT_VIEW(gtkconv->imhtml))))
 		gtk_imhtml_append_text(GTK_IMHTML(gtkconv->imhtml), "<BR>", gtk_font_options_all | GTK_IMHTML_NO_SCROLL);
 
+	scrollback_add_mark(gtkconv, mtime);
+
 	/* First message in a conversation. */
 	if (gtkconv->newday == 0)
 		pidgin_conv_calculate_newday(gtkconv, mtime);
@@ -8088,6 +8386,9 @@ pidgin_conversations_init(void)
 	purple_cmd_register("debug", "w", PURPLE_CMD_P_DEFAULT,
 	                  PURPLE_CMD_FLAG_CHAT | PURPLE_CMD_FLAG_IM, NULL,
 	                  debug_command_cb, _("debug &lt;option&gt;:  Send various debug information to the current conversation."), NULL);
+	purple_cmd_register("metrics", "", PURPLE_CMD_P_DEFAULT,
+	                  PURPLE_CMD_FLAG_CHAT | PURPLE_CMD_FLAG_IM, NULL,
+	                  metrics_command_cb, _("metrics:  Show libpurple's internal metrics in the current conversation."), NULL);
 	purple_cmd_register("clear", "", PURPLE_CMD_P_DEFAULT,
 	                  PURPLE_CMD_FLAG_CHAT | PURPLE_CMD_FLAG_IM, NULL,
 	                  clear_command_cb, _("clear: Clears the conversation scrollback."), NULL);
@@ -187,6 +187,22 @@ struct _PidginConversation
 		GtkWidget *entry;
 		GtkWidget *container;
 	} quickfind;
+
+	/**
+	 * Scrollback trimming and paging.  @c marks holds one mark per
+	 * displayed message, oldest first.  When messages have been trimmed,
+	 * @c oldest is the time of the oldest displayed message and
+	 * @c oldest_skipped the number of trimmed messages with that same time.
+	 *
+	 * @since 2.10.11
+	 */
+	struct {
+		GQueue *marks;
+		time_t oldest;
+		guint oldest_skipped;
+		gboolean trimmed;
+		guint load_timer;
+	} scrollback;
 };
 
 /*@}*/
@@ -320,6 +320,152 @@ static gboolean clipboard_paste_html_win32(GtkIMHtml *imhtml) {
 }
 #endif
 
+/*
+ * A smiley tree compiled into a transition table, so that matching costs
+ * one table lookup per byte instead of a strchr() over each node's values.
+ * Bytes are first mapped to classes: each byte used in some smiley gets its
+ * own class, and every other byte shares class 0, which has no transitions,
+ * so most text is rejected on its first byte.  State 0 is the root, which
+ * is never the target of a transition, so 0 also means "no transition".
+ */
+typedef struct _GtkSmileyMatcher {
+	guint8 classes[256];
+	guint nclasses;
+	guint16 *next;             /* nstates * nclasses transitions, or NULL if
+	                              the tree has too many nodes to compile */
+	GtkIMHtmlSmiley **images;  /* The smiley matched in each state */
+} GtkSmileyMatcher;
+
+#define SMILEY_MATCHER_NEXT(m, state, c) \
+	((m)->next[(state) * (m)->nclasses + (m)->classes[(guchar)(c)]])
+
+static GtkSmileyMatcher *
+gtk_smiley_matcher_new(GtkSmileyTree *tree)
+{
+	GtkSmileyMatcher *m = g_new0(GtkSmileyMatcher, 1);
+	GPtrArray *nodes = g_ptr_array_new();
+	guint state, child, i;
+
+	/* Number the nodes breadth first, and find the classes */
+	g_ptr_array_add(nodes, tree);
+	for (state = 0; state < nodes->len; state++) {
+		GtkSmileyTree *t = g_ptr_array_index(nodes, state);
+
+		if (!t->values)
+			continue;
+
+		for (i = 0; i < t->values->len; i++) {
+			guchar c = t->values->str[i];
+			if (!m->classes[c])
+				m->classes[c] = ++m->nclasses;
+			g_ptr_array_add(nodes, t->children[i]);
+		}
+	}
+	m->nclasses++;
+
+	if (nodes->len > G_MAXUINT16) {
+		g_ptr_array_free(nodes, TRUE);
+		return m;
+	}
+
+	/* Children were numbered in the same order they're visited here */
+	m->next = g_new0(guint16, nodes->len * m->nclasses);
+	m->images = g_new(GtkIMHtmlSmiley *, nodes->len);
+	for (state = 0, child = 1; state < nodes->len; state++) {
+		GtkSmileyTree *t = g_ptr_array_index(nodes, state);
+
+		m->images[state] = t->image;
+
+		if (!t->values)
+			continue;
+
+		for (i = 0; i < t->values->len; i++)
+			SMILEY_MATCHER_NEXT(m, state, t->values->str[i]) = child++;
+	}
+
+	g_ptr_array_free(nodes, TRUE);
+	return m;
+}
+
+static void
+gtk_smiley_matcher_destroy(GtkSmileyMatcher *m)
+{
+	if (m == NULL)
+		return;
+
+	g_free(m->next);
+	g_free(m->images);
+	g_free(m);
+}
+
+/* Matches the same way as the tree walk in gtk_smiley_tree_lookup() */
+static gint
+gtk_smiley_matcher_lookup(GtkSmileyMatcher *m, const gchar *text)
+{
+	const gchar *x = text;
+	const gchar *amp;
+	guint state = 0, next;
+	gint len = 0;
+	gint alen;
+
+	while (*x) {
+		if (*x == '&' && (amp = purple_markup_unescape_entity(x, &alen))) {
+			/* Make sure all chars of the unescaped value match */
+			next = state;
+			while (*amp && (next = SMILEY_MATCHER_NEXT(m, next, *amp)))
+				amp++;
+			if (*amp)
+				break;
+		} else if (*x == '<') {
+			/* See gtk_smiley_tree_lookup() */
+			break;
+		} else {
+			alen = 1;
+			next = SMILEY_MATCHER_NEXT(m, state, *x);
+			if (!next)
+				break;
+		}
+
+		state = next;
+		x += alen;
+		len += alen;
+	}
+
+	if (m->images[state])
+		return len;
+
+	return 0;
+}
+
+/* Root trees -> their GtkSmileyMatcher, compiled when first needed */
+static GHashTable *smiley_matchers = NULL;
+
+static GtkSmileyMatcher *
+gtk_smiley_tree_get_matcher (GtkSmileyTree *tree)
+{
+	GtkSmileyMatcher *m;
+
+	if (smiley_matchers == NULL)
+		smiley_matchers = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+				NULL, (GDestroyNotify)gtk_smiley_matcher_destroy);
+
+	m = g_hash_table_lookup(smiley_matchers, tree);
+	if (m == NULL) {
+		m = gtk_smiley_matcher_new(tree);
+		g_hash_table_insert(smiley_matchers, tree, m);
+	}
+
+	return m;
+}
+
+/* The tree has changed, so compile it again next time it's needed */
+static void
+gtk_smiley_tree_invalidate (GtkSmileyTree *tree)
+{
+	if (smiley_matchers != NULL)
+		g_hash_table_remove(smiley_matchers, tree);
+}
+
 static GtkSmileyTree*
 gtk_smiley_tree_new (void)
 {
@@ -336,6 +482,8 @@ gtk_smiley_tree_insert (GtkSmileyTree *tree,
 	if (!(*x))
 		return;
 
+	gtk_smiley_tree_invalidate(tree);
+
 	do {
 		gchar *pos;
 		gint index;
@@ -366,6 +514,9 @@ gtk_smiley_tree_destroy (GtkSmileyTree *tree)
 {
 	GSList *list = g_slist_prepend (NULL, tree);
 
+	if (tree)
+		gtk_smiley_tree_invalidate(tree);
+
 	while (list) {
 		GtkSmileyTree *t = list->data;
 		gsize i;
@@ -2045,6 +2196,7 @@ static void gtk_smiley_tree_remove (GtkSmileyTree     *tree,
 
 	if (t->image) {
 		t->image = NULL;
+		gtk_smiley_tree_invalidate(tree);
 	}
 }
 
@@ -2057,6 +2209,10 @@ gtk_smiley_tree_lookup (GtkSmileyTree *tree,
 	gint len = 0;
 	const gchar *amp;
 	gint alen;
+	GtkSmileyMatcher *m = gtk_smiley_tree_get_matcher(tree);
+
+	if (m->next)
+		return gtk_smiley_matcher_lookup(m, text);
 
 	while (*x) {
 		gchar *pos;
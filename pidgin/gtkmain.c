@@ -176,6 +176,8 @@ static void sighandler(int sig)
 	 */
 	if (sig == SIGSEGV) {
 		fprintf(stderr, "%s", segfault_message);
+		fflush(stderr);
+		purple_debug_write_recent(STDERR_FILENO);
 		abort();
 		return;
 	}
@@ -453,6 +455,8 @@ show_usage(const char *name, gboolean terse)
 		g_string_append_printf(str, "  --display=DISPLAY   %s\n",
 				_("X display to use"));
 #endif /* !WIN32 */
+		g_string_append_printf(str, "  --startup-profile   %s\n",
+				_("print how long each stage of startup took"));
 		g_string_append_printf(str, "  -v, --version       %s\n",
 				_("display the current version and exit"));
 		text = g_string_free(str, FALSE);
@@ -477,6 +481,7 @@ int main(int argc, char *argv[])
 	gboolean opt_nologin = FALSE;
 	gboolean opt_version = FALSE;
 	gboolean opt_si = TRUE;     /* Check for single instance? */
+	gboolean opt_startup_profile = FALSE;
 	char *opt_config_dir_arg = NULL;
 	char *opt_login_arg = NULL;
 	char *opt_session_arg = NULL;
@@ -512,6 +517,7 @@ int main(int argc, char *argv[])
 		{"version",      no_argument,       NULL, 'v'},
 		{"display",      required_argument, NULL, 'D'},
 		{"sync",         no_argument,       NULL, 'S'},
+		{"startup-profile", no_argument,    NULL, 'P'},
 		{0, 0, 0, 0}
 	};
 
@@ -692,6 +698,9 @@ int main(int argc, char *argv[])
 		case 'S':   /* --sync */
 			/* handled by gtk_init_check below */
 			break;
+		case 'P':   /* --startup-profile */
+			opt_startup_profile = TRUE;
+			break;
 		case '?':	/* show terse help */
 		default:
 			show_usage(argv[0], TRUE);
@@ -845,14 +854,18 @@ int main(int argc, char *argv[])
 	/* TODO: Move blist loading into purple_blist_init() */
 	purple_set_blist(purple_blist_new());
 	purple_blist_load();
+	purple_core_startup_stage("pidgin: buddy list");
 
 	/* load plugins we had when we quit */
 	purple_plugins_load_saved(PIDGIN_PREFS_ROOT "/plugins/loaded");
+	purple_core_startup_stage("pidgin: plugins");
 
 	/* TODO: Move pounces loading into purple_pounces_init() */
 	purple_pounces_load();
+	purple_core_startup_stage("pidgin: pounces");
 
 	ui_main();
+	purple_core_startup_stage("pidgin: ui main");
 
 #ifdef USE_SM
 	pidgin_session_init(argv[0], opt_session_arg, opt_config_dir_arg);
@@ -876,6 +889,7 @@ int main(int argc, char *argv[])
 	 * user feels warm and fuzzy (not cold and prickley).
 	 */
 	purple_blist_show();
+	purple_core_startup_stage("pidgin: show buddy list");
 
 	if (purple_prefs_get_bool(PIDGIN_PREFS_ROOT "/debug/enabled"))
 		pidgin_debug_window_show();
@@ -924,6 +938,13 @@ int main(int argc, char *argv[])
 	{
 		g_list_free(active_accounts);
 	}
+	purple_core_startup_stage("pidgin: statuses");
+
+	if (opt_startup_profile) {
+		char *profile = purple_core_get_startup_profile();
+		printf("%s", profile);
+		g_free(profile);
+	}
 
 	/* GTK clears the notification for us when opening the first window,
 	 * but we may have launched with only a status icon, so clear the it
@@ -40,6 +40,7 @@
 typedef struct _PidginRoomlistDialog {
 	GtkWidget *window;
 	GtkWidget *account_widget;
+	GtkWidget *filter_entry;
 	GtkWidget *progress;
 	GtkWidget *sw;
 
@@ -54,6 +55,7 @@ typedef struct _PidginRoomlistDialog {
 
 	gboolean pg_needs_pulse;
 	guint pg_update_to;
+	guint filter_timeout;
 } PidginRoomlistDialog;
 
 typedef struct _PidginRoomlist {
@@ -70,6 +72,7 @@ typedef struct _PidginRoomlist {
 	int tip_width;
 	int tip_name_height;
 	int tip_name_width;
+	char *filter; /**< Casefolded text of the filter, or NULL. */
 } PidginRoomlist;
 
 enum {
@@ -90,6 +93,9 @@ static gint delete_win_cb(GtkWidget *w, GdkEventAny *e, gpointer d)
 	if (dialog->pg_update_to > 0)
 		purple_timeout_remove(dialog->pg_update_to);
 
+	if (dialog->filter_timeout > 0)
+		purple_timeout_remove(dialog->filter_timeout);
+
 	if (dialog->roomlist) {
 		PidginRoomlist *rl = dialog->roomlist->ui_data;
 
@@ -108,6 +114,69 @@ static gint delete_win_cb(GtkWidget *w, GdkEventAny *e, gpointer d)
 	return FALSE;
 }
 
+static gboolean room_filter_func(PurpleRoomlist *list, PurpleRoomlistRoom *room,
+                                 gpointer data)
+{
+	PidginRoomlist *rl = list->ui_data;
+	GList *l, *k;
+	gboolean match;
+	char *text;
+
+	text = g_utf8_casefold(room->name, -1);
+	match = (strstr(text, rl->filter) != NULL);
+	g_free(text);
+
+	for (l = room->fields, k = list->fields; !match && l && k; l = l->next, k = k->next) {
+		PurpleRoomlistField *f = k->data;
+		if (f->hidden || f->type != PURPLE_ROOMLIST_FIELD_STRING || l->data == NULL)
+			continue;
+		text = g_utf8_casefold(l->data, -1);
+		match = (strstr(text, rl->filter) != NULL);
+		g_free(text);
+	}
+
+	return match;
+}
+
+static void set_filter(PidginRoomlistDialog *dialog, gboolean refill)
+{
+	PidginRoomlist *rl = dialog->roomlist->ui_data;
+	const char *text = gtk_entry_get_text(GTK_ENTRY(dialog->filter_entry));
+
+	g_free(rl->filter);
+	rl->filter = *text ? g_utf8_casefold(text, -1) : NULL;
+
+	if (refill) {
+		/* Start over, and let the core hand us the rooms that pass */
+		if (rl->model)
+			gtk_tree_store_clear(rl->model);
+		g_hash_table_remove_all(rl->cats);
+		rl->num_rooms = rl->total_rooms = 0;
+	}
+
+	purple_roomlist_set_filter(dialog->roomlist,
+			rl->filter ? room_filter_func : NULL, NULL);
+}
+
+static gboolean filter_timeout_cb(gpointer data)
+{
+	PidginRoomlistDialog *dialog = data;
+
+	dialog->filter_timeout = 0;
+	if (dialog->roomlist)
+		set_filter(dialog, TRUE);
+
+	return FALSE;
+}
+
+static void filter_changed_cb(GtkEditable *entry, PidginRoomlistDialog *dialog)
+{
+	/* Don't go through all the rooms for every key press */
+	if (dialog->filter_timeout > 0)
+		purple_timeout_remove(dialog->filter_timeout);
+	dialog->filter_timeout = purple_timeout_add(300, filter_timeout_cb, dialog);
+}
+
 static void dialog_select_account_cb(GObject *w, PurpleAccount *account,
 				     PidginRoomlistDialog *dialog)
 {
@@ -147,6 +216,9 @@ static void list_button_cb(GtkButton *button, PidginRoomlistDialog *dialog)
 	rl = dialog->roomlist->ui_data;
 	rl->dialog = dialog;
 
+	if (*gtk_entry_get_text(GTK_ENTRY(dialog->filter_entry)))
+		set_filter(dialog, FALSE);
+
 	if (dialog->account_widget)
 		gtk_widget_set_sensitive(dialog->account_widget, FALSE);
 
@@ -547,6 +619,12 @@ pidgin_roomlist_dialog_new_with_account(PurpleAccount *account)
 		dialog->account = pidgin_account_option_menu_get_selected(dialog->account_widget);
 	pidgin_add_widget_to_vbox(GTK_BOX(vbox2), _("_Account:"), NULL, dialog->account_widget, TRUE, NULL);
 
+	/* filter */
+	dialog->filter_entry = gtk_entry_new();
+	g_signal_connect(G_OBJECT(dialog->filter_entry), "changed",
+	                 G_CALLBACK(filter_changed_cb), dialog);
+	pidgin_add_widget_to_vbox(GTK_BOX(vbox2), _("_Filter:"), NULL, dialog->filter_entry, TRUE, NULL);
+
 	/* scrolled window */
 	dialog->sw = pidgin_make_scrollable(NULL, GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC, GTK_SHADOW_IN, -1, 250);
 	gtk_box_pack_start(GTK_BOX(vbox2), dialog->sw, TRUE, TRUE, 0);
@@ -803,7 +881,21 @@ static gboolean pidgin_progress_bar_pulse(gpointer data)
 	return TRUE;
 }
 
-static void pidgin_roomlist_add_room(PurpleRoomlist *list, PurpleRoomlistRoom *room)
+static void pidgin_roomlist_pulse(PurpleRoomlist *list)
+{
+	PidginRoomlist *rl = list->ui_data;
+
+	if (rl->dialog) {
+		if (rl->dialog->pg_update_to == 0) {
+			purple_roomlist_ref(list);
+			rl->dialog->pg_update_to = g_timeout_add(100, pidgin_progress_bar_pulse, list);
+			gtk_progress_bar_pulse(GTK_PROGRESS_BAR(rl->dialog->progress));
+		} else
+			rl->dialog->pg_needs_pulse = TRUE;
+	}
+}
+
+static void pidgin_roomlist_insert_room(PurpleRoomlist *list, PurpleRoomlistRoom *room)
 {
 	PidginRoomlist *rl = list->ui_data;
 	GtkTreeRowReference *rr, *parentrr = NULL;
@@ -817,15 +909,6 @@ static void pidgin_roomlist_add_room(PurpleRoomlist *list, PurpleRoomlistRoom *r
 	if (room->type == PURPLE_ROOMLIST_ROOMTYPE_ROOM)
 		rl->num_rooms++;
 
-	if (rl->dialog) {
-		if (rl->dialog->pg_update_to == 0) {
-			purple_roomlist_ref(list);
-			rl->dialog->pg_update_to = g_timeout_add(100, pidgin_progress_bar_pulse, list);
-			gtk_progress_bar_pulse(GTK_PROGRESS_BAR(rl->dialog->progress));
-		} else
-			rl->dialog->pg_needs_pulse = TRUE;
-	}
-
 	if (room->parent) {
 		parentrr = g_hash_table_lookup(rl->cats, room->parent);
 		path = gtk_tree_row_reference_get_path(parentrr);
@@ -871,6 +954,19 @@ static void pidgin_roomlist_add_room(PurpleRoomlist *list, PurpleRoomlistRoom *r
 	}
 }
 
+static void pidgin_roomlist_add_room(PurpleRoomlist *list, PurpleRoomlistRoom *room)
+{
+	pidgin_roomlist_pulse(list);
+	pidgin_roomlist_insert_room(list, room);
+}
+
+static void pidgin_roomlist_add_rooms(PurpleRoomlist *list, GList *rooms)
+{
+	pidgin_roomlist_pulse(list);
+	for (; rooms; rooms = rooms->next)
+		pidgin_roomlist_insert_room(list, rooms->data);
+}
+
 static void pidgin_roomlist_in_progress(PurpleRoomlist *list, gboolean in_progress)
 {
 	PidginRoomlist *rl = list->ui_data;
@@ -902,6 +998,7 @@ static void pidgin_roomlist_destroy(PurpleRoomlist *list)
 	g_return_if_fail(rl != NULL);
 
 	g_hash_table_destroy(rl->cats);
+	g_free(rl->filter);
 	g_free(rl);
 	list->ui_data = NULL;
 }
@@ -913,7 +1010,7 @@ static PurpleRoomlistUiOps ops = {
 	pidgin_roomlist_add_room,
 	pidgin_roomlist_in_progress,
 	pidgin_roomlist_destroy,
-	NULL,
+	pidgin_roomlist_add_rooms,
 	NULL,
 	NULL,
 	NULL
@@ -67,14 +67,30 @@
 #include "gtkutils.h"
 #include "pidgin/minidialog.h"
 
+/* The most memory the pixbuf cache may use for pixels */
+#define PIXBUF_CACHE_MAX_BYTES (4 * 1024 * 1024)
+
 typedef struct {
 	GtkWidget *menu;
 	gint default_item;
 } AopMenu;
 
+typedef struct {
+	char *key;
+	GdkPixbuf *pixbuf;
+	gsize size;
+} PixbufCacheEntry;
+
 static guint accels_save_timer = 0;
 static GSList *registered_url_handlers = NULL;
 
+/* Maps keys to their links in pixbuf_cache_lru, most recently used first */
+static GHashTable *pixbuf_cache = NULL;
+static GQueue pixbuf_cache_lru = G_QUEUE_INIT;
+static gsize pixbuf_cache_bytes = 0;
+static guint pixbuf_cache_hits = 0;
+static guint pixbuf_cache_misses = 0;
+
 static gboolean
 url_clicked_idle_cb(gpointer data)
 {
@@ -3149,6 +3165,84 @@ GdkPixbuf *pidgin_pixbuf_from_imgstore(PurpleStoredImage *image)
 			purple_imgstore_get_size(image));
 }
 
+static void
+pixbuf_cache_remove_link(GList *link)
+{
+	PixbufCacheEntry *entry = link->data;
+
+	g_hash_table_remove(pixbuf_cache, entry->key);
+	g_queue_delete_link(&pixbuf_cache_lru, link);
+	pixbuf_cache_bytes -= entry->size;
+
+	g_free(entry->key);
+	g_object_unref(entry->pixbuf);
+	g_free(entry);
+}
+
+GdkPixbuf *pidgin_pixbuf_cache_lookup(const char *key)
+{
+	GList *link;
+
+	g_return_val_if_fail(key != NULL, NULL);
+
+	if (pixbuf_cache == NULL ||
+			(link = g_hash_table_lookup(pixbuf_cache, key)) == NULL) {
+		pixbuf_cache_misses++;
+		return NULL;
+	}
+
+	pixbuf_cache_hits++;
+
+	g_queue_unlink(&pixbuf_cache_lru, link);
+	g_queue_push_head_link(&pixbuf_cache_lru, link);
+
+	return g_object_ref(((PixbufCacheEntry *)link->data)->pixbuf);
+}
+
+void pidgin_pixbuf_cache_insert(const char *key, GdkPixbuf *pixbuf)
+{
+	PixbufCacheEntry *entry;
+	GList *link;
+	gsize size;
+
+	g_return_if_fail(key != NULL);
+	g_return_if_fail(pixbuf != NULL);
+
+	size = gdk_pixbuf_get_rowstride(pixbuf) * gdk_pixbuf_get_height(pixbuf);
+	if (size > PIXBUF_CACHE_MAX_BYTES)
+		return;
+
+	if (pixbuf_cache == NULL)
+		pixbuf_cache = g_hash_table_new(g_str_hash, g_str_equal);
+	else if ((link = g_hash_table_lookup(pixbuf_cache, key)) != NULL)
+		pixbuf_cache_remove_link(link);
+
+	entry = g_new(PixbufCacheEntry, 1);
+	entry->key = g_strdup(key);
+	entry->pixbuf = g_object_ref(pixbuf);
+	entry->size = size;
+
+	g_queue_push_head(&pixbuf_cache_lru, entry);
+	g_hash_table_insert(pixbuf_cache, entry->key, pixbuf_cache_lru.head);
+	pixbuf_cache_bytes += size;
+
+	/* Make room by dropping the least recently used */
+	while (pixbuf_cache_bytes > PIXBUF_CACHE_MAX_BYTES)
+		pixbuf_cache_remove_link(pixbuf_cache_lru.tail);
+}
+
+void pidgin_pixbuf_cache_get_stats(guint *hits, guint *misses, guint *entries, gsize *bytes)
+{
+	if (hits)
+		*hits = pixbuf_cache_hits;
+	if (misses)
+		*misses = pixbuf_cache_misses;
+	if (entries)
+		*entries = pixbuf_cache_lru.length;
+	if (bytes)
+		*bytes = pixbuf_cache_bytes;
+}
+
 GdkPixbuf *pidgin_pixbuf_new_from_file(const gchar *filename)
 {
 	GdkPixbuf *pixbuf;
@@ -3679,6 +3773,17 @@ void pidgin_utils_init(void)
 
 void pidgin_utils_uninit(void)
 {
+	if (pixbuf_cache != NULL) {
+		purple_debug_info("gtkutils", "Pixbuf cache: %u hits, %u misses, "
+				"%u entries using %" G_GSIZE_FORMAT " bytes\n",
+				pixbuf_cache_hits, pixbuf_cache_misses,
+				pixbuf_cache_lru.length, pixbuf_cache_bytes);
+		while (pixbuf_cache_lru.head != NULL)
+			pixbuf_cache_remove_link(pixbuf_cache_lru.head);
+		g_hash_table_destroy(pixbuf_cache);
+		pixbuf_cache = NULL;
+	}
+
 	gtk_imhtml_class_register_protocol("open://", NULL, NULL);
 
 	/* If we have GNOME handlers registered, unregister them. */
@@ -870,6 +870,48 @@ GdkPixbufAnimation *pidgin_pixbuf_anim_from_data(const guchar *buf, gsize count)
  */
 GdkPixbuf *pidgin_pixbuf_from_imgstore(PurpleStoredImage *image);
 
+/**
+ * Looks up a pixbuf in the pixbuf cache.  The cache holds images that
+ * are expensive to render, like scaled and greyed buddy icons, so they
+ * can be shared by the buddy list, tooltips and conversations.  It keeps
+ * the most recently used ones, up to a fixed amount of memory.
+ *
+ * @param key Identifies the image data and how it was rendered, for
+ *            example the image's file name from
+ *            purple_imgstore_get_filename() followed by the size and
+ *            effects applied.
+ *
+ * @return A new reference to the cached pixbuf, or NULL if there isn't
+ *         one.  The pixbuf is shared, so it must not be modified.
+ *
+ * @since 2.10.11
+ */
+GdkPixbuf *pidgin_pixbuf_cache_lookup(const char *key);
+
+/**
+ * Adds a pixbuf to the pixbuf cache, replacing any other with the same
+ * key.  The cache takes its own reference, so the pixbuf must not be
+ * modified afterwards.
+ *
+ * @param key    Identifies the image, as for pidgin_pixbuf_cache_lookup().
+ * @param pixbuf The pixbuf.
+ *
+ * @since 2.10.11
+ */
+void pidgin_pixbuf_cache_insert(const char *key, GdkPixbuf *pixbuf);
+
+/**
+ * Gets counters for the pixbuf cache.  Any of the arguments may be NULL.
+ *
+ * @param hits    Return location for the number of successful lookups.
+ * @param misses  Return location for the number of failed lookups.
+ * @param entries Return location for the number of cached pixbufs.
+ * @param bytes   Return location for the memory used by their pixels.
+ *
+ * @since 2.10.11
+ */
+void pidgin_pixbuf_cache_get_stats(guint *hits, guint *misses, guint *entries, gsize *bytes);
+
 /**
  * Helper function that calls gdk_pixbuf_new_from_file() and checks both
  * the return code and the GError and returns NULL if either one failed.